@@ -0,0 +1,182 @@
+// Checks that refreshing an unchanged network list does not allocate.
+//
+// Runs the iwd backend against the fake iwctl from bench/fake, refreshes
+// until the network buffers reached their size and then counts heap
+// allocations over repeated UpdateNetworks() calls. Exits with a non-zero
+// status if there were any.
+//
+// The malloc family is replaced, so operator new, strdup(), getline() and
+// everything else that ends up in glibc's malloc is counted.
+
+#include "wireless_manager.h"
+
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+static std::atomic<std::uint64_t> s_allocations { 0 };
+
+// glibc's implementation, still exported under these names
+extern "C" void* __libc_malloc(std::size_t size);
+extern "C" void* __libc_calloc(std::size_t count, std::size_t size);
+extern "C" void* __libc_realloc(void* ptr, std::size_t size);
+extern "C" void* __libc_memalign(std::size_t alignment, std::size_t size);
+extern "C" void __libc_free(void* ptr);
+
+static void count_allocation()
+{
+	s_allocations.fetch_add(1, std::memory_order_relaxed);
+}
+
+extern "C" void* malloc(std::size_t size)
+{
+	count_allocation();
+	return __libc_malloc(size);
+}
+
+extern "C" void* calloc(std::size_t count, std::size_t size)
+{
+	count_allocation();
+	return __libc_calloc(count, size);
+}
+
+// Shrinking or freeing through realloc counts as well, it may move the block
+extern "C" void* realloc(void* ptr, std::size_t size)
+{
+	count_allocation();
+	return __libc_realloc(ptr, size);
+}
+
+extern "C" void* memalign(std::size_t alignment, std::size_t size)
+{
+	count_allocation();
+	return __libc_memalign(alignment, size);
+}
+
+extern "C" void* aligned_alloc(std::size_t alignment, std::size_t size)
+{
+	count_allocation();
+	return __libc_memalign(alignment, size);
+}
+
+extern "C" int posix_memalign(void** out, std::size_t alignment, std::size_t size)
+{
+	if (alignment < sizeof(void*) || (alignment & (alignment - 1)) != 0)
+		return EINVAL;
+
+	count_allocation();
+	void* ptr = __libc_memalign(alignment, size);
+	if (ptr == nullptr)
+		return ENOMEM;
+	*out = ptr;
+	return 0;
+}
+
+extern "C" void free(void* ptr)
+{
+	__libc_free(ptr);
+}
+
+static bool setup_environment(const char* fake_dir, const char* networks)
+{
+	char path[PATH_MAX];
+	if (realpath(fake_dir, path) == NULL)
+	{
+		fprintf(stderr, "Could not find fake binaries in '%s'\n", fake_dir);
+		return false;
+	}
+
+	const char* old_path = getenv("PATH");
+	std::string new_path = std::string(path) + ":" + (old_path ? old_path : "/usr/bin:/bin");
+
+	setenv("PATH", new_path.c_str(), 1);
+	setenv("BWM_FAKE_NETWORKS", networks, 1);
+	setenv("BWM_FAKE_DELAY", "0", 1);
+
+	// Networks would otherwise come from the real kernel scan cache
+	setenv("BWM_NL80211", "0", 1);
+
+	return true;
+}
+
+static void usage()
+{
+	fprintf(stderr,
+		"usage: bwm-alloc-check [options]\n"
+		"  --iterations <n>    refreshes counted (default 50)\n"
+		"  --networks <n>      networks reported by the fake iwctl (default 20)\n"
+		"  --fake-dir <dir>    directory of the fake binaries (default bench/fake)\n"
+	);
+}
+
+int main(int argc, char** argv)
+{
+	std::size_t		iterations	= 50;
+	const char*		networks	= "20";
+	const char*		fake_dir	= "bench/fake";
+
+	for (int i = 1; i < argc; i++)
+	{
+		bool has_value = i + 1 < argc;
+		if (strcmp(argv[i], "--iterations") == 0 && has_value)
+			iterations = strtoull(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "--networks") == 0 && has_value)
+			networks = argv[++i];
+		else if (strcmp(argv[i], "--fake-dir") == 0 && has_value)
+			fake_dir = argv[++i];
+		else
+		{
+			usage();
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (!setup_environment(fake_dir, networks))
+		return EXIT_FAILURE;
+
+	WirelessManager* wireless_manager = WirelessManager::Create(WirelessBackend::iwd);
+	if (!wireless_manager)
+	{
+		fprintf(stderr, "Could not initialize wireless backend with the fake iwctl\n");
+		return EXIT_FAILURE;
+	}
+
+	// The first refreshes size the front and back buffers
+	for (int i = 0; i < 3; i++)
+	{
+		if (!wireless_manager->UpdateNetworks())
+		{
+			fprintf(stderr, "Could not read networks from the fake iwctl\n");
+			delete wireless_manager;
+			return EXIT_FAILURE;
+		}
+	}
+
+	std::size_t failed = 0;
+	std::uint64_t allocations_begin = s_allocations.load(std::memory_order_relaxed);
+	for (std::size_t i = 0; i < iterations; i++)
+		failed += !wireless_manager->UpdateNetworks();
+	std::uint64_t allocations = s_allocations.load(std::memory_order_relaxed) - allocations_begin;
+
+	delete wireless_manager;
+
+	printf("refreshes %zu\n", iterations);
+	printf("allocations %lu (malloc, calloc, realloc, memalign and operator new)\n", (unsigned long)allocations);
+
+	if (failed > 0)
+	{
+		fprintf(stderr, "%zu refreshes failed\n", failed);
+		return EXIT_FAILURE;
+	}
+	if (allocations > 0)
+	{
+		fprintf(stderr, "Refreshing an unchanged network list allocated %lu times\n", (unsigned long)allocations);
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,257 @@
+// End-to-end benchmark of the iwd backend.
+//
+// Puts the fake iwctl, sudo and systemctl from bench/fake first on PATH and
+// measures every WirelessManager operation through the real backend code,
+// along with writing an 802.1X network file and restarting iwd: latency,
+// CPU time of bwm and the processes it waited for, and number of processes
+// spawned. Needs neither root nor a wireless device.
+
+#include "bench_results.h"
+#include "iwd_wrapper.h"
+#include "stats.h"
+#include "wireless_manager.h"
+
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <sys/resource.h>
+#include <vector>
+
+#ifndef BWM_STATS
+#error "bwm-backend-bench counts spawned processes through the statistics, build it with BWM_STATS"
+#endif
+
+struct Operation
+{
+	const char*				name;
+	std::function<bool()>	run;
+};
+
+static double cpu_time_us()
+{
+	double total = 0.0;
+	for (int who : { RUSAGE_SELF, RUSAGE_CHILDREN })
+	{
+		rusage usage;
+		getrusage(who, &usage);
+		total += usage.ru_utime.tv_sec * 1e6 + usage.ru_utime.tv_usec;
+		total += usage.ru_stime.tv_sec * 1e6 + usage.ru_stime.tv_usec;
+	}
+	return total;
+}
+
+static bool setup_environment(const char* fake_dir, const char* networks, const char* known, const char* delay)
+{
+	char path[PATH_MAX];
+	if (realpath(fake_dir, path) == NULL)
+	{
+		fprintf(stderr, "Could not find fake binaries in '%s'\n", fake_dir);
+		return false;
+	}
+
+	const char* old_path = getenv("PATH");
+	std::string new_path = std::string(path) + ":" + (old_path ? old_path : "/usr/bin:/bin");
+
+	// sudo is run by absolute path, only benchmark builds take it from
+	// BWM_SUDO
+	std::string sudo = std::string(path) + "/sudo";
+
+	setenv("PATH", new_path.c_str(), 1);
+	setenv("BWM_SUDO", sudo.c_str(), 1);
+	setenv("BWM_FAKE_NETWORKS", networks, 1);
+	setenv("BWM_FAKE_KNOWN", known, 1);
+	setenv("BWM_FAKE_DELAY", delay, 1);
+	setenv("BWM_FAKE_PASSWORD", "password", 1);
+
+	// Networks would otherwise come from the real kernel scan cache
+	setenv("BWM_NL80211", "0", 1);
+
+	return true;
+}
+
+static const Network* find_network(const std::vector<Network>& networks, NetworkSecurity security)
+{
+	for (const Network& network : networks)
+		if (network.security == security)
+			return &network;
+	return nullptr;
+}
+
+static void usage()
+{
+	fprintf(stderr,
+		"usage: bwm-backend-bench [options]\n"
+		"  --iterations <n>    runs of every operation (default 50)\n"
+		"  --networks <n>      networks reported by the fake iwctl (default 20)\n"
+		"  --known <n>         known networks reported by the fake iwctl (default 10)\n"
+		"  --delay <seconds>   artificial delay of every fake command (default 0)\n"
+		"  --fake-dir <dir>    directory of the fake binaries (default bench/fake)\n"
+		"  --only <operation>  run a single operation\n"
+		"  --output <file>     write results to file, - for stdout (default)\n"
+		"  --baseline <file>   compare results against a saved baseline\n"
+		"  --tolerance <pct>   allowed regression in percent (default 10)\n"
+	);
+}
+
+int main(int argc, char** argv)
+{
+	using bench_clock = std::chrono::steady_clock;
+
+	std::size_t		iterations		= 50;
+	const char*		networks		= "20";
+	const char*		known			= "10";
+	const char*		delay			= "0";
+	const char*		fake_dir		= "bench/fake";
+	const char*		only			= nullptr;
+	const char*		output_path		= "-";
+	const char*		baseline_path	= nullptr;
+	double			tolerance		= 10.0;
+
+	for (int i = 1; i < argc; i++)
+	{
+		bool has_value = i + 1 < argc;
+		if (strcmp(argv[i], "--iterations") == 0 && has_value)
+			iterations = strtoull(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "--networks") == 0 && has_value)
+			networks = argv[++i];
+		else if (strcmp(argv[i], "--known") == 0 && has_value)
+			known = argv[++i];
+		else if (strcmp(argv[i], "--delay") == 0 && has_value)
+			delay = argv[++i];
+		else if (strcmp(argv[i], "--fake-dir") == 0 && has_value)
+			fake_dir = argv[++i];
+		else if (strcmp(argv[i], "--only") == 0 && has_value)
+			only = argv[++i];
+		else if (strcmp(argv[i], "--output") == 0 && has_value)
+			output_path = argv[++i];
+		else if (strcmp(argv[i], "--baseline") == 0 && has_value)
+			baseline_path = argv[++i];
+		else if (strcmp(argv[i], "--tolerance") == 0 && has_value)
+			tolerance = atof(argv[++i]);
+		else
+		{
+			usage();
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (iterations == 0)
+	{
+		fprintf(stderr, "--iterations must be positive\n");
+		return EXIT_FAILURE;
+	}
+
+	if (!setup_environment(fake_dir, networks, known, delay))
+		return EXIT_FAILURE;
+
+	WirelessManager* wireless_manager = WirelessManager::Create(WirelessBackend::iwd);
+	if (!wireless_manager)
+	{
+		fprintf(stderr, "Could not initialize wireless backend with the fake iwctl\n");
+		return EXIT_FAILURE;
+	}
+
+	if (!wireless_manager->UpdateNetworks() || !wireless_manager->UpdateKnownNetworks())
+	{
+		fprintf(stderr, "Could not read networks from the fake iwctl\n");
+		return EXIT_FAILURE;
+	}
+	wireless_manager->AcquireState();
+
+	const Network* open_network	= find_network(wireless_manager->GetNetworks(), NetworkSecurity::open);
+	const Network* psk_network	= find_network(wireless_manager->GetNetworks(), NetworkSecurity::psk);
+	if (!open_network || !psk_network || wireless_manager->GetKnownNetworks().empty())
+	{
+		fprintf(stderr, "Need at least one open, one psk and one known network, increase --networks and --known\n");
+		return EXIT_FAILURE;
+	}
+
+	// Copies, the snapshot changes as operations publish state
+	Network open	= *open_network;
+	Network psk		= *psk_network;
+	Network forget	= wireless_manager->GetKnownNetworks().front();
+
+	std::vector<Operation> operations = {
+		{ "devices",			[] { WirelessManager* m = WirelessManager::Create(WirelessBackend::iwd); delete m; return m != nullptr; } },
+		{ "scan",				[&] { return wireless_manager->Scan(); } },
+		{ "networks",			[&] { return wireless_manager->UpdateNetworks(); } },
+		{ "known_networks",		[&] { return wireless_manager->UpdateKnownNetworks(); } },
+		{ "connect_open",		[&] { return wireless_manager->Connect(open, ""); } },
+		{ "connect_password",	[&] { return wireless_manager->Connect(psk, "password"); } },
+		{ "connect_rejected",	[&] { return !wireless_manager->Connect(psk, ""); } },
+		{ "disconnect",			[&] { return wireless_manager->Disconnect(); } },
+		{ "forget",				[&] { return wireless_manager->ForgetKnownNetwork(forget); } },
+		{ "activate",			[&] { return wireless_manager->ActivateDevice(); } },
+		// The fake sudo discards what is written through tee
+		{ "write_8021x",		[] { return iwd_write_network_config("/var/lib/iwd/bench.8021x", "[Security]\nEAP-Method=PEAP\n"); } },
+		{ "restart_iwd",		[] { return iwd_restart(); } },
+	};
+
+	BenchResults results;
+	results["iterations"] = iterations;
+
+	std::vector<double> latency_us, cpu_us, spawns;
+	latency_us.reserve(iterations);
+	cpu_us.reserve(iterations);
+	spawns.reserve(iterations);
+
+	for (const Operation& operation : operations)
+	{
+		if (only && strcmp(only, operation.name) != 0)
+			continue;
+
+		latency_us.clear();
+		cpu_us.clear();
+		spawns.clear();
+
+		for (std::size_t i = 0; i < iterations; i++)
+		{
+			std::uint64_t spawns_begin = StatsGetSpawnCount();
+			double cpu_begin = cpu_time_us();
+			auto begin = bench_clock::now();
+
+			bool success = operation.run();
+
+			auto end = bench_clock::now();
+			double cpu_end = cpu_time_us();
+			std::uint64_t spawns_end = StatsGetSpawnCount();
+
+			if (!success)
+			{
+				fprintf(stderr, "Operation '%s' failed\n", operation.name);
+				delete wireless_manager;
+				return EXIT_FAILURE;
+			}
+
+			latency_us.push_back(std::chrono::duration<double, std::micro>(end - begin).count());
+			cpu_us.push_back(cpu_end - cpu_begin);
+			spawns.push_back(spawns_end - spawns_begin);
+		}
+
+		std::string name = operation.name;
+		results[name + "_p50_us"]	= BenchPercentile(latency_us, 0.50);
+		results[name + "_p99_us"]	= BenchPercentile(latency_us, 0.99);
+		results[name + "_cpu_us"]	= BenchMean(cpu_us);
+		results[name + "_spawns"]	= BenchMean(spawns);
+	}
+
+	delete wireless_manager;
+
+	if (!BenchWriteResults(output_path, results))
+		return EXIT_FAILURE;
+
+	if (baseline_path)
+	{
+		BenchResults baseline;
+		if (!BenchReadResults(baseline_path, baseline))
+			return EXIT_FAILURE;
+		if (!BenchCompareResults(baseline, results, tolerance))
+			return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
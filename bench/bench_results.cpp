@@ -0,0 +1,78 @@
+#include "bench_results.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+double BenchPercentile(std::vector<double>& values, double p)
+{
+	if (values.empty())
+		return 0.0;
+	std::size_t index = std::min(values.size() - 1, (std::size_t)(p * values.size()));
+	std::nth_element(values.begin(), values.begin() + index, values.end());
+	return values[index];
+}
+
+double BenchMean(const std::vector<double>& values)
+{
+	double sum = 0.0;
+	for (double value : values)
+		sum += value;
+	return values.empty() ? 0.0 : sum / values.size();
+}
+
+bool BenchWriteResults(const char* path, const BenchResults& results)
+{
+	FILE* fp = (strcmp(path, "-") == 0) ? stdout : fopen(path, "w");
+	if (fp == NULL)
+	{
+		fprintf(stderr, "Could not open '%s'\n", path);
+		return false;
+	}
+
+	for (const auto& [key, value] : results)
+		fprintf(fp, "%s %.2f\n", key.c_str(), value);
+
+	if (fp != stdout)
+		fclose(fp);
+	return true;
+}
+
+bool BenchReadResults(const char* path, BenchResults& out)
+{
+	std::ifstream file(path);
+	if (!file)
+	{
+		fprintf(stderr, "Could not open baseline '%s'\n", path);
+		return false;
+	}
+
+	std::string key;
+	double value;
+	while (file >> key >> value)
+		out[key] = value;
+	return true;
+}
+
+bool BenchCompareResults(const BenchResults& baseline, const BenchResults& results, double tolerance)
+{
+	bool ok = true;
+	for (const auto& [key, base] : baseline)
+	{
+		auto it = results.find(key);
+		if (it == results.end() || key == "frames" || key == "iterations")
+			continue;
+
+		// Differences below 0.5 are rounding noise of small counts
+		double limit = base * (1.0 + tolerance / 100.0);
+		bool regressed = it->second > limit && it->second - base > 0.5;
+		fprintf(stderr, "%-28s %12.2f %12.2f %+8.1f%%%s\n",
+			key.c_str(), base, it->second,
+			base > 0.0 ? (it->second - base) * 100.0 / base : 0.0,
+			regressed ? "  REGRESSION" : ""
+		);
+		ok &= !regressed;
+	}
+	return ok;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+
+// Results of the benchmarks, saved as one "<name> <value>" pair per line.
+// Every value is a cost, higher is worse.
+using BenchResults = std::map<std::string, double>;
+
+// Reorders values
+double BenchPercentile(std::vector<double>& values, double p);
+double BenchMean(const std::vector<double>& values);
+
+// path "-" writes to stdout
+bool BenchWriteResults(const char* path, const BenchResults& results);
+bool BenchReadResults(const char* path, BenchResults& out);
+
+// Prints every value next to its baseline to stderr. Returns false if any
+// value is higher than its baseline by more than tolerance percent.
+bool BenchCompareResults(const BenchResults& baseline, const BenchResults& results, double tolerance);
@@ -0,0 +1,384 @@
+// Checks the nl80211 BSS parser against crafted scan results.
+//
+// Feeds hand built NL80211_ATTR_BSS nests to ParseScanResult(): well formed
+// ones with every kind of security element, and ones with truncated or
+// oversized attributes, information elements and RSN suite counts. Every
+// input is placed right in front of an inaccessible page, so reading past
+// its end crashes the check instead of going unnoticed. Every prefix of the
+// well formed inputs and a fixed set of random mutations are parsed as well.
+// Exits with a non-zero status if a result was wrong.
+
+#include "nl80211_scan_reader.h"
+
+#include <linux/netlink.h>
+#include <linux/nl80211.h>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string_view>
+#include <vector>
+
+using Bytes = std::vector<std::uint8_t>;
+
+static std::size_t	s_checks	= 0;
+static std::size_t	s_failures	= 0;
+
+// One page followed by an inaccessible one, inputs are copied to the end
+// of the first page
+class GuardedBuffer
+{
+public:
+	GuardedBuffer()
+	{
+		m_page_size = sysconf(_SC_PAGESIZE);
+		void* pages = mmap(nullptr, 2 * m_page_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (pages == MAP_FAILED || mprotect(static_cast<std::uint8_t*>(pages) + m_page_size, m_page_size, PROT_NONE) == -1)
+		{
+			perror("mmap");
+			exit(EXIT_FAILURE);
+		}
+		m_pages = static_cast<std::uint8_t*>(pages);
+	}
+
+	~GuardedBuffer()
+	{
+		munmap(m_pages, 2 * m_page_size);
+	}
+
+	GuardedBuffer(const GuardedBuffer&) = delete;
+	GuardedBuffer& operator=(const GuardedBuffer&) = delete;
+
+	// The copy ends right at the inaccessible page, so it is only aligned
+	// if size is a multiple of 4
+	const std::uint8_t* Place(const std::uint8_t* data, std::size_t size)
+	{
+		if (size > m_page_size)
+		{
+			fprintf(stderr, "Input of %zu bytes does not fit a page\n", size);
+			exit(EXIT_FAILURE);
+		}
+		std::uint8_t* copy = m_pages + m_page_size - size;
+		if (size > 0)
+			std::memcpy(copy, data, size);
+		return copy;
+	}
+
+private:
+	std::uint8_t*	m_pages		= nullptr;
+	std::size_t		m_page_size	= 0;
+};
+
+static GuardedBuffer* s_guarded = nullptr;
+
+static bool parse(const Bytes& input, std::size_t size, ScanResult& out)
+{
+	return ParseScanResult(s_guarded->Place(input.data(), size), size, out);
+}
+
+static void append_attribute(Bytes& out, std::uint16_t type, const Bytes& value)
+{
+	nlattr header;
+	header.nla_len	= std::uint16_t(NLA_HDRLEN + value.size());
+	header.nla_type	= type;
+
+	const std::uint8_t* raw = reinterpret_cast<const std::uint8_t*>(&header);
+	out.insert(out.end(), raw, raw + sizeof(header));
+	out.insert(out.end(), value.begin(), value.end());
+	out.resize(NLA_ALIGN(out.size()), 0);
+}
+
+template<typename T>
+static Bytes value_of(T value)
+{
+	Bytes bytes(sizeof(T));
+	std::memcpy(bytes.data(), &value, sizeof(T));
+	return bytes;
+}
+
+static Bytes element(std::uint8_t id, const Bytes& body)
+{
+	Bytes bytes { id, std::uint8_t(body.size()) };
+	bytes.insert(bytes.end(), body.begin(), body.end());
+	return bytes;
+}
+
+static Bytes ssid_element(std::string_view ssid)
+{
+	return element(0, Bytes(ssid.begin(), ssid.end()));
+}
+
+// RSN element body with one CCMP pairwise cipher and the given AKM suites
+static Bytes rsn_body(const Bytes& akms)
+{
+	Bytes body {
+		0x01, 0x00,					// version
+		0x00, 0x0f, 0xac, 0x04,		// group cipher
+		0x01, 0x00,					// pairwise count
+		0x00, 0x0f, 0xac, 0x04,
+		std::uint8_t(akms.size()), 0x00,
+	};
+	for (std::uint8_t akm : akms)
+		body.insert(body.end(), { 0x00, 0x0f, 0xac, akm });
+	return body;
+}
+
+static Bytes concat(std::initializer_list<Bytes> parts)
+{
+	Bytes bytes;
+	for (const Bytes& part : parts)
+		bytes.insert(bytes.end(), part.begin(), part.end());
+	return bytes;
+}
+
+// BSS nest with a BSSID, a frequency, a signal and the given elements
+static Bytes bss(const Bytes& ies, std::uint16_t capability = 0, std::uint16_t ies_type = NL80211_BSS_INFORMATION_ELEMENTS)
+{
+	Bytes bytes;
+	append_attribute(bytes, NL80211_BSS_BSSID, { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 });
+	append_attribute(bytes, NL80211_BSS_FREQUENCY, value_of<std::uint32_t>(2437));
+	append_attribute(bytes, NL80211_BSS_CAPABILITY, value_of<std::uint16_t>(capability));
+	append_attribute(bytes, NL80211_BSS_SIGNAL_MBM, value_of<std::int32_t>(-6000));
+	append_attribute(bytes, ies_type, ies);
+	return bytes;
+}
+
+static void check(bool condition, const char* name, const char* what)
+{
+	s_checks++;
+	if (condition)
+		return;
+	fprintf(stderr, "%s: %s\n", name, what);
+	s_failures++;
+}
+
+static void expect(const char* name, const Bytes& input, std::string_view ssid, NetworkSecurity security)
+{
+	ScanResult result;
+	if (!parse(input, input.size(), result))
+	{
+		check(false, name, "not parsed");
+		return;
+	}
+	check(result.ssid.view() == ssid, name, "wrong ssid");
+	if (result.security != security)
+	{
+		char what[64];
+		snprintf(what, sizeof(what), "security %s, expected %s", to_string(result.security), to_string(security));
+		check(false, name, what);
+	}
+	else
+		check(true, name, "");
+}
+
+static void expect_rejected(const char* name, const Bytes& input)
+{
+	ScanResult result;
+	check(!parse(input, input.size(), result), name, "parsed");
+}
+
+// Parses every prefix of input, nothing is expected of the results as long
+// as nothing is read past their end
+static void parse_prefixes(const Bytes& input)
+{
+	for (std::size_t size = 0; size <= input.size(); size++)
+	{
+		ScanResult result;
+		parse(input, size, result);
+	}
+}
+
+static void check_well_formed(std::vector<Bytes>& corpus)
+{
+	Bytes open = bss(ssid_element("cafe"));
+	expect("open", open, "cafe", NetworkSecurity::open);
+
+	ScanResult result;
+	parse(open, open.size(), result);
+	check(result.bssid.view() == "02:00:00:00:00:01", "open", "wrong bssid");
+	check(result.frequency == 2437, "open", "wrong frequency");
+	check(result.signal_dbm == -60 && result.signal == 80, "open", "wrong signal");
+
+	struct { const char* name; Bytes akms; NetworkSecurity security; } rsn_cases[] = {
+		{ "rsn psk",			{ 2 },		NetworkSecurity::psk },
+		{ "rsn sae",			{ 8 },		NetworkSecurity::psk },
+		{ "rsn psk sha256",		{ 6 },		NetworkSecurity::psk },
+		{ "rsn 802.1x",			{ 1 },		NetworkSecurity::ieee8021x },
+		{ "rsn suite b",		{ 12 },		NetworkSecurity::ieee8021x },
+		{ "rsn psk and 802.1x",	{ 2, 1 },	NetworkSecurity::ieee8021x },
+		{ "rsn owe",			{ 18 },		NetworkSecurity::open },
+		{ "rsn unknown akm",	{ 200 },	NetworkSecurity::unknown },
+		{ "rsn no akm",			{},			NetworkSecurity::unknown },
+	};
+	for (const auto& rsn_case : rsn_cases)
+	{
+		Bytes input = bss(concat({ ssid_element("home"), element(48, rsn_body(rsn_case.akms)) }));
+		expect(rsn_case.name, input, "home", rsn_case.security);
+		corpus.push_back(input);
+	}
+
+	// WPA1 vendor element with TKIP and PSK
+	Bytes wpa {
+		0x00, 0x50, 0xf2, 0x01,		// OUI and type
+		0x01, 0x00,
+		0x00, 0x50, 0xf2, 0x02,
+		0x01, 0x00,
+		0x00, 0x50, 0xf2, 0x02,
+		0x01, 0x00,
+		0x00, 0x50, 0xf2, 0x02,
+	};
+	Bytes wpa_input = bss(concat({ ssid_element("legacy"), element(221, wpa) }));
+	expect("wpa psk", wpa_input, "legacy", NetworkSecurity::psk);
+	corpus.push_back(wpa_input);
+
+	// Other vendor elements are skipped
+	expect("other vendor", bss(concat({ ssid_element("cafe"), element(221, { 0x00, 0x50, 0xf2, 0x04, 0x10 }) })), "cafe", NetworkSecurity::open);
+
+	expect("wep", bss(ssid_element("old"), 0x0010), "old", NetworkSecurity::wep);
+	expect("beacon only", bss(ssid_element("beacon"), 0, NL80211_BSS_BEACON_IES), "beacon", NetworkSecurity::open);
+
+	// Only the first ssid element counts
+	expect("two ssids", bss(concat({ ssid_element("first"), ssid_element("second") })), "first", NetworkSecurity::open);
+
+	expect_rejected("hidden empty", bss(ssid_element("")));
+	expect_rejected("hidden zeroed", bss(element(0, { 0, 0, 0, 0 })));
+	expect_rejected("no elements", bss({}));
+	expect_rejected("empty nest", {});
+
+	corpus.push_back(open);
+}
+
+static void check_malformed()
+{
+	Bytes ssid = ssid_element("home");
+
+	// RSN elements cut off before the pairwise count or before the AKM
+	// count default to 802.1X
+	Bytes rsn = rsn_body({ 2 });
+	expect("rsn without pairwise count", bss(concat({ ssid, element(48, Bytes(rsn.begin(), rsn.begin() + 6)) })), "home", NetworkSecurity::ieee8021x);
+	expect("rsn without akm count", bss(concat({ ssid, element(48, Bytes(rsn.begin(), rsn.begin() + 12)) })), "home", NetworkSecurity::ieee8021x);
+	expect("rsn version only", bss(concat({ ssid, element(48, { 0x01, 0x00 }) })), "home", NetworkSecurity::ieee8021x);
+	expect("rsn empty", bss(concat({ ssid, element(48, {}) })), "home", NetworkSecurity::ieee8021x);
+
+	// Suite counts far beyond the element
+	Bytes pairwise = rsn;
+	pairwise[6] = 0xff;
+	pairwise[7] = 0xff;
+	expect("rsn oversized pairwise count", bss(concat({ ssid, element(48, pairwise) })), "home", NetworkSecurity::ieee8021x);
+
+	Bytes akm = rsn;
+	akm[12] = 0xff;
+	akm[13] = 0xff;
+	expect("rsn oversized akm count", bss(concat({ ssid, element(48, akm) })), "home", NetworkSecurity::psk);
+
+	Bytes partial(rsn.begin(), rsn.end() - 1);
+	expect("rsn partial akm", bss(concat({ ssid, element(48, partial) })), "home", NetworkSecurity::unknown);
+
+	// WPA vendor elements too short for the OUI and type are skipped
+	expect("short vendor", bss(concat({ ssid, element(221, { 0x00, 0x50, 0xf2 }) })), "home", NetworkSecurity::open);
+	expect("wpa header only", bss(concat({ ssid, element(221, { 0x00, 0x50, 0xf2, 0x01 }) })), "home", NetworkSecurity::ieee8021x);
+
+	// An element longer than the rest of the data ends parsing, what came
+	// before it is kept
+	Bytes overlong = concat({ ssid, { 48, 200, 0x01, 0x00 } });
+	expect("element past the end", bss(overlong), "home", NetworkSecurity::open);
+	expect_rejected("ssid past the end", bss({ 0, 32, 'h', 'o', 'm', 'e' }));
+	expect("lone element id", bss(concat({ ssid, { 48 } })), "home", NetworkSecurity::open);
+
+	// Attributes claiming more than the nest holds are ignored
+	Bytes nest = bss(ssid);
+	Bytes oversized = nest;
+	nlattr header { std::uint16_t(NLA_HDRLEN + 200), NL80211_BSS_INFORMATION_ELEMENTS };
+	std::memcpy(oversized.data() + oversized.size() - NLA_ALIGN(NLA_HDRLEN + ssid.size()), &header, sizeof(header));
+	expect_rejected("attribute past the end", oversized);
+
+	Bytes undersized = nest;
+	header = { 2, NL80211_BSS_BSSID };
+	std::memcpy(undersized.data(), &header, sizeof(header));
+	expect_rejected("attribute shorter than its header", undersized);
+
+	// Fixed size attributes that are too short read what is there
+	Bytes short_values;
+	append_attribute(short_values, NL80211_BSS_BSSID, { 0x02, 0x00 });
+	append_attribute(short_values, NL80211_BSS_FREQUENCY, { 0x01 });
+	append_attribute(short_values, NL80211_BSS_SIGNAL_MBM, {});
+	append_attribute(short_values, NL80211_BSS_STATUS, {});
+	append_attribute(short_values, NL80211_BSS_CAPABILITY, { 0x10 });
+	append_attribute(short_values, NL80211_BSS_INFORMATION_ELEMENTS, ssid);
+	expect("short attributes", short_values, "home", NetworkSecurity::wep);
+
+	ScanResult result;
+	parse(short_values, short_values.size(), result);
+	check(result.bssid.view().empty(), "short attributes", "bssid of the wrong size used");
+	check(result.frequency == 1, "short attributes", "wrong frequency");
+
+	// Trailing bytes too short for another attribute header
+	Bytes trailing = concat({ nest, { 0x00, 0x00 } });
+	expect("trailing bytes", trailing, "home", NetworkSecurity::open);
+}
+
+// Flips random bytes of the well formed inputs, with a fixed seed so
+// failures reproduce
+static void check_mutations(const std::vector<Bytes>& corpus, std::size_t iterations)
+{
+	std::mt19937 random(80211);
+	for (std::size_t i = 0; i < iterations; i++)
+	{
+		Bytes input = corpus[random() % corpus.size()];
+		std::size_t flips = 1 + random() % 4;
+		for (std::size_t j = 0; j < flips; j++)
+			input[random() % input.size()] = std::uint8_t(random());
+
+		std::size_t size = input.size() - random() % (input.size() / 4 + 1);
+
+		ScanResult result;
+		if (parse(input, size, result))
+			check(!result.ssid.empty(), "mutation", "parsed without ssid");
+	}
+}
+
+static void usage()
+{
+	fprintf(stderr,
+		"usage: bwm-nl80211-check [options]\n"
+		"  --mutations <n>     randomly mutated inputs parsed (default 100000)\n"
+	);
+}
+
+int main(int argc, char** argv)
+{
+	std::size_t mutations = 100000;
+
+	for (int i = 1; i < argc; i++)
+	{
+		bool has_value = i + 1 < argc;
+		if (strcmp(argv[i], "--mutations") == 0 && has_value)
+			mutations = strtoull(argv[++i], NULL, 10);
+		else
+		{
+			usage();
+			return EXIT_FAILURE;
+		}
+	}
+
+	GuardedBuffer guarded;
+	s_guarded = &guarded;
+
+	std::vector<Bytes> corpus;
+	check_well_formed(corpus);
+	check_malformed();
+
+	for (const Bytes& input : corpus)
+		parse_prefixes(input);
+	check_mutations(corpus, mutations);
+
+	printf("checks %zu\n", s_checks);
+	printf("mutations %zu\n", mutations);
+	printf("failures %zu\n", s_failures);
+
+	return s_failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,345 @@
+// Checks the NetworkManager backend against bench/nm_stub.cpp.
+//
+// Meant to be started by bench/run_nm_check.sh, which puts the stub on a
+// private bus and points DBUS_SYSTEM_BUS_ADDRESS at it. Changes to the
+// access points are made through the stub's control interface and have to
+// reach bwm's lists through NetworkManager's signals alone. Prints one line
+// per scenario and exits with a non-zero status if any of them failed.
+
+#include "wireless_manager.h"
+
+#include <systemd/sd-bus.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+static constexpr const char* s_service				= "org.freedesktop.NetworkManager";
+static constexpr const char* s_manager_path			= "/org/freedesktop/NetworkManager";
+static constexpr const char* s_control_interface	= "org.bwm.NmStub";
+
+// Signals take a round trip through the bus daemon
+static constexpr auto s_wait_timeout	= std::chrono::seconds(2);
+static constexpr auto s_wait_poll		= std::chrono::milliseconds(10);
+
+static sd_bus*	s_control	= nullptr;
+static int		s_failed	= 0;
+
+static void expect(bool condition, const char* scenario, const char* what)
+{
+	if (condition)
+		return;
+	fprintf(stderr, "%s: %s\n", scenario, what);
+	s_failed++;
+}
+
+static const Network* find_network(const std::vector<Network>& networks, std::string_view ssid)
+{
+	for (const Network& network : networks)
+		if (network.ssid.view() == ssid)
+			return &network;
+	return nullptr;
+}
+
+static bool any_connected(const std::vector<Network>& networks)
+{
+	for (const Network& network : networks)
+		if (network.connected)
+			return true;
+	return false;
+}
+
+// Refreshes the lists until they satisfy the condition
+static bool wait_until(WirelessManager* wireless_manager, const std::function<bool(const WirelessState&)>& condition)
+{
+	auto deadline = std::chrono::steady_clock::now() + s_wait_timeout;
+	for (;;)
+	{
+		wireless_manager->UpdateNetworks();
+		wireless_manager->UpdateKnownNetworks();
+		if (condition(wireless_manager->CopyState()))
+			return true;
+		if (std::chrono::steady_clock::now() >= deadline)
+			return false;
+		std::this_thread::sleep_for(s_wait_poll);
+	}
+}
+
+// The stub owns its name only once all of its objects are there
+static bool wait_for_stub()
+{
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+	for (;;)
+	{
+		if (sd_bus_call_method(s_control, s_service, s_manager_path, "org.freedesktop.DBus.Peer", "Ping", NULL, NULL, "") >= 0)
+			return true;
+		if (std::chrono::steady_clock::now() >= deadline)
+			return false;
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	}
+}
+
+static std::string add_access_point(const char* ssid, const char* security, std::uint8_t strength)
+{
+	sd_bus_error error = SD_BUS_ERROR_NULL;
+	sd_bus_message* reply = nullptr;
+	std::string result;
+
+	const char* path;
+	if (sd_bus_call_method(s_control, s_service, s_manager_path, s_control_interface, "AddAccessPoint", &error, &reply, "ssy", ssid, security, strength) >= 0
+		&& sd_bus_message_read(reply, "o", &path) >= 0)
+		result = path;
+	else
+		fprintf(stderr, "Could not add access point '%s': %s\n", ssid, error.message ? error.message : "invalid reply");
+
+	sd_bus_message_unref(reply);
+	sd_bus_error_free(&error);
+	return result;
+}
+
+static bool report_control_error(const char* member, int r, sd_bus_error& error)
+{
+	if (r < 0)
+		fprintf(stderr, "%s failed: %s\n", member, error.message ? error.message : strerror(-r));
+	sd_bus_error_free(&error);
+	return r >= 0;
+}
+
+static bool remove_access_point(const std::string& path)
+{
+	sd_bus_error error = SD_BUS_ERROR_NULL;
+	int r = sd_bus_call_method(s_control, s_service, s_manager_path, s_control_interface, "RemoveAccessPoint", &error, NULL, "o", path.c_str());
+	return report_control_error("RemoveAccessPoint", r, error);
+}
+
+static bool set_strength(const std::string& path, std::uint8_t strength)
+{
+	sd_bus_error error = SD_BUS_ERROR_NULL;
+	int r = sd_bus_call_method(s_control, s_service, s_manager_path, s_control_interface, "SetStrength", &error, NULL, "oy", path.c_str(), strength);
+	return report_control_error("SetStrength", r, error);
+}
+
+static std::uint32_t access_point_loads()
+{
+	sd_bus_error error = SD_BUS_ERROR_NULL;
+	sd_bus_message* reply = nullptr;
+	std::uint32_t loads = 0;
+
+	int r = sd_bus_call_method(s_control, s_service, s_manager_path, s_control_interface, "AccessPointLoads", &error, &reply, "");
+	if (r >= 0)
+		r = sd_bus_message_read(reply, "u", &loads);
+	report_control_error("AccessPointLoads", r, error);
+
+	sd_bus_message_unref(reply);
+	return loads;
+}
+
+static void check_list(WirelessManager* wireless_manager)
+{
+	const char* scenario = "list";
+	WirelessState state = wireless_manager->CopyState();
+
+	expect(state.devices.size() == 1, scenario, "expected one device");
+	expect(!state.devices.empty() && state.devices[0].name.view() == "wlan0", scenario, "expected device wlan0");
+	expect(!state.devices.empty() && state.devices[0].power == PowerState::on, scenario, "expected the device to be powered");
+
+	// One entry per ssid, with the signal of its strongest access point
+	expect(state.networks.size() == 5, scenario, "expected 5 networks");
+	expect(!state.networks.empty() && state.networks[0].ssid.view() == "home", scenario, "expected home first");
+
+	const Network* home = find_network(state.networks, "home");
+	const Network* cafe = find_network(state.networks, "cafe");
+	const Network* campus = find_network(state.networks, "campus");
+	expect(home && home->signal == 70 && home->security == NetworkSecurity::psk, scenario, "expected home as psk with signal 70");
+	expect(cafe && cafe->security == NetworkSecurity::open, scenario, "expected cafe as open");
+	expect(campus && campus->security == NetworkSecurity::ieee8021x, scenario, "expected campus as 802.1X");
+	expect(!any_connected(state.networks), scenario, "expected no connected network");
+
+	expect(state.known_networks.size() == 2 && find_network(state.known_networks, "home") && find_network(state.known_networks, "attic"),
+		scenario, "expected home and attic as the known networks");
+}
+
+static void check_add_remove(WirelessManager* wireless_manager)
+{
+	const char* scenario = "add/remove";
+
+	std::string path = add_access_point("library", "open", 90);
+	expect(!path.empty(), scenario, "could not add access point");
+	if (path.empty())
+		return;
+
+	expect(wait_until(wireless_manager, [](const WirelessState& state) {
+		return !state.networks.empty() && state.networks[0].ssid.view() == "library" && state.networks[0].signal == 90;
+	}), scenario, "added access point did not show up first");
+
+	expect(set_strength(path, 10) && wait_until(wireless_manager, [](const WirelessState& state) {
+		const Network* library = find_network(state.networks, "library");
+		return library && library->signal == 10 && state.networks.back().ssid.view() == "library";
+	}), scenario, "strength change did not show up");
+
+	expect(remove_access_point(path) && wait_until(wireless_manager, [](const WirelessState& state) {
+		return find_network(state.networks, "library") == nullptr && state.networks.size() == 5;
+	}), scenario, "removed access point did not go away");
+}
+
+// Every scan changes LastSeen of every access point, which must not cost a
+// reload per access point
+static void check_scan(WirelessManager* wireless_manager)
+{
+	const char* scenario = "scan";
+
+	std::uint32_t loads = access_point_loads();
+	WirelessState before = wireless_manager->CopyState();
+
+	expect(wireless_manager->Scan(), scenario, "scan failed");
+
+	// The signals were sent before the scan's reply, these apply them
+	for (int i = 0; i < 5; i++)
+	{
+		wireless_manager->UpdateNetworks();
+		std::this_thread::sleep_for(s_wait_poll);
+	}
+
+	expect(access_point_loads() == loads, scenario, "access points were reloaded after a scan");
+	expect(wireless_manager->CopyState().generation == before.generation, scenario, "unchanged access points published a new state");
+}
+
+static void check_connect(WirelessManager* wireless_manager)
+{
+	const char* scenario = "connect";
+
+	auto connected_to = [](const char* ssid) {
+		return [ssid](const WirelessState& state) {
+			const Network* network = find_network(state.networks, ssid);
+			if (network == nullptr || !network->connected)
+				return false;
+			for (const Network& other : state.networks)
+				if (other.connected && other.ssid.view() != ssid)
+					return false;
+			return find_network(state.known_networks, ssid) != nullptr;
+		};
+	};
+
+	auto network = [&](const char* ssid) {
+		WirelessState state = wireless_manager->CopyState();
+		const Network* found = find_network(state.networks, ssid);
+		return found ? *found : Network {};
+	};
+
+	// New open network, saved by AddAndActivateConnection
+	expect(wireless_manager->Connect(network("cafe")), scenario, "could not connect to open network cafe");
+	expect(wait_until(wireless_manager, connected_to("cafe")), scenario, "cafe not connected and known");
+
+	// A failed activation does not leave a saved connection behind
+	expect(!wireless_manager->Connect(network("office"), "wrong"), scenario, "connected to office with a wrong passphrase");
+	expect(wait_until(wireless_manager, [](const WirelessState& state) {
+		return find_network(state.known_networks, "office") == nullptr;
+	}), scenario, "failed connection to office was remembered");
+
+	expect(wireless_manager->Connect(network("office"), "password"), scenario, "could not connect to office");
+	expect(wait_until(wireless_manager, connected_to("office")), scenario, "office not connected and known");
+
+	// Saved connections are activated without a passphrase
+	expect(wireless_manager->Connect(network("home")), scenario, "could not connect to known network home");
+	expect(wait_until(wireless_manager, connected_to("home")), scenario, "home not connected");
+
+	expect(!wireless_manager->Connect(network("campus")), scenario, "connected to unsaved 802.1X network campus");
+
+	expect(wireless_manager->Disconnect(), scenario, "could not disconnect");
+	expect(wait_until(wireless_manager, [](const WirelessState& state) { return !any_connected(state.networks); }), scenario, "still connected after disconnecting");
+
+	expect(wireless_manager->ForgetKnownNetwork(network("office")), scenario, "could not forget office");
+	expect(wait_until(wireless_manager, [](const WirelessState& state) {
+		return find_network(state.known_networks, "office") == nullptr && state.known_networks.size() == 3;
+	}), scenario, "office still known after forgetting it");
+}
+
+// A passphrase typed for a saved network replaces its stale one
+static void check_new_secret(WirelessManager* wireless_manager)
+{
+	const char* scenario = "new secret";
+
+	WirelessState state = wireless_manager->CopyState();
+	const Network* found = find_network(state.networks, "attic");
+	Network attic = found ? *found : Network {};
+
+	auto attic_known_once = [](const WirelessState& state) {
+		int count = 0;
+		for (const Network& network : state.known_networks)
+			count += (network.ssid.view() == "attic");
+		return count == 1;
+	};
+
+	expect(!wireless_manager->Connect(attic), scenario, "connected to attic with its stale passphrase");
+
+	// A wrong passphrase keeps the saved connection
+	expect(!wireless_manager->Connect(attic, "wrong"), scenario, "connected to attic with a wrong passphrase");
+	expect(wait_until(wireless_manager, attic_known_once), scenario, "attic not known once after a wrong passphrase");
+
+	expect(wireless_manager->Connect(attic, "password"), scenario, "could not connect to attic with a new passphrase");
+	expect(wait_until(wireless_manager, [&](const WirelessState& state) {
+		const Network* network = find_network(state.networks, "attic");
+		return network && network->connected && attic_known_once(state);
+	}), scenario, "attic not connected and known once");
+
+	// The new passphrase was saved
+	expect(wireless_manager->Disconnect(), scenario, "could not disconnect");
+	expect(wireless_manager->Connect(attic), scenario, "could not connect to attic with the saved passphrase");
+}
+
+int main()
+{
+	int r = sd_bus_open_system(&s_control);
+	if (r < 0)
+	{
+		fprintf(stderr, "Could not connect to the bus: %s\n", strerror(-r));
+		return EXIT_FAILURE;
+	}
+
+	if (!wait_for_stub())
+	{
+		fprintf(stderr, "The stub NetworkManager did not show up on the bus\n");
+		sd_bus_flush_close_unref(s_control);
+		return EXIT_FAILURE;
+	}
+
+	WirelessManager* wireless_manager = WirelessManager::Create(WirelessBackend::network_manager);
+	if (!wireless_manager)
+	{
+		fprintf(stderr, "Could not initialize the NetworkManager backend with the stub\n");
+		sd_bus_flush_close_unref(s_control);
+		return EXIT_FAILURE;
+	}
+
+	struct Scenario
+	{
+		const char*	name;
+		void		(*run)(WirelessManager*);
+	};
+
+	static constexpr Scenario scenarios[] = {
+		{ "list",		check_list },
+		{ "add/remove",	check_add_remove },
+		{ "scan",		check_scan },
+		{ "connect",	check_connect },
+		{ "new secret",	check_new_secret },
+	};
+
+	for (const Scenario& scenario : scenarios)
+	{
+		int failed_before = s_failed;
+		scenario.run(wireless_manager);
+		printf("%-12s %s\n", scenario.name, s_failed == failed_before ? "ok" : "FAILED");
+	}
+
+	delete wireless_manager;
+	sd_bus_flush_close_unref(s_control);
+
+	return s_failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
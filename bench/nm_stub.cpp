@@ -0,0 +1,847 @@
+// Stand-in for NetworkManager on a private bus, for bench/run_nm_check.sh.
+//
+// Owns org.freedesktop.NetworkManager on the bus in DBUS_SYSTEM_BUS_ADDRESS
+// and implements the part of NetworkManager's D-Bus API NmWirelessManager
+// uses: one wifi device with a few access points, saved connections and
+// activation. Psk networks accept the passphrase "password", like the fake
+// iwctl. The saved connection of attic has a stale one. Activations go
+// through the activating state before they succeed or fail, so callers
+// have to wait for them like for the real thing. Scans bump LastSeen of
+// every access point, like NetworkManager does.
+//
+// The check drives changes through the org.bwm.NmStub interface on the
+// manager object:
+//   AddAccessPoint(s ssid, s security, y strength) -> o
+//   RemoveAccessPoint(o path)
+//   SetStrength(o path, y strength)
+//   AccessPointLoads() -> u    GetAll calls on access points so far
+// security is "open", "psk" or "8021x".
+
+#include <systemd/sd-bus.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+static constexpr const char* s_service				= "org.freedesktop.NetworkManager";
+static constexpr const char* s_manager_path			= "/org/freedesktop/NetworkManager";
+static constexpr const char* s_device_path			= "/org/freedesktop/NetworkManager/Devices/1";
+static constexpr const char* s_settings_path		= "/org/freedesktop/NetworkManager/Settings";
+static constexpr const char* s_ap_prefix			= "/org/freedesktop/NetworkManager/AccessPoint/";
+static constexpr const char* s_connection_prefix	= "/org/freedesktop/NetworkManager/Settings/";
+static constexpr const char* s_active_prefix		= "/org/freedesktop/NetworkManager/ActiveConnection/";
+
+static constexpr const char* s_manager_interface	= "org.freedesktop.NetworkManager";
+static constexpr const char* s_device_interface		= "org.freedesktop.NetworkManager.Device";
+static constexpr const char* s_wireless_interface	= "org.freedesktop.NetworkManager.Device.Wireless";
+static constexpr const char* s_ap_interface			= "org.freedesktop.NetworkManager.AccessPoint";
+static constexpr const char* s_settings_interface	= "org.freedesktop.NetworkManager.Settings";
+static constexpr const char* s_connection_interface	= "org.freedesktop.NetworkManager.Settings.Connection";
+static constexpr const char* s_active_interface		= "org.freedesktop.NetworkManager.Connection.Active";
+static constexpr const char* s_properties_interface	= "org.freedesktop.DBus.Properties";
+static constexpr const char* s_control_interface	= "org.bwm.NmStub";
+
+static constexpr const char* s_error_invalid		= "org.freedesktop.DBus.Error.InvalidArgs";
+static constexpr const char* s_error_unknown		= "org.freedesktop.NetworkManager.UnknownConnection";
+
+// Values of NetworkManager's enums, see nm_wireless_manager.cpp
+static constexpr std::uint32_t s_device_type_wifi			= 2;
+static constexpr std::uint32_t s_device_state_disconnected	= 30;
+static constexpr std::uint32_t s_device_state_activated		= 100;
+static constexpr std::uint32_t s_active_state_activating	= 1;
+static constexpr std::uint32_t s_active_state_activated		= 2;
+static constexpr std::uint32_t s_active_state_deactivated	= 4;
+static constexpr std::uint32_t s_mode_infra					= 2;
+static constexpr std::uint32_t s_ap_flag_privacy			= 0x1;
+static constexpr std::uint32_t s_ap_key_mgmt_psk			= 0x100;
+static constexpr std::uint32_t s_ap_key_mgmt_8021x			= 0x200;
+
+// How long activations stay in the activating state
+static constexpr auto s_activation_time = std::chrono::milliseconds(50);
+
+static constexpr const char* s_password = "password";
+
+struct StubAccessPoint
+{
+	std::string		path;
+	std::string		ssid;
+	std::string		bssid;
+	std::uint32_t	rsn_flags;
+	std::uint32_t	frequency;
+	std::uint8_t	strength;
+};
+
+struct StubConnection
+{
+	std::string		path;
+	std::string		ssid;
+	std::string		key_mgmt;	// empty for open networks
+	std::string		psk;
+};
+
+struct StubActiveConnection
+{
+	std::string								path;
+	std::string								connection_path;
+	std::string								ap_path;
+	std::uint32_t							state;
+	bool									succeeds;
+	std::chrono::steady_clock::time_point	done;
+};
+
+class StubNetworkManager
+{
+public:
+	~StubNetworkManager();
+
+	bool Init();
+	int Run();
+
+private:
+	static int OnMessage(sd_bus_message* message, void* userdata, sd_bus_error* error);
+	int HandleMessage(sd_bus_message* message);
+
+	int HandleProperties(sd_bus_message* message, const std::string& path, const char* member);
+	int HandleManager(sd_bus_message* message, const char* member);
+	int HandleDevice(sd_bus_message* message);
+	int HandleSettings(sd_bus_message* message, const char* member);
+	int HandleConnection(sd_bus_message* message, const std::string& path, const char* member);
+	int HandleControl(sd_bus_message* message, const char* member);
+
+	int AddAndActivate(sd_bus_message* message);
+	int Activate(sd_bus_message* message);
+
+	// Appends the property as a variant, false if the object has no such
+	// property
+	bool AppendProperty(sd_bus_message* m, const std::string& path, const char* interface, const char* name);
+	bool AppendProperties(sd_bus_message* m, const std::string& path, const char* interface);
+	void EmitPropertyChanged(const std::string& path, const char* interface, const char* name);
+
+	StubAccessPoint& AddAccessPoint(const std::string& ssid, std::uint32_t rsn_flags, std::uint8_t strength);
+	StubConnection& AddConnection(const std::string& ssid, const std::string& key_mgmt, const std::string& psk);
+	StubActiveConnection& StartActivation(const StubConnection& connection, bool succeeds);
+
+	// Finishes the activations whose time has come, returns the time until
+	// the next one in microseconds
+	std::uint64_t FinishActivations();
+	void SetActiveAccessPoint(const std::string& path);
+
+	StubAccessPoint* FindAccessPoint(const std::string& path);
+	StubAccessPoint* FindAccessPointBySsid(const std::string& ssid);
+	StubConnection* FindConnection(const std::string& path);
+	StubActiveConnection* FindActiveConnection(const std::string& path);
+
+private:
+	sd_bus*								m_bus					= nullptr;
+	sd_bus_slot*						m_slot					= nullptr;
+
+	bool								m_wireless_enabled		= true;
+	std::uint32_t						m_device_state			= s_device_state_disconnected;
+	std::string							m_active_access_point	= "/";
+
+	std::vector<StubAccessPoint>		m_access_points;
+	std::vector<StubConnection>			m_connections;
+	std::vector<StubActiveConnection>	m_active_connections;
+
+	// Object paths are numbered like NetworkManager's and never reused
+	unsigned							m_next_id				= 1;
+
+	std::int32_t						m_last_seen				= 1;
+	std::uint32_t						m_access_point_loads	= 0;
+};
+
+static bool path_has_prefix(const std::string& path, const char* prefix)
+{
+	return path.compare(0, strlen(prefix), prefix) == 0 && path.size() > strlen(prefix);
+}
+
+static int reply_result(int r)
+{
+	return r < 0 ? r : 1;
+}
+
+static std::uint32_t rsn_flags_from_security(const char* security)
+{
+	if (strcmp(security, "psk") == 0)
+		return s_ap_key_mgmt_psk;
+	if (strcmp(security, "8021x") == 0)
+		return s_ap_key_mgmt_8021x;
+	return 0;
+}
+
+// Reads the ssid and key management out of the settings of
+// AddAndActivateConnection, leaves everything else alone
+static bool read_settings(sd_bus_message* m, std::string& ssid, std::string& key_mgmt, std::string& psk)
+{
+	if (sd_bus_message_enter_container(m, 'a', "{sa{sv}}") < 0)
+		return false;
+
+	int r;
+	while ((r = sd_bus_message_enter_container(m, 'e', "sa{sv}")) > 0)
+	{
+		const char* section;
+		if (sd_bus_message_read(m, "s", &section) < 0 || sd_bus_message_enter_container(m, 'a', "{sv}") < 0)
+			return false;
+
+		while ((r = sd_bus_message_enter_container(m, 'e', "sv")) > 0)
+		{
+			const char* key;
+			if (sd_bus_message_read(m, "s", &key) < 0)
+				return false;
+
+			bool read = false;
+			if (strcmp(section, "802-11-wireless") == 0 && strcmp(key, "ssid") == 0)
+			{
+				const void* data;
+				std::size_t size;
+				if (sd_bus_message_enter_container(m, 'v', "ay") < 0 || sd_bus_message_read_array(m, 'y', &data, &size) < 0 || sd_bus_message_exit_container(m) < 0)
+					return false;
+				ssid.assign(static_cast<const char*>(data), size);
+				read = true;
+			}
+			else if (strcmp(section, "802-11-wireless-security") == 0 && (strcmp(key, "key-mgmt") == 0 || strcmp(key, "psk") == 0))
+			{
+				const char* value;
+				if (sd_bus_message_read(m, "v", "s", &value) < 0)
+					return false;
+				(strcmp(key, "psk") == 0 ? psk : key_mgmt) = value;
+				read = true;
+			}
+
+			if (!read && sd_bus_message_skip(m, "v") < 0)
+				return false;
+			if (sd_bus_message_exit_container(m) < 0)
+				return false;
+		}
+		if (r < 0 || sd_bus_message_exit_container(m) < 0 || sd_bus_message_exit_container(m) < 0)
+			return false;
+	}
+
+	return r == 0 && sd_bus_message_exit_container(m) >= 0;
+}
+
+StubNetworkManager::~StubNetworkManager()
+{
+	sd_bus_slot_unref(m_slot);
+	sd_bus_flush_close_unref(m_bus);
+}
+
+bool StubNetworkManager::Init()
+{
+	int r = sd_bus_open_system(&m_bus);
+	if (r < 0)
+	{
+		fprintf(stderr, "nm-stub: could not connect to the bus: %s\n", strerror(-r));
+		return false;
+	}
+
+	r = sd_bus_add_fallback(m_bus, &m_slot, s_manager_path, OnMessage, this);
+	if (r < 0)
+	{
+		fprintf(stderr, "nm-stub: could not add objects: %s\n", strerror(-r));
+		return false;
+	}
+
+	// Two access points of home, the stronger one first in the list
+	AddAccessPoint("home", s_ap_key_mgmt_psk, 70);
+	AddAccessPoint("home", s_ap_key_mgmt_psk, 40);
+	AddAccessPoint("cafe", 0, 55);
+	AddAccessPoint("office", s_ap_key_mgmt_psk, 30);
+	AddAccessPoint("attic", s_ap_key_mgmt_psk, 25);
+	AddAccessPoint("campus", s_ap_key_mgmt_8021x, 20);
+	AddConnection("home", "wpa-psk", s_password);
+	AddConnection("attic", "wpa-psk", "stale");
+
+	// Objects are in place before anyone can call them
+	r = sd_bus_request_name(m_bus, s_service, 0);
+	if (r < 0)
+	{
+		fprintf(stderr, "nm-stub: could not own %s: %s\n", s_service, strerror(-r));
+		return false;
+	}
+
+	return true;
+}
+
+int StubNetworkManager::Run()
+{
+	for (;;)
+	{
+		int r = sd_bus_process(m_bus, NULL);
+		if (r < 0)
+		{
+			// The bus going away ends the check
+			fprintf(stderr, "nm-stub: %s\n", strerror(-r));
+			return EXIT_FAILURE;
+		}
+		if (r > 0)
+			continue;
+
+		r = sd_bus_wait(m_bus, FinishActivations());
+		if (r < 0 && r != -EINTR)
+		{
+			fprintf(stderr, "nm-stub: %s\n", strerror(-r));
+			return EXIT_FAILURE;
+		}
+	}
+}
+
+int StubNetworkManager::OnMessage(sd_bus_message* message, void* userdata, sd_bus_error*)
+{
+	return static_cast<StubNetworkManager*>(userdata)->HandleMessage(message);
+}
+
+int StubNetworkManager::HandleMessage(sd_bus_message* message)
+{
+	const char* interface = sd_bus_message_get_interface(message);
+	const char* member = sd_bus_message_get_member(message);
+	if (interface == NULL || member == NULL || !sd_bus_message_is_method_call(message, NULL, NULL))
+		return 0;
+
+	std::string path = sd_bus_message_get_path(message);
+
+	if (strcmp(interface, s_properties_interface) == 0)
+		return HandleProperties(message, path, member);
+	if (path == s_manager_path && strcmp(interface, s_manager_interface) == 0)
+		return HandleManager(message, member);
+	if (path == s_manager_path && strcmp(interface, s_control_interface) == 0)
+		return HandleControl(message, member);
+	if (path == s_device_path)
+		return HandleDevice(message);
+	if (path == s_settings_path && strcmp(interface, s_settings_interface) == 0)
+		return HandleSettings(message, member);
+	if (path_has_prefix(path, s_connection_prefix) && strcmp(interface, s_connection_interface) == 0)
+		return HandleConnection(message, path, member);
+
+	// Unknown methods and objects are answered by sd-bus
+	return 0;
+}
+
+int StubNetworkManager::HandleProperties(sd_bus_message* message, const std::string& path, const char* member)
+{
+	sd_bus_message* reply = nullptr;
+	int r;
+
+	if (strcmp(member, "Get") == 0)
+	{
+		const char* interface;
+		const char* name;
+		if ((r = sd_bus_message_read(message, "ss", &interface, &name)) < 0)
+			return r;
+
+		if ((r = sd_bus_message_new_method_return(message, &reply)) < 0)
+			return r;
+		if (!AppendProperty(reply, path, interface, name))
+		{
+			sd_bus_message_unref(reply);
+			return reply_result(sd_bus_reply_method_errorf(message, s_error_invalid, "No property %s.%s on %s", interface, name, path.c_str()));
+		}
+	}
+	else if (strcmp(member, "GetAll") == 0)
+	{
+		const char* interface;
+		if ((r = sd_bus_message_read(message, "s", &interface)) < 0)
+			return r;
+		if (FindAccessPoint(path))
+			m_access_point_loads++;
+
+		if ((r = sd_bus_message_new_method_return(message, &reply)) < 0)
+			return r;
+		if (!AppendProperties(reply, path, interface))
+		{
+			sd_bus_message_unref(reply);
+			return reply_result(sd_bus_reply_method_errorf(message, s_error_invalid, "No interface %s on %s", interface, path.c_str()));
+		}
+	}
+	else if (strcmp(member, "Set") == 0)
+	{
+		const char* interface;
+		const char* name;
+		int value;
+		if ((r = sd_bus_message_read(message, "ss", &interface, &name)) < 0)
+			return r;
+
+		// Both writable properties bwm uses are booleans
+		if (sd_bus_message_read(message, "v", "b", &value) < 0)
+			return reply_result(sd_bus_reply_method_errorf(message, s_error_invalid, "Unexpected value for %s", name));
+
+		if (path == s_manager_path && strcmp(interface, s_manager_interface) == 0 && strcmp(name, "WirelessEnabled") == 0)
+		{
+			m_wireless_enabled = value;
+			EmitPropertyChanged(path, interface, name);
+		}
+		else if (!(path == s_device_path && strcmp(interface, s_device_interface) == 0 && strcmp(name, "Managed") == 0))
+			return reply_result(sd_bus_reply_method_errorf(message, s_error_invalid, "No writable property %s.%s on %s", interface, name, path.c_str()));
+
+		return reply_result(sd_bus_reply_method_return(message, ""));
+	}
+	else
+		return 0;
+
+	r = sd_bus_send(m_bus, reply, NULL);
+	sd_bus_message_unref(reply);
+	return reply_result(r);
+}
+
+int StubNetworkManager::HandleManager(sd_bus_message* message, const char* member)
+{
+	if (strcmp(member, "GetDevices") == 0)
+		return reply_result(sd_bus_reply_method_return(message, "ao", 1, s_device_path));
+	if (strcmp(member, "AddAndActivateConnection") == 0)
+		return AddAndActivate(message);
+	if (strcmp(member, "ActivateConnection") == 0)
+		return Activate(message);
+	return 0;
+}
+
+int StubNetworkManager::HandleDevice(sd_bus_message* message)
+{
+	if (sd_bus_message_is_method_call(message, s_wireless_interface, "RequestScan"))
+	{
+		// Access points only change through the control interface, apart
+		// from when they were last seen
+		int r = sd_bus_message_skip(message, "a{sv}");
+		if (r < 0)
+			return r;
+
+		m_last_seen++;
+		for (const StubAccessPoint& ap : m_access_points)
+			EmitPropertyChanged(ap.path, s_ap_interface, "LastSeen");
+		return reply_result(sd_bus_reply_method_return(message, ""));
+	}
+
+	if (sd_bus_message_is_method_call(message, s_device_interface, "Disconnect"))
+	{
+		if (m_active_access_point == "/")
+			return reply_result(sd_bus_reply_method_errorf(message, "org.freedesktop.NetworkManager.Device.NotActive", "This device is not active"));
+
+		for (StubActiveConnection& active : m_active_connections)
+			active.state = s_active_state_deactivated;
+		SetActiveAccessPoint("/");
+		return reply_result(sd_bus_reply_method_return(message, ""));
+	}
+
+	return 0;
+}
+
+int StubNetworkManager::HandleSettings(sd_bus_message* message, const char* member)
+{
+	if (strcmp(member, "ListConnections") != 0)
+		return 0;
+
+	sd_bus_message* reply = nullptr;
+	int r = sd_bus_message_new_method_return(message, &reply);
+	if (r >= 0)
+		r = sd_bus_message_open_container(reply, 'a', "o");
+	for (const StubConnection& connection : m_connections)
+		if (r >= 0)
+			r = sd_bus_message_append(reply, "o", connection.path.c_str());
+	if (r >= 0)
+		r = sd_bus_message_close_container(reply);
+	if (r >= 0)
+		r = sd_bus_send(m_bus, reply, NULL);
+	sd_bus_message_unref(reply);
+	return reply_result(r);
+}
+
+int StubNetworkManager::HandleConnection(sd_bus_message* message, const std::string& path, const char* member)
+{
+	StubConnection* connection = FindConnection(path);
+	if (connection == nullptr)
+		return 0;
+
+	if (strcmp(member, "Delete") == 0)
+	{
+		std::string removed = connection->path;
+		m_connections.erase(m_connections.begin() + (connection - m_connections.data()));
+
+		// Signalled before the reply, like NetworkManager does
+		sd_bus_emit_signal(m_bus, s_settings_path, s_settings_interface, "ConnectionRemoved", "o", removed.c_str());
+		return reply_result(sd_bus_reply_method_return(message, ""));
+	}
+
+	if (strcmp(member, "GetSettings") != 0)
+		return 0;
+
+	sd_bus_message* reply = nullptr;
+	sd_bus_message* m;
+	int r = sd_bus_message_new_method_return(message, &reply);
+	m = reply;
+
+	bool ok = r >= 0;
+	ok = ok && sd_bus_message_open_container(m, 'a', "{sa{sv}}") >= 0;
+	ok = ok && sd_bus_message_append(m, "{sa{sv}}", "connection", 1, "type", "s", "802-11-wireless") >= 0;
+
+	ok = ok && sd_bus_message_open_container(m, 'e', "sa{sv}") >= 0;
+	ok = ok && sd_bus_message_append(m, "s", "802-11-wireless") >= 0;
+	ok = ok && sd_bus_message_open_container(m, 'a', "{sv}") >= 0;
+	ok = ok && sd_bus_message_open_container(m, 'e', "sv") >= 0;
+	ok = ok && sd_bus_message_append(m, "s", "ssid") >= 0;
+	ok = ok && sd_bus_message_open_container(m, 'v', "ay") >= 0;
+	ok = ok && sd_bus_message_append_array(m, 'y', connection->ssid.data(), connection->ssid.size()) >= 0;
+	ok = ok && sd_bus_message_close_container(m) >= 0;
+	ok = ok && sd_bus_message_close_container(m) >= 0;
+	ok = ok && sd_bus_message_close_container(m) >= 0;
+	ok = ok && sd_bus_message_close_container(m) >= 0;
+
+	if (!connection->key_mgmt.empty())
+		ok = ok && sd_bus_message_append(m, "{sa{sv}}", "802-11-wireless-security", 1, "key-mgmt", "s", connection->key_mgmt.c_str()) >= 0;
+
+	ok = ok && sd_bus_message_close_container(m) >= 0;
+	ok = ok && sd_bus_send(m_bus, m, NULL) >= 0;
+	sd_bus_message_unref(reply);
+	return ok ? 1 : -EINVAL;
+}
+
+int StubNetworkManager::HandleControl(sd_bus_message* message, const char* member)
+{
+	int r;
+
+	if (strcmp(member, "AddAccessPoint") == 0)
+	{
+		const char* ssid;
+		const char* security;
+		std::uint8_t strength;
+		if ((r = sd_bus_message_read(message, "ssy", &ssid, &security, &strength)) < 0)
+			return r;
+
+		StubAccessPoint& ap = AddAccessPoint(ssid, rsn_flags_from_security(security), strength);
+		std::string path = ap.path;
+		sd_bus_emit_signal(m_bus, s_device_path, s_wireless_interface, "AccessPointAdded", "o", path.c_str());
+		EmitPropertyChanged(s_device_path, s_wireless_interface, "AccessPoints");
+		return reply_result(sd_bus_reply_method_return(message, "o", path.c_str()));
+	}
+
+	if (strcmp(member, "RemoveAccessPoint") == 0)
+	{
+		const char* path;
+		if ((r = sd_bus_message_read(message, "o", &path)) < 0)
+			return r;
+
+		StubAccessPoint* ap = FindAccessPoint(path);
+		if (ap == nullptr)
+			return reply_result(sd_bus_reply_method_errorf(message, s_error_invalid, "No access point %s", path));
+
+		std::string removed = ap->path;
+		m_access_points.erase(m_access_points.begin() + (ap - m_access_points.data()));
+		if (m_active_access_point == removed)
+			SetActiveAccessPoint("/");
+
+		sd_bus_emit_signal(m_bus, s_device_path, s_wireless_interface, "AccessPointRemoved", "o", removed.c_str());
+		EmitPropertyChanged(s_device_path, s_wireless_interface, "AccessPoints");
+		return reply_result(sd_bus_reply_method_return(message, ""));
+	}
+
+	if (strcmp(member, "AccessPointLoads") == 0)
+		return reply_result(sd_bus_reply_method_return(message, "u", m_access_point_loads));
+
+	if (strcmp(member, "SetStrength") == 0)
+	{
+		const char* path;
+		std::uint8_t strength;
+		if ((r = sd_bus_message_read(message, "oy", &path, &strength)) < 0)
+			return r;
+
+		StubAccessPoint* ap = FindAccessPoint(path);
+		if (ap == nullptr)
+			return reply_result(sd_bus_reply_method_errorf(message, s_error_invalid, "No access point %s", path));
+
+		ap->strength = strength;
+		EmitPropertyChanged(ap->path, s_ap_interface, "Strength");
+		return reply_result(sd_bus_reply_method_return(message, ""));
+	}
+
+	return 0;
+}
+
+int StubNetworkManager::AddAndActivate(sd_bus_message* message)
+{
+	std::string ssid;
+	std::string key_mgmt;
+	std::string psk;
+	if (!read_settings(message, ssid, key_mgmt, psk))
+		return reply_result(sd_bus_reply_method_errorf(message, s_error_invalid, "Could not read the connection settings"));
+
+	const char* device;
+	const char* specific;
+	int r = sd_bus_message_read(message, "oo", &device, &specific);
+	if (r < 0)
+		return r;
+	if (strcmp(device, s_device_path) != 0)
+		return reply_result(sd_bus_reply_method_errorf(message, s_error_invalid, "No device %s", device));
+
+	StubAccessPoint* ap = FindAccessPointBySsid(ssid);
+	if (ap == nullptr)
+		return reply_result(sd_bus_reply_method_errorf(message, s_error_invalid, "No access point for '%s'", ssid.c_str()));
+
+	// NetworkManager fills in what the access point needs, bwm only passes
+	// the ssid for open networks
+	bool needs_psk = ap->rsn_flags & s_ap_key_mgmt_psk;
+	if (needs_psk && key_mgmt.empty())
+		return reply_result(sd_bus_reply_method_errorf(message, "org.freedesktop.NetworkManager.Settings.Connection.MissingSecrets", "Secrets were required, but not provided"));
+	if (ap->rsn_flags & s_ap_key_mgmt_8021x)
+		return reply_result(sd_bus_reply_method_errorf(message, s_error_invalid, "802.1X settings are missing"));
+
+	// The connection is saved right away, failed activations leave it to
+	// the caller to delete
+	StubConnection& connection = AddConnection(ssid, key_mgmt, psk);
+	std::string connection_path = connection.path;
+	sd_bus_emit_signal(m_bus, s_settings_path, s_settings_interface, "NewConnection", "o", connection_path.c_str());
+
+	StubActiveConnection& active = StartActivation(connection, !needs_psk || psk == s_password);
+	return reply_result(sd_bus_reply_method_return(message, "oo", connection_path.c_str(), active.path.c_str()));
+}
+
+int StubNetworkManager::Activate(sd_bus_message* message)
+{
+	const char* connection_path;
+	const char* device;
+	const char* specific;
+	int r = sd_bus_message_read(message, "ooo", &connection_path, &device, &specific);
+	if (r < 0)
+		return r;
+
+	StubConnection* connection = FindConnection(connection_path);
+	if (connection == nullptr)
+		return reply_result(sd_bus_reply_method_errorf(message, s_error_unknown, "Connection %s does not exist", connection_path));
+	if (strcmp(device, s_device_path) != 0)
+		return reply_result(sd_bus_reply_method_errorf(message, s_error_invalid, "No device %s", device));
+
+	bool in_range = FindAccessPointBySsid(connection->ssid) != nullptr;
+	bool secrets_valid = connection->key_mgmt.empty() || connection->psk == s_password;
+	StubActiveConnection& active = StartActivation(*connection, in_range && secrets_valid);
+	return reply_result(sd_bus_reply_method_return(message, "o", active.path.c_str()));
+}
+
+bool StubNetworkManager::AppendProperty(sd_bus_message* m, const std::string& path, const char* interface, const char* name)
+{
+	auto is = [&](const char* i, const char* n) { return strcmp(interface, i) == 0 && strcmp(name, n) == 0; };
+
+	if (path == s_manager_path)
+	{
+		if (is(s_manager_interface, "WirelessEnabled"))	return sd_bus_message_append(m, "v", "b", m_wireless_enabled) >= 0;
+		return false;
+	}
+
+	if (path == s_device_path)
+	{
+		if (is(s_device_interface, "DeviceType"))			return sd_bus_message_append(m, "v", "u", s_device_type_wifi) >= 0;
+		if (is(s_device_interface, "Interface"))			return sd_bus_message_append(m, "v", "s", "wlan0") >= 0;
+		if (is(s_device_interface, "State"))				return sd_bus_message_append(m, "v", "u", m_device_state) >= 0;
+		if (is(s_device_interface, "Managed"))				return sd_bus_message_append(m, "v", "b", 1) >= 0;
+		if (is(s_wireless_interface, "HwAddress"))			return sd_bus_message_append(m, "v", "s", "02:00:00:00:00:01") >= 0;
+		if (is(s_wireless_interface, "Mode"))				return sd_bus_message_append(m, "v", "u", s_mode_infra) >= 0;
+		if (is(s_wireless_interface, "Bitrate"))			return sd_bus_message_append(m, "v", "u", m_active_access_point == "/" ? 0u : 144400u) >= 0;
+		if (is(s_wireless_interface, "ActiveAccessPoint"))	return sd_bus_message_append(m, "v", "o", m_active_access_point.c_str()) >= 0;
+		if (is(s_wireless_interface, "AccessPoints"))
+		{
+			bool ok = sd_bus_message_open_container(m, 'v', "ao") >= 0;
+			ok = ok && sd_bus_message_open_container(m, 'a', "o") >= 0;
+			for (const StubAccessPoint& ap : m_access_points)
+				ok = ok && sd_bus_message_append(m, "o", ap.path.c_str()) >= 0;
+			ok = ok && sd_bus_message_close_container(m) >= 0;
+			return ok && sd_bus_message_close_container(m) >= 0;
+		}
+		return false;
+	}
+
+	if (StubAccessPoint* ap = FindAccessPoint(path))
+	{
+		std::uint32_t flags = ap->rsn_flags ? s_ap_flag_privacy : 0;
+		if (is(s_ap_interface, "Strength"))		return sd_bus_message_append(m, "v", "y", ap->strength) >= 0;
+		if (is(s_ap_interface, "Frequency"))	return sd_bus_message_append(m, "v", "u", ap->frequency) >= 0;
+		if (is(s_ap_interface, "HwAddress"))	return sd_bus_message_append(m, "v", "s", ap->bssid.c_str()) >= 0;
+		if (is(s_ap_interface, "Flags"))		return sd_bus_message_append(m, "v", "u", flags) >= 0;
+		if (is(s_ap_interface, "WpaFlags"))		return sd_bus_message_append(m, "v", "u", 0u) >= 0;
+		if (is(s_ap_interface, "RsnFlags"))		return sd_bus_message_append(m, "v", "u", ap->rsn_flags) >= 0;
+		if (is(s_ap_interface, "LastSeen"))		return sd_bus_message_append(m, "v", "i", m_last_seen) >= 0;
+		if (is(s_ap_interface, "Ssid"))
+		{
+			bool ok = sd_bus_message_open_container(m, 'v', "ay") >= 0;
+			ok = ok && sd_bus_message_append_array(m, 'y', ap->ssid.data(), ap->ssid.size()) >= 0;
+			return ok && sd_bus_message_close_container(m) >= 0;
+		}
+		return false;
+	}
+
+	if (StubActiveConnection* active = FindActiveConnection(path))
+	{
+		if (is(s_active_interface, "State"))		return sd_bus_message_append(m, "v", "u", active->state) >= 0;
+		if (is(s_active_interface, "Connection"))	return sd_bus_message_append(m, "v", "o", active->connection_path.c_str()) >= 0;
+		return false;
+	}
+
+	return false;
+}
+
+bool StubNetworkManager::AppendProperties(sd_bus_message* m, const std::string& path, const char* interface)
+{
+	static constexpr const char* manager[]	= { "WirelessEnabled" };
+	static constexpr const char* device[]	= { "DeviceType", "Interface", "State", "Managed" };
+	static constexpr const char* wireless[]	= { "HwAddress", "Mode", "Bitrate", "ActiveAccessPoint", "AccessPoints" };
+	static constexpr const char* ap[]		= { "Ssid", "Strength", "Frequency", "HwAddress", "Flags", "WpaFlags", "RsnFlags", "LastSeen" };
+	static constexpr const char* active[]	= { "State", "Connection" };
+
+	auto append = [&](const auto& names) {
+		bool ok = sd_bus_message_open_container(m, 'a', "{sv}") >= 0;
+		for (const char* name : names)
+		{
+			ok = ok && sd_bus_message_open_container(m, 'e', "sv") >= 0;
+			ok = ok && sd_bus_message_append(m, "s", name) >= 0;
+			ok = ok && AppendProperty(m, path, interface, name);
+			ok = ok && sd_bus_message_close_container(m) >= 0;
+		}
+		return ok && sd_bus_message_close_container(m) >= 0;
+	};
+
+	if (path == s_manager_path && strcmp(interface, s_manager_interface) == 0)
+		return append(manager);
+	if (path == s_device_path && strcmp(interface, s_device_interface) == 0)
+		return append(device);
+	if (path == s_device_path && strcmp(interface, s_wireless_interface) == 0)
+		return append(wireless);
+	if (FindAccessPoint(path) && strcmp(interface, s_ap_interface) == 0)
+		return append(ap);
+	if (FindActiveConnection(path) && strcmp(interface, s_active_interface) == 0)
+		return append(active);
+	return false;
+}
+
+void StubNetworkManager::EmitPropertyChanged(const std::string& path, const char* interface, const char* name)
+{
+	sd_bus_message* m = nullptr;
+	if (sd_bus_message_new_signal(m_bus, &m, path.c_str(), s_properties_interface, "PropertiesChanged") < 0)
+		return;
+
+	bool ok = sd_bus_message_append(m, "s", interface) >= 0;
+	ok = ok && sd_bus_message_open_container(m, 'a', "{sv}") >= 0;
+	ok = ok && sd_bus_message_open_container(m, 'e', "sv") >= 0;
+	ok = ok && sd_bus_message_append(m, "s", name) >= 0;
+	ok = ok && AppendProperty(m, path, interface, name);
+	ok = ok && sd_bus_message_close_container(m) >= 0;
+	ok = ok && sd_bus_message_close_container(m) >= 0;
+	ok = ok && sd_bus_message_append(m, "as", 0) >= 0;
+	if (ok)
+		sd_bus_send(m_bus, m, NULL);
+	sd_bus_message_unref(m);
+}
+
+StubAccessPoint& StubNetworkManager::AddAccessPoint(const std::string& ssid, std::uint32_t rsn_flags, std::uint8_t strength)
+{
+	unsigned id = m_next_id++;
+
+	char bssid[18];
+	snprintf(bssid, sizeof(bssid), "02:00:00:00:%02x:%02x", (id >> 8) & 0xff, id & 0xff);
+
+	StubAccessPoint& ap = m_access_points.emplace_back();
+	ap.path			= s_ap_prefix + std::to_string(id);
+	ap.ssid			= ssid;
+	ap.bssid		= bssid;
+	ap.rsn_flags	= rsn_flags;
+	ap.frequency	= (id % 2) ? 2437 : 5180;
+	ap.strength		= strength;
+	return ap;
+}
+
+StubConnection& StubNetworkManager::AddConnection(const std::string& ssid, const std::string& key_mgmt, const std::string& psk)
+{
+	StubConnection& connection = m_connections.emplace_back();
+	connection.path		= s_connection_prefix + std::to_string(m_next_id++);
+	connection.ssid		= ssid;
+	connection.key_mgmt	= key_mgmt;
+	connection.psk		= psk;
+	return connection;
+}
+
+StubActiveConnection& StubNetworkManager::StartActivation(const StubConnection& connection, bool succeeds)
+{
+	// One connection is active at a time
+	for (StubActiveConnection& active : m_active_connections)
+		active.state = s_active_state_deactivated;
+
+	StubAccessPoint* ap = FindAccessPointBySsid(connection.ssid);
+
+	StubActiveConnection& active = m_active_connections.emplace_back();
+	active.path				= s_active_prefix + std::to_string(m_next_id++);
+	active.connection_path	= connection.path;
+	active.ap_path			= ap ? ap->path : "/";
+	active.state			= s_active_state_activating;
+	active.succeeds			= succeeds;
+	active.done				= std::chrono::steady_clock::now() + s_activation_time;
+	return active;
+}
+
+std::uint64_t StubNetworkManager::FinishActivations()
+{
+	auto now = std::chrono::steady_clock::now();
+	std::uint64_t timeout = UINT64_MAX;
+
+	for (StubActiveConnection& active : m_active_connections)
+	{
+		if (active.state != s_active_state_activating)
+			continue;
+
+		if (active.done > now)
+		{
+			auto remaining = std::chrono::duration_cast<std::chrono::microseconds>(active.done - now).count();
+			timeout = std::min<std::uint64_t>(timeout, remaining);
+			continue;
+		}
+
+		active.state = active.succeeds ? s_active_state_activated : s_active_state_deactivated;
+		EmitPropertyChanged(active.path, s_active_interface, "State");
+		if (active.succeeds)
+			SetActiveAccessPoint(active.ap_path);
+	}
+
+	return timeout;
+}
+
+void StubNetworkManager::SetActiveAccessPoint(const std::string& path)
+{
+	m_active_access_point = path;
+	m_device_state = (path == "/") ? s_device_state_disconnected : s_device_state_activated;
+	EmitPropertyChanged(s_device_path, s_wireless_interface, "ActiveAccessPoint");
+	EmitPropertyChanged(s_device_path, s_device_interface, "State");
+}
+
+StubAccessPoint* StubNetworkManager::FindAccessPoint(const std::string& path)
+{
+	auto it = std::find_if(m_access_points.begin(), m_access_points.end(), [&](const StubAccessPoint& ap) { return ap.path == path; });
+	return it != m_access_points.end() ? &*it : nullptr;
+}
+
+StubAccessPoint* StubNetworkManager::FindAccessPointBySsid(const std::string& ssid)
+{
+	StubAccessPoint* result = nullptr;
+	for (StubAccessPoint& ap : m_access_points)
+		if (ap.ssid == ssid && (result == nullptr || ap.strength > result->strength))
+			result = &ap;
+	return result;
+}
+
+StubConnection* StubNetworkManager::FindConnection(const std::string& path)
+{
+	auto it = std::find_if(m_connections.begin(), m_connections.end(), [&](const StubConnection& c) { return c.path == path; });
+	return it != m_connections.end() ? &*it : nullptr;
+}
+
+StubActiveConnection* StubNetworkManager::FindActiveConnection(const std::string& path)
+{
+	auto it = std::find_if(m_active_connections.begin(), m_active_connections.end(), [&](const StubActiveConnection& a) { return a.path == path; });
+	return it != m_active_connections.end() ? &*it : nullptr;
+}
+
+int main()
+{
+	StubNetworkManager stub;
+	if (!stub.Init())
+		return EXIT_FAILURE;
+	return stub.Run();
+}
@@ -0,0 +1,118 @@
+#!/bin/sh
+# Builds the Optimized configuration (link time and profile guided
+# optimization) and reports its startup and frame times against Release.
+#
+#   bench/pgo_train.sh [--networks <n>] [--runs <n>]
+#
+# The training run covers what bwm spends its time on:
+#   - startup and the iwctl parser, by replaying sessions recorded with the
+#     fake iwctl in bench/fake through the headless commands
+#   - UI frames, by bwm-bench with a large synthetic network list
+#
+# Needs premake5, make, xvfb-run and gcov-tool. Profiles and results are
+# left in bin/pgo.
+
+set -e
+
+cd "$(dirname "$0")/.."
+
+networks=300
+runs=50
+while [ $# -gt 0 ]; do
+	case "$1" in
+	--networks) networks=$2; shift 2 ;;
+	--runs) runs=$2; shift 2 ;;
+	*) echo "usage: bench/pgo_train.sh [--networks <n>] [--runs <n>]" >&2; exit 1 ;;
+	esac
+done
+
+pgo=$PWD/bin/pgo
+results=$pgo/results
+
+# build <config> [premake options]
+build() {
+	config=$1
+	shift
+	premake5 gmake2 "$@" >/dev/null
+	make config="$config" clean >/dev/null
+	make -j"$(nproc)" config="$config" bwm bwm-bench >/dev/null
+}
+
+# One headless session per recorded command, spawning nothing
+headless() {
+	for command in devices networks known; do
+		"$1" --replay "$results/$command.rec" --replay-speed 0 "$command" >/dev/null
+	done
+}
+
+# startup <bwm> <runs>, prints the mean time of a headless session in
+# microseconds
+startup() {
+	start=$(date +%s%N)
+	i=0
+	while [ "$i" -lt "$2" ]; do
+		headless "$1"
+		i=$((i + 1))
+	done
+	end=$(date +%s%N)
+	echo $(((end - start) / $2 / 1000))
+}
+
+# ui <bwm-bench> [bwm-bench options]
+ui() {
+	bench=$1
+	shift
+	BWM_BENCH=$bench bench/run_ui_bench.sh --networks "$networks" "$@"
+}
+
+rm -rf "$pgo"
+mkdir -p "$results"
+
+echo "Building Release" >&2
+build release
+
+# The fixtures are recorded once and replayed by both builds
+for command in devices networks known; do
+	PATH="$PWD/bench/fake:$PATH" BWM_FAKE_NETWORKS=$networks BWM_FAKE_KNOWN=$((networks / 4)) BWM_NL80211=0 \
+		bin/Release/bwm --record "$results/$command.rec" "$command" >/dev/null
+done
+
+release_startup=$(startup bin/Release/bwm "$runs")
+ui bin/Release/bwm-bench --output "$results/release-ui.txt"
+
+echo "Building Optimized for training" >&2
+build optimized --pgo=generate
+
+startup bin/Optimized/bwm $((runs * 4)) >/dev/null
+ui bin/Optimized/bwm-bench --frames 4000 --output /dev/null
+
+# bwm-bench compiles its own copies of the shared sources, their profiles
+# are merged into the ones of bwm's objects
+mkdir -p "$pgo/bwm" "$pgo/bench"
+for profile in "$pgo"/*"#bwm-bench#"*.gcda; do
+	[ -f "$profile" ] || continue
+	name=$(basename "$profile" | sed 's/#bwm-bench#\([^#]*\)$/#bwm#\1/')
+	object=$(echo "$name" | tr '#' '/' | sed 's/\.gcda$/.o/')
+	[ -f "$object" ] || continue
+	cp "$profile" "$pgo/bench/$name"
+	if [ -f "$pgo/$name" ]; then
+		mv "$pgo/$name" "$pgo/bwm/$name"
+	fi
+done
+if [ -n "$(ls "$pgo/bench")" ]; then
+	gcov-tool merge -o "$pgo/merged" "$pgo/bwm" "$pgo/bench"
+	mv "$pgo"/merged/*.gcda "$pgo"
+fi
+rm -rf "$pgo/bwm" "$pgo/bench" "$pgo/merged"
+
+echo "Building Optimized with the profile" >&2
+build optimized --pgo=use
+
+optimized_startup=$(startup bin/Optimized/bwm "$runs")
+
+echo "Frame times against Release:" >&2
+ui bin/Optimized/bwm-bench --output "$results/optimized-ui.txt" --baseline "$results/release-ui.txt" || true
+
+awk -v base="$release_startup" -v value="$optimized_startup" 'BEGIN {
+	printf "Startup (headless session): %d us, Release %d us, %+.1f%%\n", value, base, (value - base) * 100.0 / base
+}' >&2
@@ -0,0 +1,37 @@
+#!/bin/sh
+# Runs bwm-nm-check against the stub NetworkManager (bench/nm_stub.cpp) on
+# a private bus started with dbus-daemon, so the NetworkManager backend is
+# tested without root and without touching the system bus.
+#
+#   bench/run_nm_check.sh
+#
+# Both need a build configured with --networkmanager. BWM_NM_STUB and
+# BWM_NM_CHECK select the binaries (default bin/Release/bwm-nm-stub and
+# bin/Release/bwm-nm-check).
+
+set -e
+
+cd "$(dirname "$0")/.."
+
+stub=${BWM_NM_STUB:-bin/Release/bwm-nm-stub}
+check=${BWM_NM_CHECK:-bin/Release/bwm-nm-check}
+
+bus=$(dbus-daemon --session --fork --print-address=1 --print-pid=1)
+address=$(echo "$bus" | sed -n 1p)
+bus_pid=$(echo "$bus" | sed -n 2p)
+stub_pid=
+
+cleanup() {
+	[ -n "$stub_pid" ] && kill "$stub_pid" 2>/dev/null
+	kill "$bus_pid" 2>/dev/null
+}
+trap cleanup EXIT
+
+# sd-bus takes the system bus from here, for the stub and for bwm alike
+export DBUS_SYSTEM_BUS_ADDRESS="$address"
+
+"$stub" &
+stub_pid=$!
+
+# The check waits until the stub owns its name
+"$check"
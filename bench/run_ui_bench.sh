@@ -0,0 +1,17 @@
+#!/bin/sh
+# Runs bwm-bench on a virtual X server with Mesa's software renderer, so
+# results do not depend on the GPU or display of the machine running it.
+#
+#   bench/run_ui_bench.sh [bwm-bench options]
+#
+# BWM_BENCH selects the binary (default bin/Release/bwm-bench).
+
+set -e
+
+cd "$(dirname "$0")/.."
+
+bench=${BWM_BENCH:-bin/Release/bwm-bench}
+
+export LIBGL_ALWAYS_SOFTWARE=1
+
+exec xvfb-run -a -s "-screen 0 1024x768x24" "$bench" --script bench/ui_bench.script "$@"
@@ -0,0 +1,188 @@
+#include "synthetic_wireless_manager.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <functional>
+
+static constexpr NetworkSecurity s_securities[] = {
+	NetworkSecurity::psk,
+	NetworkSecurity::open,
+	NetworkSecurity::psk,
+	NetworkSecurity::ieee8021x,
+	NetworkSecurity::psk,
+	NetworkSecurity::wep,
+};
+
+SyntheticWirelessManager::SyntheticWirelessManager(std::size_t network_count)
+	: m_network_count(network_count)
+{
+}
+
+Network SyntheticWirelessManager::MakeNetwork(std::size_t index) const
+{
+	char ssid[33];
+	snprintf(ssid, sizeof(ssid), "network-%03zu", index);
+
+	Network network {};
+	network.ssid		= ssid;
+	network.security	= s_securities[index % std::size(s_securities)];
+	network.connected	= false;
+	network.signal		= std::int8_t(90 - index * 60 / m_network_count);
+	return network;
+}
+
+bool SyntheticWirelessManager::Init()
+{
+	std::lock_guard lock(m_state_mutex);
+
+	const char* names[] = { "wlan0", "wlan1" };
+	for (std::size_t i = 0; i < std::size(names); i++)
+	{
+		Device device {};
+		device.name		= names[i];
+		device.address	= i == 0 ? "02:00:00:00:00:00" : "02:00:00:00:00:01";
+		device.adapter	= i == 0 ? "phy0" : "phy1";
+		device.power	= i == 0 ? PowerState::on : PowerState::off;
+		device.mode		= DeviceMode::station;
+		m_state.devices.push_back(device);
+	}
+	m_state.current_device = 0;
+
+	for (std::size_t i = 0; i < m_network_count; i++)
+		m_state.networks.push_back(MakeNetwork(i));
+	if (!m_state.networks.empty())
+		m_state.networks[0].connected = true;
+
+	for (std::size_t i = 0; i < m_network_count; i += 3)
+		m_state.known_networks.push_back(MakeNetwork(i));
+
+	PublishState();
+
+	return true;
+}
+
+bool SyntheticWirelessManager::SetCurrentDevice(const Device& device)
+{
+	std::lock_guard lock(m_state_mutex);
+
+	for (std::size_t i = 0; i < m_state.devices.size(); i++)
+	{
+		if (m_state.devices[i].name == device.name)
+		{
+			m_state.current_device = i;
+			PublishState();
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool SyntheticWirelessManager::ActivateDevice()
+{
+	std::lock_guard lock(m_state_mutex);
+
+	CurrentDevice().power	= PowerState::on;
+	CurrentDevice().mode	= DeviceMode::station;
+	PublishState();
+
+	return true;
+}
+
+bool SyntheticWirelessManager::Scan()
+{
+	return true;
+}
+
+bool SyntheticWirelessManager::UpdateNetworks()
+{
+	std::lock_guard lock(m_state_mutex);
+
+	if (m_state.networks.size() < 2)
+		return true;
+
+	// Networks near the end of the list move around, like weak networks
+	// do in a real scan
+	std::size_t count	= m_state.networks.size();
+	std::size_t half	= count / 2;
+	std::size_t a		= count - 1 - (m_refresh_count % half);
+	std::size_t b		= count - 1 - ((m_refresh_count + 1) % half);
+	std::swap(m_state.networks[a], m_state.networks[b]);
+	m_refresh_count++;
+
+	PublishState();
+
+	return true;
+}
+
+bool SyntheticWirelessManager::Connect(const Network& network, const std::string& password)
+{
+	if (network.security != NetworkSecurity::open && password != s_password)
+		return false;
+
+	std::lock_guard lock(m_state_mutex);
+	for (Network& n : m_state.networks)
+		n.connected = (n.ssid == network.ssid);
+	PublishState();
+
+	return true;
+}
+
+bool SyntheticWirelessManager::Disconnect()
+{
+	std::lock_guard lock(m_state_mutex);
+	for (Network& network : m_state.networks)
+		network.connected = false;
+	PublishState();
+
+	return true;
+}
+
+bool SyntheticWirelessManager::UpdateKnownNetworks()
+{
+	return true;
+}
+
+bool SyntheticWirelessManager::ForgetKnownNetwork(const Network& network)
+{
+	std::lock_guard lock(m_state_mutex);
+
+	auto it = std::remove_if(m_state.known_networks.begin(), m_state.known_networks.end(),
+		[&](const Network& n) { return n.ssid == network.ssid; }
+	);
+	m_state.known_networks.erase(it, m_state.known_networks.end());
+	PublishState();
+
+	return true;
+}
+
+bool SyntheticWirelessManager::GetNetworkDetails(const Network& network, NetworkDetails& out)
+{
+	out.bsses.clear();
+	out.station.clear();
+
+	// One to three access points derived from the ssid, on 2.4 and 5 GHz
+	std::size_t hash = std::hash<std::string_view>()(network.ssid.view());
+	std::size_t count = 1 + hash % 3;
+	for (std::size_t i = 0; i < count; i++)
+	{
+		char bssid[18];
+		snprintf(bssid, sizeof(bssid), "02:00:00:%02zx:%02zx:%02zx", (hash >> 8) & 0xff, hash & 0xff, i);
+
+		Bss& bss = out.bsses.emplace_back();
+		bss.bssid		= bssid;
+		bss.frequency	= (i % 2) ? 5180 + 20 * (hash % 4) : 2412 + 25 * (hash % 3);
+		bss.signal		= std::int8_t(std::max(0, network.signal - 10 * int(i)));
+		bss.signal_dbm	= std::int16_t(bss.signal / 2 - 100);
+		bss.connected	= network.connected && i == 0;
+	}
+
+	if (network.connected)
+	{
+		out.station.push_back({ "State", "connected" });
+		out.station.push_back({ "Connected network", network.ssid.c_str() });
+		out.station.push_back({ "ConnectedBss", out.bsses[0].bssid.c_str() });
+	}
+
+	return true;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "wireless_manager.h"
+
+#include <cstdint>
+
+// In-memory backend for benchmarks. Generates network_count networks and
+// changes a few of them on every refresh, so the UI sees the same kind of
+// churn as with a real environment without spawning any processes.
+class SyntheticWirelessManager : public WirelessManager
+{
+public:
+	SyntheticWirelessManager(std::size_t network_count);
+
+	virtual bool Init() override;
+
+	virtual WirelessBackend GetBackend() const override { return WirelessBackend::iwd; }
+
+	virtual bool SetCurrentDevice(const Device& device) override;
+	virtual bool ActivateDevice() override;
+
+	virtual bool Scan() override;
+	virtual bool UpdateNetworks() override;
+
+	virtual bool Connect(const Network& network, const std::string& password) override;
+	virtual bool Disconnect() override;
+
+	virtual bool UpdateKnownNetworks() override;
+	virtual bool ForgetKnownNetwork(const Network& network) override;
+
+	virtual bool GetNetworkDetails(const Network& network, NetworkDetails& out) override;
+
+	// Password accepted by Connect() for secured networks
+	static constexpr const char* s_password = "password";
+
+private:
+	Network MakeNetwork(std::size_t index) const;
+
+private:
+	std::size_t		m_network_count;
+	std::uint64_t	m_refresh_count	= 0;
+};
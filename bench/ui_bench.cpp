@@ -0,0 +1,388 @@
+// Offscreen benchmark of the bwm UI loop.
+//
+// Drives the same window, frame and screen code as bwm against a synthetic
+// backend, feeds it scripted input and reports the frame time distribution,
+// allocations per frame and draw list sizes. Results can be saved and
+// compared against a baseline, see README.md.
+
+#include "bench_results.h"
+#include "synthetic_wireless_manager.h"
+#include "ui.h"
+#include "wireless_request_queue.h"
+
+#include <imgui.h>
+
+#include <GLFW/glfw3.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+static std::atomic<std::uint64_t> s_allocations { 0 };
+
+void* operator new(std::size_t size)
+{
+	s_allocations.fetch_add(1, std::memory_order_relaxed);
+	if (void* ptr = std::malloc(size ? size : 1))
+		return ptr;
+	throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept					{ std::free(ptr); }
+void operator delete(void* ptr, std::size_t) noexcept		{ std::free(ptr); }
+
+static void* imgui_alloc(std::size_t size, void*)
+{
+	s_allocations.fetch_add(1, std::memory_order_relaxed);
+	return std::malloc(size);
+}
+
+static void imgui_free(void* ptr, void*)
+{
+	std::free(ptr);
+}
+
+enum class InputType
+{
+	move,
+	down,
+	up,
+	wheel,
+	key,
+	text,
+	resize,
+};
+
+struct InputEvent
+{
+	std::uint64_t	frame;
+	InputType		type;
+	float			x;
+	float			y;
+	ImGuiKey		key;
+	std::string		text;
+};
+
+static bool parse_key(const std::string& name, ImGuiKey& out)
+{
+	static const std::pair<const char*, ImGuiKey> keys[] = {
+		{ "enter",		ImGuiKey_Enter },
+		{ "escape",		ImGuiKey_Escape },
+		{ "tab",		ImGuiKey_Tab },
+		{ "backspace",	ImGuiKey_Backspace },
+		{ "f3",			ImGuiKey_F3 },
+	};
+
+	for (const auto& [key_name, key] : keys)
+	{
+		if (name == key_name)
+		{
+			out = key;
+			return true;
+		}
+	}
+	return false;
+}
+
+// One event per line: <frame> <action> [arguments], # starts a comment
+//   move <x> <y>		click <x> <y>		wheel <dy>
+//   key <name>			text <characters>	resize <width> <height>
+static bool parse_script(const char* path, std::vector<InputEvent>& out)
+{
+	std::ifstream file(path);
+	if (!file)
+	{
+		fprintf(stderr, "Could not open script '%s'\n", path);
+		return false;
+	}
+
+	std::string line;
+	for (int line_number = 1; std::getline(file, line); line_number++)
+	{
+		line = line.substr(0, line.find('#'));
+
+		std::istringstream ss(line);
+		InputEvent event {};
+		std::string action;
+		if (!(ss >> event.frame >> action))
+			continue;
+
+		bool valid = true;
+		if (action == "move")
+		{
+			event.type = InputType::move;
+			valid = bool(ss >> event.x >> event.y);
+		}
+		else if (action == "click")
+		{
+			event.type = InputType::move;
+			valid = bool(ss >> event.x >> event.y);
+
+			InputEvent down = event;
+			down.type = InputType::down;
+			InputEvent up = event;
+			up.type = InputType::up;
+			up.frame++;
+
+			out.push_back(event);
+			out.push_back(down);
+			event = up;
+		}
+		else if (action == "wheel")
+		{
+			event.type = InputType::wheel;
+			valid = bool(ss >> event.y);
+		}
+		else if (action == "key")
+		{
+			std::string name;
+			event.type = InputType::key;
+			valid = (ss >> name) && parse_key(name, event.key);
+		}
+		else if (action == "text")
+		{
+			event.type = InputType::text;
+			valid = bool(ss >> event.text);
+		}
+		else if (action == "resize")
+		{
+			event.type = InputType::resize;
+			valid = bool(ss >> event.x >> event.y);
+		}
+		else
+		{
+			valid = false;
+		}
+
+		if (!valid)
+		{
+			fprintf(stderr, "Error on script (line %d)\n  %s\n", line_number, line.c_str());
+			return false;
+		}
+
+		out.push_back(event);
+	}
+
+	std::stable_sort(out.begin(), out.end(), [](const InputEvent& a, const InputEvent& b) { return a.frame < b.frame; });
+	return true;
+}
+
+static void apply_event(GLFWwindow* window, const InputEvent& event)
+{
+	ImGuiIO& io = ImGui::GetIO();
+
+	switch (event.type)
+	{
+		case InputType::move:
+			io.AddMousePosEvent(event.x, event.y);
+			break;
+		case InputType::down:
+			io.AddMouseButtonEvent(ImGuiMouseButton_Left, true);
+			break;
+		case InputType::up:
+			io.AddMouseButtonEvent(ImGuiMouseButton_Left, false);
+			break;
+		case InputType::wheel:
+			io.AddMouseWheelEvent(0.0f, event.y);
+			break;
+		case InputType::key:
+			io.AddKeyEvent(event.key, true);
+			io.AddKeyEvent(event.key, false);
+			break;
+		case InputType::text:
+			io.AddInputCharactersUTF8(event.text.c_str());
+			break;
+		case InputType::resize:
+			glfwSetWindowSize(window, (int)event.x, (int)event.y);
+			break;
+	}
+}
+
+static void usage()
+{
+	fprintf(stderr,
+		"usage: bwm-bench [options]\n"
+		"  --frames <n>        number of frames to render (default 2000)\n"
+		"  --warmup <n>        frames excluded from the results (default 60)\n"
+		"  --networks <n>      networks reported by the synthetic backend (default 30)\n"
+		"  --script <file>     scripted input, see bench/ui_bench.script\n"
+		"  --output <file>     write results to file, - for stdout (default)\n"
+		"  --baseline <file>   compare results against a saved baseline\n"
+		"  --tolerance <pct>   allowed regression in percent (default 10)\n"
+		"  --visible           show the window instead of rendering offscreen\n"
+		"  --software          use the CPU renderer instead of OpenGL\n"
+		"  --render-all        render frames even if nothing changed\n"
+		"  --low-memory        run in low memory mode\n"
+	);
+}
+
+int main(int argc, char** argv)
+{
+	using bench_clock = std::chrono::steady_clock;
+
+	std::uint64_t	frame_count		= 2000;
+	std::uint64_t	warmup			= 60;
+	std::size_t		network_count	= 30;
+	const char*		script_path		= nullptr;
+	const char*		output_path		= "-";
+	const char*		baseline_path	= nullptr;
+	double			tolerance		= 10.0;
+	bool			visible			= false;
+	bool			software		= false;
+	bool			render_all		= false;
+	bool			low_memory		= false;
+
+	for (int i = 1; i < argc; i++)
+	{
+		bool has_value = i + 1 < argc;
+		if (strcmp(argv[i], "--frames") == 0 && has_value)
+			frame_count = strtoull(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "--warmup") == 0 && has_value)
+			warmup = strtoull(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "--networks") == 0 && has_value)
+			network_count = strtoull(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "--script") == 0 && has_value)
+			script_path = argv[++i];
+		else if (strcmp(argv[i], "--output") == 0 && has_value)
+			output_path = argv[++i];
+		else if (strcmp(argv[i], "--baseline") == 0 && has_value)
+			baseline_path = argv[++i];
+		else if (strcmp(argv[i], "--tolerance") == 0 && has_value)
+			tolerance = atof(argv[++i]);
+		else if (strcmp(argv[i], "--visible") == 0)
+			visible = true;
+		else if (strcmp(argv[i], "--software") == 0)
+			software = true;
+		else if (strcmp(argv[i], "--render-all") == 0)
+			render_all = true;
+		else if (strcmp(argv[i], "--low-memory") == 0)
+			low_memory = true;
+		else
+		{
+			usage();
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (warmup >= frame_count)
+	{
+		fprintf(stderr, "--warmup must be smaller than --frames\n");
+		return EXIT_FAILURE;
+	}
+
+	std::vector<InputEvent> events;
+	if (script_path && !parse_script(script_path, events))
+		return EXIT_FAILURE;
+
+	ImGui::SetAllocatorFunctions(imgui_alloc, imgui_free);
+
+	UiWindowOptions options;
+	options.visible		= visible;
+	options.vsync		= false;
+	options.software	= software;
+	options.skip_unchanged_frames = !render_all;
+	options.low_memory |= low_memory;
+
+	GLFWwindow* window = UiCreateWindow(options);
+	if (window == NULL)
+		return EXIT_FAILURE;
+
+	WirelessManager* wireless_manager = new SyntheticWirelessManager(network_count);
+	if (!wireless_manager->Init())
+	{
+		fprintf(stderr, "Could not initialize synthetic backend\n");
+		return EXIT_FAILURE;
+	}
+	wireless_manager->AcquireState();
+
+	WirelessRequestQueue* requests = new WirelessRequestQueue(wireless_manager);
+	MainScreen* main_screen = new MainScreen(wireless_manager, requests);
+
+	std::size_t sample_count = frame_count - warmup;
+	std::vector<double> frame_us, allocations, draw_calls, vertices, indices;
+	frame_us.reserve(sample_count);
+	allocations.reserve(sample_count);
+	draw_calls.reserve(sample_count);
+	vertices.reserve(sample_count);
+	indices.reserve(sample_count);
+
+	std::uint64_t rendered_frames = 0;
+
+	std::size_t next_event = 0;
+	for (std::uint64_t frame = 0; frame < frame_count && !glfwWindowShouldClose(window); frame++)
+	{
+		for (; next_event < events.size() && events[next_event].frame == frame; next_event++)
+			apply_event(window, events[next_event]);
+
+		std::uint64_t rendered_begin	= UiGetFrameCounts().rendered;
+		std::uint64_t allocations_begin	= s_allocations.load(std::memory_order_relaxed);
+		auto begin = bench_clock::now();
+
+		UiFrameStart(window);
+		requests->Poll();
+		wireless_manager->AcquireState();
+		main_screen->Show();
+		UiFrameEnd(window);
+
+		auto end = bench_clock::now();
+		std::uint64_t allocations_end = s_allocations.load(std::memory_order_relaxed);
+
+		if (frame < warmup)
+			continue;
+
+		rendered_frames += UiGetFrameCounts().rendered - rendered_begin;
+
+		std::size_t commands = 0;
+		const ImDrawData* draw_data = ImGui::GetDrawData();
+		for (int i = 0; i < draw_data->CmdListsCount; i++)
+			commands += draw_data->CmdLists[i]->CmdBuffer.Size;
+
+		frame_us.push_back(std::chrono::duration<double, std::micro>(end - begin).count());
+		allocations.push_back(allocations_end - allocations_begin);
+		draw_calls.push_back(commands);
+		vertices.push_back(draw_data->TotalVtxCount);
+		indices.push_back(draw_data->TotalIdxCount);
+	}
+
+	delete requests;
+	delete main_screen;
+	delete wireless_manager;
+
+	UiDestroyWindow(window);
+
+	BenchResults results;
+	results["frames"]				= frame_us.size();
+	results["frame_mean_us"]		= BenchMean(frame_us);
+	results["frame_p50_us"]			= BenchPercentile(frame_us, 0.50);
+	results["frame_p90_us"]			= BenchPercentile(frame_us, 0.90);
+	results["frame_p99_us"]			= BenchPercentile(frame_us, 0.99);
+	results["frame_max_us"]			= BenchPercentile(frame_us, 1.00);
+	results["allocations_mean"]		= BenchMean(allocations);
+	results["allocations_max"]		= BenchPercentile(allocations, 1.00);
+	results["draw_calls_mean"]		= BenchMean(draw_calls);
+	results["vertices_mean"]		= BenchMean(vertices);
+	results["indices_mean"]			= BenchMean(indices);
+	results["rendered_frames"]		= render_all ? frame_us.size() : rendered_frames;
+
+	if (!BenchWriteResults(output_path, results))
+		return EXIT_FAILURE;
+
+	if (baseline_path)
+	{
+		BenchResults baseline;
+		if (!BenchReadResults(baseline_path, baseline))
+			return EXIT_FAILURE;
+		if (!BenchCompareResults(baseline, results, tolerance))
+			return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
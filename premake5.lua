@@ -1,5 +1,61 @@
+newoption {
+	trigger		= "stats",
+	description	= "Build bwm with frame time and backend latency instrumentation"
+}
+
+newoption {
+	trigger		= "low-memory",
+	description	= "Build bwm for machines with little memory, see README"
+}
+
+newoption {
+	trigger		= "networkmanager",
+	description	= "Build the NetworkManager backend, needs libsystemd"
+}
+
+newoption {
+	trigger		= "pgo",
+	value		= "MODE",
+	description	= "Profile guided optimization of the Optimized configuration, see README",
+	allowed		= {
+		{ "generate",	"Instrument the build to record a profile" },
+		{ "use",		"Optimize with the recorded profile" }
+	}
+}
+
+-- Profiles of every project end up here, named after their object files
+local pgo_dir = path.getabsolute("bin/pgo")
+
 workspace "bwm"
-	configurations { "Debug", "Release" }
+	configurations { "Debug", "Release", "Optimized" }
+
+	-- Coroutines, see src/task.h
+	cppdialect "C++20"
+
+	-- Release with link time optimization across bwm, imgui and glfw.
+	-- bench/pgo_train.sh builds it with a profile of a training run.
+	filter "configurations:Optimized"
+		optimize "Speed"
+		flags "LinkTimeOptimization"
+
+	-- bwm updates counters from its worker thread as well
+	filter { "configurations:Optimized", "options:pgo=generate" }
+		buildoptions { "-fprofile-generate=" .. pgo_dir, "-fprofile-update=atomic" }
+		linkoptions ("-fprofile-generate=" .. pgo_dir)
+
+	-- Code the training run does not reach is optimized as without a
+	-- profile instead of for size
+	filter { "configurations:Optimized", "options:pgo=use" }
+		buildoptions { "-fprofile-use=" .. pgo_dir, "-fprofile-partial-training", "-Wno-missing-profile" }
+		linkoptions { "-fprofile-use=" .. pgo_dir, "-fprofile-partial-training" }
+
+	-- Lets the linker drop every function of the vendored libraries bwm
+	-- does not call
+	filter "options:low-memory"
+		buildoptions { "-ffunction-sections", "-fdata-sections" }
+		linkoptions "-Wl,--gc-sections"
+
+	filter {}
 
 project "imgui"
 	kind "StaticLib"
@@ -21,6 +77,10 @@ project "imgui"
 
 	includedirs "vendor/imgui"
 
+	-- imgui_demo.cpp compiles to empty stubs
+	filter "options:low-memory"
+		defines { "IMGUI_DISABLE_DEMO_WINDOWS", "IMGUI_DISABLE_DEBUG_TOOLS" }
+
 	filter "configurations:Debug"
 		symbols "On"
 
@@ -61,6 +121,48 @@ project "glfw"
 	filter "configurations:Release"
 		optimize "On"
 
+project "bwmstatus"
+	kind "StaticLib"
+	language "C"
+
+	files {
+		"status/bwm_status.h",
+		"status/bwm_status.c"
+	}
+
+	filter "configurations:Debug"
+		symbols "On"
+
+	filter "configurations:Release"
+		optimize "On"
+
+-- Everything but main(), shared by bwm and bwm-bench
+local bwm_sources = {
+	"src/cli.cpp",
+	"src/config.cpp",
+	"src/draw_data_cache.cpp",
+	"src/fast_connect.cpp",
+	"src/imgui_build.cpp",
+	"src/iwd_wireless_manager.cpp",
+	"src/iwd_wrapper.cpp",
+	"src/link_monitor.cpp",
+	"src/login_screen.cpp",
+	"src/metrics.cpp",
+	"src/network_details_cache.cpp",
+	"src/nl80211_scan_reader.cpp",
+	"src/process.cpp",
+	"src/process_replay.cpp",
+	"src/software_renderer.cpp",
+	"src/startup.cpp",
+	"src/stats.cpp",
+	"src/trace.cpp",
+	"src/status_page.cpp",
+	"src/task.cpp",
+	"src/ui.cpp",
+	"src/wireless_manager.cpp",
+	"src/wireless_request_queue.cpp",
+}
+
 project "bwm"
 	kind "ConsoleApp"
 	language "C++"
@@ -68,30 +170,257 @@ project "bwm"
 	warnings "Extra"
 
 	files {
+		bwm_sources,
 		"src/bwm.cpp",
-		"src/config.cpp",
-		"src/imgui_build.cpp",
-		"src/iwd_wireless_manager.cpp",
-		"src/iwd_wrapper.cpp",
-		"src/login_screen.cpp",
-		"src/wireless_manager.cpp",
 	}
 
 	includedirs {
 		"vendor/glfw/include",
 		"vendor/imgui",
+		"status",
 		"src"
 	}
 
 	links {
 		"imgui",
 		"glfw",
+		"bwmstatus",
 		"GL",
-		"X11"
+		"X11",
+		"Xext",
+		"pthread"
+	}
+
+	filter "options:networkmanager"
+		files "src/nm_wireless_manager.cpp"
+		defines "BWM_NETWORKMANAGER"
+		links "systemd"
+
+	filter "options:stats"
+		defines "BWM_STATS"
+
+	filter "options:low-memory"
+		defines { "BWM_LOW_MEMORY", "IMGUI_DISABLE_DEMO_WINDOWS", "IMGUI_DISABLE_DEBUG_TOOLS" }
+
+	filter "configurations:Debug"
+		symbols "On"
+
+	filter "configurations:Release"
+		optimize "On"
+
+project "bwm-bench"
+	kind "ConsoleApp"
+	language "C++"
+	targetdir "bin/%{cfg.buildcfg}"
+	warnings "Extra"
+
+	files {
+		bwm_sources,
+		"bench/bench_results.cpp",
+		"bench/synthetic_wireless_manager.cpp",
+		"bench/ui_bench.cpp",
+	}
+
+	includedirs {
+		"vendor/glfw/include",
+		"vendor/imgui",
+		"status",
+		"src",
+		"bench"
+	}
+
+	links {
+		"imgui",
+		"glfw",
+		"bwmstatus",
+		"GL",
+		"X11",
+		"Xext",
+		"pthread"
+	}
+
+	filter "options:networkmanager"
+		files "src/nm_wireless_manager.cpp"
+		defines "BWM_NETWORKMANAGER"
+		links "systemd"
+
+	filter "options:stats"
+		defines "BWM_STATS"
+
+	-- Same as bwm and imgui, so the benchmark measures the low memory build
+	filter "options:low-memory"
+		defines { "BWM_LOW_MEMORY", "IMGUI_DISABLE_DEMO_WINDOWS", "IMGUI_DISABLE_DEBUG_TOOLS" }
+
+	filter "configurations:Debug"
+		symbols "On"
+
+	filter "configurations:Release"
+		optimize "On"
+
+project "bwm-backend-bench"
+	kind "ConsoleApp"
+	language "C++"
+	targetdir "bin/%{cfg.buildcfg}"
+	warnings "Extra"
+
+	files {
+		"bench/backend_bench.cpp",
+		"bench/bench_results.cpp",
+		"src/iwd_wireless_manager.cpp",
+		"src/iwd_wrapper.cpp",
+		"src/metrics.cpp",
+		"src/nl80211_scan_reader.cpp",
+		"src/process.cpp",
+		"src/process_replay.cpp",
+		"src/stats.cpp",
+		"src/trace.cpp",
+		"src/wireless_manager.cpp",
+	}
+
+	includedirs {
+		"vendor/imgui",
+		"src",
+		"bench"
+	}
+
+	links {
+		"imgui",
+		"pthread"
 	}
 
+	-- Spawned processes are counted by the statistics, BWM_BENCH lets the
+	-- fake sudo replace the real one
+	defines { "BWM_STATS", "BWM_BENCH" }
+
+	filter "options:networkmanager"
+		files "src/nm_wireless_manager.cpp"
+		defines "BWM_NETWORKMANAGER"
+		links "systemd"
+
 	filter "configurations:Debug"
 		symbols "On"
 
 	filter "configurations:Release"
-		optimize "On"
\ No newline at end of file
+		optimize "On"
+
+project "bwm-alloc-check"
+	kind "ConsoleApp"
+	language "C++"
+	targetdir "bin/%{cfg.buildcfg}"
+	warnings "Extra"
+
+	files {
+		"bench/alloc_check.cpp",
+		"src/iwd_wireless_manager.cpp",
+		"src/iwd_wrapper.cpp",
+		"src/metrics.cpp",
+		"src/nl80211_scan_reader.cpp",
+		"src/process.cpp",
+		"src/process_replay.cpp",
+		"src/stats.cpp",
+		"src/trace.cpp",
+		"src/wireless_manager.cpp",
+	}
+
+	includedirs {
+		"src",
+		"bench"
+	}
+
+	links {
+		"pthread"
+	}
+
+	filter "configurations:Debug"
+		symbols "On"
+
+	filter "configurations:Release"
+		optimize "On"
+
+project "bwm-nl80211-check"
+	kind "ConsoleApp"
+	language "C++"
+	targetdir "bin/%{cfg.buildcfg}"
+	warnings "Extra"
+
+	files {
+		"bench/nl80211_check.cpp",
+		"src/nl80211_scan_reader.cpp",
+		"src/stats.cpp",
+		"src/trace.cpp",
+	}
+
+	includedirs {
+		"src",
+		"bench"
+	}
+
+	links {
+		"pthread"
+	}
+
+	filter "configurations:Debug"
+		symbols "On"
+
+	filter "configurations:Release"
+		optimize "On"
+
+-- NetworkManager backend against a stub service on a private bus, run by
+-- bench/run_nm_check.sh
+if _OPTIONS["networkmanager"] then
+
+project "bwm-nm-stub"
+	kind "ConsoleApp"
+	language "C++"
+	targetdir "bin/%{cfg.buildcfg}"
+	warnings "Extra"
+
+	files "bench/nm_stub.cpp"
+
+	links "systemd"
+
+	filter "configurations:Debug"
+		symbols "On"
+
+	filter "configurations:Release"
+		optimize "On"
+
+project "bwm-nm-check"
+	kind "ConsoleApp"
+	language "C++"
+	targetdir "bin/%{cfg.buildcfg}"
+	warnings "Extra"
+
+	files {
+		"bench/nm_check.cpp",
+		"src/iwd_wireless_manager.cpp",
+		"src/iwd_wrapper.cpp",
+		"src/metrics.cpp",
+		"src/nl80211_scan_reader.cpp",
+		"src/nm_wireless_manager.cpp",
+		"src/process.cpp",
+		"src/process_replay.cpp",
+		"src/stats.cpp",
+		"src/trace.cpp",
+		"src/wireless_manager.cpp",
+	}
+
+	includedirs {
+		"src",
+		"bench"
+	}
+
+	defines "BWM_NETWORKMANAGER"
+
+	links {
+		"systemd",
+		"pthread"
+	}
+
+	filter "configurations:Debug"
+		symbols "On"
+
+	filter "configurations:Release"
+		optimize "On"
+
+end
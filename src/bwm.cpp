@@ -1,72 +1,24 @@
 #include "wireless_manager.h"
-#include "login_screen.h"
+#include "wireless_request_queue.h"
+#include "fast_connect.h"
+#include "process_replay.h"
 #include "config.h"
+#include "cli.h"
+#include "status_page.h"
+#include "metrics.h"
+#include "startup.h"
+#include "stats.h"
+#include "trace.h"
+#include "ui.h"
 
 #include <imgui.h>
-#include <backends/imgui_impl_glfw.h>
-#include <backends/imgui_impl_opengl3.h>
 
-#include <GLFW/glfw3.h>
+#include <future>
 
-#include <chrono>
+#include <GLFW/glfw3.h>
 
 int		g_argc;
 char**	g_argv;
-char**	g_env;
-
-int WINDOW_WIDTH = 400;
-int WINDOW_HEIGHT = 400;
-
-static void glfw_error_callback(int error, const char* description)
-{
-	fprintf(stderr, "Glfw Error %d: %s\n", error, description);
-}
-
-static void cleanup(GLFWwindow* window)
-{
-	ImGui_ImplOpenGL3_Shutdown();
-	ImGui_ImplGlfw_Shutdown();
-	ImGui::DestroyContext();
-
-	glfwDestroyWindow(window);
-	glfwTerminate();
-}
-
-static void frame_start(GLFWwindow* window)
-{
-	glfwPollEvents();
-
-	// Create new frame
-	ImGui_ImplOpenGL3_NewFrame();
-	ImGui_ImplGlfw_NewFrame();
-	ImGui::NewFrame();
-
-	glfwGetWindowSize(window, &WINDOW_WIDTH, &WINDOW_HEIGHT);
-
-	// Set ImGui window to fill whole application window
-	ImGui::SetNextWindowSize(ImVec2(WINDOW_WIDTH, WINDOW_HEIGHT));
-	ImGui::SetNextWindowPos(ImVec2(0.0f, 0.0f));
-
-	ImGui::Begin("Window", NULL,
-		ImGuiWindowFlags_NoTitleBar |
-		ImGuiWindowFlags_NoResize |
-		ImGuiWindowFlags_NoMove
-	);
-}
-
-static void frame_end(GLFWwindow* window)
-{
-	ImGui::End();
-
-	ImGui::Render();
-	glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
-	glClear(GL_COLOR_BUFFER_BIT);
-	ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
-
-	glfwSwapBuffers(window);
-}
-
-
 
 static void get_and_echo_password(GLFWwindow* window)
 {
@@ -75,7 +27,7 @@ static void get_and_echo_password(GLFWwindow* window)
 
 	while (!glfwWindowShouldClose(window))
 	{
-		frame_start(window);
+		UiFrameStart(window);
 
 		ImGui::Text("%s", g_argv[1]);
 
@@ -103,128 +55,215 @@ static void get_and_echo_password(GLFWwindow* window)
 			break;
 		}
 
-		frame_end(window);
+		UiFrameEnd(window);
 	}
 
-	cleanup(window);
+	UiDestroyWindow(window);
 }
 
 
 
-static void known_networks_popup(WirelessManager* wireless_manager)
+// Handles --record/--replay before anything else and removes them from argv,
+// so both the window and the headless commands can be recorded and replayed
+static bool parse_process_options(int& argc, char** argv)
 {
-	if (!ImGui::BeginPopupModal("known-networks", NULL,
-		ImGuiWindowFlags_AlwaysAutoResize |
-		ImGuiWindowFlags_NoTitleBar |
-		ImGuiWindowFlags_NoResize |
-		ImGuiWindowFlags_NoMove
-	))
+	const char* record_path = nullptr;
+	const char* replay_path = nullptr;
+	double replay_speed = 1.0;
+
+	int out = 1;
+	for (int i = 1; i < argc; i++)
 	{
-		return;
+		if (strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+			record_path = argv[++i];
+		else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc)
+			replay_path = argv[++i];
+		else if (strcmp(argv[i], "--replay-speed") == 0 && i + 1 < argc)
+			replay_speed = atof(argv[++i]);
+		else
+			argv[out++] = argv[i];
 	}
+	argv[out] = nullptr;
+	argc = out;
 
-	const auto& known_networks = wireless_manager->GetKnownNetworks();
-
-	if (ImGui::BeginTable("known-networks", 2, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg))
+	if (record_path && replay_path)
 	{
-		ImVec2 known_button_size = ImGui::CalcTextSize("Forget");
-		known_button_size.x += 10.0f;
-		known_button_size.y += 10.0f;
-
-		ImGui::TableSetupColumn("ssid", ImGuiTableColumnFlags_WidthFixed, WINDOW_WIDTH - 2 * known_button_size.x);
-		ImGui::TableSetupColumn("##", ImGuiTableColumnFlags_WidthFixed, known_button_size.x);
-		ImGui::TableHeadersRow();
+		fprintf(stderr, "--record and --replay can not be used together\n");
+		return false;
+	}
+	if (replay_speed < 0.0)
+	{
+		fprintf(stderr, "--replay-speed must not be negative\n");
+		return false;
+	}
 
-		std::size_t count = known_networks.size();
-		for (std::size_t i = 0; i < count; i++)
-		{
-			const Network& network = known_networks[i];
+	if (record_path)
+		return ProcessStartRecording(record_path);
+	if (replay_path)
+		return ProcessStartReplay(replay_path, replay_speed);
+	return true;
+}
 
-			ImGui::TableNextColumn();
-			ImGui::Text("%s", network.ssid.c_str());
+int main(int argc, char** argv)
+{
+	MetricsClock::time_point process_start = MetricsClock::now();
+	StartupInit();
 
-			ImGui::TableNextColumn();
-			ImGui::PushID(i + 1000);
-			if (ImGui::Button("Forget", known_button_size))
-			{
-				wireless_manager->ForgetKnownNetwork(network);
-				i = count;
-			}
-			ImGui::PopID();
-		}
+	if (!parse_process_options(argc, argv))
+		return EXIT_FAILURE;
 
-		ImGui::EndTable();
+	if (argc >= 2 && (strcmp(argv[1], "--help") == 0 || strcmp(argv[1], "-h") == 0))
+	{
+		PrintUsage(stdout);
+		return EXIT_SUCCESS;
 	}
 
-	if (ImGui::Button("Close"))
-		ImGui::CloseCurrentPopup();
-	ImGui::EndPopup();
-}
-
-int main(int argc, char** argv, char** env)
-{
-	using namespace std::chrono_literals;
-	using clock = std::chrono::steady_clock;
+	// Headless commands skip all window and config initialization
+	if (argc >= 2 && IsCliCommand(argv[1]))
+		return RunCli(argc, argv);
 
 	bool password_mode = (argc == 2 && strncmp(argv[1], "[sudo]", 6) == 0);
 
 	g_argc = argc;
 	g_argv = argv;
-	g_env = env;
+
+	bool dump_stats = false;
+	bool startup_report = false;
+	const char* metrics_path = getenv("BWM_METRICS");
+	const char* fast_connect_env = getenv("BWM_FAST_CONNECT");
+	bool fast_connect_enabled = (fast_connect_env && strcmp(fast_connect_env, "1") == 0);
 
 	if (password_mode)
 	{
 		WINDOW_HEIGHT = 100;
 		WINDOW_WIDTH = 250;
 	}
-	else if (argc != 1)
+	else
 	{
-		for (int i = 0; i < argc; i++)
+		for (int i = 1; i < argc; i++)
+		{
+			if (strcmp(argv[i], "--stats") == 0)
+			{
+				dump_stats = true;
+				continue;
+			}
+
+			// Through the environment, so that the password prompt
+			// started by sudo uses it as well
+			if (strcmp(argv[i], "--software") == 0)
+			{
+				setenv("BWM_RENDERER", "software", 1);
+				continue;
+			}
+
+			if (strcmp(argv[i], "--low-memory") == 0)
+			{
+				setenv("BWM_MEMORY", "low", 1);
+				continue;
+			}
+
+			if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+			{
+				if (!TraceStart(argv[++i]))
+					return EXIT_FAILURE;
+				continue;
+			}
+
+			if (strcmp(argv[i], "--metrics") == 0 && i + 1 < argc)
+			{
+				metrics_path = argv[++i];
+				continue;
+			}
+
+			if (strcmp(argv[i], "--fast-connect") == 0)
+			{
+				fast_connect_enabled = true;
+				continue;
+			}
+
+			if (strcmp(argv[i], "--startup-report") == 0)
+			{
+				startup_report = true;
+				continue;
+			}
+
 			fprintf(stderr, "%s\n", argv[i]);
-		fprintf(stderr, "bwm does not support commandline arguments\n");
-		return EXIT_FAILURE;
+			fprintf(stderr, "unknown option, run 'bwm --help' for usage\n");
+			return EXIT_FAILURE;
+		}
 	}
 
-	glfwSetErrorCallback(glfw_error_callback);
-	if (!glfwInit())
+	// The password prompt started by sudo inherits the environment, it
+	// must not replace the file
+	if (metrics_path && !password_mode)
 	{
-		fprintf(stderr, "Could not initalize glfw\n");
-		return EXIT_FAILURE;
+		const char* interval = getenv("BWM_METRICS_INTERVAL");
+		long seconds = interval ? atol(interval) : 30;
+		if (!MetricsStart(metrics_path, std::chrono::seconds(std::max(seconds, 1L))))
+			return EXIT_FAILURE;
 	}
 
-	const char* glsl_version = "#version 130";
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 0);
+#ifndef BWM_STATS
+	if (dump_stats)
+		fprintf(stderr, "bwm was built without stats, configure with 'premake5 gmake2 --stats'\n");
+#endif
 
-	glfwWindowHint(GLFW_TRANSPARENT_FRAMEBUFFER, GLFW_TRUE);
+	// Startup lanes, see startup.h. The config and fonts, and the backend
+	// with its first scan run on workers while the main thread creates the
+	// window, each is joined only where its result is needed.
+	std::future<bool> config_loaded = std::async(std::launch::async, ConfigPreload);
 
-	GLFWwindow* window = glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, "bwm", NULL, NULL);
-	if (window == NULL)
+	// With fast connect the backend lane also brings a connection up
+	FastConnect* fast_connect = nullptr;
+	std::future<WirelessManager*> backend_ready;
+	if (fast_connect_enabled && !password_mode)
 	{
-		fprintf(stderr, "Could not create window\n");
-		glfwTerminate();
-		return EXIT_FAILURE;
+		fast_connect = new FastConnect(process_start);
+		fast_connect->Start(WirelessManager::DefaultBackend());
+	}
+	else if (!password_mode)
+	{
+		backend_ready = std::async(std::launch::async, [] {
+			WirelessManager* manager = nullptr;
+			{
+				StartupScope scope(StartupPhase::backend);
+				manager = WirelessManager::Create(WirelessManager::DefaultBackend());
+			}
+			// The window shows these right away instead of starting
+			// with an empty list and a scan of its own
+			if (manager)
+			{
+				StartupScope scope(StartupPhase::first_scan);
+				manager->Scan();
+				manager->UpdateNetworks();
+			}
+			return manager;
+		});
 	}
-	glfwMakeContextCurrent(window);
-	glfwSwapInterval(1);
 
-	// Setup ImGui context
-	IMGUI_CHECKVERSION();
-	ImGui::CreateContext();
+	bool config_ok = false;
 
-	ImGuiIO& io = ImGui::GetIO();
-	io.IniFilename = NULL;
+	UiWindowOptions window_options;
+	if (const char* renderer = getenv("BWM_RENDERER"))
+		window_options.software = (strcmp(renderer, "software") == 0);
+	if (const char* memory = getenv("BWM_MEMORY"))
+		window_options.low_memory = (strcmp(memory, "low") == 0);
+	window_options.font_atlas = [&] {
+		config_ok = config_loaded.get();
+		return config_ok ? ConfigTakeFontAtlas() : nullptr;
+	};
 
-	// Init ImGui backends
-	ImGui_ImplGlfw_InitForOpenGL(window, true);
-	ImGui_ImplOpenGL3_Init(glsl_version);
+	GLFWwindow* window = UiCreateWindow(window_options);
+	if (window == NULL)
+		return EXIT_FAILURE;
 
 	// Load config file
-	if (!ParseConfig())
+	if (!config_ok)
 	{
-		cleanup(window);
+		UiDestroyWindow(window);
 		return EXIT_FAILURE;
 	}
+	ConfigApplyPreloaded();
 
 	if (password_mode)
 	{
@@ -232,146 +271,71 @@ int main(int argc, char** argv, char** env)
 		return 0;
 	}
 
-	WirelessManager* wireless_manager = WirelessManager::Create(WirelessBackend::iwd);
+	WirelessManager* wireless_manager = fast_connect
+		? fast_connect->TakeManager()
+		: backend_ready.get();
 	if (!wireless_manager)
 	{
 		fprintf(stderr, "Could not initialize wireless backend\n");
 		return EXIT_FAILURE;
 	}
 
-	wireless_manager->Scan();
-	wireless_manager->UpdateNetworks();
+	WirelessRequestQueue* requests = new WirelessRequestQueue(wireless_manager);
+	if (fast_connect)
+		fast_connect->HoldQueue(requests);
+	MainScreen* main_screen = new MainScreen(wireless_manager, requests);
+
+	// Connection state for status bars, see status/bwm_status.h
+	StatusPage status_page;
+	if (status_page.Open())
+		status_page.Publish(wireless_manager->GetState());
 
-	LoginScreen* login_screen = nullptr;
+	ConfigWatch();
 
-	auto next_scan		= clock::now() + 10s;
-	auto next_update	= clock::now() + 2s;
+	StartupBegin(StartupPhase::first_frame);
+	bool first_frame = true;
 
 	while (!glfwWindowShouldClose(window))
 	{
-		frame_start(window);
+		if (ConfigPoll())
+			UiFontsChanged();
 
-		if (wireless_manager->GetCurrentDevice().powered == "on")
-		{
-			// Scan and update networks on specified intervals
-			auto current_time = clock::now();
-			if (current_time >= next_scan)
-			{
-				wireless_manager->Scan();
-				next_scan = current_time + 10s;
-			}
-			if (current_time >= next_update)
-			{
-				wireless_manager->UpdateNetworks();
-				next_update = current_time + 2s;
-			}
-		}
-
-		// Create dropdown for devices
-		if (ImGui::BeginCombo("Device", wireless_manager->GetCurrentDevice().name.c_str()))
-		{
-			const auto& devices			= wireless_manager->GetDevices();
-			const auto& current_device	= wireless_manager->GetCurrentDevice();
-
-			for (std::size_t i = 0; i < devices.size(); i++)
-			{
-				bool selected = (&current_device == &devices[i]);
-				if (ImGui::Selectable(devices[i].name.c_str(), selected))
-					wireless_manager->SetCurrentDevice(devices[i]);
-				if (selected)
-					ImGui::SetItemDefaultFocus();
-			}
-			ImGui::EndCombo();
-		}
+		UiFrameStart(window);
 
-		ImVec2 known_button_size = ImGui::CalcTextSize("Known");
-		known_button_size.x += 20.0f;
-		known_button_size.y += 10.0f;
+		// Run callbacks of finished requests and use one consistent
+		// backend snapshot for the whole frame
+		requests->Poll();
+		if (wireless_manager->AcquireState())
+			status_page.Publish(wireless_manager->GetState());
 
-		ImGui::SameLine();
-		if (ImGui::Button("Known", known_button_size))
-		{
-			wireless_manager->UpdateKnownNetworks();
-			ImGui::OpenPopup("known-networks");
-		}
-
-		known_networks_popup(wireless_manager);
+		main_screen->Show();
+		status_page.SetLinkSignal(main_screen->GetLinkMonitor().GetLinkSignal());
 
-		ImGui::Spacing();
-		ImGui::Spacing();
+		UiFrameEnd(window);
 
-		if (wireless_manager->GetCurrentDevice().powered != "on")
+		if (first_frame)
 		{
-			if (ImGui::Button("Activate device"))
-			{
-				if (wireless_manager->ActivateDevice())
-				{
-					next_scan	= clock::now();
-					next_update = clock::now();
-				}
-			}
+			StartupEnd(StartupPhase::first_frame);
+			if (startup_report)
+				StartupReport(stderr);
+			first_frame = false;
 		}
-		else if (ImGui::BeginTable("networks", 3, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg))
-		{
-			const ImVec2 button_size = ImVec2(ImGui::CalcTextSize("Disconnect").x + 10.0f, 0.0f);
-
-			ImGui::TableSetupColumn("ssid");
-			ImGui::TableSetupColumn("security", ImGuiTableColumnFlags_WidthFixed, -1);
-			ImGui::TableSetupColumn("##",		ImGuiTableColumnFlags_WidthFixed, -1);
-			ImGui::TableHeadersRow();
-
-			for (size_t i = 0; i < wireless_manager->GetNetworks().size(); i++)
-			{
-				const Network& network = wireless_manager->GetNetworks()[i];
-
-				ImGui::TableNextColumn();
-				ImGui::Text("%s", network.ssid.c_str());
-
-				ImGui::TableNextColumn();
-				ImGui::Text("%s", network.security.c_str());
-
-				ImGui::TableNextColumn();
-				if (network.connected)
-				{
-					ImGui::PushID(i + 1);
-					if (ImGui::Button("Disconnect", button_size))
-						wireless_manager->Disconnect();
-					ImGui::PopID();
-				}
-				else
-				{
-					ImGui::PushID(i + 1);
-					if (ImGui::Button("Connect", button_size))
-					{						
-						if (!wireless_manager->Connect(network))
-							login_screen = LoginScreen::Create(wireless_manager, network);
-					}
-					ImGui::PopID();
-				}
-			}
-
-			ImGui::EndTable();
-		}
-
-		if (login_screen)
-		{
-			login_screen->Show();
-			if (login_screen->Done())
-			{
-				delete login_screen;
-				login_screen = nullptr;
-			}
-		}
-		
-		frame_end(window);
 	}
 
-	if (login_screen)
-		delete login_screen;
+#ifdef BWM_STATS
+	if (dump_stats)
+		StatsDump(stderr);
+#endif
+
+	ConfigUnwatch();
 
+	// The fast connect releases the queue when done
+	delete fast_connect;
+	delete requests;
+	delete main_screen;
 	delete wireless_manager;
 
-	cleanup(window);
+	UiDestroyWindow(window);
 
 	return EXIT_SUCCESS;
 }
@@ -0,0 +1,363 @@
+#include "cli.h"
+
+#include "wireless_manager.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <termios.h>
+#include <unistd.h>
+
+struct CliCommand
+{
+	const char*	name;
+	int			min_args;
+	int			max_args;
+	const char*	usage;
+};
+
+static constexpr CliCommand s_commands[] = {
+	{ "devices",	0, 0, "devices" },
+	{ "networks",	0, 0, "networks [--scan]" },
+	{ "known",		0, 0, "known" },
+	{ "connect",	1, 1, "connect <ssid> [--passphrase]" },
+	{ "disconnect",	0, 0, "disconnect" },
+	{ "forget",		1, 1, "forget <ssid>" },
+};
+
+static const CliCommand* find_command(const char* name)
+{
+	for (const CliCommand& command : s_commands)
+		if (strcmp(command.name, name) == 0)
+			return &command;
+	return nullptr;
+}
+
+void PrintUsage(FILE* fp)
+{
+	fprintf(fp,
+		"usage: bwm [options]\n"
+		"       bwm [--device <name>] <command>\n"
+		"\n"
+		"Without a command bwm opens the window.\n"
+		"\n"
+		"commands (JSON output, no window):\n"
+	);
+	for (const CliCommand& command : s_commands)
+		fprintf(fp, "  %s\n", command.usage);
+	fprintf(fp,
+		"\n"
+		"window options:\n"
+		"  --software           render on the CPU instead of OpenGL\n"
+		"  --low-memory         release memory more eagerly\n"
+		"  --fast-connect       connect to the strongest known network at startup\n"
+		"  --startup-report     print the startup phase times to stderr\n"
+		"  --stats              print statistics on exit (builds with --stats)\n"
+		"  --trace <file>       record a Chrome trace\n"
+		"  --metrics <file>     export metrics as an OpenMetrics textfile\n"
+		"\n"
+		"options for both:\n"
+		"  --record <file>      record the processes bwm spawns\n"
+		"  --replay <file>      replay recorded processes instead of spawning them\n"
+		"  --replay-speed <x>   replay faster (> 1) or slower (< 1)\n"
+		"  -h, --help           show this help\n"
+	);
+}
+
+// Length of the valid UTF-8 sequence at the start of str, 0 if it is not
+// one. Overlong encodings and surrogates are not valid.
+static std::size_t utf8_sequence_length(std::string_view str)
+{
+	unsigned char c = str[0];
+
+	std::size_t		length;
+	std::uint32_t	code_point;
+	if (c < 0x80)
+		return 1;
+	else if ((c & 0xE0) == 0xC0)
+	{
+		length		= 2;
+		code_point	= c & 0x1F;
+	}
+	else if ((c & 0xF0) == 0xE0)
+	{
+		length		= 3;
+		code_point	= c & 0x0F;
+	}
+	else if ((c & 0xF8) == 0xF0)
+	{
+		length		= 4;
+		code_point	= c & 0x07;
+	}
+	else
+		return 0;
+
+	if (str.size() < length)
+		return 0;
+	for (std::size_t i = 1; i < length; i++)
+	{
+		if (((unsigned char)str[i] & 0xC0) != 0x80)
+			return 0;
+		code_point = (code_point << 6) | ((unsigned char)str[i] & 0x3F);
+	}
+
+	static constexpr std::uint32_t s_min_code_point[] = { 0, 0, 0x80, 0x800, 0x10000 };
+	if (code_point < s_min_code_point[length] || code_point > 0x10FFFF || (code_point >= 0xD800 && code_point <= 0xDFFF))
+		return 0;
+
+	return length;
+}
+
+// SSIDs are arbitrary bytes, bytes that are not valid UTF-8 are escaped as
+// the code point of the same value so the output stays valid JSON
+static void print_json_string(std::string_view str)
+{
+	putchar('"');
+	while (!str.empty())
+	{
+		char c = str[0];
+		std::size_t length = utf8_sequence_length(str);
+		if (length == 0)
+		{
+			printf("\\u%04x", (unsigned char)c);
+			str.remove_prefix(1);
+			continue;
+		}
+
+		switch (c)
+		{
+			case '"':	fputs("\\\"", stdout); break;
+			case '\\':	fputs("\\\\", stdout); break;
+			case '\n':	fputs("\\n", stdout); break;
+			case '\t':	fputs("\\t", stdout); break;
+			default:
+				if ((unsigned char)c < 0x20)
+					printf("\\u%04x", (unsigned char)c);
+				else
+					fwrite(str.data(), 1, length, stdout);
+				break;
+		}
+		str.remove_prefix(length);
+	}
+	putchar('"');
+}
+
+static void print_devices(const WirelessManager* wireless_manager)
+{
+	const auto& devices			= wireless_manager->GetDevices();
+	const auto& current_device	= wireless_manager->GetCurrentDevice();
+
+	putchar('[');
+	for (std::size_t i = 0; i < devices.size(); i++)
+	{
+		const Device& device = devices[i];
+		if (i > 0)
+			putchar(',');
+		printf("{\"name\":");
+		print_json_string(device.name.view());
+		printf(",\"address\":");
+		print_json_string(device.address.view());
+		printf(",\"adapter\":");
+		print_json_string(device.adapter.view());
+		printf(",\"powered\":%s", device.power == PowerState::on ? "true" : "false");
+		printf(",\"mode\":\"%s\"", to_string(device.mode));
+		printf(",\"current\":%s}", &device == &current_device ? "true" : "false");
+	}
+	printf("]\n");
+}
+
+static void print_networks(const std::vector<Network>& networks)
+{
+	putchar('[');
+	for (std::size_t i = 0; i < networks.size(); i++)
+	{
+		const Network& network = networks[i];
+		if (i > 0)
+			putchar(',');
+		printf("{\"ssid\":");
+		print_json_string(network.ssid.view());
+		printf(",\"security\":\"%s\"", to_string(network.security));
+		printf(",\"connected\":%s", network.connected ? "true" : "false");
+		if (network.signal >= 0)
+			printf(",\"signal\":%d}", network.signal);
+		else
+			printf(",\"signal\":null}");
+	}
+	printf("]\n");
+}
+
+// Reads one line from stdin, prompting without echo if it is a terminal.
+// Passphrases are not taken as arguments, other users can read those.
+static bool read_passphrase(std::string& out)
+{
+	char buffer[256];
+
+	bool terminal = isatty(STDIN_FILENO);
+
+	termios old_attributes;
+	if (terminal)
+	{
+		fputs("Passphrase: ", stderr);
+		fflush(stderr);
+
+		if (tcgetattr(STDIN_FILENO, &old_attributes) == 0)
+		{
+			termios attributes = old_attributes;
+			attributes.c_lflag &= ~ECHO;
+			tcsetattr(STDIN_FILENO, TCSAFLUSH, &attributes);
+		}
+		else
+			terminal = false;
+	}
+
+	bool success = fgets(buffer, sizeof(buffer), stdin) != NULL;
+
+	if (terminal)
+	{
+		tcsetattr(STDIN_FILENO, TCSAFLUSH, &old_attributes);
+		fputc('\n', stderr);
+	}
+
+	if (!success)
+	{
+		fprintf(stderr, "Could not read passphrase\n");
+		return false;
+	}
+
+	std::size_t length = strcspn(buffer, "\r\n");
+	out.assign(buffer, length);
+	explicit_bzero(buffer, sizeof(buffer));
+
+	return true;
+}
+
+static int print_result(bool success)
+{
+	printf("{\"success\":%s}\n", success ? "true" : "false");
+	return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+bool IsCliCommand(const char* argument)
+{
+	return find_command(argument) != nullptr || strcmp(argument, "--device") == 0 || strcmp(argument, "--scan") == 0 || strcmp(argument, "--passphrase") == 0;
+}
+
+int RunCli(int argc, char** argv)
+{
+	const char* device_name	= nullptr;
+	bool scan				= false;
+	bool passphrase			= false;
+
+	const CliCommand* command = nullptr;
+	std::vector<const char*> args;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--device") == 0 && i + 1 < argc)
+			device_name = argv[++i];
+		else if (strcmp(argv[i], "--scan") == 0)
+			scan = true;
+		else if (strcmp(argv[i], "--passphrase") == 0)
+			passphrase = true;
+		else if (command == nullptr && (command = find_command(argv[i])))
+			continue;
+		else if (command != nullptr)
+			args.push_back(argv[i]);
+		else
+		{
+			PrintUsage(stderr);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (command == nullptr || (int)args.size() < command->min_args || (int)args.size() > command->max_args)
+	{
+		if (command != nullptr && strcmp(command->name, "connect") == 0 && args.size() == 2)
+			fprintf(stderr, "Passphrases are not accepted as arguments, use --passphrase to enter one\n");
+		PrintUsage(stderr);
+		return EXIT_FAILURE;
+	}
+
+	// Read before the backend starts, so a prompt is not interleaved with
+	// its output
+	std::string password;
+	if (passphrase && !read_passphrase(password))
+		return EXIT_FAILURE;
+
+	WirelessManager* wireless_manager = WirelessManager::Create(WirelessManager::DefaultBackend());
+	if (!wireless_manager)
+	{
+		fprintf(stderr, "Could not initialize wireless backend\n");
+		return EXIT_FAILURE;
+	}
+
+	int result = EXIT_FAILURE;
+
+	if (device_name)
+	{
+		Device device {};
+		device.name = device_name;
+		if (!wireless_manager->SetCurrentDevice(device))
+		{
+			fprintf(stderr, "Unknown device '%s'\n", device_name);
+			delete wireless_manager;
+			return EXIT_FAILURE;
+		}
+		wireless_manager->AcquireState();
+	}
+
+	// Only the ssid is needed to connect or forget, no listing required
+	Network network {};
+	if (!args.empty())
+		network.ssid = args[0];
+
+	std::string_view name = command->name;
+	if (name == "devices")
+	{
+		print_devices(wireless_manager);
+		result = EXIT_SUCCESS;
+	}
+	else if (name == "networks")
+	{
+		if (scan)
+			wireless_manager->Scan();
+		if (wireless_manager->UpdateNetworks())
+		{
+			wireless_manager->AcquireState();
+			print_networks(wireless_manager->GetNetworks());
+			result = EXIT_SUCCESS;
+		}
+		else
+		{
+			fprintf(stderr, "Could not list networks\n");
+		}
+	}
+	else if (name == "known")
+	{
+		if (wireless_manager->UpdateKnownNetworks())
+		{
+			wireless_manager->AcquireState();
+			print_networks(wireless_manager->GetKnownNetworks());
+			result = EXIT_SUCCESS;
+		}
+		else
+		{
+			fprintf(stderr, "Could not list known networks\n");
+		}
+	}
+	else if (name == "connect")
+		result = print_result(wireless_manager->Connect(network, password));
+	else if (name == "disconnect")
+		result = print_result(wireless_manager->Disconnect());
+	else if (name == "forget")
+		result = print_result(wireless_manager->ForgetKnownNetwork(network));
+
+	delete wireless_manager;
+
+	return result;
+}
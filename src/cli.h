@@ -0,0 +1,13 @@
+#pragma once
+
+// Headless subcommands with JSON output, meant for status bars and
+// scripts. They only touch the wireless backend, no window, GL context or
+// config file is created or read.
+
+#include <cstdio>
+
+bool IsCliCommand(const char* argument);
+int RunCli(int argc, char** argv);
+
+// Commands and window options, printed by bwm --help
+void PrintUsage(FILE* fp);
@@ -1,16 +1,96 @@
 #include "config.h"
+#include "startup.h"
 
 #include <imgui.h>
 
 #include <algorithm>
+#include <array>
+#include <cerrno>
 #include <string>
-#include <unordered_map>
+#include <string_view>
 #include <vector>
 
 #include <cstdio>
+#include <cstring>
 #include <pwd.h>
+#include <sys/inotify.h>
 #include <unistd.h>
 
+struct ColorKeyword
+{
+	std::string_view	name;
+	ImGuiCol			color;
+};
+
+// Sorted by name for binary search
+static constexpr std::array<ColorKeyword, 17> s_color_keywords = {{
+	{ "background",			ImGuiCol_WindowBg },
+	{ "border",				ImGuiCol_Border },
+	{ "button",				ImGuiCol_Button },
+	{ "button_active",		ImGuiCol_ButtonActive },
+	{ "button_hover",		ImGuiCol_ButtonHovered },
+	{ "dropdown",			ImGuiCol_FrameBg },
+	{ "dropdown_hover",		ImGuiCol_FrameBgHovered },
+	{ "popup_background",	ImGuiCol_PopupBg },
+	{ "popup_shadow",		ImGuiCol_ModalWindowDimBg },
+	{ "selectable",			ImGuiCol_Header },
+	{ "selectable_active",	ImGuiCol_HeaderActive },
+	{ "selectable_hover",	ImGuiCol_HeaderHovered },
+	{ "table_border_inner",	ImGuiCol_TableBorderLight },
+	{ "table_border_outer",	ImGuiCol_TableBorderStrong },
+	{ "table_header",		ImGuiCol_TableHeaderBg },
+	{ "table_row",			ImGuiCol_TableRowBg },
+	{ "table_row_alt",		ImGuiCol_TableRowBgAlt },
+}};
+
+static constexpr bool keywords_sorted(const std::array<ColorKeyword, s_color_keywords.size()>& keywords)
+{
+	for (std::size_t i = 1; i < keywords.size(); i++)
+		if (!(keywords[i - 1].name < keywords[i].name))
+			return false;
+	return true;
+}
+static_assert(keywords_sorted(s_color_keywords), "color keywords must be sorted");
+
+static const ColorKeyword* find_color_keyword(std::string_view name)
+{
+	auto it = std::lower_bound(s_color_keywords.begin(), s_color_keywords.end(), name,
+		[](const ColorKeyword& keyword, std::string_view name) { return keyword.name < name; }
+	);
+	if (it == s_color_keywords.end() || it->name != name)
+		return nullptr;
+	return &*it;
+}
+
+// Everything the config file sets, parsed completely before any of it is
+// applied
+struct Config
+{
+	ImVec4		colors[ImGuiCol_COUNT];
+	bool		color_set[ImGuiCol_COUNT]	= {};
+
+	std::string	font_name;
+	std::string	font_file;
+	float		font_size	= 0.0f;
+};
+
+// Style colors before the config file was first applied, colors removed
+// from the file go back to these
+static ImVec4		s_default_colors[ImGuiCol_COUNT];
+static bool			s_defaults_saved	= false;
+
+// Font of the current atlas, the atlas is only rebuilt when it changes.
+// The name is only resolved with fc-match again when it changes.
+static std::string	s_font_name;
+static std::string	s_font_file;
+static float		s_font_size			= 0.0f;
+
+static int			s_inotify_fd		= -1;
+
+// Read by ConfigPreload() until ConfigApplyPreloaded()
+static Config		s_preloaded;
+static ImFontAtlas*	s_preloaded_atlas	= nullptr;
+
 template<typename... Args>
 void print_config_error(FILE* fp, int line, const char* fmt, Args&&... args)
 {
@@ -99,68 +179,53 @@ static std::string get_font_path(const std::string& font_name)
 	return buffer;
 }
 
-bool ParseConfig()
+static std::string get_config_dir()
+{
+	passwd* pwd = getpwuid(getuid());
+	return std::string(pwd->pw_dir) + "/.config/bwm";
+}
+
+// A missing config file is an empty config
+static bool read_config(Config& config)
 {
 	char buffer[1024];
 
-	passwd* pwd = getpwuid(getuid());
-	snprintf(buffer, sizeof(buffer), "%s/.config/bwm/config", pwd->pw_dir);
+	std::string path = get_config_dir() + "/config";
 
-	FILE* fp = fopen(buffer, "r");
+	FILE* fp = fopen(path.c_str(), "r");
 	if (fp == NULL)
 	{
 		fprintf(stderr, "Could not open config file\n");
 		return true;
 	}
 
-	ImGuiIO&	io		= ImGui::GetIO();
-	ImGuiStyle&	style	= ImGui::GetStyle();
-
-	std::unordered_map<std::string, ImGuiCol> color_words;
-	color_words["background"]			= ImGuiCol_WindowBg;
-	color_words["border"]				= ImGuiCol_Border;
-	color_words["button"]				= ImGuiCol_Button;
-	color_words["button_active"]		= ImGuiCol_ButtonActive;
-	color_words["button_hover"]			= ImGuiCol_ButtonHovered;
-	color_words["dropdown"]				= ImGuiCol_FrameBg;
-	color_words["dropdown_hover"]		= ImGuiCol_FrameBgHovered;
-	color_words["selectable"]			= ImGuiCol_Header;
-	color_words["selectable_active"]	= ImGuiCol_HeaderActive;
-	color_words["selectable_hover"]		= ImGuiCol_HeaderHovered;
-	color_words["popup_background"]		= ImGuiCol_PopupBg;
-	color_words["popup_shadow"]			= ImGuiCol_ModalWindowDimBg;
-	color_words["table_header"]			= ImGuiCol_TableHeaderBg;
-	color_words["table_row"]			= ImGuiCol_TableRowBg;
-	color_words["table_row_alt"]		= ImGuiCol_TableRowBgAlt;
-	color_words["table_border_inner"]	= ImGuiCol_TableBorderLight;
-	color_words["table_border_outer"]	= ImGuiCol_TableBorderStrong;
-
 	int line = 0;
 	while (fgets(buffer, sizeof(buffer), fp) != NULL)
 	{
 		line++;
 
 		std::vector<std::string> splitted = split_whitespace(buffer);
-		
+
 		if (splitted.empty() || splitted.front().front() == '#')
 			continue;
 
-		if (color_words.find(splitted[0]) != color_words.end())
+		if (const ColorKeyword* keyword = find_color_keyword(splitted[0]))
 		{
 			if (splitted.size() != 2)
 			{
 				print_config_error(fp, line, "usage: %s <color>", splitted[0].c_str());
 				return false;
 			}
-			
+
 			ImVec4 color;
 			if (!hexstr_to_color(splitted[1], color))
 			{
 				print_config_error(fp, line, "specify color as hex string '#xxxxxx' or '#xxxxxxxx'");
 				return false;
 			}
-			
-			style.Colors[color_words[splitted[0]]] = color;
+
+			config.colors[keyword->color]		= color;
+			config.color_set[keyword->color]	= true;
 		}
 		else if (splitted.front() == "font")
 		{
@@ -181,13 +246,6 @@ bool ParseConfig()
 				font += ' ' + splitted[i];
 			font.pop_back();
 
-			std::string file = get_font_path(font);
-			if (file.empty())
-			{
-				print_config_error(fp, line, "could not find font '%s'", font.c_str());
-				return false;
-			}
-
 			float size;
 
 			try
@@ -199,20 +257,182 @@ bool ParseConfig()
 				print_config_error(fp, line, "font size not a number");
 				return false;
 			}
-			
 
-			io.Fonts->AddFontFromFileTTF(file.c_str(), size);
+			// Only the first font is used as default font
+			if (!config.font_file.empty())
+				continue;
+
+			std::string file = (font == s_font_name) ? s_font_file : get_font_path(font);
+			if (file.empty())
+			{
+				print_config_error(fp, line, "could not find font '%s'", font.c_str());
+				return false;
+			}
+
+			config.font_name	= font;
+			config.font_file	= file;
+			config.font_size	= size;
 		}
 		else
 		{
 			print_config_error(fp, line, "unknown keyword '%s'", splitted[0].c_str());
 			return false;
 		}
+	}
+
+	fclose(fp);
+
+	return true;
+}
+
+// ImGui's default font if there is none or it can not be loaded
+static void add_font(ImFontAtlas* atlas, const std::string& file, float size)
+{
+	if (file.empty() || atlas->AddFontFromFileTTF(file.c_str(), size) == NULL)
+		atlas->AddFontDefault();
+}
 
+// Returns true if the font atlas was replaced
+static bool apply_config(const Config& config)
+{
+	ImGuiIO&	io		= ImGui::GetIO();
+	ImGuiStyle&	style	= ImGui::GetStyle();
 
+	if (!s_defaults_saved)
+	{
+		std::copy(std::begin(style.Colors), std::begin(style.Colors) + ImGuiCol_COUNT, s_default_colors);
+		s_defaults_saved = true;
 	}
 
-	fclose(fp);
+	for (int i = 0; i < ImGuiCol_COUNT; i++)
+		style.Colors[i] = config.color_set[i] ? config.colors[i] : s_default_colors[i];
+
+	s_font_name = config.font_name;
+
+	if (config.font_file == s_font_file && config.font_size == s_font_size)
+		return false;
+
+	s_font_file	= config.font_file;
+	s_font_size	= config.font_size;
+
+	io.Fonts->Clear();
+	add_font(io.Fonts, s_font_file, s_font_size);
 
 	return true;
-}
\ No newline at end of file
+}
+
+bool ParseConfig()
+{
+	Config config;
+	if (!read_config(config))
+		return false;
+
+	apply_config(config);
+	return true;
+}
+
+bool ConfigPreload()
+{
+	{
+		StartupScope scope(StartupPhase::config);
+		if (!read_config(s_preloaded))
+			return false;
+	}
+
+	StartupScope scope(StartupPhase::fonts);
+
+	s_preloaded_atlas = IM_NEW(ImFontAtlas)();
+	add_font(s_preloaded_atlas, s_preloaded.font_file, s_preloaded.font_size);
+	s_preloaded_atlas->Build();
+
+	// The atlas already has this font, applying does not rebuild it
+	s_font_name	= s_preloaded.font_name;
+	s_font_file	= s_preloaded.font_file;
+	s_font_size	= s_preloaded.font_size;
+
+	return true;
+}
+
+ImFontAtlas* ConfigTakeFontAtlas()
+{
+	ImFontAtlas* atlas = s_preloaded_atlas;
+	s_preloaded_atlas = nullptr;
+	return atlas;
+}
+
+void ConfigApplyPreloaded()
+{
+	apply_config(s_preloaded);
+	s_preloaded = Config();
+}
+
+bool ConfigWatch()
+{
+	if (s_inotify_fd != -1)
+		return true;
+
+	int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (fd == -1)
+	{
+		fprintf(stderr, "Could not watch config file: %s\n", strerror(errno));
+		return false;
+	}
+
+	// Editors replace the file on save, so the directory is watched
+	std::string dir = get_config_dir();
+	if (inotify_add_watch(fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE) == -1)
+	{
+		fprintf(stderr, "Could not watch %s: %s\n", dir.c_str(), strerror(errno));
+		close(fd);
+		return false;
+	}
+
+	s_inotify_fd = fd;
+	return true;
+}
+
+void ConfigUnwatch()
+{
+	if (s_inotify_fd == -1)
+		return;
+
+	close(s_inotify_fd);
+	s_inotify_fd = -1;
+}
+
+bool ConfigPoll()
+{
+	if (s_inotify_fd == -1)
+		return false;
+
+	alignas(inotify_event) char buffer[4096];
+
+	// Everything that happened since the last poll causes one reload
+	bool changed = false;
+	for (;;)
+	{
+		ssize_t nread = read(s_inotify_fd, buffer, sizeof(buffer));
+		if (nread == -1 && errno == EINTR)
+			continue;
+		if (nread <= 0)
+			break;
+
+		for (char* ptr = buffer; ptr < buffer + nread; )
+		{
+			const inotify_event* event = reinterpret_cast<const inotify_event*>(ptr);
+			if (event->len > 0 && strcmp(event->name, "config") == 0)
+				changed = true;
+			ptr += sizeof(inotify_event) + event->len;
+		}
+	}
+
+	if (!changed)
+		return false;
+
+	// A broken edit keeps the current config
+	Config config;
+	if (!read_config(config))
+		return false;
+
+	return apply_config(config);
+}
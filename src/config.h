@@ -1,3 +1,27 @@
 #pragma once
 
-bool ParseConfig();
\ No newline at end of file
+struct ImFontAtlas;
+
+// Loads ~/.config/bwm/config into the ImGui style and font atlas. The
+// whole file is validated before anything is applied.
+bool ParseConfig();
+
+// ParseConfig() split for startup. ConfigPreload() reads the file,
+// resolves the font and rasterizes it into a new atlas without an ImGui
+// context, so it can run on another thread while the window is created.
+// The atlas is then handed to the context (see UiWindowOptions) and
+// ConfigApplyPreloaded() applies the rest once the context exists.
+bool ConfigPreload();
+ImFontAtlas* ConfigTakeFontAtlas();
+void ConfigApplyPreloaded();
+
+// Watches the config file with inotify so ConfigPoll() can apply edits
+// while bwm runs
+bool ConfigWatch();
+void ConfigUnwatch();
+
+// Applies the config file if it changed since the last call, a file with
+// errors is reported and ignored. Must be called outside of a frame.
+// Returns true if the font atlas was replaced and has to be uploaded
+// again, see UiFontsChanged().
+bool ConfigPoll();
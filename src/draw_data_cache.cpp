@@ -0,0 +1,104 @@
+#include "draw_data_cache.h"
+
+#include <cstring>
+
+static constexpr std::uint64_t s_hash_seed		= 0x9E3779B97F4A7C15ull;
+static constexpr std::uint64_t s_hash_multiply	= 0xFF51AFD7ED558CCDull;
+
+static inline std::uint64_t hash_word(std::uint64_t hash, std::uint64_t word)
+{
+	hash ^= word;
+	hash *= s_hash_multiply;
+	return hash ^ (hash >> 32);
+}
+
+static std::uint64_t hash_bytes(std::uint64_t hash, const void* data, std::size_t size)
+{
+	const unsigned char* bytes = static_cast<const unsigned char*>(data);
+
+	std::size_t i = 0;
+	for (; i + 8 <= size; i += 8)
+	{
+		std::uint64_t word;
+		std::memcpy(&word, bytes + i, sizeof(word));
+		hash = hash_word(hash, word);
+	}
+
+	if (i < size)
+	{
+		std::uint64_t word = 0;
+		std::memcpy(&word, bytes + i, size - i);
+		hash = hash_word(hash, word);
+	}
+
+	return hash_word(hash, size);
+}
+
+static inline std::uint64_t hash_float(std::uint64_t hash, float value)
+{
+	std::uint32_t bits;
+	std::memcpy(&bits, &value, sizeof(bits));
+	return hash_word(hash, bits);
+}
+
+static inline std::uint64_t hash_vec(std::uint64_t hash, const ImVec2& value)
+{
+	return hash_float(hash_float(hash, value.x), value.y);
+}
+
+// Fields are hashed one by one, the structs have padding
+static std::uint64_t hash_command(std::uint64_t hash, const ImDrawCmd& cmd)
+{
+	hash = hash_float(hash, cmd.ClipRect.x);
+	hash = hash_float(hash, cmd.ClipRect.y);
+	hash = hash_float(hash, cmd.ClipRect.z);
+	hash = hash_float(hash, cmd.ClipRect.w);
+	hash = hash_word(hash, (std::uint64_t)(std::uintptr_t)cmd.GetTexID());
+	hash = hash_word(hash, cmd.VtxOffset);
+	hash = hash_word(hash, cmd.IdxOffset);
+	hash = hash_word(hash, cmd.ElemCount);
+	hash = hash_word(hash, (std::uint64_t)(std::uintptr_t)cmd.UserCallback);
+	hash = hash_word(hash, (std::uint64_t)(std::uintptr_t)cmd.UserCallbackData);
+	return hash;
+}
+
+bool DrawDataCache::Update(const ImDrawData* draw_data)
+{
+	std::uint64_t hash = s_hash_seed;
+	hash = hash_vec(hash, draw_data->DisplayPos);
+	hash = hash_vec(hash, draw_data->DisplaySize);
+	hash = hash_vec(hash, draw_data->FramebufferScale);
+	hash = hash_word(hash, draw_data->CmdListsCount);
+
+	for (int i = 0; i < draw_data->CmdListsCount; i++)
+	{
+		const ImDrawList* draw_list = draw_data->CmdLists[i];
+
+		for (const ImDrawCmd& cmd : draw_list->CmdBuffer)
+		{
+			// Callbacks can draw anything, their output can not be hashed
+			if (cmd.UserCallback && cmd.UserCallback != ImDrawCallback_ResetRenderState)
+			{
+				m_valid = false;
+				m_rendered++;
+				return true;
+			}
+			hash = hash_command(hash, cmd);
+		}
+
+		// ImDrawVert has no padding
+		hash = hash_bytes(hash, draw_list->VtxBuffer.Data, draw_list->VtxBuffer.size_in_bytes());
+		hash = hash_bytes(hash, draw_list->IdxBuffer.Data, draw_list->IdxBuffer.size_in_bytes());
+	}
+
+	if (m_valid && hash == m_hash)
+	{
+		m_elided++;
+		return false;
+	}
+
+	m_hash	= hash;
+	m_valid	= true;
+	m_rendered++;
+	return true;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <imgui.h>
+
+#include <cstdint>
+
+// Detects frames whose draw data is identical to the previous frame's, so
+// rendering, upload and presentation can be skipped for them. A static UI
+// produces the same vertices, indices and commands every frame.
+//
+// Frames are compared by a 64 bit hash of everything the renderers read,
+// the previous frame's buffers are not kept.
+class DrawDataCache
+{
+public:
+	// Returns true if draw_data has to be rendered, false if it equals the
+	// frame given last and the cache was not invalidated since
+	bool Update(const ImDrawData* draw_data);
+
+	// Forces the next frame to be rendered, for expose events and for
+	// frames that were not presented
+	void Invalidate() { m_valid = false; }
+
+	std::uint64_t GetRenderedCount() const	{ return m_rendered; }
+	std::uint64_t GetElidedCount() const	{ return m_elided; }
+
+private:
+	std::uint64_t	m_hash		= 0;
+	bool			m_valid		= false;
+
+	std::uint64_t	m_rendered	= 0;
+	std::uint64_t	m_elided	= 0;
+};
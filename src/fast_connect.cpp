@@ -0,0 +1,171 @@
+#include "fast_connect.h"
+#include "startup.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cstdio>
+
+// How long to wait for a known network to show up after starting the scan
+static constexpr std::chrono::seconds			s_scan_timeout { 8 };
+static constexpr std::chrono::milliseconds		s_poll_interval { 200 };
+
+static const Network* find_connected(const WirelessState& state)
+{
+	for (const Network& network : state.networks)
+	{
+		if (network.connected)
+			return &network;
+	}
+	return nullptr;
+}
+
+// Networks are sorted by signal, the first known one is the strongest
+static const Network* find_strongest_known(const WirelessState& state)
+{
+	for (const Network& network : state.networks)
+	{
+		auto known = std::find_if(state.known_networks.begin(), state.known_networks.end(), [&](const Network& n) {
+			return n.ssid == network.ssid && n.security == network.security;
+		});
+		if (known != state.known_networks.end())
+			return &network;
+	}
+	return nullptr;
+}
+
+FastConnect::~FastConnect()
+{
+	if (m_thread.joinable())
+		m_thread.join();
+}
+
+void FastConnect::Start(WirelessBackend backend)
+{
+	m_thread = std::thread(&FastConnect::ThreadMain, this, backend);
+}
+
+WirelessManager* FastConnect::TakeManager()
+{
+	std::unique_lock lock(m_mutex);
+	m_condition.wait(lock, [this] { return m_initialized; });
+	return m_manager;
+}
+
+void FastConnect::HoldQueue(WirelessRequestQueue* requests)
+{
+	std::lock_guard lock(m_mutex);
+	if (m_done)
+		return;
+	requests->Hold();
+	m_held_queue = requests;
+}
+
+void FastConnect::ThreadMain(WirelessBackend backend)
+{
+	WirelessManager* manager = nullptr;
+	{
+		StartupScope scope(StartupPhase::backend);
+		manager = WirelessManager::Create(backend);
+	}
+
+	{
+		std::lock_guard lock(m_mutex);
+		m_manager		= manager;
+		m_initialized	= true;
+	}
+	m_condition.notify_all();
+
+	if (manager)
+		Connect(manager);
+
+	std::lock_guard lock(m_mutex);
+	m_done = true;
+	if (m_held_queue)
+		m_held_queue->Release();
+}
+
+void FastConnect::Connect(WirelessManager* manager)
+{
+	WirelessState state = manager->CopyState();
+	const Device& device = state.devices[state.current_device];
+	if (device.power != PowerState::on || device.mode != DeviceMode::station)
+	{
+		fprintf(stderr, "fast connect: %s is not a powered station, skipped\n", device.name.c_str());
+		return;
+	}
+
+	manager->UpdateNetworks();
+	state = manager->CopyState();
+	if (const Network* network = find_connected(state))
+	{
+		Report("already connected to", network->ssid.c_str());
+		return;
+	}
+
+	// A failed scan still leaves the backend's earlier results to pick from
+	MetricsClock::time_point start = MetricsClock::now();
+	bool scanned = false;
+	{
+		StartupScope scope(StartupPhase::first_scan);
+		scanned = manager->Scan();
+	}
+	MetricsRecordOperation(MetricsOperation::scan, MetricsClock::now() - start, scanned);
+
+	manager->UpdateKnownNetworks();
+
+	// Polls until the backend's autoconnect won or a known network is in
+	// range, rather than waiting for the whole scan to finish
+	MetricsClock::time_point deadline = MetricsClock::now() + s_scan_timeout;
+	Network network;
+	{
+		BWM_TRACE_SCOPE("fast connect scan");
+		for (;;)
+		{
+			manager->UpdateNetworks();
+			state = manager->CopyState();
+
+			if (const Network* connected = find_connected(state))
+			{
+				Report("autoconnected to", connected->ssid.c_str());
+				return;
+			}
+
+			if (const Network* known = find_strongest_known(state))
+			{
+				network = *known;
+				break;
+			}
+
+			if (MetricsClock::now() >= deadline)
+			{
+				fprintf(stderr, "fast connect: no known network in range\n");
+				return;
+			}
+
+			std::this_thread::sleep_for(s_poll_interval);
+		}
+	}
+
+	BWM_TRACE_SCOPE("fast connect", network.ssid.c_str());
+
+	start = MetricsClock::now();
+	bool connected = manager->Connect(network);
+	MetricsClock::duration duration = MetricsClock::now() - start;
+	MetricsRecordOperation(MetricsOperation::connect, duration, connected);
+	MetricsRecordConnect(ConnectPhase::connect, network.security, duration, connected);
+
+	if (!connected)
+	{
+		fprintf(stderr, "fast connect: could not connect to '%s'\n", network.ssid.c_str());
+		return;
+	}
+
+	Report("connected to", network.ssid.c_str());
+}
+
+void FastConnect::Report(const char* what, const char* ssid)
+{
+	long ms = std::chrono::duration_cast<std::chrono::milliseconds>(MetricsClock::now() - m_process_start).count();
+	fprintf(stderr, "fast connect: %s '%s' %ld ms after start\n", what, ssid, ms);
+	BWM_TRACE_INSTANT("fast connect connected", ssid);
+}
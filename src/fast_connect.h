@@ -0,0 +1,54 @@
+#pragma once
+
+#include "metrics.h"
+#include "wireless_manager.h"
+#include "wireless_request_queue.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+// Opt-in startup path that brings a connection up while the window is still
+// being created. The backend is initialized on its own thread and, unless
+// a network is connected already, it scans right away and connects to the
+// strongest known network in range instead of waiting for the backend's
+// autoconnect. The time from process start to connected is printed to
+// stderr.
+class FastConnect
+{
+public:
+	explicit FastConnect(MetricsClock::time_point process_start) : m_process_start(process_start) {}
+
+	// Waits for a connect in progress, delete before the manager
+	~FastConnect();
+
+	FastConnect(const FastConnect&) = delete;
+	FastConnect& operator=(const FastConnect&) = delete;
+
+	void Start(WirelessBackend backend);
+
+	// Waits until the backend is initialized but not for the connect. The
+	// caller owns the manager, nullptr if it could not be initialized.
+	WirelessManager* TakeManager();
+
+	// The manager is not thread safe, requests submitted to the queue of
+	// the taken manager wait until the fast connect is done. Call before
+	// submitting any and delete the queue after this.
+	void HoldQueue(WirelessRequestQueue* requests);
+
+private:
+	void ThreadMain(WirelessBackend backend);
+	void Connect(WirelessManager* manager);
+	void Report(const char* what, const char* ssid);
+
+private:
+	MetricsClock::time_point	m_process_start;
+	std::thread					m_thread;
+
+	std::mutex					m_mutex;
+	std::condition_variable		m_condition;
+	WirelessManager*			m_manager		= nullptr;
+	bool						m_initialized	= false;
+	bool						m_done			= false;
+	WirelessRequestQueue*		m_held_queue	= nullptr;
+};
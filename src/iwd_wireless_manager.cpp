@@ -1,65 +1,165 @@
 #include "iwd_wireless_manager.h"
 
 #include "iwd_wrapper.h"
+#include "process_replay.h"
 
 #include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+IwdWirelessManager::~IwdWirelessManager()
+{
+	delete m_scan_reader;
+}
 
 bool IwdWirelessManager::Init()
 {
-	if (!iwd_get_devices(m_devices))
+	// Recordings and replays only cover iwctl, BWM_NL80211=0 disables the
+	// kernel reader as well
+	const char* nl80211 = getenv("BWM_NL80211");
+	if (!ProcessIsRecording() && !ProcessIsReplaying() && !(nl80211 && strcmp(nl80211, "0") == 0))
+	{
+		m_scan_reader = new Nl80211ScanReader();
+		if (!m_scan_reader->Init())
+		{
+			delete m_scan_reader;
+			m_scan_reader = nullptr;
+		}
+	}
+
+	std::lock_guard lock(m_state_mutex);
+
+	if (!iwd_get_devices(m_state.devices))
 		return false;
 
-	if (m_devices.empty())
+	if (m_state.devices.empty())
 		return false;
 
-	m_current_index = 0;
-	for (std::size_t i = 0; i < m_devices.size(); i++)
+	m_state.current_device = 0;
+	for (std::size_t i = 0; i < m_state.devices.size(); i++)
 	{
-		if (m_devices[i].powered == "on")
+		if (m_state.devices[i].power == PowerState::on)
 		{
-			m_current_index = i;
+			m_state.current_device = i;
 			break;
 		}
 	}
+
+	PublishState();
 	
 	return true;
 }
 
 bool IwdWirelessManager::Scan()
 {
-	return iwd_scan(m_devices[m_current_index]);
+	return iwd_scan(GetWorkingDevice());
+}
+
+bool IwdWirelessManager::ReadScanResults(const Device& device)
+{
+	if (!m_scan_reader->GetScanResults(device.name.c_str(), m_scan_results))
+		return false;
+
+	// Same order as iwctl, the connected network first and then by signal
+	std::stable_sort(m_scan_results.begin(), m_scan_results.end(), [](const ScanResult& a, const ScanResult& b) {
+		if (a.associated != b.associated)
+			return a.associated;
+		return a.signal > b.signal;
+	});
+
+	m_network_buffer.clear();
+	for (const ScanResult& result : m_scan_results)
+	{
+		// One entry per network, from its strongest access point
+		auto it = std::find_if(m_network_buffer.begin(), m_network_buffer.end(), [&](const Network& n) { return n.ssid == result.ssid; });
+		if (it != m_network_buffer.end())
+			continue;
+
+		Network& network = m_network_buffer.emplace_back();
+		network.ssid		= result.ssid;
+		network.security	= result.security;
+		network.connected	= result.associated;
+		network.signal		= result.signal;
+	}
+
+	return true;
 }
 
 bool IwdWirelessManager::UpdateNetworks()
 {
-	return iwd_get_networks(m_devices[m_current_index], m_networks);
+	std::lock_guard buffer_lock(m_network_buffer_mutex);
+
+	Device device = GetWorkingDevice();
+
+	if (m_scan_reader && device.power == PowerState::on && device.mode == DeviceMode::station)
+	{
+		// Without a finished scan or a link change since the last read
+		// the networks are still up to date
+		if (!m_scan_reader->PollEvents() && device.name == m_scan_device)
+			return true;
+
+		m_scan_device = DeviceName();
+		if (ReadScanResults(device))
+			m_scan_device = device.name;
+		else if (!iwd_get_networks(device, m_network_buffer))
+			return false;
+	}
+	else if (!iwd_get_networks(device, m_network_buffer))
+	{
+		return false;
+	}
+
+	std::lock_guard state_lock(m_state_mutex);
+	if (m_network_buffer != m_state.networks)
+	{
+		m_state.networks.swap(m_network_buffer);
+		PublishState();
+	}
+
+	return true;
 }
 
 bool IwdWirelessManager::Connect(const Network& network, const std::string& password)
 {
-	if (!iwd_connect(m_devices[m_current_index], network, password))
+	if (!iwd_connect(GetWorkingDevice(), network, password))
 		return false;
 
-	for (Network& n : m_networks)
+	std::lock_guard lock(m_state_mutex);
+	for (Network& n : m_state.networks)
 		n.connected = (n.ssid == network.ssid);
+	PublishState();
 
 	return true;
 }
 
 bool IwdWirelessManager::Disconnect()
 {
-	if (!iwd_disconnect(m_devices[m_current_index]))
+	if (!iwd_disconnect(GetWorkingDevice()))
 		return false;
 
-	for (Network& network : m_networks)
+	std::lock_guard lock(m_state_mutex);
+	for (Network& network : m_state.networks)
 		network.connected = false;
+	PublishState();
 
 	return true;
 }
 
 bool IwdWirelessManager::UpdateKnownNetworks()
 {
-	return iwd_get_known_networks(m_known_networks);
+	std::lock_guard buffer_lock(m_known_network_buffer_mutex);
+
+	if (!iwd_get_known_networks(m_known_network_buffer))
+		return false;
+
+	std::lock_guard state_lock(m_state_mutex);
+	if (m_known_network_buffer != m_state.known_networks)
+	{
+		m_state.known_networks.swap(m_known_network_buffer);
+		PublishState();
+	}
+
+	return true;
 }
 
 bool IwdWirelessManager::ForgetKnownNetwork(const Network& network)
@@ -67,33 +167,114 @@ bool IwdWirelessManager::ForgetKnownNetwork(const Network& network)
 	if (!iwd_forget_known_network(network))
 		return false;
 
-	auto it = std::remove_if(m_known_networks.begin(), m_known_networks.end(), [&](const Network& n) { return n.ssid == network.ssid; });
-	m_known_networks.erase(it, m_known_networks.end());
+	std::lock_guard lock(m_state_mutex);
+	auto& known_networks = m_state.known_networks;
+	auto it = std::remove_if(known_networks.begin(), known_networks.end(), [&](const Network& n) { return n.ssid == network.ssid; });
+	known_networks.erase(it, known_networks.end());
+	PublishState();
 
 	return true;
 }
 
+static const std::string* find_station_property(const std::vector<StationProperty>& station, std::string_view name)
+{
+	for (const StationProperty& property : station)
+		if (property.name == name)
+			return &property.value;
+	return nullptr;
+}
+
+bool IwdWirelessManager::GetNetworkDetails(const Network& network, NetworkDetails& out)
+{
+	Device device = GetWorkingDevice();
+
+	out.bsses.clear();
+	out.station.clear();
+
+	// Every access point of the network from the kernel's scan cache,
+	// iwctl only lists networks
+	if (m_scan_reader)
+	{
+		std::vector<ScanResult> results;
+		{
+			std::lock_guard lock(m_network_buffer_mutex);
+			if (!m_scan_reader->GetScanResults(device.name.c_str(), results))
+				results.clear();
+		}
+
+		for (const ScanResult& result : results)
+		{
+			if (result.ssid != network.ssid || result.security != network.security)
+				continue;
+
+			Bss& bss = out.bsses.emplace_back();
+			bss.bssid		= result.bssid;
+			bss.frequency	= result.frequency;
+			bss.signal		= result.signal;
+			bss.signal_dbm	= result.signal_dbm;
+			bss.connected	= result.associated;
+		}
+	}
+
+	if (network.connected && !iwd_get_station(device, out.station))
+		return false;
+
+	// Without nl80211 the connected access point is all there is
+	if (out.bsses.empty() && network.connected)
+	{
+		const std::string* bssid		= find_station_property(out.station, "ConnectedBss");
+		const std::string* frequency	= find_station_property(out.station, "Frequency");
+		const std::string* rssi			= find_station_property(out.station, "RSSI");
+		if (bssid)
+		{
+			Bss& bss = out.bsses.emplace_back();
+			bss.bssid		= bssid->c_str();
+			bss.frequency	= frequency ? std::uint32_t(atoi(frequency->c_str())) : 0;
+			bss.signal_dbm	= rssi ? std::int16_t(atoi(rssi->c_str())) : 0;
+			bss.signal		= bss.signal_dbm ? std::int8_t(SignalPercent(bss.signal_dbm)) : -1;
+			bss.connected	= true;
+		}
+	}
+
+	std::stable_sort(out.bsses.begin(), out.bsses.end(), [](const Bss& a, const Bss& b) { return a.signal > b.signal; });
+	return true;
+}
+
 bool IwdWirelessManager::SetCurrentDevice(const Device& device)
 {
-	auto it = std::find_if(m_devices.begin(), m_devices.end(), [&](const auto& d) { return d.name == device.name; });
-	if (it == m_devices.end())
+	std::lock_guard lock(m_state_mutex);
+
+	auto& devices = m_state.devices;
+	auto it = std::find_if(devices.begin(), devices.end(), [&](const auto& d) { return d.name == device.name; });
+	if (it == devices.end())
 		return false;
 
-	m_current_index = std::distance(m_devices.begin(), it);
+	m_state.current_device = std::distance(devices.begin(), it);
+	PublishState();
 	return true;
 }
 
 bool IwdWirelessManager::ActivateDevice()
 {
-	Device& current_device = m_devices[m_current_index];
+	Device device = GetWorkingDevice();
 
-	if (!iwd_adapter_power_on(current_device))
+	{
+		// The device was off, its scan cache is read again
+		std::lock_guard lock(m_network_buffer_mutex);
+		m_scan_device = DeviceName();
+	}
+
+	if (!iwd_adapter_power_on(device))
 		return false;
 
-	if (!iwd_device_power_on(current_device))
+	if (!iwd_device_power_on(device))
 		return false;
 
-	current_device.powered = "on";
+	std::lock_guard lock(m_state_mutex);
+	for (Device& d : m_state.devices)
+		if (d.name == device.name)
+			d.power = PowerState::on;
+	PublishState();
 
 	return true;
-}
\ No newline at end of file
+}
@@ -1,21 +1,21 @@
 #pragma once
 
+#include "nl80211_scan_reader.h"
 #include "wireless_manager.h"
 
 
 class IwdWirelessManager : public WirelessManager
 {
 public:
+	virtual ~IwdWirelessManager() override;
+
 	virtual bool Init() override;
 
-	virtual const Device& GetCurrentDevice() const override { return m_devices[m_current_index]; }
+	virtual WirelessBackend GetBackend() const override { return WirelessBackend::iwd; }
+
 	virtual bool SetCurrentDevice(const Device& device) override;
 	virtual bool ActivateDevice() override;
 
-	virtual const std::vector<Device>&  GetDevices() const override			{ return m_devices; }
-	virtual const std::vector<Network>& GetNetworks() const override		{ return m_networks; }
-	virtual const std::vector<Network>& GetKnownNetworks() const override	{ return m_known_networks; }
-
 	virtual bool Scan() override;
 	virtual bool UpdateNetworks() override;
 
@@ -25,9 +25,26 @@ public:
 	virtual bool UpdateKnownNetworks() override;
 	virtual bool ForgetKnownNetwork(const Network& network) override;
 
+	virtual bool GetNetworkDetails(const Network& network, NetworkDetails& out) override;
+
+private:
+	bool ReadScanResults(const Device& device);
+
 private:
-	std::size_t				m_current_index;
-	std::vector<Device>		m_devices;
-	std::vector<Network>	m_networks;
-	std::vector<Network>	m_known_networks;
-};
\ No newline at end of file
+	// Refreshes are parsed into these buffers, reusing their capacity,
+	// and swapped into m_state only if the result differs. With an
+	// unchanged environment a refresh does not touch the heap and does
+	// not publish a new snapshot.
+	std::mutex				m_network_buffer_mutex;
+	std::vector<Network>	m_network_buffer;
+
+	// Networks are read from the kernel's scan cache instead of iwctl when
+	// nl80211 is available, only after it could have changed. Used with
+	// m_network_buffer_mutex held.
+	Nl80211ScanReader*		m_scan_reader	= nullptr;
+	std::vector<ScanResult>	m_scan_results;
+	DeviceName				m_scan_device;
+
+	std::mutex				m_known_network_buffer_mutex;
+	std::vector<Network>	m_known_network_buffer;
+};
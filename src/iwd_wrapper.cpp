@@ -1,10 +1,19 @@
 #include "iwd_wrapper.h"
 
+#include "metrics.h"
+#include "process.h"
+#include "stats.h"
+#include "trace.h"
+
+#include <cerrno>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
-
-#define PARSE_COLOR " | sed -e 's/\\x1b\\[[0-9;]*m//g'"
+#include <fcntl.h>
+#include <filesystem>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 struct PropertyInfo
 {
@@ -12,13 +21,74 @@ struct PropertyInfo
 	std::size_t max_len;
 };
 
-static std::string strip_property(const char* buffer, const PropertyInfo& info)
+static std::string_view strip_property(const char* buffer, const PropertyInfo& info)
 {
 	std::size_t pos = info.offset;
-	std::size_t len = info.max_len;
-	while (isspace(buffer[pos + len - 1]))
+	std::size_t len = strnlen(buffer, pos + info.max_len);
+	if (len <= pos)
+		return std::string_view();
+	len -= pos;
+	while (len > 0 && isspace(buffer[pos + len - 1]))
 		len--;
-	return std::string(buffer + pos, len);
+	return std::string_view(buffer + pos, len);
+}
+
+static PowerState parse_power_state(std::string_view str)
+{
+	return (str == "on") ? PowerState::on : PowerState::off;
+}
+
+static DeviceMode parse_device_mode(std::string_view str)
+{
+	if (str == "station")	return DeviceMode::station;
+	if (str == "ap")		return DeviceMode::ap;
+	if (str == "ad-hoc")	return DeviceMode::ad_hoc;
+	return DeviceMode::unknown;
+}
+
+static NetworkSecurity parse_network_security(std::string_view str)
+{
+	if (str == "open")		return NetworkSecurity::open;
+	if (str == "wep")		return NetworkSecurity::wep;
+	if (str == "psk")		return NetworkSecurity::psk;
+	if (str == "8021x")		return NetworkSecurity::ieee8021x;
+	return NetworkSecurity::unknown;
+}
+
+static bool is_station(const Device& device)
+{
+	return device.power == PowerState::on && device.mode == DeviceMode::station;
+}
+
+// Removes ANSI color sequences ("\x1b[...m") that iwctl writes even
+// when stdout is not a terminal
+static void strip_color(char* buffer)
+{
+	char* out = buffer;
+	for (const char* in = buffer; *in; in++)
+	{
+		if (in[0] == '\x1b' && in[1] == '[')
+		{
+			const char* end = in + 2;
+			while (isdigit(*end) || *end == ';')
+				end++;
+			if (*end == 'm')
+			{
+				in = end;
+				continue;
+			}
+		}
+		*out++ = *in;
+	}
+	*out = '\0';
+}
+
+static bool read_line(ProcessReader& reader, char* buffer, std::size_t size)
+{
+	if (!reader.ReadLine(buffer, size))
+		return false;
+	strip_color(buffer);
+	return true;
 }
 
 static bool parse_buffer_property_info(const char* buffer, const char* key, PropertyInfo& out_info)
@@ -38,10 +108,14 @@ static bool parse_buffer_property_info(const char* buffer, const char* key, Prop
 
 bool iwd_get_devices(std::vector<Device>& out)
 {
+	BWM_STATS_SCOPE(iwd_get_devices);
+	BWM_TRACE_SCOPE("iwd_get_devices");
+
 	char buffer[1024];
 
-	FILE* fp = popen("iwctl device list" PARSE_COLOR, "r");
-	if (fp == NULL)
+	const char* argv[] = { "iwctl", "device", "list", NULL };
+	ProcessReader reader;
+	if (!reader.Open(argv))
 		return false;
 
 	PropertyInfo prop_name;
@@ -53,7 +127,7 @@ bool iwd_get_devices(std::vector<Device>& out)
 	for (int i = 0; i < 4; i++)
 	{
 		bool fail = false;
-		if (fgets(buffer, sizeof(buffer), fp) == NULL)
+		if (!read_line(reader, buffer, sizeof(buffer)))
 			fail = true;
 		else if (i == 2)
 		{
@@ -71,14 +145,14 @@ bool iwd_get_devices(std::vector<Device>& out)
 
 		if (fail)
 		{
-			pclose(fp);
+			reader.Close();
 			return false;
 		}
 	}
 
 	std::vector<Device> devices;
 
-	while (fgets(buffer, sizeof(buffer), fp) != NULL)
+	while (read_line(reader, buffer, sizeof(buffer)))
 	{
 		if (buffer[0] == '\n')
 			continue;
@@ -86,43 +160,50 @@ bool iwd_get_devices(std::vector<Device>& out)
 		Device device;
 		device.name		= strip_property(buffer, prop_name);
 		device.address	= strip_property(buffer, prop_address);
-		device.powered	= strip_property(buffer, prop_powered);
+		device.power	= parse_power_state(strip_property(buffer, prop_powered));
 		device.adapter	= strip_property(buffer, prop_adapter);
-		device.mode		= strip_property(buffer, prop_mode);
-		devices.push_back(std::move(device));
+		device.mode		= parse_device_mode(strip_property(buffer, prop_mode));
+		devices.push_back(device);
 	}
 
-	if (pclose(fp) != 0)
+	if (!reader.Close())
 		return false;
 
 	out = std::move(devices);
 	return true;
 }
 
-bool iwd_set_adapter_property(const std::string& adapter, const std::string& property, const std::string& value)
+bool iwd_set_adapter_property(const Device& device, const char* property, const char* value)
 {
-	char buffer[1024];
-	snprintf(buffer, sizeof(buffer), "iwctl adapter %s set-property %s %s &> /dev/null", adapter.c_str(), property.c_str(), value.c_str());
-	return system(buffer) == 0;
+	BWM_STATS_SCOPE(iwd_set_adapter_property);
+	BWM_TRACE_SCOPE("iwd_set_adapter_property", property);
+
+	const char* argv[] = { "iwctl", "adapter", device.adapter.c_str(), "set-property", property, value, NULL };
+	return run_process(argv);
 }
 
-bool iwd_set_device_property(const Device& device, const std::string& property, const std::string& value)
+bool iwd_set_device_property(const Device& device, const char* property, const char* value)
 {
-	char buffer[1024];
-	snprintf(buffer, sizeof(buffer), "iwctl device %s set-property %s %s &> /dev/null", device.name.c_str(), property.c_str(), value.c_str());
-	return system(buffer) == 0;
+	BWM_STATS_SCOPE(iwd_set_device_property);
+	BWM_TRACE_SCOPE("iwd_set_device_property", property);
+
+	const char* argv[] = { "iwctl", "device", device.name.c_str(), "set-property", property, value, NULL };
+	return run_process(argv);
 }
 
 bool iwd_get_networks(const Device& device, std::vector<Network>& out)
 {
-	if (device.powered != "on" || device.mode != "station")
+	BWM_STATS_SCOPE(iwd_get_networks);
+	BWM_TRACE_SCOPE("iwd_get_networks", device.name.c_str());
+
+	if (!is_station(device))
 		return false;
 
 	char buffer[1024];
 
-	snprintf(buffer, sizeof(buffer), "iwctl station %s get-networks" PARSE_COLOR, device.name.c_str());
-	FILE* fp = popen(buffer, "r");
-	if (fp == NULL)
+	const char* argv[] = { "iwctl", "station", device.name.c_str(), "get-networks", NULL };
+	ProcessReader reader;
+	if (!reader.Open(argv))
 		return false;
 
 	PropertyInfo prop_network_name;
@@ -131,7 +212,7 @@ bool iwd_get_networks(const Device& device, std::vector<Network>& out)
 	for (int i = 0; i < 4; i++)
 	{
 		bool fail = false;
-		if (fgets(buffer, sizeof(buffer), fp) == NULL)
+		if (!read_line(reader, buffer, sizeof(buffer)))
 			fail = true;
 		else if (i == 2)
 		{
@@ -143,68 +224,77 @@ bool iwd_get_networks(const Device& device, std::vector<Network>& out)
 
 		if (fail)
 		{
-			pclose(fp);
+			reader.Close();
 			return false;
 		}
 	}
 
-	std::vector<Network> networks;
+	out.clear();
 
-	while (fgets(buffer, sizeof(buffer), fp) != NULL)
+	while (read_line(reader, buffer, sizeof(buffer)))
 	{
 		if (buffer[0] == '\n')
 			continue;
 
 		Network network;
 		network.ssid		= strip_property(buffer, prop_network_name);
-		network.security	= strip_property(buffer, prop_security);
+		network.security	= parse_network_security(strip_property(buffer, prop_security));
 		network.connected	= (buffer[2] == '>');
-		networks.push_back(std::move(network));
+		network.signal		= -1;
+		out.push_back(network);
 	}
 
-	if (pclose(fp) != 0)
-		return false;
-
-	out = std::move(networks);
-	return true;
+	return reader.Close();
 }
 
 bool iwd_scan(const Device& device)
 {
-	if (device.powered != "on" || device.mode != "station")
+	BWM_STATS_SCOPE(iwd_scan);
+	BWM_TRACE_SCOPE("iwd_scan", device.name.c_str());
+
+	if (!is_station(device))
 		return false;
-	char command[1024];
-	snprintf(command, sizeof(command), "iwctl station %s scan &> /dev/null", device.name.c_str());
-	return system(command) == 0;
+	const char* argv[] = { "iwctl", "station", device.name.c_str(), "scan", NULL };
+	return run_process(argv);
 }
 
 bool iwd_connect(const Device& device, const Network& network, const std::string& password)
 {
-	if (device.powered != "on" || device.mode != "station")
+	BWM_STATS_SCOPE(iwd_connect);
+	BWM_TRACE_SCOPE("iwd_connect", network.ssid.c_str());
+
+	if (!is_station(device))
 		return false;
-	char command[1024];
 	if (password.empty())
-		snprintf(command, sizeof(command), "iwctl --dont-ask station %s connect \"%s\" &> /dev/null", device.name.c_str(), network.ssid.c_str());
-	else
-		snprintf(command, sizeof(command), "iwctl --passphrase %s station %s connect \"%s\" &> /dev/null", password.c_str(), device.name.c_str(), network.ssid.c_str());
-	return system(command) == 0;
+	{
+		const char* argv[] = { "iwctl", "--dont-ask", "station", device.name.c_str(), "connect", network.ssid.c_str(), NULL };
+		return run_process(argv);
+	}
+	const char* argv[] = { "iwctl", "--passphrase", password.c_str(), "station", device.name.c_str(), "connect", network.ssid.c_str(), NULL };
+	return run_process(argv);
 }
 
 bool iwd_disconnect(const Device& device)
 {
-	if (device.powered != "on" || device.mode != "station")
+	BWM_STATS_SCOPE(iwd_disconnect);
+	BWM_TRACE_SCOPE("iwd_disconnect", device.name.c_str());
+
+	if (!is_station(device))
 		return false;
-	char command[1024];
-	snprintf(command, sizeof(command), "iwctl station %s disconnect &> /dev/null", device.name.c_str());
-	return system(command) == 0;
+	const char* argv[] = { "iwctl", "station", device.name.c_str(), "disconnect", NULL };
+	return run_process(argv);
 }
 
 bool iwd_get_known_networks(std::vector<Network>& out)
 {
+	BWM_STATS_SCOPE(iwd_get_known_networks);
+	BWM_TRACE_SCOPE("iwd_get_known_networks");
+
 	char buffer[1024];
 
-	FILE* fp = popen("iwctl known-networks list" PARSE_COLOR, "r");
-	if (fp == NULL)
+	const char* argv[] = { "iwctl", "known-networks", "list", NULL };
+	ProcessReader reader;
+	if (!reader.Open(argv))
 		return false;
 
 	PropertyInfo prop_name;
@@ -213,7 +303,7 @@ bool iwd_get_known_networks(std::vector<Network>& out)
 	for (int i = 0; i < 4; i++)
 	{
 		bool fail = false;
-		if (fgets(buffer, sizeof(buffer), fp) == NULL)
+		if (!read_line(reader, buffer, sizeof(buffer)))
 			fail = true;
 		else if (i == 2)
 		{
@@ -225,42 +315,208 @@ bool iwd_get_known_networks(std::vector<Network>& out)
 
 		if (fail)
 		{
-			pclose(fp);
+			reader.Close();
 			return false;
 		}
 	}
 
-	std::vector<Network> networks;
+	out.clear();
 
-	while (fgets(buffer, sizeof(buffer), fp) != NULL)
+	while (read_line(reader, buffer, sizeof(buffer)))
 	{
 		if (buffer[0] == '\n')
 			continue;
 
 		Network network;
 		network.ssid		= strip_property(buffer, prop_name);
-		network.security	= strip_property(buffer, prop_security);
+		network.security	= parse_network_security(strip_property(buffer, prop_security));
 		network.connected	= false;
-		networks.push_back(std::move(network));
+		network.signal		= -1;
+		out.push_back(network);
 	}
 
-	if (pclose(fp) != 0)
+	return reader.Close();
+}
+
+bool iwd_forget_known_network(const Network& network)
+{
+	BWM_STATS_SCOPE(iwd_forget_known_network);
+	BWM_TRACE_SCOPE("iwd_forget_known_network", network.ssid.c_str());
+
+	const char* argv[] = { "iwctl", "known-networks", network.ssid.c_str(), "forget", NULL };
+	return run_process(argv);
+}
+
+
+bool iwd_get_station(const Device& device, std::vector<StationProperty>& out)
+{
+	BWM_STATS_SCOPE(iwd_get_station);
+	BWM_TRACE_SCOPE("iwd_get_station", device.name.c_str());
+
+	if (!is_station(device))
 		return false;
 
-	out = std::move(networks);
-	return true;
+	char buffer[1024];
+
+	const char* argv[] = { "iwctl", "station", device.name.c_str(), "show", NULL };
+	ProcessReader reader;
+	if (!reader.Open(argv))
+		return false;
+
+	PropertyInfo prop_property;
+	PropertyInfo prop_value;
+
+	for (int i = 0; i < 4; i++)
+	{
+		bool fail = false;
+		if (!read_line(reader, buffer, sizeof(buffer)))
+			fail = true;
+		else if (i == 2)
+		{
+			if (!fail && !parse_buffer_property_info(buffer, "Property", prop_property))
+				fail = true;
+			if (!fail && !parse_buffer_property_info(buffer, "Value", prop_value))
+				fail = true;
+		}
+
+		if (fail)
+		{
+			reader.Close();
+			return false;
+		}
+	}
+
+	// Values are the last column and may be longer than its header
+	prop_property.max_len	= prop_value.offset - prop_property.offset;
+	prop_value.max_len		= sizeof(buffer);
+
+	out.clear();
+
+	while (read_line(reader, buffer, sizeof(buffer)))
+	{
+		if (buffer[0] == '\n')
+			continue;
+
+		StationProperty property;
+		property.name	= strip_property(buffer, prop_property);
+		property.value	= strip_property(buffer, prop_value);
+		if (!property.name.empty())
+			out.push_back(std::move(property));
+	}
+
+	return reader.Close();
 }
 
-bool iwd_forget_known_network(const Network& network)
+
+// sudo is run by absolute path, the environment can not substitute it.
+// Only bwm-backend-bench, built with BWM_BENCH, takes its fake from
+// BWM_SUDO.
+static const char* sudo_path()
 {
-	char command[1024];
-	snprintf(command, sizeof(command), "iwctl known-networks %s forget &> /dev/null", network.ssid.c_str());
-	return system(command) == 0;
+#ifdef BWM_BENCH
+	if (const char* path = getenv("BWM_SUDO"); path && path[0])
+		return path;
+#endif
+	return "/usr/bin/sudo";
 }
 
+bool iwd_write_network_config(const std::string& file, const std::string& data)
+{
+	BWM_TRACE_SCOPE("iwd_write_network_config", file.c_str());
+
+	// Everything the child needs is prepared before spawning, other threads
+	// may hold the malloc lock meanwhile
+	std::error_code error;
+	auto path = std::filesystem::canonical("/proc/self/exe", error);
+	if (error)
+	{
+		std::fprintf(stderr, "canonical(/proc/self/exe)\n");
+		std::fprintf(stderr, "  %s\n", error.message().c_str());
+		return false;
+	}
+	std::string pass = std::string("SUDO_ASKPASS=") + path.string();
+
+	std::vector<char*> new_env;
+	for (char** ptr = environ; *ptr; ptr++)
+		new_env.push_back(*ptr);
+	new_env.push_back(pass.data());
+	new_env.push_back(NULL);
+
+	std::string file_arg = file;
+	char sudo[]	= "sudo";
+	char ask[]	= "-A";
+	char tee[]	= "tee";
+	char* const argv[] = { sudo, ask, tee, file_arg.data(), NULL };
+
+	int stdin_pair[2];
+	if (pipe2(stdin_pair, O_CLOEXEC) == -1)
+	{
+		std::fprintf(stderr, "pipe()\n");
+		std::fprintf(stderr, "  %s\n", strerror(errno));
+		return false;
+	}
+
+	// dup2 clears O_CLOEXEC from the new descriptors, the pipe itself is
+	// closed in the child on exec
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_adddup2(&actions, stdin_pair[0], STDIN_FILENO);
+	posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+	posix_spawn_file_actions_adddup2(&actions, STDOUT_FILENO, STDERR_FILENO);
+
+	BWM_STATS_SPAWN();
+	MetricsRecordSpawn();
+	pid_t pid;
+	int result = posix_spawn(&pid, sudo_path(), &actions, NULL, argv, new_env.data());
+	posix_spawn_file_actions_destroy(&actions);
+	close(stdin_pair[0]);
+
+	if (result != 0)
+	{
+		std::fprintf(stderr, "posix_spawn()\n");
+		std::fprintf(stderr, "  %s\n", strerror(result));
+		MetricsRecordProcessFailure(ProcessFailure::spawn);
+		close(stdin_pair[1]);
+		return false;
+	}
+
+	FILE* fp = fdopen(stdin_pair[1], "w");
+	if (fp == NULL)
+	{
+		std::fprintf(stderr, "fdopen()\n");
+		std::fprintf(stderr, "  %s\n", strerror(errno));
+		close(stdin_pair[1]);
+	}
+	else
+	{
+		std::fprintf(fp, "%s", data.data());
+		fclose(fp);
+	}
+
+	int status;
+	while (waitpid(pid, &status, 0) == -1)
+	{
+		if (errno != EINTR)
+		{
+			std::fprintf(stderr, "waitpid()\n");
+			std::fprintf(stderr, "  %s\n", strerror(errno));
+			return false;
+		}
+	}
+
+	return fp != NULL && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+bool iwd_restart()
+{
+	BWM_TRACE_SCOPE("iwd_restart");
+
+	const char* argv[] = { sudo_path(), "-n", "systemctl", "restart", "iwd", NULL };
+	return run_process(argv);
+}
 
 
-bool iwd_adapter_power_on(const Device& device)		{ return iwd_set_adapter_property(device.adapter, "Powered", "on"); }
-bool iwd_adapter_power_off(const Device& device)	{ return iwd_set_adapter_property(device.adapter, "Powered", "off"); }
+bool iwd_adapter_power_on(const Device& device)		{ return iwd_set_adapter_property(device, "Powered", "on"); }
+bool iwd_adapter_power_off(const Device& device)	{ return iwd_set_adapter_property(device, "Powered", "off"); }
 bool iwd_device_power_on(const Device& device)		{ return iwd_set_device_property(device, "Powered", "on"); }
 bool iwd_device_power_off(const Device& device)		{ return iwd_set_device_property(device, "Powered", "off"); }
\ No newline at end of file
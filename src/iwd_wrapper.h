@@ -7,9 +7,11 @@
 
 bool iwd_get_devices(std::vector<Device>& out);
 
-bool iwd_set_adapter_property(const std::string& adapter, const std::string& property, const std::string& value);
-bool iwd_set_device_property(const Device& device, const std::string& property, const std::string& value);
+bool iwd_set_adapter_property(const Device& device, const char* property, const char* value);
+bool iwd_set_device_property(const Device& device, const char* property, const char* value);
 
+// Network listings are written into out in place so that its capacity
+// is reused between calls. Contents of out are unspecified on failure.
 bool iwd_get_networks(const Device& device, std::vector<Network>& out);
 bool iwd_scan(const Device& device);
 
@@ -19,6 +21,14 @@ bool iwd_disconnect(const Device& device);
 bool iwd_get_known_networks(std::vector<Network>& out);
 bool iwd_forget_known_network(const Network& network);
 
+// Properties of iwctl station <device> show in the order listed
+bool iwd_get_station(const Device& device, std::vector<StationProperty>& out);
+
+// 802.1X networks are configured through files in /var/lib/iwd, written
+// with sudo -A tee. iwd only reads them when it is restarted.
+bool iwd_write_network_config(const std::string& file, const std::string& data);
+bool iwd_restart();
+
 
 // Wrappers around powering devices/adapters
 
@@ -0,0 +1,196 @@
+#include "link_monitor.h"
+
+#include "stats.h"
+#include "trace.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+static constexpr auto	s_sample_interval	= std::chrono::seconds(1);
+
+// Marks /proc/net/wireless as missing, the kernel has no wireless extensions
+static constexpr int	s_proc_missing		= -2;
+
+// Link quality in /proc/net/wireless is reported out of 70 by cfg80211
+static constexpr float	s_max_link_quality	= 70.0f;
+
+LinkMonitor::LinkMonitor()
+{
+	m_histories.reserve(s_max_networks);
+}
+
+LinkMonitor::~LinkMonitor()
+{
+	if (m_proc_fd >= 0)
+		close(m_proc_fd);
+	delete m_scan_reader;
+}
+
+void LinkMonitor::Poll(const WirelessState& state)
+{
+	auto now = clock::now();
+	if (now < m_next_sample)
+		return;
+	m_next_sample = now + s_sample_interval;
+
+	BWM_STATS_SCOPE(link_monitor);
+	BWM_TRACE_SCOPE("link_monitor");
+
+	Sample(state);
+}
+
+const LinkMonitor::History* LinkMonitor::FindHistory(const Ssid& ssid) const
+{
+	for (const History& history : m_histories)
+		if (history.ssid == ssid)
+			return &history;
+	return nullptr;
+}
+
+void LinkMonitor::Sample(const WirelessState& state)
+{
+	m_tick++;
+	m_link_signal = -1;
+
+	if (state.devices.empty())
+		return;
+
+	const Device& device = state.devices[state.current_device];
+	if (device.power != PowerState::on)
+		return;
+
+	bool connected = std::any_of(state.networks.begin(), state.networks.end(), [](const Network& n) { return n.connected; });
+	if (connected)
+	{
+		int signal;
+		if (ReadProcSignal(device.name.c_str(), signal) || ReadNl80211Signal(device.name.c_str(), signal))
+			m_link_signal = signal;
+	}
+
+	// Listings are sorted by signal, networks past the limit are too weak
+	// to be interesting
+	std::size_t count = std::min(state.networks.size(), s_max_networks);
+	for (std::size_t i = 0; i < count; i++)
+	{
+		const Network& network = state.networks[i];
+
+		int signal = (network.connected && m_link_signal >= 0) ? m_link_signal : network.signal;
+		if (signal < 0)
+			continue;
+
+		History& history = GetHistory(network.ssid);
+		history.samples[history.next]	= float(signal);
+		history.next					= (history.next + 1) % s_history_length;
+		history.count					= std::min<std::uint32_t>(history.count + 1, s_history_length);
+		history.last_tick				= m_tick;
+	}
+}
+
+// Lines look like " wlan0: 0000   54.  -56.  -256 ...", with the interface,
+// status, link quality and signal level in dBm
+bool LinkMonitor::ReadProcSignal(const char* interface, int& out)
+{
+	if (m_proc_fd == s_proc_missing)
+		return false;
+
+	if (m_proc_fd == -1)
+	{
+		m_proc_fd = open("/proc/net/wireless", O_RDONLY | O_CLOEXEC);
+		if (m_proc_fd == -1)
+		{
+			m_proc_fd = s_proc_missing;
+			return false;
+		}
+	}
+
+	ssize_t length = pread(m_proc_fd, m_proc_buffer, sizeof(m_proc_buffer) - 1, 0);
+	if (length <= 0)
+		return false;
+	m_proc_buffer[length] = '\0';
+
+	std::size_t interface_length = strlen(interface);
+
+	for (char* line = m_proc_buffer; line && *line; line = strchr(line, '\n'))
+	{
+		while (*line == '\n' || *line == ' ')
+			line++;
+		if (strncmp(line, interface, interface_length) != 0 || line[interface_length] != ':')
+			continue;
+
+		char* ptr = line + interface_length + 1;
+		strtoul(ptr, &ptr, 16);
+		float link	= strtof(ptr, &ptr);
+		ptr += (*ptr == '.');
+		float level	= strtof(ptr, &ptr);
+
+		if (level < 0.0f)
+			out = SignalPercent(int(level));
+		else if (link > 0.0f)
+			out = int(std::min(link / s_max_link_quality, 1.0f) * 100.0f);
+		else
+			return false;
+		return true;
+	}
+
+	return false;
+}
+
+// The associated BSS's signal is updated from every beacon, not only by
+// scans
+bool LinkMonitor::ReadNl80211Signal(const char* interface, int& out)
+{
+	if (m_scan_failed)
+		return false;
+
+	if (m_scan_reader == nullptr)
+	{
+		m_scan_reader = new Nl80211ScanReader();
+		if (!m_scan_reader->Init())
+		{
+			delete m_scan_reader;
+			m_scan_reader = nullptr;
+			m_scan_failed = true;
+			return false;
+		}
+	}
+
+	// Only the dump is used, drop the queued events
+	m_scan_reader->PollEvents();
+
+	if (!m_scan_reader->GetScanResults(interface, m_scan_results))
+		return false;
+
+	for (const ScanResult& result : m_scan_results)
+	{
+		if (result.associated && result.signal >= 0)
+		{
+			out = result.signal;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+LinkMonitor::History& LinkMonitor::GetHistory(const Ssid& ssid)
+{
+	for (History& history : m_histories)
+		if (history.ssid == ssid)
+			return history;
+
+	// Capacity was reserved, this never allocates. Once full the history of
+	// the network not seen for the longest time is reused.
+	History* history;
+	if (m_histories.size() < s_max_networks)
+		history = &m_histories.emplace_back();
+	else
+		history = &*std::min_element(m_histories.begin(), m_histories.end(), [](const History& a, const History& b) { return a.last_tick < b.last_tick; });
+
+	*history = History {};
+	history->ssid = ssid;
+	return *history;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "nl80211_scan_reader.h"
+#include "wireless_manager.h"
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+// Samples the signal of the networks of the current device once a second
+// into fixed size ring buffers, for the sparklines of the network table.
+//
+// The connected network is sampled from the kernel's link statistics
+// (/proc/net/wireless, or the associated BSS over nl80211 if the kernel
+// has no wireless extensions), other networks use the signal of their last
+// scan. Nothing is spawned and nothing is allocated after construction, a
+// sample costs one read of a small proc file.
+class LinkMonitor
+{
+public:
+	static constexpr std::size_t s_history_length	= 60;
+	static constexpr std::size_t s_max_networks		= 32;
+
+	struct History
+	{
+		Ssid			ssid;
+		float			samples[s_history_length];
+		std::uint32_t	next;		// index of the oldest sample once full
+		std::uint32_t	count;
+		std::uint64_t	last_tick;
+	};
+
+public:
+	LinkMonitor();
+	~LinkMonitor();
+
+	LinkMonitor(const LinkMonitor&) = delete;
+	LinkMonitor& operator=(const LinkMonitor&) = delete;
+
+	// Takes a sample if a second has passed, cheap to call every frame
+	void Poll(const WirelessState& state);
+
+	// Signal of the current device's link in percent, -1 if there is no
+	// link or it could not be read
+	int GetLinkSignal() const { return m_link_signal; }
+
+	// nullptr if the network was not sampled yet
+	const History* FindHistory(const Ssid& ssid) const;
+
+private:
+	using clock = std::chrono::steady_clock;
+
+	void Sample(const WirelessState& state);
+	bool ReadProcSignal(const char* interface, int& out);
+	bool ReadNl80211Signal(const char* interface, int& out);
+	History& GetHistory(const Ssid& ssid);
+
+private:
+	clock::time_point		m_next_sample;
+	std::uint64_t			m_tick			= 0;
+	int						m_link_signal	= -1;
+
+	int						m_proc_fd		= -1;
+	char					m_proc_buffer[4096];
+
+	// Created on first use if /proc/net/wireless does not list the device
+	Nl80211ScanReader*		m_scan_reader	= nullptr;
+	bool					m_scan_failed	= false;
+	std::vector<ScanResult>	m_scan_results;
+
+	std::vector<History>	m_histories;
+};
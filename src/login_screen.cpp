@@ -1,116 +1,15 @@
 #include "login_screen.h"
 
+#include "iwd_wrapper.h"
+#include "metrics.h"
+#include "trace.h"
+
 #include <imgui.h>
 
 #include <cassert>
-#include <fcntl.h>
-#include <filesystem>
-#include <fstream>
 #include <iomanip>
 #include <sstream>
 #include <strings.h>
-#include <sys/wait.h>
-#include <thread>
-#include <unistd.h>
-
-extern int		g_argc;
-extern char**	g_argv;
-extern char**	g_env;
-
-static void close_pair(int pair[2])
-{
-	close(pair[0]);
-	close(pair[1]);
-}
-
-static bool write_as_root(const std::string file, const std::string& data)
-{
-	int stdin_pair[2];
-	if (pipe(stdin_pair) == -1)
-	{
-		std::fprintf(stderr, "pipe()\n");
-		std::fprintf(stderr, "  %s\n", strerror(errno));
-		return false;
-	}
-
-	pid_t pid = vfork();
-	if (pid == -1)
-	{
-		std::fprintf(stderr, "fork()\n");
-		std::fprintf(stderr, "  %s\n", strerror(errno));
-		close_pair(stdin_pair);
-		return false;
-	}
-
-	if (pid == 0)
-	{
-		if (dup2(stdin_pair[0], STDIN_FILENO) == -1)
-		{
-			std::fprintf(stderr, "dup2()\n");
-			std::fprintf(stderr, "  %s\n", strerror(errno));
-			exit(1);
-		}
-		close_pair(stdin_pair);
-
-		int dn = open("/dev/null", O_WRONLY);
-		if (dn == -1)
-		{
-			std::fprintf(stderr, "open()\n");
-			std::fprintf(stderr, "  %s\n", strerror(errno));
-			exit(1);
-		}
-
-		if (dup2(dn, STDOUT_FILENO) == -1 || dup2(dn, STDERR_FILENO))
-		{
-			std::fprintf(stderr, "dup2()\n");
-			std::fprintf(stderr, "  %s\n", strerror(errno));
-			exit(1);
-		}
-		close(dn);
-
-		std::vector<char*> new_env;
-		char** ptr = g_env;
-		while (*ptr)
-			new_env.push_back(*ptr++);
-
-		auto path = std::filesystem::canonical("/proc/self/exe");
-		std::string pass = std::string("SUDO_ASKPASS=")	+ path.string();
-		new_env.push_back(pass.data());
-		new_env.push_back(NULL);
-
-		if (execle("/usr/bin/sudo", "sudo", "-A", "tee", file.data(), NULL, new_env.data()) == -1)
-		{
-			std::fprintf(stderr, "execve()\n");
-			std::fprintf(stderr, "  %s\n", strerror(errno));
-			exit(1);
-		}
-	}
-
-	FILE* fp = fdopen(stdin_pair[1], "w");
-	close(stdin_pair[0]);
-
-	if (fp == NULL)
-	{
-		std::fprintf(stderr, "fdopen()\n");
-		std::fprintf(stderr, "  %s\n", strerror(errno));
-		close(stdin_pair[1]);
-		return false;
-	}
-
-	std::fprintf(fp, "%s", data.data());
-	fclose(fp);
-
-	int ret;
-	if (waitpid(pid, &ret, 0) == -1)
-	{
-		std::fprintf(stderr, "waitpid()\n");
-		std::fprintf(stderr, "  %s\n", strerror(errno));
-		close_pair(stdin_pair);
-		return false;
-	}
-
-	return ret == 0;
-}
 
 static std::string get_iwd_file_name(const Network& network)
 {
@@ -125,7 +24,7 @@ static std::string get_iwd_file_name(const Network& network)
 
 	if (basic)
 	{
-		ss << network.ssid;
+		ss << network.ssid.c_str();
 	}
 	else
 	{
@@ -135,20 +34,86 @@ static std::string get_iwd_file_name(const Network& network)
 			ss << (int)c;
 	}
 	
-	ss << "." << network.security;
+	ss << "." << to_string(network.security);
 
 	return ss.str();
 }
 
+// The tasks get copies of everything, they outlive the login screen when it
+// is closed while connecting
+
+// Runs a connect step and records its duration and result. The connect
+// itself goes through the request queue, which records it.
+template<typename F>
+static bool timed_connect_phase(ConnectPhase phase, NetworkSecurity security, F&& step)
+{
+	auto start = MetricsClock::now();
+	bool success = step();
+	MetricsRecordConnect(phase, security, MetricsClock::now() - start, success);
+	return success;
+}
+
+// Serialized with the other operations on the device and followed by a
+// network refresh like every connect
+static Task connect_request(WirelessRequestQueue* requests, Network network, std::string password)
+{
+	co_return co_await AwaitCallback([&](auto done) { requests->Connect(network, password, done); });
+}
+
+static Task connect_psk(WirelessRequestQueue* requests, Network network, std::string password)
+{
+	co_return co_await connect_request(requests, network, password);
+}
+
+static Task connect_8021x(WirelessRequestQueue* requests, Network network, std::string file_name, std::string config_data)
+{
+	bool written = co_await RunBlocking([&] {
+		if (timed_connect_phase(ConnectPhase::write_config, network.security, [&] { return iwd_write_network_config(file_name, config_data); }))
+			return true;
+		std::fprintf(stderr, "Could not write file\n");
+		return false;
+	});
+	if (!written)
+		co_return false;
+
+	// iwd does not seem to reload /var/lib/iwd
+	// unless it is restarted.
+	bool restarted = co_await RunBlocking([&] {
+		if (timed_connect_phase(ConnectPhase::restart_backend, network.security, [] { return iwd_restart(); }))
+			return true;
+		std::fprintf(stderr, "Could not restart iwd\n");
+		return false;
+	});
+	if (!restarted)
+		co_return false;
+
+	BWM_TRACE_INSTANT("iwd restart wait");
+	if (!co_await Sleep(std::chrono::seconds(3)))
+		co_return false;
+
+	co_return co_await connect_request(requests, network, std::string());
+}
 
-LoginScreen* LoginScreen::Create(WirelessManager* wireless_manager, const Network& network)
+LoginScreen* LoginScreen::Create(WirelessManager* wireless_manager, WirelessRequestQueue* requests, TaskExecutor* tasks, const Network& network)
 {
 	assert(wireless_manager);
+	assert(requests);
+	assert(tasks);
 
-	if (network.security == "psk")
-		return new LoginScreenPsk(wireless_manager, network);
-	if (network.security == "8021x")
-		return new LoginScreen8021x(wireless_manager, network);
+	BWM_TRACE_INSTANT("login screen open", to_string(network.security));
+
+	switch (network.security)
+	{
+		case NetworkSecurity::psk:
+			return new LoginScreenPsk(requests, tasks, network);
+		case NetworkSecurity::ieee8021x:
+			// Writes iwd's network configuration files
+			if (wireless_manager->GetBackend() == WirelessBackend::iwd)
+				return new LoginScreen8021x(requests, tasks, network);
+			break;
+		default:
+			break;
+	}
 
 	std::fprintf(stderr, "Unsupported security type\n");
 	return nullptr;
@@ -160,12 +125,18 @@ LoginScreen* LoginScreen::Create(WirelessManager* wireless_manager, const Networ
 		Psk
 */
 
-LoginScreenPsk::LoginScreenPsk(WirelessManager* wireless_manager, const Network& network)
-	: m_wireless_manager(wireless_manager)
+LoginScreenPsk::LoginScreenPsk(WirelessRequestQueue* requests, TaskExecutor* tasks, const Network& network)
+	: m_requests(requests)
+	, m_tasks(tasks)
 	, m_network(network)
 {
 }
 
+LoginScreenPsk::~LoginScreenPsk()
+{
+	m_tasks->Cancel(m_connect_task);
+}
+
 void LoginScreenPsk::Show()
 {
 	if (!m_is_opened)
@@ -184,8 +155,12 @@ void LoginScreenPsk::Show()
 	bool connect	= false;
 	bool close		= false;
 
+	bool connecting = m_tasks->IsRunning(m_connect_task);
+
 	ImGui::Text("ssid: %s", m_network.ssid.c_str());
 
+	ImGui::BeginDisabled(connecting);
+
 	ImGuiInputTextFlags flags = ImGuiInputTextFlags_EnterReturnsTrue;
 	if (m_hide_password)
 		flags |= ImGuiInputTextFlags_Password;
@@ -199,20 +174,33 @@ void LoginScreenPsk::Show()
 	if (ImGui::Button("Connect"))
 		connect = true;
 
-	if (connect)
+	ImGui::EndDisabled();
+
+	if (connect && !connecting)
 	{
-		if (m_wireless_manager->Connect(m_network, m_password))
-			close = true;
+		BWM_TRACE_INSTANT("login screen connect", m_network.ssid.c_str());
+		m_connect_task = m_tasks->Spawn(connect_psk(m_requests, m_network, m_password), [this](bool success) { m_connected = success; });
 
 		m_password[0] = '\0';
 	}
 
+	if (m_connected)
+		close = true;
+
 	ImGui::SameLine();
 	if (ImGui::Button("Cancel"))
 		close = true;
 
+	if (connecting)
+	{
+		ImGui::SameLine();
+		ImGui::TextUnformatted("Connecting...");
+	}
+
 	if (close)
 	{
+		m_tasks->Cancel(m_connect_task);
+		BWM_TRACE_INSTANT("login screen close");
 		m_done = true;
 		ImGui::CloseCurrentPopup();
 	}
@@ -227,13 +215,19 @@ void LoginScreenPsk::Show()
 		8021x
 */
 
-LoginScreen8021x::LoginScreen8021x(WirelessManager* wireless_manager, const Network& network)
-	: m_wireless_manager(wireless_manager)
+LoginScreen8021x::LoginScreen8021x(WirelessRequestQueue* requests, TaskExecutor* tasks, const Network& network)
+	: m_requests(requests)
+	, m_tasks(tasks)
 	, m_network(network)
 {
 	
 }
 
+LoginScreen8021x::~LoginScreen8021x()
+{
+	m_tasks->Cancel(m_connect_task);
+}
+
 void LoginScreen8021x::Show()
 {
 	if (!m_is_opened)
@@ -252,8 +246,12 @@ void LoginScreen8021x::Show()
 	bool connect	= false;
 	bool close		= false;
 
+	bool connecting = m_tasks->IsRunning(m_connect_task);
+
 	ImGui::Text("ssid: %s", m_network.ssid.c_str());
 
+	ImGui::BeginDisabled(connecting);
+
 	ImGui::InputText("anonymous", m_anonymous, sizeof(m_anonymous));
 	ImGui::InputText("username", m_username, sizeof(m_username));
 
@@ -270,40 +268,33 @@ void LoginScreen8021x::Show()
 	if (ImGui::Button("Connect"))
 		connect = true;
 
-	if (connect && m_username[0] && m_password[0])
+	ImGui::EndDisabled();
+
+	if (connect && !connecting && m_username[0] && m_password[0])
 	{
-		auto config_data = GetConfigData();
-		auto file_name = get_iwd_file_name(m_network);
-
-		if (write_as_root(file_name, config_data))
-		{
-			// iwd does not seem to reload /var/lib/iwd
-			// unless it is restarted.
-			if (std::system("sudo -n systemctl restart iwd") == 0)
-			{
-				std::this_thread::sleep_for(std::chrono::seconds(3));
-				if (m_wireless_manager->Connect(m_network))
-					close = true;
-			}
-			else
-			{
-				std::fprintf(stderr, "Could not restart iwd\n");
-			}
-		}
-		else
-		{
-			std::fprintf(stderr, "Could not write file\n");
-		}
+		BWM_TRACE_INSTANT("login screen connect", m_network.ssid.c_str());
+		m_connect_task = m_tasks->Spawn(connect_8021x(m_requests, m_network, get_iwd_file_name(m_network), GetConfigData()), [this](bool success) { m_connected = success; });
 
 		m_password[0] = '\0';
 	}
 
+	if (m_connected)
+		close = true;
+
 	ImGui::SameLine();
 	if (ImGui::Button("Cancel"))
 		close = true;
 
+	if (connecting)
+	{
+		ImGui::SameLine();
+		ImGui::TextUnformatted("Connecting...");
+	}
+
 	if (close)
 	{
+		m_tasks->Cancel(m_connect_task);
+		BWM_TRACE_INSTANT("login screen close");
 		m_done = true;
 		ImGui::CloseCurrentPopup();
 	}
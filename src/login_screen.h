@@ -1,13 +1,17 @@
 #pragma once
 
+#include "task.h"
 #include "wireless_manager.h"
+#include "wireless_request_queue.h"
 
 class LoginScreen
 {
 protected:
 	LoginScreen() {}
 public:
-	static LoginScreen* Create(WirelessManager* wireless_manager, const Network& network);
+	// Connecting runs as a task on tasks, the screen keeps rendering. The
+	// connect itself is a request on requests.
+	static LoginScreen* Create(WirelessManager* wireless_manager, WirelessRequestQueue* requests, TaskExecutor* tasks, const Network& network);
 
 	virtual ~LoginScreen() {}
 
@@ -18,7 +22,8 @@ public:
 class LoginScreenPsk : public LoginScreen
 {
 public:
-	LoginScreenPsk(WirelessManager* wireless_manager, const Network& network);
+	LoginScreenPsk(WirelessRequestQueue* requests, TaskExecutor* tasks, const Network& network);
+	virtual ~LoginScreenPsk() override;
 
 	virtual bool Done() const override { return m_done; } 
 	virtual void Show() override;
@@ -26,18 +31,22 @@ public:
 private:
 	bool					m_is_opened		= false;
 	bool					m_done			= false;
+	bool					m_connected		= false;
 
 	char					m_password[128] {};
 	bool					m_hide_password	= true;
 
-	WirelessManager*		m_wireless_manager;
+	WirelessRequestQueue*	m_requests;
+	TaskExecutor*			m_tasks;
+	TaskExecutor::TaskId	m_connect_task	= 0;
 	Network					m_network;
 };
 
 class LoginScreen8021x : public LoginScreen
 {
 public:
-	LoginScreen8021x(WirelessManager* wireless_manager, const Network& network);
+	LoginScreen8021x(WirelessRequestQueue* requests, TaskExecutor* tasks, const Network& network);
+	virtual ~LoginScreen8021x() override;
 
 	virtual bool Done() const override { return m_done; }
 	virtual void Show() override;
@@ -48,12 +57,15 @@ private:
 private:
 	bool					m_is_opened		= false;
 	bool					m_done			= false;
+	bool					m_connected		= false;
 
 	char					m_anonymous[128] {};
 	char 					m_username[128] {};
 	char					m_password[128] {};
 	bool					m_hide_password	= true;
 
-	WirelessManager*		m_wireless_manager;
+	WirelessRequestQueue*	m_requests;
+	TaskExecutor*			m_tasks;
+	TaskExecutor::TaskId	m_connect_task	= 0;
 	Network					m_network;
 };
\ No newline at end of file
@@ -0,0 +1,307 @@
+#include "metrics.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unistd.h>
+
+// Bucket bounds in microseconds, from nl80211 reads to connects timing out
+static constexpr std::uint64_t s_bucket_bounds[] = {
+	1000, 5000, 10000, 50000, 100000, 250000, 500000,
+	1000000, 2500000, 5000000, 10000000, 30000000,
+};
+static constexpr std::size_t s_bucket_count = sizeof(s_bucket_bounds) / sizeof(*s_bucket_bounds) + 1;
+
+static constexpr std::size_t s_security_count = (std::size_t)NetworkSecurity::ieee8021x + 1;
+
+class MetricsHistogram
+{
+public:
+	void Record(MetricsClock::duration duration)
+	{
+		std::uint64_t us = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+
+		std::size_t index = 0;
+		while (index < s_bucket_count - 1 && us > s_bucket_bounds[index])
+			index++;
+
+		m_buckets[index].fetch_add(1, std::memory_order_relaxed);
+		m_sum_us.fetch_add(us, std::memory_order_relaxed);
+	}
+
+	// Appends the _bucket, _sum and _count samples, labels is either empty
+	// or ends with a comma
+	void Write(std::string& out, const char* name, const char* labels) const;
+
+private:
+	std::atomic<std::uint64_t> m_buckets[s_bucket_count] {};
+	std::atomic<std::uint64_t> m_sum_us { 0 };
+};
+
+static MetricsHistogram				s_operations[(std::size_t)MetricsOperation::count];
+static std::atomic<std::uint64_t>	s_operation_failures[(std::size_t)MetricsOperation::count] {};
+static MetricsHistogram				s_connects[(std::size_t)ConnectPhase::count][s_security_count];
+static std::atomic<std::uint64_t>	s_connect_failures[(std::size_t)ConnectPhase::count][s_security_count] {};
+static std::atomic<std::uint64_t>	s_spawn_count { 0 };
+static std::atomic<std::uint64_t>	s_process_failures[(std::size_t)ProcessFailure::count] {};
+
+static constexpr const char* s_operation_names[] = {
+	"scan",
+	"update_networks",
+	"update_known_networks",
+	"connect",
+	"disconnect",
+	"forget_known_network",
+	"activate_device",
+	"network_details",
+};
+static_assert(sizeof(s_operation_names) / sizeof(*s_operation_names) == (std::size_t)MetricsOperation::count);
+
+static constexpr const char* s_phase_names[] = {
+	"queued",
+	"write_config",
+	"restart_backend",
+	"connect",
+};
+static_assert(sizeof(s_phase_names) / sizeof(*s_phase_names) == (std::size_t)ConnectPhase::count);
+
+static constexpr const char* s_process_failure_names[] = {
+	"spawn",
+	"not_found",
+	"exit_status",
+	"signal",
+};
+static_assert(sizeof(s_process_failure_names) / sizeof(*s_process_failure_names) == (std::size_t)ProcessFailure::count);
+
+static std::mutex				s_mutex;
+static std::condition_variable	s_condition;
+static std::thread				s_writer;
+static bool						s_stop		= false;
+static std::string				s_path;
+static std::string				s_temp_path;
+static std::chrono::seconds		s_interval;
+
+static void append(std::string& out, const char* format, ...) __attribute__((format(printf, 2, 3)));
+static void append(std::string& out, const char* format, ...)
+{
+	char buffer[256];
+	va_list args;
+	va_start(args, format);
+	int length = vsnprintf(buffer, sizeof(buffer), format, args);
+	va_end(args);
+	if (length > 0)
+		out.append(buffer, std::min<std::size_t>(length, sizeof(buffer) - 1));
+}
+
+void MetricsHistogram::Write(std::string& out, const char* name, const char* labels) const
+{
+	std::uint64_t count = 0;
+	for (std::size_t i = 0; i < s_bucket_count; i++)
+	{
+		count += m_buckets[i].load(std::memory_order_relaxed);
+		if (i < s_bucket_count - 1)
+			append(out, "%s_bucket{%sle=\"%g\"} %lu\n", name, labels, s_bucket_bounds[i] / 1e6, count);
+		else
+			append(out, "%s_bucket{%sle=\"+Inf\"} %lu\n", name, labels, count);
+	}
+
+	// Without labels OpenMetrics wants no braces at all
+	std::string plain(labels);
+	if (!plain.empty())
+	{
+		plain.pop_back();
+		plain = "{" + plain + "}";
+	}
+	append(out, "%s_sum%s %.6f\n", name, plain.c_str(), m_sum_us.load(std::memory_order_relaxed) / 1e6);
+	append(out, "%s_count%s %lu\n", name, plain.c_str(), count);
+}
+
+static void format_metrics(std::string& out)
+{
+	char labels[96];
+
+	out += "# TYPE bwm_operation_duration_seconds histogram\n";
+	out += "# UNIT bwm_operation_duration_seconds seconds\n";
+	out += "# HELP bwm_operation_duration_seconds Duration of backend operations.\n";
+	for (std::size_t i = 0; i < (std::size_t)MetricsOperation::count; i++)
+	{
+		snprintf(labels, sizeof(labels), "operation=\"%s\",", s_operation_names[i]);
+		s_operations[i].Write(out, "bwm_operation_duration_seconds", labels);
+	}
+
+	out += "# TYPE bwm_operation_failures counter\n";
+	out += "# HELP bwm_operation_failures Backend operations that failed.\n";
+	for (std::size_t i = 0; i < (std::size_t)MetricsOperation::count; i++)
+		append(out, "bwm_operation_failures_total{operation=\"%s\"} %lu\n", s_operation_names[i], s_operation_failures[i].load(std::memory_order_relaxed));
+
+	out += "# TYPE bwm_connect_phase_duration_seconds histogram\n";
+	out += "# UNIT bwm_connect_phase_duration_seconds seconds\n";
+	out += "# HELP bwm_connect_phase_duration_seconds Duration of the steps of connects by security type.\n";
+	for (std::size_t phase = 0; phase < (std::size_t)ConnectPhase::count; phase++)
+	{
+		for (std::size_t security = 0; security < s_security_count; security++)
+		{
+			snprintf(labels, sizeof(labels), "phase=\"%s\",security=\"%s\",", s_phase_names[phase], to_string((NetworkSecurity)security));
+			s_connects[phase][security].Write(out, "bwm_connect_phase_duration_seconds", labels);
+		}
+	}
+
+	out += "# TYPE bwm_connect_failures counter\n";
+	out += "# HELP bwm_connect_failures Failed connects by the step that failed and security type.\n";
+	for (std::size_t phase = 0; phase < (std::size_t)ConnectPhase::count; phase++)
+	{
+		for (std::size_t security = 0; security < s_security_count; security++)
+		{
+			append(out, "bwm_connect_failures_total{phase=\"%s\",security=\"%s\"} %lu\n",
+				s_phase_names[phase], to_string((NetworkSecurity)security), s_connect_failures[phase][security].load(std::memory_order_relaxed)
+			);
+		}
+	}
+
+	out += "# TYPE bwm_processes_spawned counter\n";
+	out += "# HELP bwm_processes_spawned Processes spawned by bwm.\n";
+	append(out, "bwm_processes_spawned_total %lu\n", s_spawn_count.load(std::memory_order_relaxed));
+
+	out += "# TYPE bwm_process_failures counter\n";
+	out += "# HELP bwm_process_failures Spawned processes that did not exit successfully.\n";
+	for (std::size_t i = 0; i < (std::size_t)ProcessFailure::count; i++)
+		append(out, "bwm_process_failures_total{cause=\"%s\"} %lu\n", s_process_failure_names[i], s_process_failures[i].load(std::memory_order_relaxed));
+
+	out += "# EOF\n";
+}
+
+static void remove_temp_file()
+{
+	int error = errno;
+	unlink(s_temp_path.c_str());
+	errno = error;
+}
+
+// Written next to the final file and renamed over it, which is atomic on
+// the same file system
+static bool write_metrics(const std::string& data)
+{
+	int fd = open(s_temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd == -1)
+		return false;
+
+	std::size_t written = 0;
+	while (written < data.size())
+	{
+		ssize_t n = write(fd, data.data() + written, data.size() - written);
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n <= 0)
+		{
+			close(fd);
+			remove_temp_file();
+			return false;
+		}
+		written += n;
+	}
+
+	if (close(fd) == -1 || rename(s_temp_path.c_str(), s_path.c_str()) == -1)
+	{
+		remove_temp_file();
+		return false;
+	}
+
+	return true;
+}
+
+static void writer_main()
+{
+	std::string data;
+	bool reported = false;
+
+	std::unique_lock lock(s_mutex);
+	for (;;)
+	{
+		bool stop = s_condition.wait_for(lock, s_interval, [] { return s_stop; });
+
+		data.clear();
+		format_metrics(data);
+		if (!write_metrics(data) && !reported)
+		{
+			fprintf(stderr, "Could not write metrics to '%s': %s\n", s_path.c_str(), strerror(errno));
+			reported = true;
+		}
+
+		if (stop)
+			break;
+	}
+}
+
+bool MetricsStart(const char* path, std::chrono::seconds interval)
+{
+	if (s_writer.joinable())
+		return false;
+
+	s_path		= path;
+	s_temp_path	= s_path + ".tmp";
+	s_interval	= interval;
+	s_stop		= false;
+
+	// Fail early on an unwritable directory instead of in the background
+	std::string data;
+	format_metrics(data);
+	if (!write_metrics(data))
+	{
+		fprintf(stderr, "Could not write metrics to '%s': %s\n", path, strerror(errno));
+		return false;
+	}
+
+	static bool registered = false;
+	if (!registered)
+		std::atexit(MetricsStop);
+	registered = true;
+
+	s_writer = std::thread(writer_main);
+	return true;
+}
+
+void MetricsStop()
+{
+	if (!s_writer.joinable())
+		return;
+
+	{
+		std::lock_guard lock(s_mutex);
+		s_stop = true;
+	}
+	s_condition.notify_all();
+	s_writer.join();
+}
+
+void MetricsRecordOperation(MetricsOperation operation, MetricsClock::duration duration, bool success)
+{
+	s_operations[(std::size_t)operation].Record(duration);
+	if (!success)
+		s_operation_failures[(std::size_t)operation].fetch_add(1, std::memory_order_relaxed);
+}
+
+void MetricsRecordConnect(ConnectPhase phase, NetworkSecurity security, MetricsClock::duration duration, bool success)
+{
+	s_connects[(std::size_t)phase][(std::size_t)security].Record(duration);
+	if (!success)
+		s_connect_failures[(std::size_t)phase][(std::size_t)security].fetch_add(1, std::memory_order_relaxed);
+}
+
+void MetricsRecordSpawn()
+{
+	s_spawn_count.fetch_add(1, std::memory_order_relaxed);
+}
+
+void MetricsRecordProcessFailure(ProcessFailure failure)
+{
+	s_process_failures[(std::size_t)failure].fetch_add(1, std::memory_order_relaxed);
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+// Counters and histograms of backend operations for machines in the field,
+// written periodically as an OpenMetrics textfile for node_exporter's
+// textfile collector.
+//
+// Unlike stats.h this is always compiled in. Recording is a few relaxed
+// atomic increments from any thread and never allocates. The file is only
+// written once MetricsStart() was called, by a background thread, and
+// replaced atomically so the collector never reads a partial file.
+
+#include "structs.h"
+
+#include <chrono>
+#include <cstdint>
+
+enum class MetricsOperation
+{
+	scan,
+	update_networks,
+	update_known_networks,
+	connect,
+	disconnect,
+	forget_known_network,
+	activate_device,
+	network_details,
+
+	count
+};
+
+// Steps of a connect. Failures are counted by the step that failed.
+enum class ConnectPhase
+{
+	queued,				// waiting in the request queue
+	write_config,		// writing iwd's 802.1X network configuration
+	restart_backend,	// restarting iwd so it reads the configuration
+	connect,			// the backend's connect call
+
+	count
+};
+
+enum class ProcessFailure
+{
+	spawn,				// fork failed
+	not_found,			// exec failed, exit status 127
+	exit_status,		// any other non-zero exit status
+	signal,				// killed by a signal
+
+	count
+};
+
+using MetricsClock = std::chrono::steady_clock;
+
+// Writes path every interval and once more at exit
+bool MetricsStart(const char* path, std::chrono::seconds interval);
+void MetricsStop();
+
+void MetricsRecordOperation(MetricsOperation operation, MetricsClock::duration duration, bool success);
+void MetricsRecordConnect(ConnectPhase phase, NetworkSecurity security, MetricsClock::duration duration, bool success);
+void MetricsRecordSpawn();
+void MetricsRecordProcessFailure(ProcessFailure failure);
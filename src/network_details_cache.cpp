@@ -0,0 +1,133 @@
+#include "network_details_cache.h"
+
+#include "trace.h"
+
+#include <algorithm>
+
+NetworkDetailsCache::NetworkDetailsCache(WirelessRequestQueue* requests, clock::duration ttl)
+	: m_requests(requests)
+	, m_ttl(ttl)
+{
+}
+
+NetworkDetailsCache::~NetworkDetailsCache()
+{
+	*m_alive = false;
+}
+
+NetworkDetailsCache::Entry* NetworkDetailsCache::Find(const Network& network)
+{
+	auto it = std::find_if(m_entries.begin(), m_entries.end(), [&](const Entry& entry) {
+		return entry.ssid == network.ssid && entry.security == network.security && entry.connected == network.connected;
+	});
+	return (it != m_entries.end()) ? &*it : nullptr;
+}
+
+const NetworkDetails* NetworkDetailsCache::Get(const Network& network)
+{
+	auto now = clock::now();
+
+	Entry* entry = Find(network);
+	if (entry == nullptr)
+	{
+		entry = &m_entries.emplace_back();
+		entry->ssid			= network.ssid;
+		entry->security		= network.security;
+		entry->connected	= network.connected;
+		entry->fetching		= false;
+	}
+	entry->last_used = now;
+
+	// Failed fetches are cached as well, until their retry
+	if (now < entry->expires)
+	{
+		m_hits++;
+	}
+	else if (entry->fetching)
+	{
+		m_deduplicated++;
+	}
+	else
+	{
+		m_misses++;
+		Fetch(*entry);
+	}
+
+	return entry->details.get();
+}
+
+bool NetworkDetailsCache::IsFetching(const Network& network) const
+{
+	return std::any_of(m_entries.begin(), m_entries.end(), [&](const Entry& entry) {
+		return entry.fetching && entry.ssid == network.ssid && entry.security == network.security && entry.connected == network.connected;
+	});
+}
+
+void NetworkDetailsCache::Fetch(Entry& entry)
+{
+	BWM_TRACE_INSTANT("details fetch", entry.ssid.c_str());
+
+	Network network {};
+	network.ssid		= entry.ssid;
+	network.security	= entry.security;
+	network.connected	= entry.connected;
+	network.signal		= -1;
+
+	// Fetched into fresh storage, the cached details stay readable until
+	// the fetch finished
+	auto details = std::make_shared<NetworkDetails>();
+	entry.fetching = true;
+
+	m_requests->GetNetworkDetails(network, details, [this, alive = m_alive, network, epoch = m_epoch, details](bool success) {
+		if (*alive)
+			Fetched(network, epoch, details, success);
+	});
+}
+
+void NetworkDetailsCache::Fetched(const Network& network, std::uint64_t epoch, std::shared_ptr<NetworkDetails> details, bool success)
+{
+	Entry* entry = Find(network);
+	if (entry == nullptr)
+		return;
+
+	auto now = clock::now();
+	entry->fetching = false;
+
+	if (!success)
+	{
+		// Keeps what was there, a failing backend is not asked every frame
+		entry->expires = now + s_retry;
+		return;
+	}
+
+	entry->details = std::move(details);
+	entry->expires = (epoch == m_epoch) ? now + m_ttl : now;
+}
+
+void NetworkDetailsCache::Invalidate()
+{
+	auto now = clock::now();
+
+	m_epoch++;
+	m_invalidations++;
+
+	// Expired entries are still shown until their refetch finished
+	for (Entry& entry : m_entries)
+		entry.expires = now;
+
+	auto unused = std::remove_if(m_entries.begin(), m_entries.end(), [&](const Entry& entry) {
+		return !entry.fetching && now - entry.last_used > s_unused;
+	});
+	m_entries.erase(unused, m_entries.end());
+}
+
+NetworkDetailsCache::Stats NetworkDetailsCache::GetStats() const
+{
+	Stats stats;
+	stats.hits			= m_hits;
+	stats.misses		= m_misses;
+	stats.deduplicated	= m_deduplicated;
+	stats.invalidations	= m_invalidations;
+	stats.entries		= m_entries.size();
+	return stats;
+}
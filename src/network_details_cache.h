@@ -0,0 +1,84 @@
+#pragma once
+
+#include "wireless_request_queue.h"
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Details of networks by ssid, security and whether it is connected, in
+// front of the backend. Only used from the UI thread.
+//
+// Get() never blocks: it returns what is cached, possibly expired, and
+// fetches in the background through the request queue once the entry is
+// older than the TTL. At most one fetch per network is in flight, lookups
+// meanwhile are deduplicated into it. Invalidate() expires everything,
+// the UI calls it when a scan brought in new results.
+class NetworkDetailsCache
+{
+public:
+	using clock = std::chrono::steady_clock;
+
+	struct Stats
+	{
+		std::uint64_t	hits;
+		std::uint64_t	misses;
+		std::uint64_t	deduplicated;
+		std::uint64_t	invalidations;
+		std::size_t		entries;
+	};
+
+public:
+	explicit NetworkDetailsCache(WirelessRequestQueue* requests, clock::duration ttl = std::chrono::seconds(15));
+	~NetworkDetailsCache();
+
+	NetworkDetailsCache(const NetworkDetailsCache&) = delete;
+	NetworkDetailsCache& operator=(const NetworkDetailsCache&) = delete;
+
+	// nullptr until a fetch for network succeeded
+	const NetworkDetails* Get(const Network& network);
+	bool IsFetching(const Network& network) const;
+
+	void Invalidate();
+
+	Stats GetStats() const;
+
+private:
+	struct Entry
+	{
+		Ssid							ssid;
+		NetworkSecurity					security;
+		bool							connected;
+		std::shared_ptr<NetworkDetails>	details;
+		clock::time_point				expires;
+		clock::time_point				last_used;
+		bool							fetching;
+	};
+
+	Entry* Find(const Network& network);
+	void Fetch(Entry& entry);
+	void Fetched(const Network& network, std::uint64_t epoch, std::shared_ptr<NetworkDetails> details, bool success);
+
+private:
+	// Failed fetches are retried after this instead of the TTL
+	static constexpr auto		s_retry			= std::chrono::seconds(3);
+
+	// Entries not looked up for this long are dropped on invalidation
+	static constexpr auto		s_unused		= std::chrono::seconds(60);
+
+	WirelessRequestQueue*		m_requests;
+	clock::duration				m_ttl;
+	std::vector<Entry>			m_entries;
+
+	// Fetches started before an invalidation are stored already expired
+	std::uint64_t				m_epoch			= 0;
+
+	// Completions arriving after destruction are ignored
+	std::shared_ptr<bool>		m_alive			= std::make_shared<bool>(true);
+
+	std::uint64_t				m_hits			= 0;
+	std::uint64_t				m_misses		= 0;
+	std::uint64_t				m_deduplicated	= 0;
+	std::uint64_t				m_invalidations	= 0;
+};
@@ -0,0 +1,452 @@
+#include "nl80211_scan_reader.h"
+
+#include "stats.h"
+#include "trace.h"
+
+#include <linux/genetlink.h>
+#include <linux/netlink.h>
+#include <linux/nl80211.h>
+
+#include <net/if.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+static constexpr std::size_t s_buffer_size = 32 * 1024;
+
+// Information element ids and the parts of their contents bwm looks at
+static constexpr std::uint8_t s_ie_ssid					= 0;
+static constexpr std::uint8_t s_ie_rsn					= 48;
+static constexpr std::uint8_t s_ie_vendor				= 221;
+
+static constexpr std::uint8_t s_oui_rsn[3]				= { 0x00, 0x0f, 0xac };
+static constexpr std::uint8_t s_oui_wpa[3]				= { 0x00, 0x50, 0xf2 };
+static constexpr std::uint8_t s_wpa_vendor_type			= 1;
+
+static constexpr std::uint16_t s_capability_privacy		= 0x0010;
+
+// Calls visit(type, data, size) for every attribute in data
+template<typename F>
+static void for_each_attribute(const void* data, std::size_t size, F&& visit)
+{
+	const std::uint8_t* ptr = static_cast<const std::uint8_t*>(data);
+
+	while (size >= NLA_HDRLEN)
+	{
+		// Nests are not guaranteed to be aligned for nlattr
+		nlattr attribute;
+		std::memcpy(&attribute, ptr, sizeof(attribute));
+		if (attribute.nla_len < NLA_HDRLEN || attribute.nla_len > size)
+			return;
+
+		visit(attribute.nla_type & NLA_TYPE_MASK, ptr + NLA_HDRLEN, std::size_t(attribute.nla_len - NLA_HDRLEN));
+
+		std::size_t step = NLA_ALIGN(attribute.nla_len);
+		if (step >= size)
+			return;
+		ptr += step;
+		size -= step;
+	}
+}
+
+template<typename T>
+static T read_attribute(const void* data, std::size_t size)
+{
+	T value {};
+	std::memcpy(&value, data, std::min(size, sizeof(T)));
+	return value;
+}
+
+struct AkmSuites
+{
+	bool	present;
+	bool	ieee8021x;
+	bool	psk;
+	bool	owe;
+};
+
+// Reads the AKM suite list of an RSN or WPA element body, both start with
+// version, group cipher and the pairwise cipher list
+static void parse_akm_suites(const std::uint8_t* data, std::size_t size, const std::uint8_t (&oui)[3], AkmSuites& out)
+{
+	out.present = true;
+
+	std::size_t offset = 2 + 4;
+	if (offset + 2 > size)
+	{
+		// Truncated elements default to 802.1X
+		out.ieee8021x = true;
+		return;
+	}
+	std::size_t pairwise_count = data[offset] | (data[offset + 1] << 8);
+	offset += 2 + 4 * pairwise_count;
+
+	if (offset + 2 > size)
+	{
+		out.ieee8021x = true;
+		return;
+	}
+	std::size_t akm_count = data[offset] | (data[offset + 1] << 8);
+	offset += 2;
+
+	for (std::size_t i = 0; i < akm_count && offset + 4 <= size; i++, offset += 4)
+	{
+		if (std::memcmp(data + offset, oui, 3) != 0)
+			continue;
+
+		switch (data[offset + 3])
+		{
+			// 802.1X, FT, SHA-256, Suite B and FILS variants
+			case 1: case 3: case 5: case 11: case 12: case 13: case 14: case 15: case 16: case 17:
+				out.ieee8021x = true;
+				break;
+			// PSK, FT, SHA-256 and SAE variants
+			case 2: case 4: case 6: case 8: case 9: case 19: case 20: case 24: case 25:
+				out.psk = true;
+				break;
+			case 18:
+				out.owe = true;
+				break;
+		}
+	}
+}
+
+static void parse_information_elements(const std::uint8_t* data, std::size_t size, std::uint16_t capability, ScanResult& out)
+{
+	AkmSuites akm {};
+	bool has_ssid = false;
+
+	std::size_t offset = 0;
+	while (offset + 2 <= size)
+	{
+		std::uint8_t id		= data[offset];
+		std::uint8_t length	= data[offset + 1];
+		const std::uint8_t* body = data + offset + 2;
+		if (offset + 2 + length > size)
+			break;
+
+		if (id == s_ie_ssid && !has_ssid)
+		{
+			// Hidden networks send an empty or zeroed ssid
+			if (std::any_of(body, body + length, [](std::uint8_t c) { return c != 0; }))
+				out.ssid.assign(std::string_view(reinterpret_cast<const char*>(body), length));
+			has_ssid = true;
+		}
+		else if (id == s_ie_rsn)
+		{
+			parse_akm_suites(body, length, s_oui_rsn, akm);
+		}
+		else if (id == s_ie_vendor && length >= 4 && std::memcmp(body, s_oui_wpa, 3) == 0 && body[3] == s_wpa_vendor_type)
+		{
+			parse_akm_suites(body + 4, length - 4, s_oui_wpa, akm);
+		}
+
+		offset += 2 + length;
+	}
+
+	if (akm.ieee8021x)
+		out.security = NetworkSecurity::ieee8021x;
+	else if (akm.psk)
+		out.security = NetworkSecurity::psk;
+	else if (akm.owe)
+		out.security = NetworkSecurity::open;
+	else if (akm.present)
+		out.security = NetworkSecurity::unknown;
+	else if (capability & s_capability_privacy)
+		out.security = NetworkSecurity::wep;
+	else
+		out.security = NetworkSecurity::open;
+}
+
+bool ParseScanResult(const void* data, std::size_t size, ScanResult& out)
+{
+	out = ScanResult {};
+	out.signal = -1;
+
+	const std::uint8_t*	ies			= nullptr;
+	std::size_t			ies_size	= 0;
+	const std::uint8_t*	beacon		= nullptr;
+	std::size_t			beacon_size	= 0;
+	std::uint16_t		capability	= 0;
+
+	for_each_attribute(data, size, [&](std::uint16_t type, const void* value, std::size_t value_size) {
+		switch (type)
+		{
+			case NL80211_BSS_INFORMATION_ELEMENTS:
+				ies			= static_cast<const std::uint8_t*>(value);
+				ies_size	= value_size;
+				break;
+			case NL80211_BSS_BEACON_IES:
+				beacon		= static_cast<const std::uint8_t*>(value);
+				beacon_size	= value_size;
+				break;
+			case NL80211_BSS_CAPABILITY:
+				capability = read_attribute<std::uint16_t>(value, value_size);
+				break;
+			case NL80211_BSS_BSSID:
+				if (value_size == 6)
+				{
+					const std::uint8_t* a = static_cast<const std::uint8_t*>(value);
+					char bssid[18];
+					snprintf(bssid, sizeof(bssid), "%02x:%02x:%02x:%02x:%02x:%02x", a[0], a[1], a[2], a[3], a[4], a[5]);
+					out.bssid = bssid;
+				}
+				break;
+			case NL80211_BSS_FREQUENCY:
+				out.frequency = read_attribute<std::uint32_t>(value, value_size);
+				break;
+			case NL80211_BSS_SIGNAL_MBM:
+				out.signal_dbm	= std::int16_t(read_attribute<std::int32_t>(value, value_size) / 100);
+				out.signal		= std::int8_t(SignalPercent(out.signal_dbm));
+				break;
+			case NL80211_BSS_SIGNAL_UNSPEC:
+				if (out.signal < 0)
+					out.signal = std::int8_t(std::min<std::uint8_t>(read_attribute<std::uint8_t>(value, value_size), 100));
+				break;
+			case NL80211_BSS_STATUS:
+				out.associated = (read_attribute<std::uint32_t>(value, value_size) == NL80211_BSS_STATUS_ASSOCIATED);
+				break;
+		}
+	});
+
+	// Probe responses carry the ssid of hidden networks, beacons do not
+	if (ies == nullptr)
+	{
+		ies			= beacon;
+		ies_size	= beacon_size;
+	}
+	if (ies == nullptr)
+		return false;
+
+	parse_information_elements(ies, ies_size, capability, out);
+	return !out.ssid.empty();
+}
+
+Nl80211ScanReader::~Nl80211ScanReader()
+{
+	if (m_socket != -1)
+		close(m_socket);
+	if (m_event_socket != -1)
+		close(m_event_socket);
+}
+
+bool Nl80211ScanReader::Init()
+{
+	BWM_TRACE_SCOPE("nl80211 init");
+
+	m_buffer.resize(s_buffer_size);
+
+	m_socket		= socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_GENERIC);
+	m_event_socket	= socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_GENERIC);
+	if (m_socket == -1 || m_event_socket == -1)
+		return false;
+
+	sockaddr_nl address {};
+	address.nl_family = AF_NETLINK;
+	if (bind(m_socket, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == -1)
+		return false;
+	if (bind(m_event_socket, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == -1)
+		return false;
+
+	if (!ResolveFamily())
+		return false;
+
+	for (std::uint32_t group : { m_scan_group, m_mlme_group })
+	{
+		if (setsockopt(m_event_socket, SOL_NETLINK, NETLINK_ADD_MEMBERSHIP, &group, sizeof(group)) == -1)
+		{
+			fprintf(stderr, "Could not subscribe to nl80211 events: %s\n", strerror(errno));
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool Nl80211ScanReader::ResolveFamily()
+{
+	static constexpr char name[] = NL80211_GENL_NAME;
+	if (!Send(GENL_ID_CTRL, 0, CTRL_CMD_GETFAMILY, CTRL_ATTR_FAMILY_NAME, name, sizeof(name)))
+		return false;
+
+	bool ok = Receive([&](const nlmsghdr* header) {
+		const std::uint8_t* payload = static_cast<const std::uint8_t*>(NLMSG_DATA(header)) + GENL_HDRLEN;
+		std::size_t size = header->nlmsg_len - NLMSG_HDRLEN - GENL_HDRLEN;
+
+		for_each_attribute(payload, size, [&](std::uint16_t type, const void* value, std::size_t value_size) {
+			if (type == CTRL_ATTR_FAMILY_ID)
+				m_family = read_attribute<std::uint16_t>(value, value_size);
+			if (type != CTRL_ATTR_MCAST_GROUPS)
+				return;
+
+			for_each_attribute(value, value_size, [&](std::uint16_t, const void* group, std::size_t group_size) {
+				const char*		group_name	= nullptr;
+				std::uint32_t	group_id	= 0;
+				for_each_attribute(group, group_size, [&](std::uint16_t group_type, const void* group_value, std::size_t group_value_size) {
+					if (group_type == CTRL_ATTR_MCAST_GRP_NAME && group_value_size > 0)
+						group_name = static_cast<const char*>(group_value);
+					else if (group_type == CTRL_ATTR_MCAST_GRP_ID)
+						group_id = read_attribute<std::uint32_t>(group_value, group_value_size);
+				});
+
+				if (group_name && strcmp(group_name, NL80211_MULTICAST_GROUP_SCAN) == 0)
+					m_scan_group = group_id;
+				else if (group_name && strcmp(group_name, NL80211_MULTICAST_GROUP_MLME) == 0)
+					m_mlme_group = group_id;
+			});
+		});
+	});
+
+	return ok && m_family != 0 && m_scan_group != 0 && m_mlme_group != 0;
+}
+
+bool Nl80211ScanReader::Send(std::uint16_t type, std::uint16_t flags, std::uint8_t command, std::uint16_t attribute, const void* data, std::uint16_t size)
+{
+	struct
+	{
+		nlmsghdr		header;
+		genlmsghdr		genl;
+		nlattr			attribute;
+		std::uint8_t	data[64];
+	} message {};
+
+	if (size > sizeof(message.data))
+		return false;
+
+	message.header.nlmsg_len	= NLMSG_HDRLEN + GENL_HDRLEN + NLA_HDRLEN + NLA_ALIGN(size);
+	message.header.nlmsg_type	= type;
+	message.header.nlmsg_flags	= NLM_F_REQUEST | flags;
+	message.header.nlmsg_seq	= ++m_sequence;
+	message.genl.cmd			= command;
+	message.attribute.nla_len	= NLA_HDRLEN + size;
+	message.attribute.nla_type	= attribute;
+	std::memcpy(message.data, data, size);
+
+	sockaddr_nl kernel {};
+	kernel.nl_family = AF_NETLINK;
+
+	return sendto(m_socket, &message, message.header.nlmsg_len, 0, reinterpret_cast<sockaddr*>(&kernel), sizeof(kernel)) == ssize_t(message.header.nlmsg_len);
+}
+
+template<typename F>
+bool Nl80211ScanReader::Receive(F&& handle)
+{
+	for (;;)
+	{
+		ssize_t length = recv(m_socket, m_buffer.data(), m_buffer.size(), MSG_TRUNC);
+		if (length == -1 && errno == EINTR)
+			continue;
+		if (length <= 0 || std::size_t(length) > m_buffer.size())
+			return false;
+
+		bool more = false;
+
+		std::size_t remaining = length;
+		for (const nlmsghdr* header = reinterpret_cast<const nlmsghdr*>(m_buffer.data()); NLMSG_OK(header, remaining); header = NLMSG_NEXT(header, remaining))
+		{
+			if (header->nlmsg_seq != m_sequence)
+				continue;
+
+			if (header->nlmsg_type == NLMSG_DONE)
+				return true;
+
+			if (header->nlmsg_type == NLMSG_ERROR)
+			{
+				const nlmsgerr* error = static_cast<const nlmsgerr*>(NLMSG_DATA(header));
+				if (error->error == 0)
+					return true;
+				errno = -error->error;
+				return false;
+			}
+
+			if (header->nlmsg_len < NLMSG_HDRLEN + GENL_HDRLEN)
+				return false;
+
+			handle(header);
+			more |= (header->nlmsg_flags & NLM_F_MULTI) != 0;
+		}
+
+		if (!more)
+			return true;
+	}
+}
+
+bool Nl80211ScanReader::GetScanResults(const char* interface, std::vector<ScanResult>& out)
+{
+	BWM_STATS_SCOPE(nl80211_get_scan);
+	BWM_TRACE_SCOPE("nl80211_get_scan", interface);
+
+	std::uint32_t index = if_nametoindex(interface);
+	if (index == 0)
+		return false;
+
+	if (!Send(m_family, NLM_F_DUMP, NL80211_CMD_GET_SCAN, NL80211_ATTR_IFINDEX, &index, sizeof(index)))
+		return false;
+
+	out.clear();
+
+	return Receive([&](const nlmsghdr* header) {
+		const std::uint8_t* payload = static_cast<const std::uint8_t*>(NLMSG_DATA(header)) + GENL_HDRLEN;
+		std::size_t size = header->nlmsg_len - NLMSG_HDRLEN - GENL_HDRLEN;
+
+		for_each_attribute(payload, size, [&](std::uint16_t type, const void* value, std::size_t value_size) {
+			if (type != NL80211_ATTR_BSS)
+				return;
+			ScanResult result;
+			if (ParseScanResult(value, value_size, result))
+				out.push_back(result);
+		});
+	});
+}
+
+bool Nl80211ScanReader::PollEvents()
+{
+	bool changed = false;
+
+	for (;;)
+	{
+		ssize_t length = recv(m_event_socket, m_buffer.data(), m_buffer.size(), 0);
+		if (length == -1)
+		{
+			if (errno == EINTR)
+				continue;
+			// Events were dropped, anything could have happened
+			if (errno == ENOBUFS)
+			{
+				changed = true;
+				continue;
+			}
+			break;
+		}
+
+		std::size_t remaining = length;
+		for (const nlmsghdr* header = reinterpret_cast<const nlmsghdr*>(m_buffer.data()); NLMSG_OK(header, remaining); header = NLMSG_NEXT(header, remaining))
+		{
+			if (header->nlmsg_type != m_family || header->nlmsg_len < NLMSG_HDRLEN + GENL_HDRLEN)
+				continue;
+
+			const genlmsghdr* genl = static_cast<const genlmsghdr*>(NLMSG_DATA(header));
+			switch (genl->cmd)
+			{
+				case NL80211_CMD_NEW_SCAN_RESULTS:
+				case NL80211_CMD_CONNECT:
+				case NL80211_CMD_ROAM:
+				case NL80211_CMD_DISCONNECT:
+				case NL80211_CMD_ASSOCIATE:
+				case NL80211_CMD_DISASSOCIATE:
+				case NL80211_CMD_DEAUTHENTICATE:
+					changed = true;
+					break;
+			}
+		}
+	}
+
+	if (changed)
+		BWM_TRACE_INSTANT("nl80211 scan cache changed");
+
+	return changed;
+}
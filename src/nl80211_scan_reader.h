@@ -0,0 +1,81 @@
+#pragma once
+
+#include "structs.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// One entry of the kernel's BSS cache
+struct ScanResult
+{
+	Ssid			ssid;
+	FixedString<17>	bssid;			// aa:bb:cc:dd:ee:ff
+	NetworkSecurity	security;
+	std::int8_t		signal;			// percent, -1 if unknown
+	std::int16_t	signal_dbm;		// 0 if unknown
+	std::uint32_t	frequency;		// MHz
+	bool			associated;
+};
+
+// Signal in percent like NetworkManager shows it, -100 dBm is 0% and
+// -50 dBm is 100%
+inline int SignalPercent(int dbm)
+{
+	return std::clamp(2 * (dbm + 100), 0, 100);
+}
+
+// Parses the attributes of one NL80211_ATTR_BSS nest, including the
+// information elements the security is derived from. Returns false for
+// hidden networks and BSSs without elements. Public for bwm-nl80211-check.
+bool ParseScanResult(const void* data, std::size_t size, ScanResult& out);
+
+// Reads scan results straight from the kernel over generic netlink.
+//
+// cfg80211 keeps the results of every scan, no matter who started it, and
+// hands them out with an NL80211_CMD_GET_SCAN dump. That takes a few
+// microseconds where asking iwd means spawning iwctl. The reader also
+// listens to the "scan" and "mlme" multicast groups, so callers can tell
+// whether the cache could have changed at all since they last read it.
+//
+// Not thread safe, callers serialize access.
+class Nl80211ScanReader
+{
+public:
+	Nl80211ScanReader() = default;
+	~Nl80211ScanReader();
+
+	Nl80211ScanReader(const Nl80211ScanReader&) = delete;
+	Nl80211ScanReader& operator=(const Nl80211ScanReader&) = delete;
+
+	// Fails if the kernel has no nl80211 (no wireless drivers loaded)
+	bool Init();
+
+	// Replaces out with the cached BSSs of interface, reusing its capacity.
+	// Hidden networks are left out.
+	bool GetScanResults(const char* interface, std::vector<ScanResult>& out);
+
+	// Returns true if a scan finished or a link was established or lost on
+	// any interface since the last call, without blocking
+	bool PollEvents();
+
+private:
+	bool ResolveFamily();
+	bool Send(std::uint16_t type, std::uint16_t flags, std::uint8_t command, std::uint16_t attribute, const void* data, std::uint16_t size);
+
+	// Calls handle() for every message of the reply to the last request,
+	// returns false on errors
+	template<typename F>
+	bool Receive(F&& handle);
+
+private:
+	int							m_socket		= -1;
+	int							m_event_socket	= -1;
+	std::uint16_t				m_family		= 0;
+	std::uint32_t				m_scan_group	= 0;
+	std::uint32_t				m_mlme_group	= 0;
+	std::uint32_t				m_sequence		= 0;
+
+	// Dumps come in messages of up to a page each, this fits a batch of them
+	std::vector<std::uint8_t>	m_buffer;
+};
@@ -0,0 +1,1172 @@
+#include "nm_wireless_manager.h"
+
+#include "stats.h"
+#include "trace.h"
+
+#include <systemd/sd-bus.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+static constexpr const char* s_service				= "org.freedesktop.NetworkManager";
+static constexpr const char* s_manager_path			= "/org/freedesktop/NetworkManager";
+static constexpr const char* s_settings_path		= "/org/freedesktop/NetworkManager/Settings";
+
+static constexpr const char* s_manager_interface	= "org.freedesktop.NetworkManager";
+static constexpr const char* s_device_interface		= "org.freedesktop.NetworkManager.Device";
+static constexpr const char* s_wireless_interface	= "org.freedesktop.NetworkManager.Device.Wireless";
+static constexpr const char* s_ap_interface			= "org.freedesktop.NetworkManager.AccessPoint";
+static constexpr const char* s_settings_interface	= "org.freedesktop.NetworkManager.Settings";
+static constexpr const char* s_connection_interface	= "org.freedesktop.NetworkManager.Settings.Connection";
+static constexpr const char* s_active_interface		= "org.freedesktop.NetworkManager.Connection.Active";
+static constexpr const char* s_properties_interface	= "org.freedesktop.DBus.Properties";
+
+// NMDeviceType, NMDeviceState, NMActiveConnectionState and NM80211Mode
+static constexpr std::uint32_t s_device_type_wifi			= 2;
+static constexpr std::uint32_t s_device_state_unmanaged		= 10;
+static constexpr std::uint32_t s_device_state_unavailable	= 20;
+static constexpr std::uint32_t s_device_state_disconnected	= 30;
+static constexpr std::uint32_t s_active_state_activated		= 2;
+static constexpr std::uint32_t s_mode_adhoc					= 1;
+static constexpr std::uint32_t s_mode_infra					= 2;
+static constexpr std::uint32_t s_mode_ap					= 3;
+
+// NM80211ApFlags and NM80211ApSecurityFlags
+static constexpr std::uint32_t s_ap_flag_privacy		= 0x1;
+static constexpr std::uint32_t s_ap_key_mgmt_psk		= 0x100;
+static constexpr std::uint32_t s_ap_key_mgmt_8021x		= 0x200;
+static constexpr std::uint32_t s_ap_key_mgmt_sae		= 0x400;
+static constexpr std::uint32_t s_ap_key_mgmt_suite_b	= 0x2000;
+
+// Activation includes association and DHCP
+static constexpr auto s_activation_timeout	= std::chrono::seconds(60);
+static constexpr auto s_activation_poll		= std::chrono::milliseconds(100);
+
+// sd-bus objects are reference counted C objects, these drop the
+// reference when going out of scope
+struct BusMessage
+{
+	sd_bus_message* message = nullptr;
+	~BusMessage() { sd_bus_message_unref(message); }
+};
+
+struct BusError
+{
+	sd_bus_error error {};
+	~BusError() { sd_bus_error_free(&error); }
+};
+
+static void print_bus_error(const char* what, const BusError& error, int r)
+{
+	fprintf(stderr, "NetworkManager: %s: %s\n", what, error.error.message ? error.error.message : strerror(-r));
+}
+
+// Calls read(key) for every entry of an a{sv} dictionary. read() consumes
+// the variant and returns true, or returns false to have it skipped.
+template<typename F>
+static bool read_properties(sd_bus_message* message, F&& read)
+{
+	if (sd_bus_message_enter_container(message, 'a', "{sv}") < 0)
+		return false;
+
+	int r;
+	while ((r = sd_bus_message_enter_container(message, 'e', "sv")) > 0)
+	{
+		const char* key;
+		if (sd_bus_message_read(message, "s", &key) < 0)
+			return false;
+		if (!read(key) && sd_bus_message_skip(message, "v") < 0)
+			return false;
+		if (sd_bus_message_exit_container(message) < 0)
+			return false;
+	}
+
+	return r == 0 && sd_bus_message_exit_container(message) >= 0;
+}
+
+static bool read_variant_ssid(sd_bus_message* message, Ssid& out)
+{
+	if (sd_bus_message_enter_container(message, 'v', "ay") < 0)
+		return false;
+
+	const void* data;
+	std::size_t size;
+	if (sd_bus_message_read_array(message, 'y', &data, &size) < 0)
+		return false;
+	out.assign(std::string_view(static_cast<const char*>(data), size));
+
+	return sd_bus_message_exit_container(message) >= 0;
+}
+
+static bool read_object_paths(sd_bus_message* message, std::vector<std::string>& out)
+{
+	if (sd_bus_message_enter_container(message, 'a', "o") < 0)
+		return false;
+
+	const char* path;
+	int r;
+	while ((r = sd_bus_message_read(message, "o", &path)) > 0)
+		out.emplace_back(path);
+
+	return r == 0 && sd_bus_message_exit_container(message) >= 0;
+}
+
+static NetworkSecurity security_from_ap_flags(std::uint32_t flags, std::uint32_t wpa_flags, std::uint32_t rsn_flags)
+{
+	std::uint32_t key_mgmt = wpa_flags | rsn_flags;
+	if (key_mgmt & (s_ap_key_mgmt_8021x | s_ap_key_mgmt_suite_b))
+		return NetworkSecurity::ieee8021x;
+	if (key_mgmt & (s_ap_key_mgmt_psk | s_ap_key_mgmt_sae))
+		return NetworkSecurity::psk;
+	if (flags & s_ap_flag_privacy)
+		return NetworkSecurity::wep;
+	return NetworkSecurity::open;
+}
+
+static NetworkSecurity security_from_key_mgmt(std::string_view key_mgmt)
+{
+	if (key_mgmt.empty() || key_mgmt == "owe")
+		return NetworkSecurity::open;
+	if (key_mgmt == "none")
+		return NetworkSecurity::wep;
+	if (key_mgmt == "wpa-psk" || key_mgmt == "sae")
+		return NetworkSecurity::psk;
+	if (key_mgmt == "wpa-eap" || key_mgmt == "wpa-eap-suite-b-192" || key_mgmt == "ieee8021x")
+		return NetworkSecurity::ieee8021x;
+	return NetworkSecurity::unknown;
+}
+
+static DeviceMode mode_from_nm(std::uint32_t mode)
+{
+	switch (mode)
+	{
+		case s_mode_adhoc:	return DeviceMode::ad_hoc;
+		case s_mode_infra:	return DeviceMode::station;
+		case s_mode_ap:		return DeviceMode::ap;
+		default:			return DeviceMode::unknown;
+	}
+}
+
+NmWirelessManager::~NmWirelessManager()
+{
+	for (sd_bus_slot* slot : m_slots)
+		sd_bus_slot_unref(slot);
+	if (m_bus)
+		sd_bus_flush_close_unref(m_bus);
+}
+
+bool NmWirelessManager::Init()
+{
+	std::lock_guard bus_lock(m_bus_mutex);
+
+	int r = sd_bus_open_system(&m_bus);
+	if (r < 0)
+	{
+		fprintf(stderr, "Could not connect to the system bus: %s\n", strerror(-r));
+		return false;
+	}
+
+	// Subscribed before listing so no change falls in between
+	if (!Subscribe())
+		return false;
+
+	if (!LoadDevices() || m_device_paths.empty())
+		return false;
+
+	std::size_t current_device = 0;
+	{
+		std::lock_guard state_lock(m_state_mutex);
+		for (std::size_t i = 0; i < m_state.devices.size(); i++)
+		{
+			if (m_state.devices[i].power == PowerState::on)
+			{
+				current_device = i;
+				break;
+			}
+		}
+		m_state.current_device = current_device;
+	}
+
+	if (!LoadAccessPoints(m_device_paths[current_device]) || !LoadConnections())
+		return false;
+
+	m_devices_changed = true;
+	SyncState();
+
+	return true;
+}
+
+bool NmWirelessManager::Subscribe()
+{
+	struct Match
+	{
+		const char*					rule;
+		sd_bus_message_handler_t	handler;
+	};
+
+	static constexpr Match matches[] = {
+		{ "type='signal',sender='org.freedesktop.NetworkManager',interface='org.freedesktop.NetworkManager.Device.Wireless',member='AccessPointAdded'", OnAccessPointAdded },
+		{ "type='signal',sender='org.freedesktop.NetworkManager',interface='org.freedesktop.NetworkManager.Device.Wireless',member='AccessPointRemoved'", OnAccessPointRemoved },
+		{ "type='signal',sender='org.freedesktop.NetworkManager',interface='org.freedesktop.NetworkManager.Settings',member='NewConnection'", OnNewConnection },
+		{ "type='signal',sender='org.freedesktop.NetworkManager',interface='org.freedesktop.NetworkManager.Settings',member='ConnectionRemoved'", OnConnectionRemoved },
+		{ "type='signal',sender='org.freedesktop.NetworkManager',interface='org.freedesktop.DBus.Properties',member='PropertiesChanged',arg0='org.freedesktop.NetworkManager'", OnPropertiesChanged },
+		{ "type='signal',sender='org.freedesktop.NetworkManager',interface='org.freedesktop.DBus.Properties',member='PropertiesChanged',arg0='org.freedesktop.NetworkManager.Device'", OnPropertiesChanged },
+		{ "type='signal',sender='org.freedesktop.NetworkManager',interface='org.freedesktop.DBus.Properties',member='PropertiesChanged',arg0='org.freedesktop.NetworkManager.Device.Wireless'", OnPropertiesChanged },
+		{ "type='signal',sender='org.freedesktop.NetworkManager',interface='org.freedesktop.DBus.Properties',member='PropertiesChanged',arg0='org.freedesktop.NetworkManager.AccessPoint'", OnPropertiesChanged },
+	};
+
+	for (const Match& match : matches)
+	{
+		sd_bus_slot* slot = nullptr;
+		int r = sd_bus_add_match(m_bus, &slot, match.rule, match.handler, this);
+		if (r < 0)
+		{
+			fprintf(stderr, "Could not subscribe to NetworkManager signals: %s\n", strerror(-r));
+			return false;
+		}
+		m_slots.push_back(slot);
+	}
+
+	return true;
+}
+
+bool NmWirelessManager::LoadDevices()
+{
+	BusError error;
+	BusMessage reply;
+
+	int r = sd_bus_call_method(m_bus, s_service, s_manager_path, s_manager_interface, "GetDevices", &error.error, &reply.message, "");
+	if (r < 0)
+	{
+		print_bus_error("could not list devices", error, r);
+		return false;
+	}
+
+	std::vector<std::string> paths;
+	if (!read_object_paths(reply.message, paths))
+		return false;
+
+	int enabled = 0;
+	sd_bus_get_property_trivial(m_bus, s_service, s_manager_path, s_manager_interface, "WirelessEnabled", NULL, 'b', &enabled);
+	m_wireless_enabled = enabled;
+
+	std::vector<Device> devices;
+	m_device_paths.clear();
+	m_device_states.clear();
+
+	for (const std::string& path : paths)
+	{
+		std::uint32_t type = 0;
+		if (sd_bus_get_property_trivial(m_bus, s_service, path.c_str(), s_device_interface, "DeviceType", NULL, 'u', &type) < 0 || type != s_device_type_wifi)
+			continue;
+
+		char* interface = nullptr;
+		char* address = nullptr;
+		std::uint32_t state = 0;
+		std::uint32_t mode = 0;
+
+		sd_bus_get_property_string(m_bus, s_service, path.c_str(), s_device_interface, "Interface", NULL, &interface);
+		sd_bus_get_property_string(m_bus, s_service, path.c_str(), s_wireless_interface, "HwAddress", NULL, &address);
+		sd_bus_get_property_trivial(m_bus, s_service, path.c_str(), s_device_interface, "State", NULL, 'u', &state);
+		sd_bus_get_property_trivial(m_bus, s_service, path.c_str(), s_wireless_interface, "Mode", NULL, 'u', &mode);
+
+		Device& device = devices.emplace_back();
+		device.name		= interface ? interface : "";
+		device.address	= address ? address : "";
+		device.mode		= mode_from_nm(mode);
+		device.power	= PowerState::off;
+
+		free(interface);
+		free(address);
+
+		m_device_paths.push_back(path);
+		m_device_states.push_back(state);
+	}
+
+	std::lock_guard lock(m_state_mutex);
+	m_state.devices.swap(devices);
+	return true;
+}
+
+bool NmWirelessManager::LoadAccessPoints(const std::string& device_path)
+{
+	BusError error;
+	BusMessage reply;
+
+	m_ap_device_path = device_path;
+	m_access_points.clear();
+	m_pending_access_points.clear();
+	m_active_access_point.clear();
+	m_networks_changed = true;
+
+	int r = sd_bus_get_property(m_bus, s_service, device_path.c_str(), s_wireless_interface, "AccessPoints", &error.error, &reply.message, "ao");
+	if (r < 0)
+	{
+		print_bus_error("could not list access points", error, r);
+		return false;
+	}
+
+	std::vector<std::string> paths;
+	if (!read_object_paths(reply.message, paths))
+		return false;
+
+	for (const std::string& path : paths)
+		LoadAccessPoint(path);
+
+	char* active = nullptr;
+	if (sd_bus_get_property_string(m_bus, s_service, device_path.c_str(), s_wireless_interface, "ActiveAccessPoint", NULL, &active) >= 0)
+	{
+		m_active_access_point = active;
+		free(active);
+	}
+
+	return true;
+}
+
+bool NmWirelessManager::ReadAccessPointProperty(sd_bus_message* message, const char* key, AccessPoint& ap, bool& valid)
+{
+	auto read = [&](const char* type, void* value) {
+		valid = valid && sd_bus_message_read(message, "v", type, value) >= 0;
+		return true;
+	};
+
+	if (strcmp(key, "Ssid") == 0)
+	{
+		valid = valid && read_variant_ssid(message, ap.ssid);
+		return true;
+	}
+	if (strcmp(key, "HwAddress") == 0)
+	{
+		const char* address = nullptr;
+		read("s", &address);
+		if (valid)
+			ap.bssid = address;
+		return true;
+	}
+	if (strcmp(key, "Strength") == 0)	return read("y", &ap.strength);
+	if (strcmp(key, "Frequency") == 0)	return read("u", &ap.frequency);
+	if (strcmp(key, "Flags") == 0)		return read("u", &ap.flags);
+	if (strcmp(key, "WpaFlags") == 0)	return read("u", &ap.wpa_flags);
+	if (strcmp(key, "RsnFlags") == 0)	return read("u", &ap.rsn_flags);
+
+	// LastSeen, MaxBitrate, Mode, ...
+	return false;
+}
+
+void NmWirelessManager::LoadAccessPoint(const std::string& path)
+{
+	auto it = std::find_if(m_access_points.begin(), m_access_points.end(), [&](const AccessPoint& ap) { return ap.path == path; });
+
+	m_networks_changed = true;
+
+	BusMessage reply;
+	if (sd_bus_call_method(m_bus, s_service, path.c_str(), s_properties_interface, "GetAll", NULL, &reply.message, "s", s_ap_interface) < 0)
+	{
+		// Removed in the meantime
+		if (it != m_access_points.end())
+			m_access_points.erase(it);
+		return;
+	}
+
+	AccessPoint ap {};
+	ap.path = path;
+
+	bool valid = true;
+	valid = read_properties(reply.message, [&](const char* key) { return ReadAccessPointProperty(reply.message, key, ap, valid); }) && valid;
+	if (!valid)
+		return;
+
+	ap.security = security_from_ap_flags(ap.flags, ap.wpa_flags, ap.rsn_flags);
+
+	if (it != m_access_points.end())
+		*it = std::move(ap);
+	else
+		m_access_points.push_back(std::move(ap));
+}
+
+bool NmWirelessManager::LoadConnections()
+{
+	BusError error;
+	BusMessage reply;
+
+	int r = sd_bus_call_method(m_bus, s_service, s_settings_path, s_settings_interface, "ListConnections", &error.error, &reply.message, "");
+	if (r < 0)
+	{
+		print_bus_error("could not list connections", error, r);
+		return false;
+	}
+
+	std::vector<std::string> paths;
+	if (!read_object_paths(reply.message, paths))
+		return false;
+
+	m_connections.clear();
+	m_pending_connections.clear();
+	m_known_changed = true;
+
+	for (const std::string& path : paths)
+		LoadConnection(path);
+
+	return true;
+}
+
+void NmWirelessManager::LoadConnection(const std::string& path)
+{
+	auto it = std::find_if(m_connections.begin(), m_connections.end(), [&](const Connection& c) { return c.path == path; });
+	if (it != m_connections.end())
+		m_connections.erase(it);
+
+	m_known_changed = true;
+
+	BusMessage reply;
+	if (sd_bus_call_method(m_bus, s_service, path.c_str(), s_connection_interface, "GetSettings", NULL, &reply.message, "") < 0)
+		return;
+
+	sd_bus_message* message = reply.message;
+
+	std::string	type;
+	std::string	key_mgmt;
+	Ssid		ssid;
+
+	// a{sa{sv}}, settings grouped by section
+	if (sd_bus_message_enter_container(message, 'a', "{sa{sv}}") < 0)
+		return;
+	while (sd_bus_message_enter_container(message, 'e', "sa{sv}") > 0)
+	{
+		const char* section;
+		if (sd_bus_message_read(message, "s", &section) < 0)
+			return;
+
+		bool valid = read_properties(message, [&](const char* key) {
+			const char* value;
+			if (strcmp(section, "connection") == 0 && strcmp(key, "type") == 0)
+			{
+				if (sd_bus_message_read(message, "v", "s", &value) < 0)
+					return false;
+				type = value;
+				return true;
+			}
+			if (strcmp(section, "802-11-wireless-security") == 0 && strcmp(key, "key-mgmt") == 0)
+			{
+				if (sd_bus_message_read(message, "v", "s", &value) < 0)
+					return false;
+				key_mgmt = value;
+				return true;
+			}
+			if (strcmp(section, "802-11-wireless") == 0 && strcmp(key, "ssid") == 0)
+				return read_variant_ssid(message, ssid);
+			return false;
+		});
+
+		if (!valid || sd_bus_message_exit_container(message) < 0)
+			return;
+	}
+
+	if (type != "802-11-wireless" || ssid.empty())
+		return;
+
+	Connection& connection = m_connections.emplace_back();
+	connection.path		= path;
+	connection.ssid		= ssid;
+	connection.security	= security_from_key_mgmt(key_mgmt);
+}
+
+int NmWirelessManager::OnAccessPointAdded(sd_bus_message* message, void* userdata, sd_bus_error*)
+{
+	NmWirelessManager* self = static_cast<NmWirelessManager*>(userdata);
+
+	const char* path;
+	if (self->m_ap_device_path != sd_bus_message_get_path(message) || sd_bus_message_read(message, "o", &path) < 0)
+		return 0;
+
+	self->m_pending_access_points.emplace_back(path);
+	return 0;
+}
+
+int NmWirelessManager::OnAccessPointRemoved(sd_bus_message* message, void* userdata, sd_bus_error*)
+{
+	NmWirelessManager* self = static_cast<NmWirelessManager*>(userdata);
+
+	const char* path;
+	if (self->m_ap_device_path != sd_bus_message_get_path(message) || sd_bus_message_read(message, "o", &path) < 0)
+		return 0;
+
+	auto& pending = self->m_pending_access_points;
+	pending.erase(std::remove(pending.begin(), pending.end(), path), pending.end());
+
+	auto& access_points = self->m_access_points;
+	auto it = std::remove_if(access_points.begin(), access_points.end(), [&](const AccessPoint& ap) { return ap.path == path; });
+	if (it != access_points.end())
+	{
+		access_points.erase(it, access_points.end());
+		self->m_networks_changed = true;
+	}
+
+	return 0;
+}
+
+int NmWirelessManager::OnPropertiesChanged(sd_bus_message* message, void* userdata, sd_bus_error*)
+{
+	NmWirelessManager* self = static_cast<NmWirelessManager*>(userdata);
+
+	const char* interface;
+	if (sd_bus_message_read(message, "s", &interface) < 0)
+		return 0;
+
+	const char* path = sd_bus_message_get_path(message);
+
+	if (strcmp(interface, s_ap_interface) == 0)
+	{
+		auto& access_points = self->m_access_points;
+		auto it = std::find_if(access_points.begin(), access_points.end(), [&](const AccessPoint& ap) { return ap.path == path; });
+		if (it == access_points.end())
+			return 0;
+
+		// Applied in place from the signal. Every scan updates LastSeen of
+		// every access point, which is not used and changes nothing.
+		AccessPoint ap = *it;
+		bool valid = true;
+		bool changed = false;
+		valid = read_properties(message, [&](const char* key) {
+			bool used = ReadAccessPointProperty(message, key, ap, valid);
+			changed |= used;
+			return used;
+		}) && valid;
+
+		// Reloaded with a method call after dispatching instead
+		if (!valid)
+		{
+			self->m_pending_access_points.emplace_back(path);
+			return 0;
+		}
+
+		if (changed)
+		{
+			ap.security = security_from_ap_flags(ap.flags, ap.wpa_flags, ap.rsn_flags);
+			*it = std::move(ap);
+			self->m_networks_changed = true;
+		}
+	}
+	else if (strcmp(interface, s_wireless_interface) == 0)
+	{
+		if (self->m_ap_device_path != path)
+			return 0;
+
+		read_properties(message, [&](const char* key) {
+			const char* active;
+			if (strcmp(key, "ActiveAccessPoint") != 0 || sd_bus_message_read(message, "v", "o", &active) < 0)
+				return false;
+			self->m_active_access_point = active;
+			self->m_networks_changed = true;
+			return true;
+		});
+	}
+	else if (strcmp(interface, s_device_interface) == 0)
+	{
+		auto& paths = self->m_device_paths;
+		auto it = std::find(paths.begin(), paths.end(), path);
+		if (it == paths.end())
+			return 0;
+
+		std::uint32_t& state = self->m_device_states[std::distance(paths.begin(), it)];
+		read_properties(message, [&](const char* key) {
+			if (strcmp(key, "State") != 0 || sd_bus_message_read(message, "v", "u", &state) < 0)
+				return false;
+			self->m_devices_changed = true;
+			return true;
+		});
+	}
+	else if (strcmp(interface, s_manager_interface) == 0)
+	{
+		read_properties(message, [&](const char* key) {
+			int enabled;
+			if (strcmp(key, "WirelessEnabled") != 0 || sd_bus_message_read(message, "v", "b", &enabled) < 0)
+				return false;
+			self->m_wireless_enabled = enabled;
+			self->m_devices_changed = true;
+			return true;
+		});
+	}
+
+	return 0;
+}
+
+int NmWirelessManager::OnNewConnection(sd_bus_message* message, void* userdata, sd_bus_error*)
+{
+	NmWirelessManager* self = static_cast<NmWirelessManager*>(userdata);
+
+	const char* path;
+	if (sd_bus_message_read(message, "o", &path) >= 0)
+		self->m_pending_connections.emplace_back(path);
+	return 0;
+}
+
+int NmWirelessManager::OnConnectionRemoved(sd_bus_message* message, void* userdata, sd_bus_error*)
+{
+	NmWirelessManager* self = static_cast<NmWirelessManager*>(userdata);
+
+	const char* path;
+	if (sd_bus_message_read(message, "o", &path) < 0)
+		return 0;
+
+	auto& pending = self->m_pending_connections;
+	pending.erase(std::remove(pending.begin(), pending.end(), path), pending.end());
+
+	auto& connections = self->m_connections;
+	auto it = std::remove_if(connections.begin(), connections.end(), [&](const Connection& c) { return c.path == path; });
+	if (it != connections.end())
+	{
+		connections.erase(it, connections.end());
+		self->m_known_changed = true;
+	}
+
+	return 0;
+}
+
+void NmWirelessManager::Dispatch()
+{
+	BWM_TRACE_SCOPE("nm_dispatch");
+
+	while (sd_bus_process(m_bus, NULL) > 0)
+		continue;
+
+	// Loading may queue more signals, those are handled by the next call
+	std::vector<std::string> access_points;
+	access_points.swap(m_pending_access_points);
+	for (const std::string& path : access_points)
+		LoadAccessPoint(path);
+
+	std::vector<std::string> connections;
+	connections.swap(m_pending_connections);
+	for (const std::string& path : connections)
+		LoadConnection(path);
+}
+
+void NmWirelessManager::SyncState()
+{
+	if (m_networks_changed)
+	{
+		// One network per ssid, strongest access point first
+		m_sorted_access_points.clear();
+		for (const AccessPoint& ap : m_access_points)
+			m_sorted_access_points.push_back(&ap);
+		std::stable_sort(m_sorted_access_points.begin(), m_sorted_access_points.end(),
+			[](const AccessPoint* a, const AccessPoint* b) { return a->strength > b->strength; }
+		);
+
+		Ssid active_ssid;
+		for (const AccessPoint& ap : m_access_points)
+			if (ap.path == m_active_access_point)
+				active_ssid = ap.ssid;
+
+		m_network_buffer.clear();
+		for (const AccessPoint* ap : m_sorted_access_points)
+		{
+			if (ap->ssid.empty())
+				continue;
+			if (std::any_of(m_network_buffer.begin(), m_network_buffer.end(), [&](const Network& n) { return n.ssid == ap->ssid; }))
+				continue;
+
+			Network& network = m_network_buffer.emplace_back();
+			network.ssid		= ap->ssid;
+			network.security	= ap->security;
+			network.connected	= !active_ssid.empty() && ap->ssid == active_ssid;
+			network.signal		= std::int8_t(std::min<std::uint8_t>(ap->strength, 100));
+		}
+	}
+
+	if (m_known_changed)
+	{
+		m_known_network_buffer.clear();
+		for (const Connection& connection : m_connections)
+		{
+			Network& network = m_known_network_buffer.emplace_back();
+			network.ssid		= connection.ssid;
+			network.security	= connection.security;
+			network.connected	= false;
+			network.signal		= -1;
+		}
+	}
+
+	std::lock_guard lock(m_state_mutex);
+
+	bool changed = false;
+
+	if (m_devices_changed)
+	{
+		for (std::size_t i = 0; i < m_state.devices.size(); i++)
+		{
+			PowerState power = (m_wireless_enabled && m_device_states[i] > s_device_state_unavailable) ? PowerState::on : PowerState::off;
+			changed |= (m_state.devices[i].power != power);
+			m_state.devices[i].power = power;
+		}
+	}
+
+	if (m_networks_changed && m_network_buffer != m_state.networks)
+	{
+		m_state.networks.swap(m_network_buffer);
+		changed = true;
+	}
+
+	if (m_known_changed && m_known_network_buffer != m_state.known_networks)
+	{
+		m_state.known_networks.swap(m_known_network_buffer);
+		changed = true;
+	}
+
+	m_devices_changed	= false;
+	m_networks_changed	= false;
+	m_known_changed		= false;
+
+	if (changed)
+		PublishState();
+}
+
+std::string NmWirelessManager::CurrentDevicePath()
+{
+	std::lock_guard lock(m_state_mutex);
+	return m_device_paths[m_state.current_device];
+}
+
+const NmWirelessManager::Connection* NmWirelessManager::FindConnection(const Ssid& ssid) const
+{
+	for (const Connection& connection : m_connections)
+		if (connection.ssid == ssid)
+			return &connection;
+	return nullptr;
+}
+
+const NmWirelessManager::AccessPoint* NmWirelessManager::FindAccessPoint(const Ssid& ssid) const
+{
+	const AccessPoint* result = nullptr;
+	for (const AccessPoint& ap : m_access_points)
+		if (ap.ssid == ssid && (result == nullptr || ap.strength > result->strength))
+			result = &ap;
+	return result;
+}
+
+bool NmWirelessManager::Scan()
+{
+	BWM_STATS_SCOPE(nm_scan);
+
+	std::lock_guard lock(m_bus_mutex);
+	Dispatch();
+
+	std::string device_path = CurrentDevicePath();
+	BWM_TRACE_SCOPE("nm_scan", device_path.c_str());
+
+	// Results arrive as AccessPointAdded signals
+	BusError error;
+	int r = sd_bus_call_method(m_bus, s_service, device_path.c_str(), s_wireless_interface, "RequestScan", &error.error, NULL, "a{sv}", 0);
+
+	SyncState();
+	return r >= 0;
+}
+
+bool NmWirelessManager::UpdateNetworks()
+{
+	BWM_STATS_SCOPE(nm_update_networks);
+	BWM_TRACE_SCOPE("nm_update_networks");
+
+	std::lock_guard lock(m_bus_mutex);
+	Dispatch();
+	SyncState();
+	return true;
+}
+
+bool NmWirelessManager::UpdateKnownNetworks()
+{
+	BWM_STATS_SCOPE(nm_update_known_networks);
+	BWM_TRACE_SCOPE("nm_update_known_networks");
+
+	std::lock_guard lock(m_bus_mutex);
+	Dispatch();
+	SyncState();
+	return true;
+}
+
+bool NmWirelessManager::AddAndActivate(const Network& network, const std::string& password, const std::string& device_path, std::string& connection_path, std::string& active_path)
+{
+	const AccessPoint* ap = FindAccessPoint(network.ssid);
+
+	BusMessage call;
+	if (sd_bus_message_new_method_call(m_bus, &call.message, s_service, s_manager_path, s_manager_interface, "AddAndActivateConnection") < 0)
+		return false;
+	sd_bus_message* m = call.message;
+
+	// NetworkManager fills in everything else from the access point
+	bool ok = sd_bus_message_open_container(m, 'a', "{sa{sv}}") >= 0;
+
+	ok = ok && sd_bus_message_open_container(m, 'e', "sa{sv}") >= 0;
+	ok = ok && sd_bus_message_append(m, "s", "802-11-wireless") >= 0;
+	ok = ok && sd_bus_message_open_container(m, 'a', "{sv}") >= 0;
+	ok = ok && sd_bus_message_open_container(m, 'e', "sv") >= 0;
+	ok = ok && sd_bus_message_append(m, "s", "ssid") >= 0;
+	ok = ok && sd_bus_message_open_container(m, 'v', "ay") >= 0;
+	ok = ok && sd_bus_message_append_array(m, 'y', network.ssid.c_str(), network.ssid.size()) >= 0;
+	ok = ok && sd_bus_message_close_container(m) >= 0;
+	ok = ok && sd_bus_message_close_container(m) >= 0;
+	ok = ok && sd_bus_message_close_container(m) >= 0;
+	ok = ok && sd_bus_message_close_container(m) >= 0;
+
+	if (network.security == NetworkSecurity::psk || network.security == NetworkSecurity::wep)
+	{
+		ok = ok && sd_bus_message_open_container(m, 'e', "sa{sv}") >= 0;
+		ok = ok && sd_bus_message_append(m, "s", "802-11-wireless-security") >= 0;
+		ok = ok && sd_bus_message_open_container(m, 'a', "{sv}") >= 0;
+		if (network.security == NetworkSecurity::psk)
+		{
+			ok = ok && sd_bus_message_append(m, "{sv}", "key-mgmt", "s", "wpa-psk") >= 0;
+			ok = ok && sd_bus_message_append(m, "{sv}", "psk", "s", password.c_str()) >= 0;
+		}
+		else
+		{
+			// Keys have 5 or 13 characters or 10 or 26 hex digits,
+			// anything else is a passphrase (NMWepKeyType)
+			std::size_t length = password.size();
+			std::uint32_t key_type = (length == 5 || length == 10 || length == 13 || length == 26) ? 1 : 2;
+			ok = ok && sd_bus_message_append(m, "{sv}", "key-mgmt", "s", "none") >= 0;
+			ok = ok && sd_bus_message_append(m, "{sv}", "wep-key0", "s", password.c_str()) >= 0;
+			ok = ok && sd_bus_message_append(m, "{sv}", "wep-key-type", "u", key_type) >= 0;
+		}
+		ok = ok && sd_bus_message_close_container(m) >= 0;
+		ok = ok && sd_bus_message_close_container(m) >= 0;
+	}
+
+	ok = ok && sd_bus_message_close_container(m) >= 0;
+	ok = ok && sd_bus_message_append(m, "oo", device_path.c_str(), ap ? ap->path.c_str() : "/") >= 0;
+	if (!ok)
+		return false;
+
+	BusError error;
+	BusMessage reply;
+	int r = sd_bus_call(m_bus, m, 0, &error.error, &reply.message);
+	if (r < 0)
+	{
+		print_bus_error("could not connect", error, r);
+		return false;
+	}
+
+	const char* connection;
+	const char* active;
+	if (sd_bus_message_read(reply.message, "oo", &connection, &active) < 0)
+		return false;
+
+	connection_path	= connection;
+	active_path		= active;
+	return true;
+}
+
+bool NmWirelessManager::WaitForActivation(const std::string& active_path)
+{
+	BWM_TRACE_SCOPE("nm_wait_activation");
+
+	auto deadline = std::chrono::steady_clock::now() + s_activation_timeout;
+
+	for (;;)
+	{
+		std::uint32_t state;
+		{
+			// The bus is released in between, other requests keep working
+			std::lock_guard lock(m_bus_mutex);
+			Dispatch();
+
+			// The active connection is removed once deactivated
+			if (sd_bus_get_property_trivial(m_bus, s_service, active_path.c_str(), s_active_interface, "State", NULL, 'u', &state) < 0)
+				return false;
+		}
+
+		if (state == s_active_state_activated)
+			return true;
+		if (state > s_active_state_activated)
+			return false;
+		if (std::chrono::steady_clock::now() >= deadline)
+			return false;
+
+		std::this_thread::sleep_for(s_activation_poll);
+	}
+}
+
+bool NmWirelessManager::Connect(const Network& network, const std::string& password)
+{
+	BWM_STATS_SCOPE(nm_connect);
+	BWM_TRACE_SCOPE("nm_connect", network.ssid.c_str());
+
+	std::string device_path;
+	std::string connection_path;
+	std::string active_path;
+	std::string replaced_path;
+	bool added = false;
+
+	{
+		std::lock_guard lock(m_bus_mutex);
+		Dispatch();
+
+		device_path = CurrentDevicePath();
+
+		// A passphrase typed for a saved network replaces the saved one,
+		// which may be stale. 802.1X credentials are only set up in
+		// NetworkManager.
+		const Connection* connection = FindConnection(network.ssid);
+		if (connection && !password.empty() && network.security != NetworkSecurity::ieee8021x)
+		{
+			replaced_path = connection->path;
+			connection = nullptr;
+		}
+
+		if (connection)
+		{
+			connection_path = connection->path;
+
+			BusError error;
+			BusMessage reply;
+			int r = sd_bus_call_method(m_bus, s_service, s_manager_path, s_manager_interface, "ActivateConnection", &error.error, &reply.message,
+				"ooo", connection_path.c_str(), device_path.c_str(), "/");
+			if (r < 0)
+			{
+				print_bus_error("could not connect", error, r);
+				return false;
+			}
+
+			const char* active;
+			if (sd_bus_message_read(reply.message, "o", &active) < 0)
+				return false;
+			active_path = active;
+		}
+		else
+		{
+			if (network.security == NetworkSecurity::ieee8021x)
+			{
+				fprintf(stderr, "NetworkManager: 802.1X networks have to be set up in NetworkManager first\n");
+				return false;
+			}
+
+			// Without credentials the caller asks for them
+			if (network.security != NetworkSecurity::open && password.empty())
+				return false;
+
+			if (!AddAndActivate(network, password, device_path, connection_path, active_path))
+				return false;
+			added = true;
+		}
+	}
+
+	bool success = WaitForActivation(active_path);
+
+	std::lock_guard lock(m_bus_mutex);
+
+	if (!success)
+	{
+		// Like iwd, networks are only remembered once connected
+		if (added)
+			sd_bus_call_method(m_bus, s_service, connection_path.c_str(), s_connection_interface, "Delete", NULL, NULL, "");
+		Dispatch();
+		SyncState();
+		return false;
+	}
+
+	char* active = nullptr;
+	if (sd_bus_get_property_string(m_bus, s_service, device_path.c_str(), s_wireless_interface, "ActiveAccessPoint", NULL, &active) >= 0)
+	{
+		if (device_path == m_ap_device_path)
+			m_active_access_point = active;
+		free(active);
+	}
+	m_networks_changed = true;
+
+	// Only once the new one worked, ConnectionRemoved updates the list
+	if (!replaced_path.empty())
+	{
+		BusError error;
+		int r = sd_bus_call_method(m_bus, s_service, replaced_path.c_str(), s_connection_interface, "Delete", &error.error, NULL, "");
+		if (r < 0)
+			print_bus_error("could not remove the replaced connection", error, r);
+	}
+
+	Dispatch();
+	SyncState();
+	return true;
+}
+
+bool NmWirelessManager::Disconnect()
+{
+	BWM_STATS_SCOPE(nm_disconnect);
+	BWM_TRACE_SCOPE("nm_disconnect");
+
+	std::lock_guard lock(m_bus_mutex);
+	Dispatch();
+
+	std::string device_path = CurrentDevicePath();
+
+	BusError error;
+	int r = sd_bus_call_method(m_bus, s_service, device_path.c_str(), s_device_interface, "Disconnect", &error.error, NULL, "");
+	if (r < 0)
+	{
+		print_bus_error("could not disconnect", error, r);
+		return false;
+	}
+
+	if (device_path == m_ap_device_path)
+	{
+		m_active_access_point = "/";
+		m_networks_changed = true;
+	}
+
+	SyncState();
+	return true;
+}
+
+bool NmWirelessManager::ForgetKnownNetwork(const Network& network)
+{
+	BWM_STATS_SCOPE(nm_forget_known_network);
+	BWM_TRACE_SCOPE("nm_forget_known_network", network.ssid.c_str());
+
+	std::lock_guard lock(m_bus_mutex);
+	Dispatch();
+
+	bool success = true;
+	for (auto it = m_connections.begin(); it != m_connections.end(); )
+	{
+		if (it->ssid != network.ssid)
+		{
+			++it;
+			continue;
+		}
+
+		BusError error;
+		int r = sd_bus_call_method(m_bus, s_service, it->path.c_str(), s_connection_interface, "Delete", &error.error, NULL, "");
+		if (r < 0)
+		{
+			print_bus_error("could not forget network", error, r);
+			success = false;
+			++it;
+			continue;
+		}
+
+		it = m_connections.erase(it);
+		m_known_changed = true;
+	}
+
+	SyncState();
+	return success;
+}
+
+bool NmWirelessManager::GetNetworkDetails(const Network& network, NetworkDetails& out)
+{
+	BWM_STATS_SCOPE(nm_get_network_details);
+	BWM_TRACE_SCOPE("nm_get_network_details", network.ssid.c_str());
+
+	std::lock_guard lock(m_bus_mutex);
+	Dispatch();
+	SyncState();
+
+	out.bsses.clear();
+	out.station.clear();
+
+	// Access points are kept up to date from signals already
+	const AccessPoint* active = nullptr;
+	for (const AccessPoint& ap : m_access_points)
+	{
+		if (ap.ssid != network.ssid || ap.security != network.security)
+			continue;
+
+		Bss& bss = out.bsses.emplace_back();
+		bss.bssid		= ap.bssid;
+		bss.frequency	= ap.frequency;
+		bss.signal		= std::int8_t(std::min<std::uint8_t>(ap.strength, 100));
+		bss.signal_dbm	= 0;
+		bss.connected	= (ap.path == m_active_access_point);
+		if (bss.connected)
+			active = &ap;
+	}
+
+	std::stable_sort(out.bsses.begin(), out.bsses.end(), [](const Bss& a, const Bss& b) { return a.signal > b.signal; });
+
+	if (!network.connected || active == nullptr)
+		return true;
+
+	// What NetworkManager has of iwctl station show
+	char value[64];
+	out.station.push_back({ "Connected network", network.ssid.c_str() });
+	out.station.push_back({ "ConnectedBss", active->bssid.c_str() });
+	snprintf(value, sizeof(value), "%u", active->frequency);
+	out.station.push_back({ "Frequency", value });
+	snprintf(value, sizeof(value), "%u %%", active->strength);
+	out.station.push_back({ "Strength", value });
+
+	std::uint32_t bitrate = 0;
+	std::string device_path = CurrentDevicePath();
+	if (sd_bus_get_property_trivial(m_bus, s_service, device_path.c_str(), s_wireless_interface, "Bitrate", NULL, 'u', &bitrate) >= 0)
+	{
+		snprintf(value, sizeof(value), "%u Kbit/s", bitrate);
+		out.station.push_back({ "Bitrate", value });
+	}
+
+	return true;
+}
+
+bool NmWirelessManager::SetCurrentDevice(const Device& device)
+{
+	std::lock_guard bus_lock(m_bus_mutex);
+
+	std::size_t index;
+	{
+		std::lock_guard state_lock(m_state_mutex);
+
+		auto& devices = m_state.devices;
+		auto it = std::find_if(devices.begin(), devices.end(), [&](const auto& d) { return d.name == device.name; });
+		if (it == devices.end())
+			return false;
+
+		index = std::distance(devices.begin(), it);
+		m_state.current_device = index;
+		PublishState();
+	}
+
+	if (m_device_paths[index] != m_ap_device_path && !LoadAccessPoints(m_device_paths[index]))
+		return false;
+
+	SyncState();
+	return true;
+}
+
+bool NmWirelessManager::ActivateDevice()
+{
+	BWM_STATS_SCOPE(nm_activate_device);
+	BWM_TRACE_SCOPE("nm_activate_device");
+
+	std::lock_guard lock(m_bus_mutex);
+	Dispatch();
+
+	std::string device_path = CurrentDevicePath();
+	std::size_t index = std::distance(m_device_paths.begin(), std::find(m_device_paths.begin(), m_device_paths.end(), device_path));
+
+	BusError error;
+	int r = sd_bus_set_property(m_bus, s_service, s_manager_path, s_manager_interface, "WirelessEnabled", &error.error, "b", 1);
+	if (r < 0)
+	{
+		print_bus_error("could not enable wireless", error, r);
+		return false;
+	}
+
+	if (m_device_states[index] <= s_device_state_unmanaged)
+	{
+		r = sd_bus_set_property(m_bus, s_service, device_path.c_str(), s_device_interface, "Managed", &error.error, "b", 1);
+		if (r < 0)
+		{
+			print_bus_error("could not manage device", error, r);
+			return false;
+		}
+	}
+
+	// The state change signal follows later, the device is usable now
+	m_wireless_enabled = true;
+	m_device_states[index] = std::max(m_device_states[index], s_device_state_disconnected);
+	m_devices_changed = true;
+
+	SyncState();
+	return true;
+}
@@ -0,0 +1,132 @@
+#pragma once
+
+#include "wireless_manager.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct sd_bus;
+struct sd_bus_message;
+struct sd_bus_slot;
+struct sd_bus_error;
+
+// Backend for systems running NetworkManager. Talks to it over the system
+// bus with sd-bus and does not spawn any processes.
+//
+// Access points and saved connections are listed once by Init() and then
+// kept up to date from NetworkManager's signals (AccessPointAdded,
+// AccessPointRemoved, property changes, NewConnection, ConnectionRemoved).
+// Signals are dispatched at the start of every backend call, so
+// UpdateNetworks() only applies what changed since the last call instead
+// of listing everything again.
+class NmWirelessManager : public WirelessManager
+{
+public:
+	virtual ~NmWirelessManager() override;
+
+	virtual bool Init() override;
+
+	virtual WirelessBackend GetBackend() const override { return WirelessBackend::network_manager; }
+
+	virtual bool SetCurrentDevice(const Device& device) override;
+	virtual bool ActivateDevice() override;
+
+	virtual bool Scan() override;
+	virtual bool UpdateNetworks() override;
+
+	virtual bool Connect(const Network& network, const std::string& password) override;
+	virtual bool Disconnect() override;
+
+	virtual bool UpdateKnownNetworks() override;
+	virtual bool ForgetKnownNetwork(const Network& network) override;
+
+	virtual bool GetNetworkDetails(const Network& network, NetworkDetails& out) override;
+
+private:
+	struct AccessPoint
+	{
+		std::string		path;
+		Ssid			ssid;
+		FixedString<17>	bssid;
+		NetworkSecurity	security;
+		std::uint8_t	strength;
+		std::uint32_t	frequency;
+
+		// What security is derived from
+		std::uint32_t	flags;
+		std::uint32_t	wpa_flags;
+		std::uint32_t	rsn_flags;
+	};
+
+	struct Connection
+	{
+		std::string		path;
+		Ssid			ssid;
+		NetworkSecurity	security;
+	};
+
+	bool Subscribe();
+	bool LoadDevices();
+	// Reads the value of key into ap if it is one of the properties bwm
+	// uses, returns false without consuming it otherwise
+	static bool ReadAccessPointProperty(sd_bus_message* message, const char* key, AccessPoint& ap, bool& valid);
+
+	bool LoadAccessPoints(const std::string& device_path);
+	void LoadAccessPoint(const std::string& path);
+	bool LoadConnections();
+	void LoadConnection(const std::string& path);
+
+	// Runs the signal handlers of everything received so far and loads the
+	// objects they announced
+	void Dispatch();
+
+	// Applies the tables below to m_state, publishes it if it changed
+	void SyncState();
+
+	std::string CurrentDevicePath();
+	const Connection* FindConnection(const Ssid& ssid) const;
+	const AccessPoint* FindAccessPoint(const Ssid& ssid) const;
+
+	bool AddAndActivate(const Network& network, const std::string& password, const std::string& device_path, std::string& connection_path, std::string& active_path);
+	bool WaitForActivation(const std::string& active_path);
+
+	static int OnAccessPointAdded(sd_bus_message* message, void* userdata, sd_bus_error* error);
+	static int OnAccessPointRemoved(sd_bus_message* message, void* userdata, sd_bus_error* error);
+	static int OnPropertiesChanged(sd_bus_message* message, void* userdata, sd_bus_error* error);
+	static int OnNewConnection(sd_bus_message* message, void* userdata, sd_bus_error* error);
+	static int OnConnectionRemoved(sd_bus_message* message, void* userdata, sd_bus_error* error);
+
+private:
+	// sd-bus objects are not thread safe. Everything below is only used
+	// with m_bus_mutex held, which is always locked before m_state_mutex.
+	std::mutex					m_bus_mutex;
+	sd_bus*						m_bus				= nullptr;
+	std::vector<sd_bus_slot*>	m_slots;
+
+	// Both parallel to m_state.devices
+	std::vector<std::string>	m_device_paths;
+	std::vector<std::uint32_t>	m_device_states;
+	bool						m_wireless_enabled	= false;
+
+	// Access points of this device only
+	std::string					m_ap_device_path;
+	std::vector<AccessPoint>	m_access_points;
+	std::string					m_active_access_point;
+
+	std::vector<Connection>		m_connections;
+
+	// Objects announced by signals. Loading them needs method calls, which
+	// are made after dispatching instead of from the handlers.
+	std::vector<std::string>	m_pending_access_points;
+	std::vector<std::string>	m_pending_connections;
+
+	bool						m_devices_changed	= false;
+	bool						m_networks_changed	= false;
+	bool						m_known_changed		= false;
+
+	// Reused like in IwdWirelessManager
+	std::vector<const AccessPoint*>	m_sorted_access_points;
+	std::vector<Network>			m_network_buffer;
+	std::vector<Network>			m_known_network_buffer;
+};
@@ -0,0 +1,261 @@
+#include "process.h"
+
+#include "metrics.h"
+#include "process_replay.h"
+#include "stats.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Formats argv for trace events, never records passphrases
+static const char* format_command(const char* const argv[], char* buffer, std::size_t size)
+{
+	std::size_t len = 0;
+	buffer[0] = '\0';
+	for (std::size_t i = 0; argv[i] && len + 1 < size; i++)
+	{
+		bool hidden = (i > 0 && strcmp(argv[i - 1], "--passphrase") == 0);
+		int written = snprintf(buffer + len, size - len, "%s%s", i ? " " : "", hidden ? "***" : argv[i]);
+		if (written < 0)
+			break;
+		len += written;
+	}
+	return buffer;
+}
+
+static bool wait_for_process(pid_t pid)
+{
+	int status;
+	while (waitpid(pid, &status, 0) == -1)
+		if (errno != EINTR)
+			return false;
+
+	if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
+		return true;
+
+	// The child exits with 127 if exec failed
+	if (WIFSIGNALED(status))
+		MetricsRecordProcessFailure(ProcessFailure::signal);
+	else if (WIFEXITED(status) && WEXITSTATUS(status) == 127)
+		MetricsRecordProcessFailure(ProcessFailure::not_found);
+	else
+		MetricsRecordProcessFailure(ProcessFailure::exit_status);
+	return false;
+}
+
+struct ProcessRecording
+{
+	std::vector<std::string>				argv;
+	std::string								output;
+	std::chrono::steady_clock::time_point	start;
+};
+
+ProcessReader::~ProcessReader()
+{
+	if (IsOpen())
+		Close();
+}
+
+bool ProcessReader::Open(const char* const argv[])
+{
+	if (IsOpen())
+		return false;
+
+	m_begin	= 0;
+	m_end	= 0;
+
+	if (ProcessIsReplaying())
+	{
+		m_fixture			= ProcessReplayTake(argv);
+		m_fixture_offset	= 0;
+		return m_fixture != nullptr;
+	}
+
+	int pipe_fds[2];
+	if (pipe2(pipe_fds, O_CLOEXEC) == -1)
+		return false;
+
+	if (TraceEnabled())
+	{
+		char command[128];
+		TraceInstant("spawn", format_command(argv, command, sizeof(command)));
+	}
+
+	BWM_STATS_SPAWN();
+	MetricsRecordSpawn();
+	pid_t pid = vfork();
+	if (pid == -1)
+	{
+		MetricsRecordProcessFailure(ProcessFailure::spawn);
+		close(pipe_fds[0]);
+		close(pipe_fds[1]);
+		return false;
+	}
+
+	if (pid == 0)
+	{
+		// dup2 clears O_CLOEXEC from the new descriptor
+		if (dup2(pipe_fds[1], STDOUT_FILENO) == -1)
+			_exit(127);
+		execvp(argv[0], const_cast<char* const*>(argv));
+		_exit(127);
+	}
+
+	close(pipe_fds[1]);
+
+	m_pid	= pid;
+	m_fd	= pipe_fds[0];
+
+	if (ProcessIsRecording())
+	{
+		m_recording			= new ProcessRecording();
+		m_recording->argv	= ProcessRecordArgv(argv);
+		m_recording->start	= std::chrono::steady_clock::now();
+	}
+
+	return true;
+}
+
+bool ProcessReader::FillFromFixture()
+{
+	std::size_t count = std::min(sizeof(m_buffer) - m_end, m_fixture->output.size() - m_fixture_offset);
+	if (count == 0)
+		return false;
+
+	std::memcpy(m_buffer + m_end, m_fixture->output.data() + m_fixture_offset, count);
+	m_fixture_offset	+= count;
+	m_end				+= count;
+	return true;
+}
+
+bool ProcessReader::Fill()
+{
+	if (m_begin > 0)
+	{
+		std::memmove(m_buffer, m_buffer + m_begin, m_end - m_begin);
+		m_end -= m_begin;
+		m_begin = 0;
+	}
+
+	if (m_fixture)
+		return FillFromFixture();
+
+	for (;;)
+	{
+		ssize_t nread = read(m_fd, m_buffer + m_end, sizeof(m_buffer) - m_end);
+		if (nread == -1 && errno == EINTR)
+			continue;
+		if (nread <= 0)
+			return false;
+		if (m_recording)
+			m_recording->output.append(m_buffer + m_end, nread);
+		m_end += nread;
+		return true;
+	}
+}
+
+bool ProcessReader::ReadLine(char* buffer, std::size_t size)
+{
+	if (!IsOpen() || size == 0)
+		return false;
+
+	std::size_t written = 0;
+	while (written + 1 < size)
+	{
+		if (m_begin == m_end && !Fill())
+			break;
+
+		char c = m_buffer[m_begin++];
+		buffer[written++] = c;
+		if (c == '\n')
+			break;
+	}
+
+	buffer[written] = '\0';
+	return written > 0;
+}
+
+bool ProcessReader::Close()
+{
+	if (!IsOpen())
+		return false;
+
+	if (m_fixture)
+	{
+		bool success = m_fixture->success;
+		m_fixture = nullptr;
+		return success;
+	}
+
+	BWM_TRACE_SCOPE("wait process");
+
+	// The fixture has to contain the whole output even if the caller
+	// stopped reading early
+	if (m_recording)
+	{
+		m_begin = m_end = 0;
+		while (Fill())
+			m_begin = m_end;
+	}
+
+	close(m_fd);
+	bool success = wait_for_process(m_pid);
+
+	if (m_recording)
+	{
+		ProcessRecord(m_recording->argv, m_recording->start, m_recording->output, success);
+		delete m_recording;
+		m_recording = nullptr;
+	}
+
+	m_pid	= -1;
+	m_fd	= -1;
+
+	return success;
+}
+
+bool run_process(const char* const argv[])
+{
+	char command[128];
+	BWM_TRACE_SCOPE("run process", TraceEnabled() ? format_command(argv, command, sizeof(command)) : nullptr);
+
+	if (ProcessIsReplaying())
+	{
+		const ProcessFixture* fixture = ProcessReplayTake(argv);
+		return fixture && fixture->success;
+	}
+
+	auto start = std::chrono::steady_clock::now();
+
+	BWM_STATS_SPAWN();
+	MetricsRecordSpawn();
+	pid_t pid = vfork();
+	if (pid == -1)
+	{
+		MetricsRecordProcessFailure(ProcessFailure::spawn);
+		return false;
+	}
+
+	if (pid == 0)
+	{
+		int dn = open("/dev/null", O_WRONLY);
+		if (dn == -1)
+			_exit(127);
+		if (dup2(dn, STDOUT_FILENO) == -1 || dup2(dn, STDERR_FILENO) == -1)
+			_exit(127);
+		close(dn);
+		execvp(argv[0], const_cast<char* const*>(argv));
+		_exit(127);
+	}
+
+	bool success = wait_for_process(pid);
+	if (ProcessIsRecording())
+		ProcessRecord(ProcessRecordArgv(argv), start, {}, success);
+	return success;
+}
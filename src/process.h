@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstddef>
+#include <sys/types.h>
+
+struct ProcessFixture;
+struct ProcessRecording;
+
+// Spawns a process with its stdout connected to a pipe. Unlike popen()
+// this does not go through the shell and does not allocate, output is
+// read through a fixed size buffer owned by the reader.
+//
+// When recording or replaying (see process_replay.h) the reader captures
+// the output or serves it from a fixture instead.
+class ProcessReader
+{
+public:
+	ProcessReader() = default;
+	~ProcessReader();
+
+	ProcessReader(const ProcessReader&) = delete;
+	ProcessReader& operator=(const ProcessReader&) = delete;
+
+	// argv must be NULL terminated, argv[0] is searched from PATH
+	bool Open(const char* const argv[]);
+
+	// Same semantics as fgets(), reads at most one line including the newline
+	bool ReadLine(char* buffer, std::size_t size);
+
+	// Waits for the process, returns true if it exited with status 0
+	bool Close();
+
+private:
+	bool Fill();
+	bool FillFromFixture();
+	bool IsOpen() const { return m_pid != -1 || m_fixture != nullptr; }
+
+private:
+	pid_t		m_pid	= -1;
+	int			m_fd	= -1;
+
+	const ProcessFixture*	m_fixture			= nullptr;
+	std::size_t				m_fixture_offset	= 0;
+	ProcessRecording*		m_recording			= nullptr;
+
+	char		m_buffer[4096];
+	std::size_t	m_begin	= 0;
+	std::size_t	m_end	= 0;
+};
+
+// Runs a process with stdout and stderr redirected to /dev/null and waits
+// for it. Returns true if it exited with status 0.
+bool run_process(const char* const argv[]);
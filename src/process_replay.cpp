@@ -0,0 +1,214 @@
+#include "process_replay.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+enum class ProcessMode
+{
+	normal,
+	recording,
+	replaying,
+};
+
+static std::atomic<ProcessMode>		s_mode { ProcessMode::normal };
+static std::mutex					s_mutex;
+static FILE*						s_record_file	= nullptr;
+static std::chrono::steady_clock::time_point s_record_epoch;
+static std::chrono::steady_clock::time_point s_replay_epoch;
+static std::vector<ProcessFixture>	s_fixtures;
+static double						s_speed			= 1.0;
+
+static constexpr const char* s_header		= "bwm-fixture 1\n";
+static constexpr const char* s_hidden_arg	= "***";
+
+bool ProcessStartRecording(const char* path)
+{
+	std::lock_guard lock(s_mutex);
+
+	if (s_mode.load() != ProcessMode::normal)
+		return false;
+
+	s_record_file = fopen(path, "w");
+	if (s_record_file == NULL)
+	{
+		fprintf(stderr, "Could not open fixture file '%s'\n", path);
+		return false;
+	}
+
+	fputs(s_header, s_record_file);
+	fflush(s_record_file);
+
+	s_record_epoch = std::chrono::steady_clock::now();
+	s_mode.store(ProcessMode::recording);
+	return true;
+}
+
+static bool parse_fixtures(std::istream& in, std::vector<ProcessFixture>& out)
+{
+	std::string line;
+	if (!std::getline(in, line) || line + '\n' != s_header)
+		return false;
+
+	while (std::getline(in, line))
+	{
+		if (line.empty())
+			continue;
+
+		ProcessFixture fixture {};
+		std::size_t argc;
+
+		int success;
+		if (sscanf(line.c_str(), "command %lu %lu %d %zu", &fixture.start_us, &fixture.duration_us, &success, &argc) != 4)
+			return false;
+		fixture.success = success;
+
+		for (std::size_t i = 0; i < argc; i++)
+		{
+			std::size_t len;
+			if (!(in >> len) || in.get() != ' ')
+				return false;
+			std::string arg(len, '\0');
+			if (!in.read(arg.data(), len) || in.get() != '\n')
+				return false;
+			fixture.argv.push_back(std::move(arg));
+		}
+
+		std::size_t len;
+		if (!std::getline(in, line) || sscanf(line.c_str(), "output %zu", &len) != 1)
+			return false;
+		fixture.output.resize(len);
+		if (!in.read(fixture.output.data(), len) || in.get() != '\n')
+			return false;
+
+		out.push_back(std::move(fixture));
+	}
+
+	return true;
+}
+
+bool ProcessStartReplay(const char* path, double speed)
+{
+	std::lock_guard lock(s_mutex);
+
+	if (s_mode.load() != ProcessMode::normal)
+		return false;
+
+	std::ifstream file(path, std::ios::binary);
+	if (!file)
+	{
+		fprintf(stderr, "Could not open fixture file '%s'\n", path);
+		return false;
+	}
+
+	if (!parse_fixtures(file, s_fixtures))
+	{
+		fprintf(stderr, "Invalid fixture file '%s'\n", path);
+		s_fixtures.clear();
+		return false;
+	}
+
+	s_speed			= speed;
+	s_replay_epoch	= std::chrono::steady_clock::now();
+	s_mode.store(ProcessMode::replaying);
+	return true;
+}
+
+bool ProcessIsRecording()	{ return s_mode.load(std::memory_order_relaxed) == ProcessMode::recording; }
+bool ProcessIsReplaying()	{ return s_mode.load(std::memory_order_relaxed) == ProcessMode::replaying; }
+
+static bool fixture_matches(const ProcessFixture& fixture, const char* const argv[])
+{
+	std::size_t i = 0;
+	for (; argv[i]; i++)
+	{
+		if (i >= fixture.argv.size())
+			return false;
+		if (fixture.argv[i] != s_hidden_arg && fixture.argv[i] != argv[i])
+			return false;
+	}
+	return i == fixture.argv.size();
+}
+
+const ProcessFixture* ProcessReplayTake(const char* const argv[])
+{
+	const ProcessFixture* result = nullptr;
+
+	{
+		std::lock_guard lock(s_mutex);
+		for (ProcessFixture& fixture : s_fixtures)
+		{
+			if (fixture.used || !fixture_matches(fixture, argv))
+				continue;
+			fixture.used = true;
+			result = &fixture;
+			break;
+		}
+	}
+
+	if (result == nullptr)
+	{
+		fprintf(stderr, "replay: no fixture left for '%s", argv[0]);
+		for (std::size_t i = 1; argv[i]; i++)
+			fprintf(stderr, " %s", argv[i]);
+		fprintf(stderr, "'\n");
+		return nullptr;
+	}
+
+	// The call starts at its recorded offset from the start of the session,
+	// or right away if bwm is behind, and takes its recorded duration
+	if (s_speed > 0.0)
+	{
+		using namespace std::chrono;
+
+		auto scaled = [](std::uint64_t us) { return microseconds((std::uint64_t)(us / s_speed)); };
+		auto start = std::max(steady_clock::now(), s_replay_epoch + scaled(result->start_us));
+		std::this_thread::sleep_until(start + scaled(result->duration_us));
+	}
+
+	return result;
+}
+
+std::vector<std::string> ProcessRecordArgv(const char* const argv[])
+{
+	std::vector<std::string> result;
+	for (std::size_t i = 0; argv[i]; i++)
+	{
+		bool hidden = (i > 0 && strcmp(argv[i - 1], "--passphrase") == 0);
+		result.push_back(hidden ? s_hidden_arg : argv[i]);
+	}
+	return result;
+}
+
+void ProcessRecord(const std::vector<std::string>& argv, std::chrono::steady_clock::time_point start, std::string_view output, bool success)
+{
+	using namespace std::chrono;
+
+	auto now = steady_clock::now();
+
+	std::lock_guard lock(s_mutex);
+	if (s_record_file == NULL)
+		return;
+
+	fprintf(s_record_file, "command %lu %lu %d %zu\n",
+		(std::uint64_t)duration_cast<microseconds>(start - s_record_epoch).count(),
+		(std::uint64_t)duration_cast<microseconds>(now - start).count(),
+		success ? 1 : 0,
+		argv.size()
+	);
+	for (const std::string& arg : argv)
+	{
+		fprintf(s_record_file, "%zu ", arg.size());
+		fwrite(arg.data(), 1, arg.size(), s_record_file);
+		fputc('\n', s_record_file);
+	}
+	fprintf(s_record_file, "output %zu\n", output.size());
+	fwrite(output.data(), 1, output.size(), s_record_file);
+	fputc('\n', s_record_file);
+	fflush(s_record_file);
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Record and replay of every process bwm spawns.
+//
+// While recording, the command line, full stdout, exit status and timing
+// of each process are appended to a fixture file. While replaying, no
+// processes are spawned at all, ProcessReader and run_process() are served
+// from a fixture instead. This lets sessions captured on real hardware be
+// reproduced on machines without wireless hardware, and serves as input
+// for benchmarks of the parser and update path.
+//
+// Passphrases are never written to fixtures. They are recorded as "***",
+// which matches any argument when replaying.
+
+struct ProcessFixture
+{
+	std::vector<std::string>	argv;
+	std::string					output;
+	bool						success;
+	std::uint64_t				start_us;
+	std::uint64_t				duration_us;
+	bool						used;
+};
+
+bool ProcessStartRecording(const char* path);
+
+// speed scales the recorded timing, 1.0 replays at the recorded pace and
+// 0.0 returns results immediately
+bool ProcessStartReplay(const char* path, double speed);
+
+bool ProcessIsRecording();
+bool ProcessIsReplaying();
+
+// Finds the first unused fixture matching argv and waits until its scaled
+// start offset from the start of the replay plus its scaled duration, so
+// the gaps between calls are kept. Returns nullptr if nothing matches.
+const ProcessFixture* ProcessReplayTake(const char* const argv[]);
+
+void ProcessRecord(const std::vector<std::string>& argv, std::chrono::steady_clock::time_point start, std::string_view output, bool success);
+std::vector<std::string> ProcessRecordArgv(const char* const argv[]);
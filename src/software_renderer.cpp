@@ -0,0 +1,543 @@
+#include "software_renderer.h"
+
+#include "trace.h"
+
+#define GLFW_EXPOSE_NATIVE_X11
+#include <GLFW/glfw3.h>
+#include <GLFW/glfw3native.h>
+
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <X11/extensions/XShm.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+struct SoftwareRenderer::X11
+{
+	Display*		display		= nullptr;
+	::Window		window		= 0;
+	GC				gc			= nullptr;
+	Visual*			visual		= nullptr;
+	int				depth		= 0;
+
+	XImage*			image		= nullptr;
+	XShmSegmentInfo	shm			{};
+	bool			use_shm		= false;
+};
+
+// Pixels are 0xAARRGGBB with premultiplied alpha, ImGui colors are
+// 0xAABBGGRR with straight alpha
+static inline std::uint32_t div255(std::uint32_t x)
+{
+	return (x + 1 + (x >> 8)) >> 8;
+}
+
+static inline std::uint32_t premultiply(ImU32 color, std::uint32_t alpha)
+{
+	std::uint32_t r = (color >> IM_COL32_R_SHIFT) & 0xFF;
+	std::uint32_t g = (color >> IM_COL32_G_SHIFT) & 0xFF;
+	std::uint32_t b = (color >> IM_COL32_B_SHIFT) & 0xFF;
+	return (alpha << 24) | (div255(r * alpha) << 16) | (div255(g * alpha) << 8) | div255(b * alpha);
+}
+
+// dst = src + dst * (255 - src_alpha) / 255 on every channel
+static inline std::uint32_t blend(std::uint32_t dst, std::uint32_t src)
+{
+	std::uint32_t inv = 255 - (src >> 24);
+	std::uint32_t rb = (dst & 0x00FF00FF) * inv + 0x00800080;
+	std::uint32_t ag = ((dst >> 8) & 0x00FF00FF) * inv + 0x00800080;
+	rb = ((rb + ((rb >> 8) & 0x00FF00FF)) >> 8) & 0x00FF00FF;
+	ag = (ag + ((ag >> 8) & 0x00FF00FF)) & 0xFF00FF00;
+	return src + (rb | ag);
+}
+
+static void blend_span(std::uint32_t* dst, int count, std::uint32_t src)
+{
+	if ((src >> 24) == 0xFF)
+	{
+		std::fill(dst, dst + count, src);
+		return;
+	}
+	if (src == 0)
+		return;
+
+	int i = 0;
+
+#ifdef __SSE2__
+	const __m128i zero	= _mm_setzero_si128();
+	const __m128i inv	= _mm_set1_epi16(255 - (src >> 24));
+	const __m128i bias	= _mm_set1_epi16(0x80);
+	const __m128i color	= _mm_set1_epi32(src);
+
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128i pixels	= _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+		__m128i lo		= _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(pixels, zero), inv), bias);
+		__m128i hi		= _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(pixels, zero), inv), bias);
+		lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+		hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_add_epi8(_mm_packus_epi16(lo, hi), color));
+	}
+#endif
+
+	for (; i < count; i++)
+		dst[i] = blend(dst[i], src);
+}
+
+// XShmAttach() fails asynchronously, the X server's error would otherwise
+// end up in the default handler which exits the process
+static bool s_shm_error = false;
+
+static int catch_shm_error(Display*, XErrorEvent*)
+{
+	s_shm_error = true;
+	return 0;
+}
+
+SoftwareRenderer::~SoftwareRenderer()
+{
+	Shutdown();
+}
+
+bool SoftwareRenderer::Init(GLFWwindow* window)
+{
+	Display* display = glfwGetX11Display();
+	if (display == NULL)
+		return false;
+
+	XWindowAttributes attributes;
+	if (!XGetWindowAttributes(display, glfwGetX11Window(window), &attributes))
+		return false;
+
+	Visual* visual = attributes.visual;
+	if (ImageByteOrder(display) != LSBFirst || (attributes.depth != 24 && attributes.depth != 32) ||
+		visual->red_mask != 0xFF0000 || visual->green_mask != 0x00FF00 || visual->blue_mask != 0x0000FF)
+	{
+		fprintf(stderr, "Software renderer does not support the X server's pixel format\n");
+		return false;
+	}
+
+	m_x11 = new X11();
+	m_x11->display	= display;
+	m_x11->window	= glfwGetX11Window(window);
+	m_x11->gc		= XCreateGC(display, m_x11->window, 0, NULL);
+	m_x11->visual	= visual;
+	m_x11->depth	= attributes.depth;
+	m_x11->use_shm	= XShmQueryExtension(display);
+
+	// MIT-SHM only works with a local X server
+	if (const char* env = getenv("DISPLAY"); env && env[0] != ':')
+		m_x11->use_shm = false;
+
+	ImGuiIO& io = ImGui::GetIO();
+	io.BackendRendererName = "bwm_software";
+	io.BackendFlags |= ImGuiBackendFlags_RendererHasVtxOffset;
+
+	return true;
+}
+
+void SoftwareRenderer::Shutdown()
+{
+	if (m_x11 == nullptr)
+		return;
+
+	DestroyImage();
+	XFreeGC(m_x11->display, m_x11->gc);
+
+	delete m_x11;
+	m_x11 = nullptr;
+
+	ImGuiIO& io = ImGui::GetIO();
+	io.BackendRendererName = NULL;
+	io.Fonts->SetTexID(0);
+}
+
+bool SoftwareRenderer::CreateImage(int width, int height)
+{
+	DestroyImage();
+
+	X11& x = *m_x11;
+
+	if (x.use_shm)
+	{
+		x.image = XShmCreateImage(x.display, x.visual, x.depth, ZPixmap, NULL, &x.shm, width, height);
+		if (x.image)
+		{
+			x.shm.shmid = shmget(IPC_PRIVATE, x.image->bytes_per_line * height, IPC_CREAT | 0600);
+			x.shm.shmaddr = x.image->data = (char*)shmat(x.shm.shmid, NULL, 0);
+			x.shm.readOnly = False;
+
+			// Errors of earlier requests go to the installed handler
+			XSync(x.display, False);
+			s_shm_error = false;
+			XErrorHandler previous_handler = XSetErrorHandler(catch_shm_error);
+
+			bool attached = x.shm.shmaddr != (char*)-1 && XShmAttach(x.display, &x.shm);
+			XSync(x.display, False);
+
+			XSetErrorHandler(previous_handler);
+			if (s_shm_error)
+				attached = false;
+
+			// Removed once both sides detach
+			shmctl(x.shm.shmid, IPC_RMID, NULL);
+
+			if (!attached)
+			{
+				if (x.shm.shmaddr != (char*)-1)
+					shmdt(x.shm.shmaddr);
+				x.image->data = NULL;
+				XDestroyImage(x.image);
+				x.image = nullptr;
+			}
+		}
+
+		if (x.image == nullptr)
+		{
+			fprintf(stderr, "Could not use MIT-SHM, falling back to XPutImage\n");
+			x.use_shm = false;
+		}
+	}
+
+	if (x.image == nullptr)
+	{
+		char* data = (char*)calloc(width * height, 4);
+		x.image = XCreateImage(x.display, x.visual, x.depth, ZPixmap, 0, data, width, height, 32, width * 4);
+		if (x.image == nullptr)
+		{
+			free(data);
+			return false;
+		}
+	}
+
+	m_width		= width;
+	m_height	= height;
+	m_back.assign((std::size_t)width * height, 0);
+	m_full_damage = true;
+
+	return true;
+}
+
+void SoftwareRenderer::DestroyImage()
+{
+	X11& x = *m_x11;
+	if (x.image == nullptr)
+		return;
+
+	if (x.use_shm)
+	{
+		XShmDetach(x.display, &x.shm);
+		XSync(x.display, False);
+		shmdt(x.shm.shmaddr);
+		x.image->data = NULL;
+	}
+
+	// Frees the data of a non shared image
+	XDestroyImage(x.image);
+	x.image = nullptr;
+}
+
+void SoftwareRenderer::NewFrame()
+{
+	if (m_font.alpha)
+		return;
+
+	ImGuiIO& io = ImGui::GetIO();
+
+	unsigned char* pixels;
+	int width, height;
+	io.Fonts->GetTexDataAsAlpha8(&pixels, &width, &height);
+
+	m_font.width	= width;
+	m_font.height	= height;
+	m_font.alpha	= pixels;
+	io.Fonts->SetTexID((ImTextureID)&m_font);
+}
+
+std::uint8_t SoftwareRenderer::SampleAlpha(float u, float v) const
+{
+	int x = std::clamp((int)(u * m_font.width), 0, m_font.width - 1);
+	int y = std::clamp((int)(v * m_font.height), 0, m_font.height - 1);
+	return m_font.alpha[y * m_font.width + x];
+}
+
+void SoftwareRenderer::RenderDrawData(const ImDrawData* draw_data)
+{
+	BWM_TRACE_SCOPE("SoftwareRenderer::RenderDrawData");
+
+	int width	= (int)(draw_data->DisplaySize.x * draw_data->FramebufferScale.x);
+	int height	= (int)(draw_data->DisplaySize.y * draw_data->FramebufferScale.y);
+	if (width <= 0 || height <= 0)
+		return;
+
+	if ((width != m_width || height != m_height || m_x11->image == nullptr) && !CreateImage(width, height))
+		return;
+
+	std::fill(m_back.begin(), m_back.end(), 0);
+
+	for (int i = 0; i < draw_data->CmdListsCount; i++)
+		RenderDrawList(draw_data->CmdLists[i], draw_data);
+
+	Present();
+}
+
+void SoftwareRenderer::RenderDrawList(const ImDrawList* draw_list, const ImDrawData* draw_data)
+{
+	const ImVec2 offset	= draw_data->DisplayPos;
+	const ImVec2 scale	= draw_data->FramebufferScale;
+
+	// Vertices are scaled once per list instead of once per pixel
+	ImVector<ImDrawVert>& vertices = m_vertices;
+	vertices.resize(draw_list->VtxBuffer.Size);
+	for (int i = 0; i < draw_list->VtxBuffer.Size; i++)
+	{
+		ImDrawVert v = draw_list->VtxBuffer[i];
+		v.pos.x = (v.pos.x - offset.x) * scale.x;
+		v.pos.y = (v.pos.y - offset.y) * scale.y;
+		vertices[i] = v;
+	}
+
+	for (const ImDrawCmd& cmd : draw_list->CmdBuffer)
+	{
+		if (cmd.UserCallback)
+		{
+			if (cmd.UserCallback != ImDrawCallback_ResetRenderState)
+				cmd.UserCallback(draw_list, &cmd);
+			continue;
+		}
+
+		ClipRect clip;
+		clip.x0 = std::max(0,			(int)std::floor((cmd.ClipRect.x - offset.x) * scale.x));
+		clip.y0 = std::max(0,			(int)std::floor((cmd.ClipRect.y - offset.y) * scale.y));
+		clip.x1 = std::min(m_width,		(int)std::ceil((cmd.ClipRect.z - offset.x) * scale.x));
+		clip.y1 = std::min(m_height,	(int)std::ceil((cmd.ClipRect.w - offset.y) * scale.y));
+		if (clip.x0 >= clip.x1 || clip.y0 >= clip.y1)
+			continue;
+
+		const ImDrawVert* vtx = vertices.Data + cmd.VtxOffset;
+		const ImDrawIdx* idx = draw_list->IdxBuffer.Data + cmd.IdxOffset;
+
+		for (unsigned int i = 0; i < cmd.ElemCount; )
+		{
+			// Most of what ImGui draws are axis aligned quads of two triangles
+			if (i + 6 <= cmd.ElemCount && RenderRect(vtx, idx + i, clip))
+			{
+				i += 6;
+				continue;
+			}
+
+			RenderTriangle(vtx[idx[i]], vtx[idx[i + 1]], vtx[idx[i + 2]], clip);
+			i += 3;
+		}
+	}
+}
+
+bool SoftwareRenderer::RenderRect(const ImDrawVert* vtx, const ImDrawIdx* idx, const ClipRect& clip)
+{
+	// ImGui emits quads as (a, b, c), (a, c, d)
+	if (idx[3] != idx[0] || idx[4] != idx[2])
+		return false;
+
+	const ImDrawVert& a = vtx[idx[0]];
+	const ImDrawVert& b = vtx[idx[1]];
+	const ImDrawVert& c = vtx[idx[2]];
+	const ImDrawVert& d = vtx[idx[5]];
+
+	if (a.pos.y != b.pos.y || b.pos.x != c.pos.x || c.pos.y != d.pos.y || d.pos.x != a.pos.x)
+		return false;
+	if (a.col != b.col || a.col != c.col || a.col != d.col)
+		return false;
+	if (a.uv.y != b.uv.y || b.uv.x != c.uv.x || c.uv.y != d.uv.y || d.uv.x != a.uv.x)
+		return false;
+
+	float x0 = std::min(a.pos.x, c.pos.x), x1 = std::max(a.pos.x, c.pos.x);
+	float y0 = std::min(a.pos.y, c.pos.y), y1 = std::max(a.pos.y, c.pos.y);
+
+	// Pixels whose centers are inside the rectangle
+	int px0 = std::max(clip.x0, (int)std::ceil(x0 - 0.5f));
+	int py0 = std::max(clip.y0, (int)std::ceil(y0 - 0.5f));
+	int px1 = std::min(clip.x1, (int)std::ceil(x1 - 0.5f));
+	int py1 = std::min(clip.y1, (int)std::ceil(y1 - 0.5f));
+	if (px0 >= px1 || py0 >= py1)
+		return true;
+
+	if (a.uv.x == c.uv.x && a.uv.y == c.uv.y)
+	{
+		std::uint32_t color = premultiply(a.col, div255(((a.col >> IM_COL32_A_SHIFT) & 0xFF) * SampleAlpha(a.uv.x, a.uv.y)));
+		for (int y = py0; y < py1; y++)
+			blend_span(&m_back[(std::size_t)y * m_width + px0], px1 - px0, color);
+		return true;
+	}
+
+	// Glyphs, uv is linear in the pixel position
+	std::uint32_t alpha = (a.col >> IM_COL32_A_SHIFT) & 0xFF;
+	float du = (c.uv.x - a.uv.x) / (c.pos.x - a.pos.x);
+	float dv = (c.uv.y - a.uv.y) / (c.pos.y - a.pos.y);
+
+	for (int y = py0; y < py1; y++)
+	{
+		float v = a.uv.y + (y + 0.5f - a.pos.y) * dv;
+		std::uint32_t* row = &m_back[(std::size_t)y * m_width];
+		for (int x = px0; x < px1; x++)
+		{
+			float u = a.uv.x + (x + 0.5f - a.pos.x) * du;
+			std::uint32_t coverage = div255(alpha * SampleAlpha(u, v));
+			if (coverage)
+				row[x] = blend(row[x], premultiply(a.col, coverage));
+		}
+	}
+
+	return true;
+}
+
+void SoftwareRenderer::RenderTriangle(const ImDrawVert& v0, const ImDrawVert& in_v1, const ImDrawVert& in_v2, const ClipRect& clip)
+{
+	auto edge = [](const ImVec2& a, const ImVec2& b, float x, float y) {
+		return (b.x - a.x) * (y - a.y) - (b.y - a.y) * (x - a.x);
+	};
+
+	// Same winding for every triangle, so that the two triangles sharing
+	// an edge see it in opposite directions
+	float area = edge(v0.pos, in_v1.pos, in_v2.pos.x, in_v2.pos.y);
+	if (area == 0.0f)
+		return;
+	const ImDrawVert& v1 = area > 0.0f ? in_v1 : in_v2;
+	const ImDrawVert& v2 = area > 0.0f ? in_v2 : in_v1;
+	area = std::abs(area);
+
+	// Pixels exactly on an edge belong to only one of the two triangles
+	// sharing it, otherwise translucent shapes get seams
+	auto owns = [](const ImVec2& a, const ImVec2& b) {
+		return b.y > a.y || (b.y == a.y && b.x < a.x);
+	};
+	bool owns0 = owns(v1.pos, v2.pos);
+	bool owns1 = owns(v2.pos, v0.pos);
+	bool owns2 = owns(v0.pos, v1.pos);
+
+	int x0 = std::max(clip.x0, (int)std::floor(std::min({ v0.pos.x, v1.pos.x, v2.pos.x })));
+	int y0 = std::max(clip.y0, (int)std::floor(std::min({ v0.pos.y, v1.pos.y, v2.pos.y })));
+	int x1 = std::min(clip.x1, (int)std::ceil(std::max({ v0.pos.x, v1.pos.x, v2.pos.x })));
+	int y1 = std::min(clip.y1, (int)std::ceil(std::max({ v0.pos.y, v1.pos.y, v2.pos.y })));
+	if (x0 >= x1 || y0 >= y1)
+		return;
+
+	auto channel = [](ImU32 color, int shift) { return (float)((color >> shift) & 0xFF); };
+
+	bool same_color	= v0.col == v1.col && v0.col == v2.col;
+	bool solid		= v0.uv.x == v1.uv.x && v0.uv.x == v2.uv.x && v0.uv.y == v1.uv.y && v0.uv.y == v2.uv.y;
+	std::uint8_t solid_alpha = solid ? SampleAlpha(v0.uv.x, v0.uv.y) : 0;
+
+	float inv_area = 1.0f / area;
+
+	for (int y = y0; y < y1; y++)
+	{
+		std::uint32_t* row = &m_back[(std::size_t)y * m_width];
+		float py = y + 0.5f;
+
+		for (int x = x0; x < x1; x++)
+		{
+			float px = x + 0.5f;
+
+			float e0 = edge(v1.pos, v2.pos, px, py);
+			float e1 = edge(v2.pos, v0.pos, px, py);
+			float e2 = edge(v0.pos, v1.pos, px, py);
+			if (e0 < 0.0f || e1 < 0.0f || e2 < 0.0f)
+				continue;
+			if ((e0 == 0.0f && !owns0) || (e1 == 0.0f && !owns1) || (e2 == 0.0f && !owns2))
+				continue;
+
+			float w0 = e0 * inv_area;
+			float w1 = e1 * inv_area;
+			float w2 = e2 * inv_area;
+
+			ImU32 color = v0.col;
+			if (!same_color)
+			{
+				auto mix = [&](int shift) {
+					return (ImU32)(channel(v0.col, shift) * w0 + channel(v1.col, shift) * w1 + channel(v2.col, shift) * w2 + 0.5f) << shift;
+				};
+				color = mix(IM_COL32_R_SHIFT) | mix(IM_COL32_G_SHIFT) | mix(IM_COL32_B_SHIFT) | mix(IM_COL32_A_SHIFT);
+			}
+
+			std::uint32_t texel = solid_alpha;
+			if (!solid)
+				texel = SampleAlpha(v0.uv.x * w0 + v1.uv.x * w1 + v2.uv.x * w2, v0.uv.y * w0 + v1.uv.y * w1 + v2.uv.y * w2);
+
+			std::uint32_t coverage = div255(((color >> IM_COL32_A_SHIFT) & 0xFF) * texel);
+			if (coverage)
+				row[x] = blend(row[x], premultiply(color, coverage));
+		}
+	}
+}
+
+void SoftwareRenderer::Present()
+{
+	X11& x = *m_x11;
+	std::uint32_t* front = reinterpret_cast<std::uint32_t*>(x.image->data);
+	std::size_t stride = x.image->bytes_per_line / 4;
+
+	bool sent = false;
+
+	// Compares the frame with the one on screen tile by tile, runs of
+	// changed tiles in a row are sent as one rectangle
+	for (int ty = 0; ty < m_height; ty += s_tile_height)
+	{
+		int th = std::min(s_tile_height, m_height - ty);
+		int run_begin = -1;
+
+		for (int tx = 0; tx <= m_width; tx += s_tile_width)
+		{
+			bool dirty = false;
+			if (tx < m_width)
+			{
+				int tw = std::min(s_tile_width, m_width - tx);
+				for (int y = ty; y < ty + th; y++)
+				{
+					std::uint32_t*			dst = front + y * stride + tx;
+					const std::uint32_t*	src = &m_back[(std::size_t)y * m_width + tx];
+					if (m_full_damage || std::memcmp(dst, src, tw * 4) != 0)
+					{
+						dirty = true;
+						for (; y < ty + th; y++)
+							std::memcpy(front + y * stride + tx, &m_back[(std::size_t)y * m_width + tx], tw * 4);
+						break;
+					}
+				}
+			}
+
+			if (dirty && run_begin == -1)
+				run_begin = tx;
+
+			if (!dirty && run_begin != -1)
+			{
+				int rw = std::min(tx, m_width) - run_begin;
+				if (x.use_shm)
+					XShmPutImage(x.display, x.window, x.gc, x.image, run_begin, ty, run_begin, ty, rw, th, False);
+				else
+					XPutImage(x.display, x.window, x.gc, x.image, run_begin, ty, run_begin, ty, rw, th);
+				run_begin = -1;
+				sent = true;
+			}
+		}
+	}
+
+	m_full_damage = false;
+
+	// The server reads the shared image asynchronously, it must be done
+	// before the next frame writes to it
+	if (sent)
+	{
+		BWM_TRACE_SCOPE("XSync");
+		XSync(x.display, False);
+	}
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <imgui.h>
+
+#include <cstdint>
+#include <vector>
+
+struct GLFWwindow;
+
+// Renders ImGui draw data on the CPU and presents it with XShm, for
+// machines without a GPU where a GL context falls back to a software
+// implementation that redraws and composites the whole window every frame.
+//
+// Each frame is rasterized into a back buffer and compared with the frame
+// on screen in tiles. Only tiles that changed are copied and sent to the X
+// server, so an idle window does not cause any X traffic. The window must
+// be created without a client API (GLFW_NO_API). Only the font atlas is
+// supported as texture, which is all bwm draws.
+class SoftwareRenderer
+{
+public:
+	SoftwareRenderer() = default;
+	~SoftwareRenderer();
+
+	SoftwareRenderer(const SoftwareRenderer&) = delete;
+	SoftwareRenderer& operator=(const SoftwareRenderer&) = delete;
+
+	// Fails if the X server's pixel format is not supported. Nothing
+	// blocks like a vsynced swap would, the caller has to pace frames.
+	bool Init(GLFWwindow* window);
+	void Shutdown();
+
+	void NewFrame();
+	void RenderDrawData(const ImDrawData* draw_data);
+
+	// Forces the whole window to be sent with the next frame, for expose
+	// events and resizes
+	void Invalidate() { m_full_damage = true; }
+
+	// The font atlas was rebuilt, its texture is read again by NewFrame()
+	void InvalidateFontTexture() { m_font = Texture(); }
+
+private:
+	struct Texture
+	{
+		int						width	= 0;
+		int						height	= 0;
+		const std::uint8_t*		alpha	= nullptr;
+	};
+
+	struct ClipRect
+	{
+		int	x0;
+		int	y0;
+		int	x1;
+		int	y1;
+	};
+
+	bool CreateImage(int width, int height);
+	void DestroyImage();
+
+	void RenderDrawList(const ImDrawList* draw_list, const ImDrawData* draw_data);
+	bool RenderRect(const ImDrawVert* v, const ImDrawIdx* idx, const ClipRect& clip);
+	void RenderTriangle(const ImDrawVert& v0, const ImDrawVert& in_v1, const ImDrawVert& in_v2, const ClipRect& clip);
+
+	std::uint8_t SampleAlpha(float u, float v) const;
+
+	void Present();
+
+private:
+	static constexpr int s_tile_width	= 64;
+	static constexpr int s_tile_height	= 16;
+
+	// Keeps Xlib out of this header, its macros clash with everything
+	struct X11;
+
+	X11*						m_x11			= nullptr;
+
+	int							m_width			= 0;
+	int							m_height		= 0;
+	std::vector<std::uint32_t>	m_back;
+	ImVector<ImDrawVert>		m_vertices;
+	bool						m_full_damage	= true;
+
+	Texture						m_font;
+};
@@ -0,0 +1,84 @@
+#include "startup.h"
+
+#include "trace.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
+using clock_type = std::chrono::steady_clock;
+
+static constexpr const char* s_phase_names[] = {
+	"window",
+	"imgui",
+	"config",
+	"fonts",
+	"backend",
+	"first scan",
+	"first frame",
+};
+static_assert(sizeof(s_phase_names) / sizeof(*s_phase_names) == (std::size_t)StartupPhase::count);
+
+struct PhaseTimes
+{
+	// Microseconds since StartupInit() plus one, zero if not recorded
+	std::atomic<std::uint64_t>	begin	{ 0 };
+	std::atomic<std::uint64_t>	end		{ 0 };
+	std::atomic<bool>			main	{ false };
+};
+
+static clock_type::time_point	s_start;
+static std::thread::id			s_main_thread;
+static PhaseTimes				s_phases[(std::size_t)StartupPhase::count];
+
+static std::uint64_t now_us()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(clock_type::now() - s_start).count() + 1;
+}
+
+void StartupInit()
+{
+	s_start			= clock_type::now();
+	s_main_thread	= std::this_thread::get_id();
+}
+
+void StartupBegin(StartupPhase phase)
+{
+	PhaseTimes& times = s_phases[(std::size_t)phase];
+	times.main.store(std::this_thread::get_id() == s_main_thread, std::memory_order_relaxed);
+	times.begin.store(now_us(), std::memory_order_relaxed);
+
+	BWM_TRACE_BEGIN(s_phase_names[(std::size_t)phase]);
+}
+
+void StartupEnd(StartupPhase phase)
+{
+	BWM_TRACE_END(s_phase_names[(std::size_t)phase]);
+
+	s_phases[(std::size_t)phase].end.store(now_us(), std::memory_order_release);
+}
+
+void StartupReport(FILE* fp)
+{
+	fprintf(fp, "startup (ms)\n");
+	fprintf(fp, "  %-14s %-6s %9s %9s %9s\n", "phase", "thread", "begin", "end", "duration");
+
+	for (std::size_t i = 0; i < (std::size_t)StartupPhase::count; i++)
+	{
+		const PhaseTimes& times = s_phases[i];
+		std::uint64_t end	= times.end.load(std::memory_order_acquire);
+		std::uint64_t begin	= times.begin.load(std::memory_order_relaxed);
+		if (begin == 0 || end == 0)
+			continue;
+
+		fprintf(fp, "  %-14s %-6s %9.1f %9.1f %9.1f\n",
+			s_phase_names[i], times.main.load(std::memory_order_relaxed) ? "main" : "worker",
+			(begin - 1) / 1000.0, (end - 1) / 1000.0, (end - begin) / 1000.0
+		);
+	}
+
+	std::uint64_t first_frame = s_phases[(std::size_t)StartupPhase::first_frame].end.load(std::memory_order_acquire);
+	if (first_frame != 0)
+		fprintf(fp, "first frame after %.1f ms\n", (first_frame - 1) / 1000.0);
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+// Timing of the startup phases. bwm starts as a small dependency graph,
+// each lane runs on its own thread and is joined only where its result is
+// needed:
+//
+//   main thread   window ----------> imgui -> (join backend) -> first frame
+//   worker        config -> fonts ---^
+//   worker        backend -> first scan ------^
+//
+// glfw requires the window to be created on the main thread, so that is
+// the window lane. Phases are recorded from any thread and printed with
+// bwm --startup-report.
+
+#include <cstdio>
+
+enum class StartupPhase
+{
+	window,			// glfw, X11 window and GL context
+	imgui,			// ImGui context and renderer backend
+	config,			// config file and font path resolution (fc-match)
+	fonts,			// glyph rasterization into the font atlas
+	backend,		// WirelessManager::Create()
+	first_scan,		// the first scan and network list
+	first_frame,	// from the end of the setup to the first presented frame
+
+	count
+};
+
+// Phase times are relative to this, call first thing in main()
+void StartupInit();
+
+void StartupBegin(StartupPhase phase);
+void StartupEnd(StartupPhase phase);
+
+// Prints every recorded phase, the thread it ran on and the time from
+// StartupInit() to the end of the first frame
+void StartupReport(FILE* fp);
+
+class StartupScope
+{
+public:
+	StartupScope(StartupPhase phase) : m_phase(phase) { StartupBegin(phase); }
+	~StartupScope() { StartupEnd(m_phase); }
+
+	StartupScope(const StartupScope&) = delete;
+	StartupScope& operator=(const StartupScope&) = delete;
+
+private:
+	StartupPhase m_phase;
+};
@@ -0,0 +1,231 @@
+#include "stats.h"
+
+#ifdef BWM_STATS
+
+#include <imgui.h>
+
+#include <algorithm>
+#include <atomic>
+#include <malloc.h>
+#include <unistd.h>
+
+// Log-linear histogram of durations in microseconds. Values below 4 get
+// their own bucket, above that every power of two is split into four
+// buckets, so the reported percentiles are within 25% of the real value.
+// Recording is a handful of relaxed atomic increments, backend calls
+// record from worker threads.
+class Histogram
+{
+public:
+	static constexpr std::size_t bucket_count = 160;
+
+	void Record(std::uint64_t value)
+	{
+		m_buckets[BucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+		m_count.fetch_add(1, std::memory_order_relaxed);
+
+		std::uint64_t max = m_max.load(std::memory_order_relaxed);
+		while (value > max && !m_max.compare_exchange_weak(max, value, std::memory_order_relaxed))
+			continue;
+	}
+
+	std::uint64_t Count() const { return m_count.load(std::memory_order_relaxed); }
+	std::uint64_t Max() const { return m_max.load(std::memory_order_relaxed); }
+
+	std::uint64_t Percentile(double percentile) const
+	{
+		std::uint64_t count = Count();
+		if (count == 0)
+			return 0;
+
+		std::uint64_t target = std::max<std::uint64_t>(1, count * percentile);
+		std::uint64_t seen = 0;
+		for (std::size_t i = 0; i < bucket_count; i++)
+		{
+			seen += m_buckets[i].load(std::memory_order_relaxed);
+			if (seen >= target)
+				return std::min(BucketUpperBound(i), Max());
+		}
+		return Max();
+	}
+
+private:
+	static std::size_t BucketIndex(std::uint64_t value)
+	{
+		if (value < 4)
+			return value;
+		int msb = 63 - __builtin_clzll(value);
+		std::size_t sub = (value >> (msb - 2)) & 3;
+		return std::min<std::size_t>(4 + (msb - 2) * 4 + sub, bucket_count - 1);
+	}
+
+	static std::uint64_t BucketUpperBound(std::size_t index)
+	{
+		if (index < 4)
+			return index;
+		int msb = (index - 4) / 4 + 2;
+		std::uint64_t sub = (index - 4) % 4;
+		std::uint64_t lower = (4 + sub) << (msb - 2);
+		return lower + (std::uint64_t(1) << (msb - 2)) - 1;
+	}
+
+private:
+	std::atomic<std::uint64_t> m_buckets[bucket_count] {};
+	std::atomic<std::uint64_t> m_count { 0 };
+	std::atomic<std::uint64_t> m_max { 0 };
+};
+
+static Histogram					s_histograms[(std::size_t)Stat::count];
+static std::atomic<std::uint64_t>	s_spawn_count { 0 };
+
+static constexpr const char* s_stat_names[] = {
+	"frame",
+	"frame_start",
+	"imgui build",
+	"frame_end",
+	"RenderDrawData",
+	"link_monitor",
+
+	"iwd_get_devices",
+	"iwd_set_adapter_property",
+	"iwd_set_device_property",
+	"iwd_get_networks",
+	"iwd_scan",
+	"iwd_connect",
+	"iwd_disconnect",
+	"iwd_get_known_networks",
+	"iwd_forget_known_network",
+	"iwd_get_station",
+
+	"nl80211_get_scan",
+
+	"nm_scan",
+	"nm_update_networks",
+	"nm_connect",
+	"nm_disconnect",
+	"nm_update_known_networks",
+	"nm_forget_known_network",
+	"nm_activate_device",
+	"nm_get_network_details",
+};
+static_assert(sizeof(s_stat_names) / sizeof(*s_stat_names) == (std::size_t)Stat::count);
+
+void StatsRecord(Stat stat, StatsClock::duration duration)
+{
+	auto us = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+	s_histograms[(std::size_t)stat].Record(us);
+}
+
+void StatsRecordSpawn()
+{
+	s_spawn_count.fetch_add(1, std::memory_order_relaxed);
+}
+
+const char* StatsName(Stat stat)
+{
+	return s_stat_names[(std::size_t)stat];
+}
+
+StatsSummary StatsGetSummary(Stat stat)
+{
+	const Histogram& histogram = s_histograms[(std::size_t)stat];
+
+	StatsSummary summary;
+	summary.count	= histogram.Count();
+	summary.p50_us	= histogram.Percentile(0.50);
+	summary.p99_us	= histogram.Percentile(0.99);
+	summary.max_us	= histogram.Max();
+	return summary;
+}
+
+std::uint64_t StatsGetSpawnCount()
+{
+	return s_spawn_count.load(std::memory_order_relaxed);
+}
+
+StatsMemory StatsGetMemory()
+{
+	StatsMemory memory {};
+
+	// Second field is the resident set in pages
+	if (FILE* fp = fopen("/proc/self/statm", "r"))
+	{
+		unsigned long size, resident;
+		if (fscanf(fp, "%lu %lu", &size, &resident) == 2)
+			memory.rss_bytes = (std::uint64_t)resident * sysconf(_SC_PAGESIZE);
+		fclose(fp);
+	}
+
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+	struct mallinfo2 info = mallinfo2();
+	memory.heap_used_bytes	= info.uordblks + info.hblkhd;
+	memory.heap_free_bytes	= info.fordblks;
+#endif
+
+	return memory;
+}
+
+void StatsDrawTable()
+{
+	if (!ImGui::BeginTable("stats", 5, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg | ImGuiTableFlags_SizingFixedFit))
+		return;
+
+	ImGui::TableSetupColumn("name");
+	ImGui::TableSetupColumn("calls");
+	ImGui::TableSetupColumn("p50 us");
+	ImGui::TableSetupColumn("p99 us");
+	ImGui::TableSetupColumn("max us");
+	ImGui::TableHeadersRow();
+
+	for (std::size_t i = 0; i < (std::size_t)Stat::count; i++)
+	{
+		StatsSummary summary = StatsGetSummary((Stat)i);
+		if (summary.count == 0)
+			continue;
+
+		ImGui::TableNextColumn(); ImGui::TextUnformatted(s_stat_names[i]);
+		ImGui::TableNextColumn(); ImGui::Text("%lu", summary.count);
+		ImGui::TableNextColumn(); ImGui::Text("%lu", summary.p50_us);
+		ImGui::TableNextColumn(); ImGui::Text("%lu", summary.p99_us);
+		ImGui::TableNextColumn(); ImGui::Text("%lu", summary.max_us);
+	}
+
+	ImGui::EndTable();
+
+	ImGui::Text("processes spawned: %lu", StatsGetSpawnCount());
+
+	// Reading /proc and walking the malloc arenas every frame would show up
+	// in the frame times the table displays
+	static StatsMemory				s_memory {};
+	static StatsClock::time_point	s_memory_time {};
+	if (StatsClock::time_point now = StatsClock::now(); now - s_memory_time >= std::chrono::seconds(1))
+	{
+		s_memory		= StatsGetMemory();
+		s_memory_time	= now;
+	}
+
+	const StatsMemory& memory = s_memory;
+	ImGui::Text("rss: %.1f MiB, heap: %.1f MiB used, %.1f MiB free",
+		memory.rss_bytes / 1048576.0, memory.heap_used_bytes / 1048576.0, memory.heap_free_bytes / 1048576.0
+	);
+}
+
+void StatsDump(FILE* fp)
+{
+	fprintf(fp, "%-26s %10s %10s %10s %10s\n", "name", "calls", "p50 us", "p99 us", "max us");
+	for (std::size_t i = 0; i < (std::size_t)Stat::count; i++)
+	{
+		StatsSummary summary = StatsGetSummary((Stat)i);
+		if (summary.count == 0)
+			continue;
+		fprintf(fp, "%-26s %10lu %10lu %10lu %10lu\n", s_stat_names[i], summary.count, summary.p50_us, summary.p99_us, summary.max_us);
+	}
+	fprintf(fp, "processes spawned: %lu\n", StatsGetSpawnCount());
+
+	StatsMemory memory = StatsGetMemory();
+	fprintf(fp, "rss: %.1f MiB, heap: %.1f MiB used, %.1f MiB free\n",
+		memory.rss_bytes / 1048576.0, memory.heap_used_bytes / 1048576.0, memory.heap_free_bytes / 1048576.0
+	);
+}
+
+#endif
@@ -0,0 +1,101 @@
+#pragma once
+
+// Frame time and backend latency instrumentation.
+//
+// Only compiled in when BWM_STATS is defined (premake5 gmake2 --stats).
+// Otherwise every macro below expands to nothing and there is no runtime
+// cost at all.
+
+#ifdef BWM_STATS
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+
+enum class Stat
+{
+	frame,
+	frame_start,
+	imgui_build,
+	frame_end,
+	render_draw_data,
+	link_monitor,
+
+	iwd_get_devices,
+	iwd_set_adapter_property,
+	iwd_set_device_property,
+	iwd_get_networks,
+	iwd_scan,
+	iwd_connect,
+	iwd_disconnect,
+	iwd_get_known_networks,
+	iwd_forget_known_network,
+	iwd_get_station,
+
+	nl80211_get_scan,
+
+	nm_scan,
+	nm_update_networks,
+	nm_connect,
+	nm_disconnect,
+	nm_update_known_networks,
+	nm_forget_known_network,
+	nm_activate_device,
+	nm_get_network_details,
+
+	count
+};
+
+using StatsClock = std::chrono::steady_clock;
+
+void StatsRecord(Stat stat, StatsClock::duration duration);
+void StatsRecordSpawn();
+
+struct StatsSummary
+{
+	std::uint64_t	count;
+	std::uint64_t	p50_us;
+	std::uint64_t	p99_us;
+	std::uint64_t	max_us;
+};
+
+// Heap numbers need glibc 2.33 (mallinfo2) and are zero otherwise
+struct StatsMemory
+{
+	std::uint64_t	rss_bytes;
+	std::uint64_t	heap_used_bytes;
+	std::uint64_t	heap_free_bytes;
+};
+
+const char*		StatsName(Stat stat);
+StatsSummary	StatsGetSummary(Stat stat);
+std::uint64_t	StatsGetSpawnCount();
+StatsMemory		StatsGetMemory();
+
+// Draws the statistics table into the current ImGui window
+void StatsDrawTable();
+void StatsDump(FILE* fp);
+
+class StatsScope
+{
+public:
+	StatsScope(Stat stat) : m_stat(stat), m_start(StatsClock::now()) {}
+	~StatsScope() { StatsRecord(m_stat, StatsClock::now() - m_start); }
+
+private:
+	Stat					m_stat;
+	StatsClock::time_point	m_start;
+};
+
+#define BWM_STATS_CONCAT_(a, b) a##b
+#define BWM_STATS_CONCAT(a, b) BWM_STATS_CONCAT_(a, b)
+
+#define BWM_STATS_SCOPE(stat)	StatsScope BWM_STATS_CONCAT(stats_scope_, __LINE__)(Stat::stat)
+#define BWM_STATS_SPAWN()		StatsRecordSpawn()
+
+#else
+
+#define BWM_STATS_SCOPE(stat)	((void)0)
+#define BWM_STATS_SPAWN()		((void)0)
+
+#endif
@@ -0,0 +1,168 @@
+#include "status_page.h"
+
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+template<std::size_t N>
+static void copy_string(char (&out)[N], const char* str)
+{
+	strncpy(out, str, N - 1);
+	out[N - 1] = '\0';
+}
+
+StatusPage::~StatusPage()
+{
+	if (m_page == nullptr)
+		return;
+
+	bwm_status status {};
+	status.generation	= m_page->status.generation + 1;
+	status.state		= BWM_STATE_NOT_RUNNING;
+	status.signal		= -1;
+	Write(status);
+
+	munmap(m_page, sizeof(bwm_status_page));
+
+	// Releases the lock for the next instance
+	close(m_fd);
+}
+
+bool StatusPage::Open()
+{
+	char path[256];
+	if (bwm_status_path(path, sizeof(path)) != 0)
+		return false;
+
+	// Without $XDG_RUNTIME_DIR the page is in /tmp, where other users can
+	// create the file or a symlink first
+	int fd = open(path, O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0600);
+	if (fd == -1)
+	{
+		std::fprintf(stderr, "Could not open status page '%s'\n", path);
+		return false;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_uid != getuid())
+	{
+		std::fprintf(stderr, "Status page '%s' is not a regular file owned by the user\n", path);
+		close(fd);
+		return false;
+	}
+
+	// Two writers would interleave their updates and break the seqlock
+	if (flock(fd, LOCK_EX | LOCK_NB) == -1)
+	{
+		std::fprintf(stderr, "Status page '%s' is published by another bwm instance\n", path);
+		close(fd);
+		return false;
+	}
+
+	// Pages of earlier versions were readable by everyone
+	if ((st.st_mode & 0077) != 0 && fchmod(fd, 0600) == -1)
+	{
+		close(fd);
+		return false;
+	}
+
+	if (ftruncate(fd, sizeof(bwm_status_page)) == -1)
+	{
+		close(fd);
+		return false;
+	}
+
+	void* addr = mmap(NULL, sizeof(bwm_status_page), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (addr == MAP_FAILED)
+	{
+		close(fd);
+		return false;
+	}
+
+	// The lock is held for as long as the file stays open
+	m_fd	= fd;
+	m_page	= static_cast<bwm_status_page*>(addr);
+
+	// A previous instance that died mid-update left the sequence odd
+	if (m_page->sequence & 1)
+		__atomic_store_n(&m_page->sequence, m_page->sequence + 1, __ATOMIC_RELEASE);
+
+	// Keep the sequence of a previous instance so readers waiting on it
+	// notice the change
+	if (m_page->magic != BWM_STATUS_MAGIC || m_page->version != BWM_STATUS_VERSION)
+	{
+		m_page->version = BWM_STATUS_VERSION;
+		__atomic_store_n(&m_page->magic, BWM_STATUS_MAGIC, __ATOMIC_RELEASE);
+	}
+
+	return true;
+}
+
+void StatusPage::Publish(const WirelessState& state)
+{
+	if (m_page == nullptr)
+		return;
+
+	bwm_status status {};
+	status.generation	= state.generation;
+	status.signal		= -1;
+
+	const Device& device = state.devices[state.current_device];
+	copy_string(status.device, device.name.c_str());
+
+	if (device.power != PowerState::on)
+		status.state = BWM_STATE_DEVICE_OFF;
+	else
+	{
+		status.state = BWM_STATE_DISCONNECTED;
+		for (const Network& network : state.networks)
+		{
+			if (!network.connected)
+				continue;
+			status.state = BWM_STATE_CONNECTED;
+			copy_string(status.ssid, network.ssid.c_str());
+			copy_string(status.security, to_string(network.security));
+			m_scan_signal = network.signal;
+			status.signal = (m_link_signal >= 0) ? m_link_signal : m_scan_signal;
+			break;
+		}
+	}
+
+	m_status = status;
+	Write(status);
+}
+
+void StatusPage::SetLinkSignal(int signal)
+{
+	if (signal == m_link_signal)
+		return;
+	m_link_signal = signal;
+
+	if (m_page == nullptr || m_status.state != BWM_STATE_CONNECTED)
+		return;
+
+	m_status.signal = (m_link_signal >= 0) ? m_link_signal : m_scan_signal;
+	Write(m_status);
+}
+
+void StatusPage::Write(const bwm_status& status)
+{
+	uint32_t sequence = m_page->sequence;
+
+	__atomic_store_n(&m_page->sequence, sequence + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	m_page->status		= status;
+	m_page->status.pid	= getpid();
+
+	__atomic_store_n(&m_page->sequence, sequence + 2, __ATOMIC_RELEASE);
+
+	syscall(SYS_futex, &m_page->sequence, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "wireless_manager.h"
+
+#include <bwm_status.h>
+
+// Writer side of the shared memory status page described in bwm_status.h
+class StatusPage
+{
+public:
+	StatusPage() = default;
+	~StatusPage();
+
+	StatusPage(const StatusPage&) = delete;
+	StatusPage& operator=(const StatusPage&) = delete;
+
+	// Fails if another instance publishes the page already
+	bool Open();
+	void Publish(const WirelessState& state);
+
+	// Live signal of the connected network in percent, -1 if unknown.
+	// Rewrites the page if it changed, otherwise the signal of the last
+	// scan is published.
+	void SetLinkSignal(int signal);
+
+private:
+	void Write(const bwm_status& status);
+
+private:
+	int					m_fd			= -1;
+	bwm_status_page*	m_page			= nullptr;
+	bwm_status			m_status		= {};
+	int					m_scan_signal	= -1;
+	int					m_link_signal	= -1;
+};
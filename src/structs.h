@@ -1,19 +1,180 @@
 #pragma once
 
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
 #include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+// String with inline storage of at most N bytes. Identifiers handled by
+// bwm all have small upper bounds (ssid 32 bytes, interface name 15), so
+// storing them inline keeps Device and Network trivially copyable.
+template<std::size_t N>
+class FixedString
+{
+	static_assert(N < 256);
+
+public:
+	FixedString() = default;
+	FixedString(std::string_view str) { assign(str); }
+	FixedString(const char* str) { assign(str); }
+
+	void assign(std::string_view str)
+	{
+		m_length = std::min(str.size(), N);
+		std::memcpy(m_data, str.data(), m_length);
+		m_data[m_length] = '\0';
+	}
+
+	const char*			c_str() const	{ return m_data; }
+	std::string_view	view() const	{ return std::string_view(m_data, m_length); }
+	std::size_t			size() const	{ return m_length; }
+	bool				empty() const	{ return m_length == 0; }
+
+	const char* begin() const	{ return m_data; }
+	const char* end() const		{ return m_data + m_length; }
+
+	bool operator==(const FixedString& other) const { return view() == other.view(); }
+	bool operator!=(const FixedString& other) const { return view() != other.view(); }
+	bool operator==(std::string_view other) const	{ return view() == other; }
+	bool operator!=(std::string_view other) const	{ return view() != other; }
+
+private:
+	char			m_data[N + 1] {};
+	std::uint8_t	m_length = 0;
+};
+
+using Ssid			= FixedString<32>;
+using DeviceName	= FixedString<15>;
+
+enum class PowerState : std::uint8_t
+{
+	off,
+	on
+};
+
+enum class DeviceMode : std::uint8_t
+{
+	unknown,
+	station,
+	ap,
+	ad_hoc
+};
+
+enum class NetworkSecurity : std::uint8_t
+{
+	unknown,
+	open,
+	wep,
+	psk,
+	ieee8021x
+};
 
 struct Device
 {
-	std::string	name;
-	std::string address;
-	std::string powered;
-	std::string adapter;
-	std::string mode;
+	DeviceName		name;
+	FixedString<17>	address;
+	FixedString<15>	adapter;
+	PowerState		power;
+	DeviceMode		mode;
 };
 
 struct Network
 {
-	std::string ssid;
-	std::string security;
-	bool		connected;
-};
\ No newline at end of file
+	Ssid			ssid;
+	NetworkSecurity	security;
+	bool			connected;
+	std::int8_t		signal;		// percent, -1 if unknown
+};
+
+// One access point of a network
+struct Bss
+{
+	FixedString<17>	bssid;			// aa:bb:cc:dd:ee:ff
+	std::uint32_t	frequency;		// MHz, 0 if unknown
+	std::int8_t		signal;			// percent, -1 if unknown
+	std::int16_t	signal_dbm;		// 0 if unknown
+	bool			connected;
+};
+
+struct StationProperty
+{
+	std::string		name;
+	std::string		value;
+};
+
+// Diagnostics of one network, too expensive to keep up to date for all of
+// them. Fetched on demand, see NetworkDetailsCache.
+struct NetworkDetails
+{
+	std::vector<Bss>				bsses;		// strongest first
+	std::vector<StationProperty>	station;	// connected network only
+};
+
+// Channel number of a frequency in MHz, 0 if unknown
+inline int FrequencyToChannel(std::uint32_t frequency)
+{
+	if (frequency == 2484)
+		return 14;
+	if (frequency >= 2412 && frequency < 2484)
+		return (frequency - 2407) / 5;
+	if (frequency >= 5160 && frequency <= 5885)
+		return (frequency - 5000) / 5;
+	if (frequency >= 5955 && frequency <= 7115)
+		return (frequency - 5950) / 5;
+	return 0;
+}
+
+inline bool operator==(const Device& a, const Device& b)
+{
+	return a.name == b.name && a.address == b.address && a.adapter == b.adapter && a.power == b.power && a.mode == b.mode;
+}
+
+inline bool operator==(const Network& a, const Network& b)
+{
+	return a.ssid == b.ssid && a.security == b.security && a.connected == b.connected && a.signal == b.signal;
+}
+
+inline bool operator!=(const Device& a, const Device& b)	{ return !(a == b); }
+inline bool operator!=(const Network& a, const Network& b)	{ return !(a == b); }
+
+static_assert(std::is_trivially_copyable_v<Device>);
+static_assert(std::is_trivially_copyable_v<Network>);
+static_assert(std::is_trivially_copyable_v<Bss>);
+
+inline const char* to_string(PowerState power)
+{
+	switch (power)
+	{
+		case PowerState::off:	return "off";
+		case PowerState::on:	return "on";
+	}
+	return "unknown";
+}
+
+inline const char* to_string(DeviceMode mode)
+{
+	switch (mode)
+	{
+		case DeviceMode::unknown:	return "unknown";
+		case DeviceMode::station:	return "station";
+		case DeviceMode::ap:		return "ap";
+		case DeviceMode::ad_hoc:	return "ad-hoc";
+	}
+	return "unknown";
+}
+
+inline const char* to_string(NetworkSecurity security)
+{
+	switch (security)
+	{
+		case NetworkSecurity::unknown:		return "unknown";
+		case NetworkSecurity::open:			return "open";
+		case NetworkSecurity::wep:			return "wep";
+		case NetworkSecurity::psk:			return "psk";
+		case NetworkSecurity::ieee8021x:	return "8021x";
+	}
+	return "unknown";
+}
@@ -0,0 +1,196 @@
+#include "task.h"
+
+#include <algorithm>
+
+bool WhenAll::await_suspend(Task::Handle parent)
+{
+	// One extra count for starting, children finishing right away must not
+	// resume the parent before it is suspended
+	m_pending = m_tasks.size() + 1;
+
+	for (Task& task : m_tasks)
+	{
+		task.Inherit(parent.promise());
+		task.m_handle.promise().continuation	= parent;
+		task.m_handle.promise().join_count		= &m_pending;
+		task.m_handle.resume();
+	}
+
+	return --m_pending > 0;
+}
+
+bool WhenAll::await_resume() const
+{
+	bool success = true;
+	for (const Task& task : m_tasks)
+		success &= task.await_resume();
+	return success;
+}
+
+bool Sleep::await_suspend(Task::Handle handle)
+{
+	m_promise = &handle.promise();
+	if (m_promise->IsCancelled() || std::chrono::steady_clock::now() >= m_deadline)
+		return false;
+
+	m_promise->executor->AddSleeper(m_deadline, handle);
+	return true;
+}
+
+RunBlocking::~RunBlocking()
+{
+	if (m_thread.joinable())
+		m_thread.join();
+}
+
+bool RunBlocking::await_suspend(Task::Handle handle)
+{
+	m_promise = &handle.promise();
+	if (m_promise->IsCancelled())
+		return false;
+
+	TaskExecutor* executor = m_promise->executor;
+	executor->BlockingStarted();
+	m_thread = std::thread([this, executor, handle] {
+		m_result = m_function();
+		executor->BlockingFinished(handle);
+	});
+	return true;
+}
+
+bool RunBlocking::await_resume()
+{
+	if (m_thread.joinable())
+		m_thread.join();
+	return m_result && !m_promise->IsCancelled();
+}
+
+bool AwaitCallback::await_suspend(Task::Handle handle)
+{
+	m_promise = &handle.promise();
+	if (m_promise->IsCancelled())
+		return false;
+
+	// The task may be destroyed before the operation finishes
+	m_start([this, alive = m_alive, handle](bool success) {
+		if (!*alive)
+			return;
+		m_result	= success;
+		m_done		= true;
+		if (m_suspended)
+			handle.resume();
+	});
+
+	m_suspended = !m_done;
+	return m_suspended;
+}
+
+TaskExecutor::~TaskExecutor()
+{
+	for (Spawned& spawned : m_tasks)
+		spawned.task.m_handle.promise().cancel_requested = true;
+
+	// Blocking steps write into the frames of their tasks
+	{
+		std::unique_lock lock(m_mutex);
+		m_condition.wait(lock, [this] { return m_blocking == 0; });
+	}
+
+	m_tasks.clear();
+}
+
+TaskExecutor::TaskId TaskExecutor::Spawn(Task task, Callback callback)
+{
+	Task::Handle handle = task.m_handle;
+	handle.promise().executor = this;
+
+	TaskId id = m_next_id++;
+	m_tasks.push_back({ id, std::move(task), std::move(callback) });
+
+	handle.resume();
+	return id;
+}
+
+void TaskExecutor::Cancel(TaskId id)
+{
+	for (Spawned& spawned : m_tasks)
+		if (spawned.id == id)
+			spawned.task.m_handle.promise().cancel_requested = true;
+}
+
+bool TaskExecutor::IsRunning(TaskId id) const
+{
+	return std::any_of(m_tasks.begin(), m_tasks.end(), [id](const Spawned& s) { return s.id == id && !s.task.m_handle.done(); });
+}
+
+void TaskExecutor::Poll()
+{
+	{
+		std::lock_guard lock(m_mutex);
+		std::swap(m_ready, m_poll_ready);
+	}
+
+	for (Task::Handle handle : m_poll_ready)
+		handle.resume();
+	m_poll_ready.clear();
+
+	// Resumed tasks may start sleeping again, collect the due ones first
+	auto now = std::chrono::steady_clock::now();
+	auto due = std::stable_partition(m_sleepers.begin(), m_sleepers.end(), [now](const Sleeper& s) {
+		return s.deadline > now && !s.handle.promise().IsCancelled();
+	});
+	std::vector<Task::Handle> wake;
+	for (auto it = due; it != m_sleepers.end(); ++it)
+		wake.push_back(it->handle);
+	m_sleepers.erase(due, m_sleepers.end());
+
+	for (Task::Handle handle : wake)
+		handle.resume();
+
+	ReapFinished();
+}
+
+void TaskExecutor::AddSleeper(std::chrono::steady_clock::time_point deadline, Task::Handle handle)
+{
+	m_sleepers.push_back({ deadline, handle });
+}
+
+void TaskExecutor::BlockingStarted()
+{
+	std::lock_guard lock(m_mutex);
+	m_blocking++;
+}
+
+void TaskExecutor::BlockingFinished(Task::Handle handle)
+{
+	// Notified under the lock, the destructor may be waiting for this
+	std::lock_guard lock(m_mutex);
+	m_ready.push_back(handle);
+	m_blocking--;
+	m_condition.notify_all();
+}
+
+void TaskExecutor::ReapFinished()
+{
+	std::vector<Spawned> finished;
+	for (auto it = m_tasks.begin(); it != m_tasks.end();)
+	{
+		if (it->task.m_handle.done())
+		{
+			finished.push_back(std::move(*it));
+			it = m_tasks.erase(it);
+		}
+		else
+		{
+			++it;
+		}
+	}
+
+	// Callbacks may spawn new tasks
+	for (Spawned& spawned : finished)
+	{
+		const Task::promise_type& promise = spawned.task.m_handle.promise();
+		if (spawned.callback && !promise.cancel_requested)
+			spawned.callback(promise.result);
+	}
+}
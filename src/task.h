@@ -0,0 +1,257 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+class TaskExecutor;
+
+// Coroutine for operations made of several steps (spawning processes,
+// waiting, submitting requests), co_returns whether it succeeded.
+//
+// A task does nothing until it is spawned on a TaskExecutor or awaited by
+// another task. Every step it awaits returns false once the task was
+// cancelled, the task is expected to co_return false then. Cancelling a
+// task cancels everything it awaits.
+class Task
+{
+public:
+	struct promise_type
+	{
+		Task get_return_object() { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+
+		std::suspend_always initial_suspend() noexcept { return {}; }
+		auto final_suspend() noexcept { return FinalAwaiter {}; }
+
+		void return_value(bool value) { result = value; }
+		void unhandled_exception() { std::terminate(); }
+
+		bool IsCancelled() const { return *cancelled; }
+
+		TaskExecutor*			executor			= nullptr;
+		std::coroutine_handle<>	continuation;
+		std::size_t*			join_count			= nullptr;
+
+		// Points to cancel_requested of the spawned task
+		bool*					cancelled			= &cancel_requested;
+		bool					cancel_requested	= false;
+
+		bool					result				= false;
+	};
+
+	using Handle = std::coroutine_handle<promise_type>;
+
+public:
+	Task() = default;
+	explicit Task(Handle handle) : m_handle(handle) {}
+	~Task() { if (m_handle) m_handle.destroy(); }
+
+	Task(Task&& other) noexcept : m_handle(std::exchange(other.m_handle, nullptr)) {}
+	Task& operator=(Task&& other) noexcept
+	{
+		if (this != &other)
+		{
+			if (m_handle)
+				m_handle.destroy();
+			m_handle = std::exchange(other.m_handle, nullptr);
+		}
+		return *this;
+	}
+
+	Task(const Task&) = delete;
+	Task& operator=(const Task&) = delete;
+
+	bool await_ready() const noexcept { return false; }
+	std::coroutine_handle<> await_suspend(Handle parent) noexcept
+	{
+		Inherit(parent.promise());
+		m_handle.promise().continuation = parent;
+		return m_handle;
+	}
+	bool await_resume() const noexcept { return m_handle.promise().result && !m_handle.promise().IsCancelled(); }
+
+private:
+	struct FinalAwaiter
+	{
+		bool await_ready() const noexcept { return false; }
+		std::coroutine_handle<> await_suspend(Handle handle) noexcept
+		{
+			promise_type& promise = handle.promise();
+			if (promise.join_count && --*promise.join_count > 0)
+				return std::noop_coroutine();
+			if (promise.continuation)
+				return promise.continuation;
+			return std::noop_coroutine();
+		}
+		void await_resume() const noexcept {}
+	};
+
+	void Inherit(promise_type& parent)
+	{
+		m_handle.promise().executor		= parent.executor;
+		m_handle.promise().cancelled	= parent.cancelled;
+	}
+
+private:
+	Handle m_handle;
+
+	friend class TaskExecutor;
+	friend class WhenAll;
+};
+
+// Runs the tasks concurrently, succeeds if all of them succeed
+class WhenAll
+{
+public:
+	template<typename... Tasks>
+	explicit WhenAll(Tasks&&... tasks) { (m_tasks.push_back(std::move(tasks)), ...); }
+
+	bool await_ready() const noexcept { return m_tasks.empty(); }
+	bool await_suspend(Task::Handle parent);
+	bool await_resume() const;
+
+private:
+	std::vector<Task>	m_tasks;
+	std::size_t			m_pending	= 0;
+};
+
+// Resumes the task after duration, or right away once it is cancelled.
+// Nothing blocks in the meantime.
+class Sleep
+{
+public:
+	explicit Sleep(std::chrono::steady_clock::duration duration)
+		: m_deadline(std::chrono::steady_clock::now() + duration)
+	{}
+
+	bool await_ready() const noexcept { return false; }
+	bool await_suspend(Task::Handle handle);
+	bool await_resume() const { return !m_promise->IsCancelled(); }
+
+private:
+	std::chrono::steady_clock::time_point	m_deadline;
+	Task::promise_type*						m_promise	= nullptr;
+};
+
+// Calls a blocking function (spawning a process, ...) on its own thread
+// and resumes the task with its result. The function can not be
+// interrupted, a task cancelled meanwhile stops once it returned.
+class RunBlocking
+{
+public:
+	explicit RunBlocking(std::function<bool()> function) : m_function(std::move(function)) {}
+	~RunBlocking();
+
+	RunBlocking(const RunBlocking&) = delete;
+	RunBlocking& operator=(const RunBlocking&) = delete;
+
+	bool await_ready() const noexcept { return false; }
+	bool await_suspend(Task::Handle handle);
+	bool await_resume();
+
+private:
+	std::function<bool()>	m_function;
+	std::thread				m_thread;
+	bool					m_result	= false;
+	Task::promise_type*		m_promise	= nullptr;
+};
+
+// Awaits an operation reporting its result through a callback invoked on
+// the executor's thread, like the requests of WirelessRequestQueue:
+//
+//   co_await AwaitCallback([&](auto done) { requests->Scan(done); });
+//
+// The operation always runs to completion, the task sees false if it was
+// cancelled meanwhile.
+class AwaitCallback
+{
+public:
+	using Callback = std::function<void(bool)>;
+
+	explicit AwaitCallback(std::function<void(Callback)> start) : m_start(std::move(start)) {}
+	~AwaitCallback() { *m_alive = false; }
+
+	AwaitCallback(const AwaitCallback&) = delete;
+	AwaitCallback& operator=(const AwaitCallback&) = delete;
+
+	bool await_ready() const noexcept { return false; }
+	bool await_suspend(Task::Handle handle);
+	bool await_resume() const { return m_result && !m_promise->IsCancelled(); }
+
+private:
+	std::function<void(Callback)>	m_start;
+	std::shared_ptr<bool>			m_alive		= std::make_shared<bool>(true);
+	bool							m_result	= false;
+	bool							m_done		= false;
+	bool							m_suspended	= false;
+	Task::promise_type*				m_promise	= nullptr;
+};
+
+// Runs tasks on the thread calling Poll(), which is the main loop. Steps
+// waiting for something (a process, a timer, a request) do not block it.
+class TaskExecutor
+{
+public:
+	using TaskId	= std::uint64_t;
+	using Callback	= std::function<void(bool)>;
+
+public:
+	TaskExecutor() = default;
+	~TaskExecutor();
+
+	TaskExecutor(const TaskExecutor&) = delete;
+	TaskExecutor& operator=(const TaskExecutor&) = delete;
+
+	// Starts task right away, it runs until its first step that waits.
+	// callback is invoked with the result once the task finished, unless
+	// it was cancelled.
+	TaskId Spawn(Task task, Callback callback = {});
+
+	// The task stops at its next step
+	void Cancel(TaskId id);
+	bool IsRunning(TaskId id) const;
+
+	// Resumes tasks whose step finished, call once per frame
+	void Poll();
+
+private:
+	void AddSleeper(std::chrono::steady_clock::time_point deadline, Task::Handle handle);
+	void BlockingStarted();
+	void BlockingFinished(Task::Handle handle);
+	void ReapFinished();
+
+private:
+	struct Spawned
+	{
+		TaskId		id;
+		Task		task;
+		Callback	callback;
+	};
+
+	struct Sleeper
+	{
+		std::chrono::steady_clock::time_point	deadline;
+		Task::Handle							handle;
+	};
+
+	std::vector<Spawned>		m_tasks;
+	std::vector<Sleeper>		m_sleepers;
+	TaskId						m_next_id	= 1;
+
+	// Tasks whose blocking step finished, posted from its thread
+	std::mutex					m_mutex;
+	std::condition_variable		m_condition;
+	std::vector<Task::Handle>	m_ready;
+	std::vector<Task::Handle>	m_poll_ready;
+	std::size_t					m_blocking	= 0;
+
+	friend class Sleep;
+	friend class RunBlocking;
+};
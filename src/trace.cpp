@@ -0,0 +1,235 @@
+#include "trace.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+std::atomic<bool> g_trace_enabled { false };
+
+struct TraceEvent
+{
+	const char*		name;
+	std::uint64_t	timestamp;
+	std::uint64_t	duration;
+	char			phase;
+	char			arg[55];
+};
+
+// Single producer (the owning thread), single consumer (the flusher)
+class TraceBuffer
+{
+public:
+	static constexpr std::size_t capacity = 4096;
+
+	TraceBuffer(int tid) : m_tid(tid) {}
+
+	bool Push(const TraceEvent& event)
+	{
+		std::size_t head = m_head.load(std::memory_order_relaxed);
+		if (head - m_tail.load(std::memory_order_acquire) == capacity)
+			return false;
+		m_events[head % capacity] = event;
+		m_head.store(head + 1, std::memory_order_release);
+		return true;
+	}
+
+	template<typename F>
+	void Drain(F&& callback)
+	{
+		std::size_t tail = m_tail.load(std::memory_order_relaxed);
+		std::size_t head = m_head.load(std::memory_order_acquire);
+		for (; tail != head; tail++)
+			callback(m_events[tail % capacity]);
+		m_tail.store(tail, std::memory_order_release);
+	}
+
+	int Tid() const { return m_tid; }
+
+private:
+	int							m_tid;
+	TraceEvent					m_events[capacity];
+	std::atomic<std::size_t>	m_head { 0 };
+	std::atomic<std::size_t>	m_tail { 0 };
+};
+
+using trace_clock = std::chrono::steady_clock;
+
+static std::mutex					s_mutex;
+static std::condition_variable		s_condition;
+static std::vector<TraceBuffer*>	s_buffers;
+static std::thread					s_flusher;
+static bool							s_stop		= false;
+static FILE*						s_file		= nullptr;
+static bool							s_first		= true;
+static trace_clock::time_point		s_epoch;
+static std::atomic<std::uint64_t>	s_dropped { 0 };
+
+// Buffers are leaked on purpose, a thread may exit before its events are
+// flushed. There is one per thread that ever recorded an event.
+static TraceBuffer* thread_buffer()
+{
+	thread_local TraceBuffer* buffer = nullptr;
+	if (buffer == nullptr)
+	{
+		buffer = new TraceBuffer(gettid());
+		std::lock_guard lock(s_mutex);
+		s_buffers.push_back(buffer);
+	}
+	return buffer;
+}
+
+static void push_event(const char* name, char phase, std::uint64_t timestamp, std::uint64_t duration, const char* arg)
+{
+	TraceEvent event;
+	event.name		= name;
+	event.phase		= phase;
+	event.timestamp	= timestamp;
+	event.duration	= duration;
+	event.arg[0]	= '\0';
+	if (arg)
+	{
+		strncpy(event.arg, arg, sizeof(event.arg) - 1);
+		event.arg[sizeof(event.arg) - 1] = '\0';
+	}
+
+	if (!thread_buffer()->Push(event))
+		s_dropped.fetch_add(1, std::memory_order_relaxed);
+}
+
+static void write_json_string(FILE* fp, const char* str)
+{
+	fputc('"', fp);
+	for (; *str; str++)
+	{
+		if (*str == '"' || *str == '\\')
+			fputc('\\', fp);
+		if ((unsigned char)*str < 0x20)
+			fprintf(fp, "\\u%04x", (unsigned char)*str);
+		else
+			fputc(*str, fp);
+	}
+	fputc('"', fp);
+}
+
+static void write_event(int tid, const TraceEvent& event)
+{
+	fprintf(s_file, "%s\n{\"name\":", s_first ? "" : ",");
+	write_json_string(s_file, event.name);
+	fprintf(s_file, ",\"ph\":\"%c\",\"ts\":%lu,\"pid\":%d,\"tid\":%d", event.phase, event.timestamp, getpid(), tid);
+	if (event.phase == 'X')
+		fprintf(s_file, ",\"dur\":%lu", event.duration);
+	if (event.phase == 'i')
+		fprintf(s_file, ",\"s\":\"t\"");
+	if (event.arg[0])
+	{
+		fprintf(s_file, ",\"args\":{\"arg\":");
+		write_json_string(s_file, event.arg);
+		fputc('}', s_file);
+	}
+	fputc('}', s_file);
+	s_first = false;
+}
+
+// Called with s_mutex held
+static void flush_buffers()
+{
+	for (TraceBuffer* buffer : s_buffers)
+		buffer->Drain([&](const TraceEvent& event) { write_event(buffer->Tid(), event); });
+	fflush(s_file);
+}
+
+static void flusher_main()
+{
+	std::unique_lock lock(s_mutex);
+	while (!s_stop)
+	{
+		s_condition.wait_for(lock, std::chrono::milliseconds(200));
+		flush_buffers();
+	}
+}
+
+bool TraceStart(const char* path)
+{
+	std::lock_guard lock(s_mutex);
+
+	if (s_file)
+		return false;
+
+	s_file = fopen(path, "w");
+	if (s_file == NULL)
+	{
+		fprintf(stderr, "Could not open trace file '%s'\n", path);
+		return false;
+	}
+
+	fprintf(s_file, "[");
+	s_first	= true;
+	s_stop	= false;
+	s_epoch	= trace_clock::now();
+	s_flusher = std::thread(flusher_main);
+
+	// Finish the file however the process exits
+	static bool registered = false;
+	if (!registered)
+		std::atexit(TraceStop);
+	registered = true;
+
+	g_trace_enabled.store(true, std::memory_order_release);
+	return true;
+}
+
+void TraceStop()
+{
+	if (!TraceEnabled())
+		return;
+	g_trace_enabled.store(false, std::memory_order_relaxed);
+
+	{
+		std::lock_guard lock(s_mutex);
+		s_stop = true;
+	}
+	s_condition.notify_all();
+	s_flusher.join();
+
+	std::lock_guard lock(s_mutex);
+	flush_buffers();
+	fprintf(s_file, "\n]\n");
+	fclose(s_file);
+	s_file = nullptr;
+
+	if (auto dropped = s_dropped.load())
+		fprintf(stderr, "trace: dropped %lu events\n", dropped);
+}
+
+std::uint64_t TraceNow()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(trace_clock::now() - s_epoch).count();
+}
+
+void TraceComplete(const char* name, std::uint64_t start_us, const char* arg)
+{
+	if (TraceEnabled())
+		push_event(name, 'X', start_us, TraceNow() - start_us, arg);
+}
+
+void TraceBegin(const char* name, const char* arg)
+{
+	push_event(name, 'B', TraceNow(), 0, arg);
+}
+
+void TraceEnd(const char* name)
+{
+	push_event(name, 'E', TraceNow(), 0, nullptr);
+}
+
+void TraceInstant(const char* name, const char* arg)
+{
+	push_event(name, 'i', TraceNow(), 0, arg);
+}
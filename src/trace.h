@@ -0,0 +1,62 @@
+#pragma once
+
+// Session tracing in Chrome trace event format, open the resulting file in
+// chrome://tracing or ui.perfetto.dev.
+//
+// Tracing is enabled at runtime with TraceStart(). Events are appended to
+// a lock-free ring buffer owned by the recording thread and written to
+// the file by a background thread, so recording never does I/O. When
+// tracing is not enabled every macro costs one atomic load.
+//
+// Event names must be string literals, they are written out after the
+// recording scope has ended. Arguments are copied.
+
+#include <atomic>
+#include <cstdint>
+
+extern std::atomic<bool> g_trace_enabled;
+
+// The trace file is finished by TraceStop() or at exit
+bool TraceStart(const char* path);
+void TraceStop();
+
+inline bool TraceEnabled() { return g_trace_enabled.load(std::memory_order_acquire); }
+
+std::uint64_t TraceNow();
+
+void TraceComplete(const char* name, std::uint64_t start_us, const char* arg = nullptr);
+void TraceBegin(const char* name, const char* arg = nullptr);
+void TraceEnd(const char* name);
+void TraceInstant(const char* name, const char* arg = nullptr);
+
+class TraceScope
+{
+public:
+	TraceScope(const char* name, const char* arg = nullptr)
+	{
+		if (!TraceEnabled())
+			return;
+		m_name	= name;
+		m_arg	= arg;
+		m_start	= TraceNow();
+	}
+
+	~TraceScope()
+	{
+		if (m_name)
+			TraceComplete(m_name, m_start, m_arg);
+	}
+
+private:
+	const char*		m_name	= nullptr;
+	const char*		m_arg	= nullptr;
+	std::uint64_t	m_start	= 0;
+};
+
+#define BWM_TRACE_CONCAT_(a, b) a##b
+#define BWM_TRACE_CONCAT(a, b) BWM_TRACE_CONCAT_(a, b)
+
+#define BWM_TRACE_SCOPE(...)	TraceScope BWM_TRACE_CONCAT(trace_scope_, __LINE__)(__VA_ARGS__)
+#define BWM_TRACE_INSTANT(...)	do { if (TraceEnabled()) TraceInstant(__VA_ARGS__); } while (0)
+#define BWM_TRACE_BEGIN(...)	do { if (TraceEnabled()) TraceBegin(__VA_ARGS__); } while (0)
+#define BWM_TRACE_END(name)		do { if (TraceEnabled()) TraceEnd(name); } while (0)
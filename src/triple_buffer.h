@@ -0,0 +1,52 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// Lock-free single producer, single consumer snapshot publication.
+//
+// The producer fills Back() and calls Publish(), which atomically swaps
+// the back slot with the shared middle slot. The consumer calls Acquire()
+// to swap its front slot with the middle one if something new was
+// published. Each side only ever touches the slot it currently owns, so
+// the consumer's snapshot stays valid and immutable until its next
+// Acquire() without reference counting or deferred reclamation. Slots are
+// reused, so no allocation happens once the slot contents have grown to
+// their steady-state size.
+template<typename T>
+class TripleBuffer
+{
+public:
+	TripleBuffer() = default;
+
+	TripleBuffer(const TripleBuffer&) = delete;
+	TripleBuffer& operator=(const TripleBuffer&) = delete;
+
+	// Producer side
+	T& Back() { return m_slots[m_back]; }
+	void Publish()
+	{
+		std::uint8_t previous = m_middle.exchange(m_back | s_dirty_bit, std::memory_order_acq_rel);
+		m_back = previous & s_index_mask;
+	}
+
+	// Consumer side, returns true if a new snapshot was acquired
+	bool Acquire()
+	{
+		if (!(m_middle.load(std::memory_order_relaxed) & s_dirty_bit))
+			return false;
+		std::uint8_t previous = m_middle.exchange(m_front, std::memory_order_acq_rel);
+		m_front = previous & s_index_mask;
+		return true;
+	}
+	const T& Front() const { return m_slots[m_front]; }
+
+private:
+	static constexpr std::uint8_t s_index_mask	= 0x03;
+	static constexpr std::uint8_t s_dirty_bit	= 0x04;
+
+	T							m_slots[3];
+	std::uint8_t				m_back		= 0;
+	std::uint8_t				m_front		= 1;
+	std::atomic<std::uint8_t>	m_middle	{ 2 };
+};
@@ -0,0 +1,834 @@
+#include "ui.h"
+
+#include "draw_data_cache.h"
+#include "software_renderer.h"
+#include "startup.h"
+#include "stats.h"
+#include "trace.h"
+
+#include <imgui.h>
+#include <backends/imgui_impl_glfw.h>
+#include <backends/imgui_impl_opengl3.h>
+
+#include <GLFW/glfw3.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <malloc.h>
+#include <thread>
+
+int WINDOW_WIDTH = 400;
+int WINDOW_HEIGHT = 400;
+
+static SoftwareRenderer*	s_software_renderer	= nullptr;
+static DrawDataCache*		s_draw_data_cache	= nullptr;
+static bool					s_vsync				= true;
+
+// Frames that do not block on a vsynced swap are paced to this rate
+static constexpr auto s_frame_interval = std::chrono::microseconds(1000000 / 60);
+static std::chrono::steady_clock::time_point s_next_frame;
+
+static bool s_low_memory = false;
+
+// Shared with the ImGui context, which does not delete it
+static ImFontAtlas* s_font_atlas = nullptr;
+
+// Draw buffers at least this large and less than half used are released
+static constexpr auto s_trim_interval = std::chrono::seconds(2);
+static constexpr int s_trim_min_bytes = 64 * 1024;
+static std::chrono::steady_clock::time_point s_next_trim;
+
+#ifdef BWM_STATS
+static bool						s_show_stats	= false;
+static WirelessRequestQueue*	s_requests		= nullptr;
+static NetworkDetailsCache*		s_details		= nullptr;
+static StatsClock::time_point	s_frame_begin;
+static StatsClock::time_point	s_build_begin;
+
+static void stats_overlay()
+{
+	ImGui::SetNextWindowPos(ImVec2(10.0f, 10.0f));
+	ImGui::SetNextWindowBgAlpha(0.9f);
+	ImGui::Begin("stats", NULL,
+		ImGuiWindowFlags_NoDecoration |
+		ImGuiWindowFlags_AlwaysAutoResize |
+		ImGuiWindowFlags_NoFocusOnAppearing |
+		ImGuiWindowFlags_NoNav
+	);
+
+	StatsDrawTable();
+
+	if (s_requests)
+	{
+		auto stats = s_requests->GetStats();
+		ImGui::Text("requests: %zu queued, %zu running", stats.queue_depth, stats.in_flight);
+		ImGui::Text("  %lu submitted, %lu coalesced, %lu stale", stats.submitted, stats.coalesced, stats.dropped_stale);
+	}
+
+	if (s_details)
+	{
+		auto stats = s_details->GetStats();
+		ImGui::Text("details: %lu hits, %lu misses, %lu deduplicated", stats.hits, stats.misses, stats.deduplicated);
+		ImGui::Text("  %zu cached, %lu invalidations", stats.entries, stats.invalidations);
+	}
+
+	if (s_draw_data_cache)
+		ImGui::Text("frames: %lu rendered, %lu elided", s_draw_data_cache->GetRenderedCount(), s_draw_data_cache->GetElidedCount());
+
+	ImGui::End();
+}
+#endif
+
+static void glfw_error_callback(int error, const char* description)
+{
+	fprintf(stderr, "Glfw Error %d: %s\n", error, description);
+}
+
+// Exposed or resized windows have to be drawn even if nothing changed
+static void window_refresh_callback(GLFWwindow*)
+{
+	if (s_draw_data_cache)
+		s_draw_data_cache->Invalidate();
+	if (s_software_renderer)
+		s_software_renderer->Invalidate();
+}
+
+template<typename T>
+static bool is_oversized(const ImVector<T>& vector)
+{
+	return vector.Capacity * (int)sizeof(T) >= s_trim_min_bytes && vector.Capacity > 2 * vector.Size;
+}
+
+// Runs between frames, the last frame's draw lists are not used anymore
+static void trim_memory()
+{
+	// The GL backend keeps its own copy, the software renderer reads the
+	// atlas every frame
+	ImGuiIO& io = ImGui::GetIO();
+	if (!s_software_renderer && io.Fonts->TexID && (io.Fonts->TexPixelsAlpha8 || io.Fonts->TexPixelsRGBA32))
+		io.Fonts->ClearTexData();
+
+	auto now = std::chrono::steady_clock::now();
+	if (now < s_next_trim)
+		return;
+	s_next_trim = now + s_trim_interval;
+
+	ImDrawData* draw_data = ImGui::GetDrawData();
+	if (draw_data == NULL)
+		return;
+
+	bool freed = false;
+	for (int i = 0; i < draw_data->CmdListsCount; i++)
+	{
+		ImDrawList* draw_list = draw_data->CmdLists[i];
+		if (is_oversized(draw_list->VtxBuffer) || is_oversized(draw_list->IdxBuffer))
+		{
+			// Reallocated at the size the next frame needs
+			draw_list->_ClearFreeMemory();
+			freed = true;
+		}
+	}
+
+#ifdef __GLIBC__
+	// Freed memory is not returned to the system otherwise
+	if (freed)
+		malloc_trim(0);
+#endif
+}
+
+static void pace_frame()
+{
+	auto now = std::chrono::steady_clock::now();
+	s_next_frame = std::max(s_next_frame + s_frame_interval, now - s_frame_interval);
+	if (s_next_frame > now)
+	{
+		BWM_TRACE_SCOPE("pace frame");
+		std::this_thread::sleep_until(s_next_frame);
+	}
+}
+
+GLFWwindow* UiCreateWindow(const UiWindowOptions& options)
+{
+	const char* glsl_version = "#version 130";
+
+	GLFWwindow* window = nullptr;
+	{
+		StartupScope scope(StartupPhase::window);
+
+		glfwSetErrorCallback(glfw_error_callback);
+		if (!glfwInit())
+		{
+			fprintf(stderr, "Could not initalize glfw\n");
+			return nullptr;
+		}
+
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 0);
+
+		glfwWindowHint(GLFW_TRANSPARENT_FRAMEBUFFER, GLFW_TRUE);
+		glfwWindowHint(GLFW_VISIBLE, options.visible ? GLFW_TRUE : GLFW_FALSE);
+		glfwWindowHint(GLFW_CLIENT_API, options.software ? GLFW_NO_API : GLFW_OPENGL_API);
+
+		window = glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, "bwm", NULL, NULL);
+		if (window == NULL)
+		{
+			fprintf(stderr, "Could not create window\n");
+			glfwTerminate();
+			return nullptr;
+		}
+
+		if (!options.software)
+		{
+			glfwMakeContextCurrent(window);
+			glfwSwapInterval(options.vsync ? 1 : 0);
+		}
+	}
+
+	// Waits for the atlas if it is still being built
+	ImFontAtlas* font_atlas = options.font_atlas ? options.font_atlas() : nullptr;
+
+	StartupScope scope(StartupPhase::imgui);
+
+	// Setup ImGui context
+	IMGUI_CHECKVERSION();
+	ImGui::CreateContext(font_atlas);
+	s_font_atlas = font_atlas;
+
+	ImGuiIO& io = ImGui::GetIO();
+	io.IniFilename = NULL;
+
+	s_vsync			= options.vsync;
+	s_next_frame	= std::chrono::steady_clock::now();
+	s_low_memory	= options.low_memory;
+
+	if (options.low_memory)
+	{
+		// Windows not drawn anymore release their buffers after 5 seconds
+		// instead of 60
+		io.ConfigMemoryCompactTimer = 5.0f;
+
+#ifdef __GLIBC__
+		// Every request worker would get a malloc arena of its own
+		mallopt(M_ARENA_MAX, 2);
+#endif
+	}
+
+	if (options.software)
+	{
+		s_software_renderer = new SoftwareRenderer();
+		if (!s_software_renderer->Init(window))
+		{
+			fprintf(stderr, "Falling back to OpenGL\n");
+			delete s_software_renderer;
+			s_software_renderer = nullptr;
+
+			ImGui::DestroyContext();
+			glfwDestroyWindow(window);
+			glfwTerminate();
+
+			UiWindowOptions gl_options = options;
+			gl_options.software		= false;
+			gl_options.font_atlas	= [font_atlas] { return font_atlas; };
+			return UiCreateWindow(gl_options);
+		}
+
+		ImGui_ImplGlfw_InitForOther(window, true);
+	}
+	else
+	{
+		// Init ImGui backends
+		ImGui_ImplGlfw_InitForOpenGL(window, true);
+		ImGui_ImplOpenGL3_Init(glsl_version);
+	}
+
+	if (options.skip_unchanged_frames)
+		s_draw_data_cache = new DrawDataCache();
+	glfwSetWindowRefreshCallback(window, window_refresh_callback);
+
+	return window;
+}
+
+void UiDestroyWindow(GLFWwindow* window)
+{
+	glfwSetWindowRefreshCallback(window, NULL);
+	if (s_draw_data_cache)
+	{
+		delete s_draw_data_cache;
+		s_draw_data_cache = nullptr;
+	}
+
+	if (s_software_renderer)
+	{
+		delete s_software_renderer;
+		s_software_renderer = nullptr;
+	}
+	else
+	{
+		ImGui_ImplOpenGL3_Shutdown();
+	}
+	ImGui_ImplGlfw_Shutdown();
+	ImGui::DestroyContext();
+
+	if (s_font_atlas)
+	{
+		IM_DELETE(s_font_atlas);
+		s_font_atlas = nullptr;
+	}
+
+	glfwDestroyWindow(window);
+	glfwTerminate();
+}
+
+void UiFontsChanged()
+{
+	if (s_software_renderer)
+	{
+		s_software_renderer->InvalidateFontTexture();
+	}
+	else
+	{
+		ImGui_ImplOpenGL3_DestroyFontsTexture();
+		ImGui_ImplOpenGL3_CreateFontsTexture();
+	}
+
+	// Texture ids can be reused
+	if (s_draw_data_cache)
+		s_draw_data_cache->Invalidate();
+}
+
+UiFrameCounts UiGetFrameCounts()
+{
+	UiFrameCounts counts;
+	if (s_draw_data_cache)
+	{
+		counts.rendered	= s_draw_data_cache->GetRenderedCount();
+		counts.elided	= s_draw_data_cache->GetElidedCount();
+	}
+	return counts;
+}
+
+void UiFrameStart(GLFWwindow* window)
+{
+#ifdef BWM_STATS
+	s_frame_begin = StatsClock::now();
+#endif
+	BWM_STATS_SCOPE(frame_start);
+	BWM_TRACE_BEGIN("frame");
+	BWM_TRACE_SCOPE("frame_start");
+
+	glfwPollEvents();
+
+	// Create new frame
+	if (s_software_renderer)
+		s_software_renderer->NewFrame();
+	else
+		ImGui_ImplOpenGL3_NewFrame();
+	if (s_low_memory)
+		trim_memory();
+	ImGui_ImplGlfw_NewFrame();
+	ImGui::NewFrame();
+
+	glfwGetWindowSize(window, &WINDOW_WIDTH, &WINDOW_HEIGHT);
+
+	// Set ImGui window to fill whole application window
+	ImGui::SetNextWindowSize(ImVec2(WINDOW_WIDTH, WINDOW_HEIGHT));
+	ImGui::SetNextWindowPos(ImVec2(0.0f, 0.0f));
+
+	ImGui::Begin("Window", NULL,
+		ImGuiWindowFlags_NoTitleBar |
+		ImGuiWindowFlags_NoResize |
+		ImGuiWindowFlags_NoMove
+	);
+
+#ifdef BWM_STATS
+	s_build_begin = StatsClock::now();
+#endif
+}
+
+void UiFrameEnd(GLFWwindow* window)
+{
+#ifdef BWM_STATS
+	StatsRecord(Stat::imgui_build, StatsClock::now() - s_build_begin);
+#endif
+
+	{
+		BWM_STATS_SCOPE(frame_end);
+		BWM_TRACE_SCOPE("frame_end");
+
+		ImGui::End();
+
+#ifdef BWM_STATS
+		if (ImGui::IsKeyPressed(ImGuiKey_F3, false))
+			s_show_stats = !s_show_stats;
+		if (s_show_stats)
+			stats_overlay();
+#endif
+
+		ImGui::Render();
+
+		if (s_draw_data_cache && !s_draw_data_cache->Update(ImGui::GetDrawData()))
+		{
+			// The window already shows this frame
+			BWM_TRACE_INSTANT("frame elided");
+			if (s_vsync)
+				pace_frame();
+		}
+		else if (s_software_renderer)
+		{
+			// Presents the changed parts of the window
+			{
+				BWM_STATS_SCOPE(render_draw_data);
+				s_software_renderer->RenderDrawData(ImGui::GetDrawData());
+			}
+			if (s_vsync)
+				pace_frame();
+		}
+		else
+		{
+			glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+			glClear(GL_COLOR_BUFFER_BIT);
+			{
+				BWM_STATS_SCOPE(render_draw_data);
+				BWM_TRACE_SCOPE("RenderDrawData");
+				ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+			}
+
+			BWM_TRACE_SCOPE("glfwSwapBuffers");
+			glfwSwapBuffers(window);
+
+			// Keeps skipped frames in step with the swaps
+			s_next_frame = std::chrono::steady_clock::now();
+		}
+	}
+
+	BWM_TRACE_END("frame");
+
+#ifdef BWM_STATS
+	StatsRecord(Stat::frame, StatsClock::now() - s_frame_begin);
+#endif
+}
+
+
+
+MainScreen::MainScreen(WirelessManager* wireless_manager, WirelessRequestQueue* requests)
+	: m_wireless_manager(wireless_manager)
+	, m_requests(requests)
+	, m_details(requests)
+{
+	using namespace std::chrono_literals;
+
+	m_next_scan		= clock::now() + 10s;
+	m_next_update	= clock::now() + 2s;
+
+#ifdef BWM_STATS
+	s_requests	= requests;
+	s_details	= &m_details;
+#endif
+}
+
+MainScreen::~MainScreen()
+{
+#ifdef BWM_STATS
+	s_requests	= nullptr;
+	s_details	= nullptr;
+#endif
+
+	if (m_login_screen)
+		delete m_login_screen;
+}
+
+void MainScreen::Show()
+{
+	using namespace std::chrono_literals;
+
+	m_tasks.Poll();
+
+	m_link_monitor.Poll(m_wireless_manager->GetState());
+
+	// Compared only when a new snapshot was published
+	const WirelessState& state = m_wireless_manager->GetState();
+	if (state.generation != m_details_generation)
+	{
+		m_details_generation = state.generation;
+		if (state.networks != m_details_networks)
+		{
+			m_details.Invalidate();
+			m_details_networks = state.networks;
+		}
+	}
+
+	if (m_wireless_manager->GetCurrentDevice().power == PowerState::on)
+	{
+		// Scan and update networks on specified intervals
+		auto current_time = clock::now();
+		if (current_time >= m_next_scan)
+		{
+			m_requests->Scan();
+			m_next_scan = current_time + 10s;
+		}
+		if (current_time >= m_next_update)
+		{
+			m_requests->UpdateNetworks();
+			m_next_update = current_time + 2s;
+		}
+	}
+
+	ShowDevices();
+
+	ImVec2 known_button_size = ImGui::CalcTextSize("Known");
+	known_button_size.x += 20.0f;
+	known_button_size.y += 10.0f;
+
+	ImGui::SameLine();
+	if (ImGui::Button("Known", known_button_size))
+	{
+		m_requests->UpdateKnownNetworks();
+		ImGui::OpenPopup("known-networks");
+	}
+
+	ShowKnownNetworksPopup();
+
+	ImGui::Spacing();
+	ImGui::Spacing();
+
+	ShowNetworks();
+
+	if (m_login_screen)
+	{
+		m_login_screen->Show();
+		if (m_login_screen->Done())
+		{
+			delete m_login_screen;
+			m_login_screen = nullptr;
+		}
+	}
+}
+
+void MainScreen::ShowDevices()
+{
+	// Create dropdown for devices
+	if (ImGui::BeginCombo("Device", m_wireless_manager->GetCurrentDevice().name.c_str()))
+	{
+		const auto& devices			= m_wireless_manager->GetDevices();
+		const auto& current_device	= m_wireless_manager->GetCurrentDevice();
+
+		for (std::size_t i = 0; i < devices.size(); i++)
+		{
+			bool selected = (&current_device == &devices[i]);
+			if (ImGui::Selectable(devices[i].name.c_str(), selected))
+				m_requests->SetCurrentDevice(devices[i]);
+			if (selected)
+				ImGui::SetItemDefaultFocus();
+		}
+		ImGui::EndCombo();
+	}
+}
+
+// Case insensitive substring match, an empty filter matches everything
+static bool matches_filter(const Ssid& ssid, const char* filter)
+{
+	std::string_view needle(filter);
+	auto it = std::search(ssid.begin(), ssid.end(), needle.begin(), needle.end(), [](char a, char b) {
+		return std::tolower((unsigned char)a) == std::tolower((unsigned char)b);
+	});
+	return needle.empty() || it != ssid.end();
+}
+
+void MainScreen::ShowKnownNetworksPopup()
+{
+	if (!ImGui::BeginPopupModal("known-networks", NULL,
+		ImGuiWindowFlags_AlwaysAutoResize |
+		ImGuiWindowFlags_NoTitleBar |
+		ImGuiWindowFlags_NoResize |
+		ImGuiWindowFlags_NoMove
+	))
+	{
+		return;
+	}
+
+	const auto& known_networks = m_wireless_manager->GetKnownNetworks();
+
+	auto is_selected = [&](const Ssid& ssid) {
+		return std::find(m_known_selection.begin(), m_known_selection.end(), ssid) != m_known_selection.end();
+	};
+	auto set_selected = [&](const Ssid& ssid, bool selected) {
+		auto it = std::find(m_known_selection.begin(), m_known_selection.end(), ssid);
+		if (selected && it == m_known_selection.end())
+			m_known_selection.push_back(ssid);
+		else if (!selected && it != m_known_selection.end())
+			m_known_selection.erase(it);
+	};
+
+	// Networks forgotten meanwhile can not stay selected
+	auto stale = std::remove_if(m_known_selection.begin(), m_known_selection.end(), [&](const Ssid& ssid) {
+		return std::none_of(known_networks.begin(), known_networks.end(), [&](const Network& n) { return n.ssid == ssid; });
+	});
+	m_known_selection.erase(stale, m_known_selection.end());
+
+	ImGui::InputText("filter", m_known_filter, sizeof(m_known_filter));
+
+	// Only rows matching the filter are selected or deselected
+	bool select_all		= ImGui::Button("Select all");
+	ImGui::SameLine();
+	bool select_none	= ImGui::Button("Select none");
+	if (select_all || select_none)
+	{
+		for (const Network& network : known_networks)
+			if (matches_filter(network.ssid, m_known_filter))
+				set_selected(network.ssid, select_all);
+	}
+
+	if (ImGui::BeginTable("known-networks", 3, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg | ImGuiTableFlags_ScrollY, ImVec2(0.0f, WINDOW_HEIGHT * 0.5f)))
+	{
+		ImVec2 known_button_size = ImGui::CalcTextSize("Forget");
+		known_button_size.x += 10.0f;
+		known_button_size.y += 10.0f;
+
+		float checkbox_width = ImGui::GetFrameHeight();
+
+		ImGui::TableSetupColumn("##select", ImGuiTableColumnFlags_WidthFixed, checkbox_width);
+		ImGui::TableSetupColumn("ssid", ImGuiTableColumnFlags_WidthFixed, WINDOW_WIDTH - 2 * known_button_size.x - checkbox_width);
+		ImGui::TableSetupColumn("##", ImGuiTableColumnFlags_WidthFixed, known_button_size.x);
+		ImGui::TableHeadersRow();
+
+		std::size_t count = known_networks.size();
+		for (std::size_t i = 0; i < count; i++)
+		{
+			const Network& network = known_networks[i];
+			if (!matches_filter(network.ssid, m_known_filter))
+				continue;
+
+			ImGui::PushID(i + 1000);
+
+			ImGui::TableNextColumn();
+			bool selected = is_selected(network.ssid);
+			if (ImGui::Checkbox("##select", &selected))
+				set_selected(network.ssid, selected);
+
+			ImGui::TableNextColumn();
+			ImGui::Text("%s", network.ssid.c_str());
+
+			ImGui::TableNextColumn();
+			if (ImGui::Button("Forget", known_button_size))
+				m_requests->ForgetKnownNetwork(network);
+
+			ImGui::PopID();
+		}
+
+		ImGui::EndTable();
+	}
+
+	// One request for the whole selection, the known networks are
+	// refreshed once when it is done
+	bool forgetting = m_requests->IsPending(WirelessRequestType::forget_known_networks);
+
+	ImGui::BeginDisabled(m_known_selection.empty());
+	char forget_label[64];
+	snprintf(forget_label, sizeof(forget_label), "Forget selected (%zu)", m_known_selection.size());
+	if (ImGui::Button(forget_label))
+	{
+		std::vector<Network> networks;
+		for (const Network& network : known_networks)
+			if (is_selected(network.ssid))
+				networks.push_back(network);
+
+		m_requests->ForgetKnownNetworks(networks);
+		m_known_selection.clear();
+	}
+	ImGui::EndDisabled();
+
+	if (forgetting)
+	{
+		auto progress = m_requests->GetForgetProgress();
+
+		char overlay[32];
+		snprintf(overlay, sizeof(overlay), "%zu/%zu", progress.done, progress.total);
+		ImGui::SameLine();
+		ImGui::ProgressBar(progress.total ? float(progress.done) / float(progress.total) : 0.0f, ImVec2(-1.0f, 0.0f), overlay);
+	}
+
+	if (ImGui::Button("Close"))
+		ImGui::CloseCurrentPopup();
+	ImGui::EndPopup();
+}
+
+// Resumes the task with the result of a request
+static Task await_request(std::function<void(WirelessRequestQueue::Callback)> submit)
+{
+	co_return co_await AwaitCallback(std::move(submit));
+}
+
+Task MainScreen::ActivateDevice()
+{
+	using namespace std::chrono_literals;
+
+	// Powers on the adapter and then the device, the second needs the first
+	if (!co_await await_request([this](auto done) { m_requests->ActivateDevice(done); }))
+		co_return false;
+
+	// The periodic scan and refresh would only repeat the ones below
+	auto current_time = clock::now();
+	m_next_scan		= current_time + 10s;
+	m_next_update	= current_time + 2s;
+
+	// The scan is followed by a network refresh. Known networks are not
+	// bound to the device, the queue runs both at once.
+	co_return co_await WhenAll(
+		await_request([this](auto done) { m_requests->Scan(done); }),
+		await_request([this](auto done) { m_requests->UpdateKnownNetworks(done); })
+	);
+}
+
+void MainScreen::ShowNetworks()
+{
+	if (m_wireless_manager->GetCurrentDevice().power != PowerState::on)
+	{
+		bool activating = m_tasks.IsRunning(m_activate_task);
+
+		ImGui::BeginDisabled(activating);
+		if (ImGui::Button("Activate device"))
+			m_activate_task = m_tasks.Spawn(ActivateDevice());
+		ImGui::EndDisabled();
+
+		if (activating)
+		{
+			ImGui::SameLine();
+			ImGui::TextUnformatted("Activating...");
+		}
+	}
+	else if (ImGui::BeginTable("networks", 4, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg))
+	{
+		const ImVec2 button_size = ImVec2(ImGui::CalcTextSize("Disconnect").x + 10.0f, 0.0f);
+
+		ImGui::TableSetupColumn("ssid");
+		ImGui::TableSetupColumn("security", ImGuiTableColumnFlags_WidthFixed, -1);
+		ImGui::TableSetupColumn("signal",	ImGuiTableColumnFlags_WidthFixed, -1);
+		ImGui::TableSetupColumn("##",		ImGuiTableColumnFlags_WidthFixed, -1);
+		ImGui::TableHeadersRow();
+
+		for (size_t i = 0; i < m_wireless_manager->GetNetworks().size(); i++)
+		{
+			const Network& network = m_wireless_manager->GetNetworks()[i];
+
+			// Identified by the network rather than the row, rows move
+			// around with every scan
+			char node_id[48];
+			snprintf(node_id, sizeof(node_id), "%s/%s", network.ssid.c_str(), to_string(network.security));
+
+			ImGui::TableNextColumn();
+			bool expanded = ImGui::TreeNodeEx(node_id, ImGuiTreeNodeFlags_NoTreePushOnOpen | ImGuiTreeNodeFlags_SpanFullWidth, "%s", network.ssid.c_str());
+
+			ImGui::TableNextColumn();
+			ImGui::TextUnformatted(to_string(network.security));
+
+			ImGui::TableNextColumn();
+			if (const LinkMonitor::History* history = m_link_monitor.FindHistory(network.ssid))
+			{
+				// Oldest sample first, next is where the ring wraps once full
+				int offset = (history->count == LinkMonitor::s_history_length) ? history->next : 0;
+				ImGui::PushID(i + 1);
+				ImGui::PlotLines("##signal", history->samples, history->count, offset, nullptr, 0.0f, 100.0f, ImVec2(60.0f, ImGui::GetTextLineHeight()));
+				ImGui::PopID();
+				ImGui::SameLine();
+			}
+			int signal = (network.connected && m_link_monitor.GetLinkSignal() >= 0) ? m_link_monitor.GetLinkSignal() : network.signal;
+			if (signal >= 0)
+				ImGui::Text("%d%%", signal);
+
+			ImGui::TableNextColumn();
+			if (network.connected)
+			{
+				ImGui::PushID(i + 1);
+				if (ImGui::Button("Disconnect", button_size))
+					m_requests->Disconnect();
+				ImGui::PopID();
+			}
+			else
+			{
+				ImGui::PushID(i + 1);
+				if (ImGui::Button("Connect", button_size))
+				{
+					// Try connecting without credentials first, ask for
+					// them only if that fails
+					m_requests->Connect(network, "", [this, network](bool success) {
+						if (!success && m_login_screen == nullptr)
+							m_login_screen = LoginScreen::Create(m_wireless_manager, m_requests, &m_tasks, network);
+					});
+				}
+				ImGui::PopID();
+			}
+
+			if (expanded)
+				ShowNetworkDetails(network);
+		}
+
+		ImGui::EndTable();
+	}
+}
+
+// One row per access point and one per station property below the row of
+// the network
+void MainScreen::ShowNetworkDetails(const Network& network)
+{
+	const NetworkDetails* details = m_details.Get(network);
+
+	float indent = ImGui::GetTreeNodeToLabelSpacing();
+
+	if (details == nullptr)
+	{
+		ImGui::TableNextRow();
+		ImGui::TableNextColumn();
+		ImGui::Indent(indent);
+		ImGui::TextDisabled("%s", m_details.IsFetching(network) ? "Loading..." : "No details");
+		ImGui::Unindent(indent);
+		return;
+	}
+
+	for (const Bss& bss : details->bsses)
+	{
+		ImGui::TableNextRow();
+
+		ImGui::TableNextColumn();
+		ImGui::Indent(indent);
+		if (bss.connected)
+			ImGui::Text("%s *", bss.bssid.c_str());
+		else
+			ImGui::TextDisabled("%s", bss.bssid.c_str());
+		ImGui::Unindent(indent);
+
+		ImGui::TableNextColumn();
+		if (int channel = FrequencyToChannel(bss.frequency))
+			ImGui::Text("ch %d", channel);
+
+		ImGui::TableNextColumn();
+		if (bss.signal_dbm != 0)
+			ImGui::Text("%d dBm", bss.signal_dbm);
+		else if (bss.signal >= 0)
+			ImGui::Text("%d%%", bss.signal);
+
+		ImGui::TableNextColumn();
+		if (bss.frequency != 0)
+			ImGui::Text("%u MHz", bss.frequency);
+	}
+
+	for (const StationProperty& property : details->station)
+	{
+		ImGui::TableNextRow();
+		ImGui::TableNextColumn();
+		ImGui::Indent(indent);
+		ImGui::TextDisabled("%s:", property.name.c_str());
+		ImGui::SameLine();
+		ImGui::TextUnformatted(property.value.c_str());
+		ImGui::Unindent(indent);
+	}
+
+	if (details->bsses.empty() && details->station.empty())
+	{
+		ImGui::TableNextRow();
+		ImGui::TableNextColumn();
+		ImGui::Indent(indent);
+		ImGui::TextDisabled("No details");
+		ImGui::Unindent(indent);
+	}
+}
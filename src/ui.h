@@ -0,0 +1,120 @@
+#pragma once
+
+#include "link_monitor.h"
+#include "login_screen.h"
+#include "network_details_cache.h"
+#include "task.h"
+#include "wireless_manager.h"
+#include "wireless_request_queue.h"
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+struct GLFWwindow;
+struct ImFontAtlas;
+
+extern int WINDOW_WIDTH;
+extern int WINDOW_HEIGHT;
+
+// Window and frame handling shared by bwm and the UI benchmark
+
+struct UiWindowOptions
+{
+	bool	visible					= true;
+	bool	vsync					= true;
+
+	// Render on the CPU and present through XShm instead of OpenGL, see
+	// software_renderer.h. Falls back to OpenGL if not supported.
+	bool	software				= false;
+
+	// Skips rendering and presenting frames whose draw data equals the
+	// previous frame's, see draw_data_cache.h
+	bool	skip_unchanged_frames	= true;
+
+	// Frees the CPU copy of the font atlas after upload and releases draw
+	// buffers that grew for a frame with much more content than usual.
+	// Default for builds configured with --low-memory.
+#ifdef BWM_LOW_MEMORY
+	bool	low_memory				= true;
+#else
+	bool	low_memory				= false;
+#endif
+
+	// Called once the window and GL context exist, right before the ImGui
+	// context is created, so the atlas can be built on another thread
+	// meanwhile. The window owns the returned atlas, nullptr uses ImGui's
+	// default font.
+	std::function<ImFontAtlas*()>	font_atlas;
+};
+
+struct UiFrameCounts
+{
+	std::uint64_t	rendered	= 0;
+	std::uint64_t	elided		= 0;
+};
+
+// Frames rendered and skipped as unchanged since the window was created
+UiFrameCounts UiGetFrameCounts();
+
+// Creates the window with a current GL context and an initialized ImGui
+// context of WINDOW_WIDTH x WINDOW_HEIGHT
+GLFWwindow* UiCreateWindow(const UiWindowOptions& options);
+void UiDestroyWindow(GLFWwindow* window);
+
+// A frame is built between these two, the full window ImGui window is
+// current in between
+void UiFrameStart(GLFWwindow* window);
+void UiFrameEnd(GLFWwindow* window);
+
+// Uploads the font atlas again after it was rebuilt, outside of a frame
+void UiFontsChanged();
+
+// Device selection, network table and the popups opened from it
+class MainScreen
+{
+public:
+	MainScreen(WirelessManager* wireless_manager, WirelessRequestQueue* requests);
+	~MainScreen();
+
+	MainScreen(const MainScreen&) = delete;
+	MainScreen& operator=(const MainScreen&) = delete;
+
+	void Show();
+
+	const LinkMonitor& GetLinkMonitor() const { return m_link_monitor; }
+
+private:
+	void ShowDevices();
+	void ShowKnownNetworksPopup();
+	void ShowNetworks();
+	void ShowNetworkDetails(const Network& network);
+
+	Task ActivateDevice();
+
+private:
+	using clock = std::chrono::steady_clock;
+
+	WirelessManager*		m_wireless_manager;
+	WirelessRequestQueue*	m_requests;
+	LoginScreen*			m_login_screen	= nullptr;
+	LinkMonitor				m_link_monitor;
+
+	// Known networks popup, selected networks are forgotten in one batch
+	char					m_known_filter[33]	= {};
+	std::vector<Ssid>		m_known_selection;
+
+	clock::time_point		m_next_scan;
+	clock::time_point		m_next_update;
+
+	// Details of expanded network rows, expired when the network list
+	// changed, which is when a scan brought in new results
+	NetworkDetailsCache		m_details;
+	std::uint64_t			m_details_generation	= 0;
+	std::vector<Network>	m_details_networks;
+
+	// Declared last, tasks are cancelled before anything they use is gone
+	TaskExecutor			m_tasks;
+	TaskExecutor::TaskId	m_activate_task	= 0;
+};
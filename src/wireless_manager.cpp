@@ -1,6 +1,13 @@
 #include "wireless_manager.h"
 
 #include "iwd_wireless_manager.h"
+#ifdef BWM_NETWORKMANAGER
+#include "nm_wireless_manager.h"
+#endif
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 
 
 WirelessManager* WirelessManager::Create(WirelessBackend backend)
@@ -12,14 +19,51 @@ WirelessManager* WirelessManager::Create(WirelessBackend backend)
 		case WirelessBackend::iwd:
 			result = new IwdWirelessManager();
 			break;
+		case WirelessBackend::network_manager:
+#ifdef BWM_NETWORKMANAGER
+			result = new NmWirelessManager();
+#else
+			fprintf(stderr, "bwm was built without NetworkManager support, configure with 'premake5 gmake2 --networkmanager'\n");
+#endif
+			break;
 	}
 
 	if (!result)
 		return nullptr;
 
 	if (result->Init())
+	{
+		result->AcquireState();
 		return result;
+	}
 
 	delete result;
 	return nullptr;
 }
+
+WirelessBackend WirelessManager::DefaultBackend()
+{
+	const char* backend = getenv("BWM_BACKEND");
+	if (backend == NULL || strcmp(backend, "iwd") == 0)
+		return WirelessBackend::iwd;
+	if (strcmp(backend, "networkmanager") == 0)
+		return WirelessBackend::network_manager;
+
+	fprintf(stderr, "Unknown backend '%s' in BWM_BACKEND, using iwd\n", backend);
+	return WirelessBackend::iwd;
+}
+
+void WirelessManager::PublishState()
+{
+	m_state.generation++;
+
+	// Assignment reuses the capacity of the slot's vectors
+	WirelessState& snapshot = m_snapshots.Back();
+	snapshot.generation		= m_state.generation;
+	snapshot.current_device	= m_state.current_device;
+	snapshot.devices		= m_state.devices;
+	snapshot.networks		= m_state.networks;
+	snapshot.known_networks	= m_state.known_networks;
+
+	m_snapshots.Publish();
+}
\ No newline at end of file
@@ -1,13 +1,28 @@
 #pragma once
 
 #include "structs.h"
+#include "triple_buffer.h"
 
+#include <cstdint>
+#include <mutex>
 #include <string>
 #include <vector>
 
 enum class WirelessBackend
 {
-	iwd
+	iwd,
+	network_manager
+};
+
+// Everything the UI reads from a backend. Published as an immutable
+// snapshot, generation increases by one on every publish.
+struct WirelessState
+{
+	std::uint64_t			generation		= 0;
+	std::size_t				current_device	= 0;
+	std::vector<Device>		devices;
+	std::vector<Network>	networks;
+	std::vector<Network>	known_networks;
 };
 
 class WirelessManager
@@ -18,17 +33,35 @@ protected:
 public:
 	static WirelessManager* Create(WirelessBackend backend);
 
+	// Selected with BWM_BACKEND=iwd|networkmanager, iwd if unset
+	static WirelessBackend DefaultBackend();
+
 	virtual ~WirelessManager() {};
 
 	virtual bool Init() = 0;
 
-	virtual const Device& GetCurrentDevice() const = 0;
+	virtual WirelessBackend GetBackend() const = 0;
+
+	// Reader side. AcquireState() makes the latest published snapshot
+	// current and returns true if it changed. The getters below read the
+	// current snapshot, references stay valid until the next AcquireState().
+	bool AcquireState() { return m_snapshots.Acquire(); }
+	const WirelessState& GetState() const { return m_snapshots.Front(); }
+
+	const Device& GetCurrentDevice() const { return GetState().devices[GetState().current_device]; }
 	virtual bool SetCurrentDevice(const Device& device) = 0;
 	virtual bool ActivateDevice() = 0;
 
-	virtual const std::vector<Device>&  GetDevices() const = 0;
-	virtual const std::vector<Network>& GetNetworks() const = 0;
-	virtual const std::vector<Network>& GetKnownNetworks() const = 0;
+	const std::vector<Device>&  GetDevices() const			{ return GetState().devices; }
+	const std::vector<Network>& GetNetworks() const			{ return GetState().networks; }
+	const std::vector<Network>& GetKnownNetworks() const	{ return GetState().known_networks; }
+
+	// Copy of the latest state for threads other than the reader
+	WirelessState CopyState()
+	{
+		std::lock_guard lock(m_state_mutex);
+		return m_state;
+	}
 
 	virtual bool Scan() = 0;
 	virtual bool UpdateNetworks() = 0;
@@ -38,4 +71,28 @@ public:
 
 	virtual bool UpdateKnownNetworks() = 0;
 	virtual bool ForgetKnownNetwork(const Network& network) = 0;
-};
\ No newline at end of file
+
+	// Queries the backend every time, does not change the state
+	virtual bool GetNetworkDetails(const Network& network, NetworkDetails& out) = 0;
+
+protected:
+	// Writer side. Backend operations may run concurrently on worker
+	// threads, m_state must only be accessed with m_state_mutex held.
+	// Backends modify m_state and call PublishState() to make the changes
+	// visible to the reader.
+	void PublishState();
+
+	Device& CurrentDevice() { return m_state.devices[m_state.current_device]; }
+	Device GetWorkingDevice()
+	{
+		std::lock_guard lock(m_state_mutex);
+		return CurrentDevice();
+	}
+
+protected:
+	std::mutex					m_state_mutex;
+	WirelessState				m_state;
+
+private:
+	TripleBuffer<WirelessState>	m_snapshots;
+};
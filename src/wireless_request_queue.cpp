@@ -0,0 +1,461 @@
+#include "wireless_request_queue.h"
+
+#include "metrics.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cassert>
+
+// Operations that change what networks are visible or connected. They are
+// followed by a network refresh, which makes refreshes queued before them
+// stale.
+static bool refreshes_networks(WirelessRequestType type)
+{
+	switch (type)
+	{
+		case WirelessRequestType::scan:
+		case WirelessRequestType::connect:
+		case WirelessRequestType::disconnect:
+		case WirelessRequestType::activate_device:
+		case WirelessRequestType::set_current_device:
+			return true;
+		default:
+			return false;
+	}
+}
+
+static const char* request_name(WirelessRequestType type)
+{
+	switch (type)
+	{
+		case WirelessRequestType::scan:						return "request scan";
+		case WirelessRequestType::update_networks:			return "request update networks";
+		case WirelessRequestType::update_known_networks:	return "request update known networks";
+		case WirelessRequestType::connect:					return "request connect";
+		case WirelessRequestType::disconnect:				return "request disconnect";
+		case WirelessRequestType::forget_known_network:		return "request forget known network";
+		case WirelessRequestType::forget_known_networks:	return "request forget known networks";
+		case WirelessRequestType::activate_device:			return "request activate device";
+		case WirelessRequestType::set_current_device:		return "request set current device";
+		case WirelessRequestType::network_details:			return "request network details";
+	}
+	return "request";
+}
+
+// Requests not touching the backend have no metrics
+static bool metrics_operation(WirelessRequestType type, MetricsOperation& out)
+{
+	switch (type)
+	{
+		case WirelessRequestType::scan:						out = MetricsOperation::scan;					return true;
+		case WirelessRequestType::update_networks:			out = MetricsOperation::update_networks;		return true;
+		case WirelessRequestType::update_known_networks:	out = MetricsOperation::update_known_networks;	return true;
+		case WirelessRequestType::connect:					out = MetricsOperation::connect;				return true;
+		case WirelessRequestType::disconnect:				out = MetricsOperation::disconnect;				return true;
+		case WirelessRequestType::forget_known_network:		out = MetricsOperation::forget_known_network;	return true;
+		case WirelessRequestType::activate_device:			out = MetricsOperation::activate_device;		return true;
+		case WirelessRequestType::network_details:			out = MetricsOperation::network_details;		return true;
+		default:
+			return false;
+	}
+}
+
+static bool is_same_target(WirelessRequestType type, const Network& a, const Network& b)
+{
+	switch (type)
+	{
+		case WirelessRequestType::connect:
+		case WirelessRequestType::forget_known_network:
+			return a.ssid == b.ssid;
+		// Batches are never merged, each reports its own completion. Details
+		// are written to the storage of each request.
+		case WirelessRequestType::forget_known_networks:
+		case WirelessRequestType::network_details:
+			return false;
+		default:
+			return true;
+	}
+}
+
+static WirelessRequestQueue::Callback chain_callbacks(WirelessRequestQueue::Callback first, WirelessRequestQueue::Callback second)
+{
+	if (!first)
+		return second;
+	if (!second)
+		return first;
+	return [first = std::move(first), second = std::move(second)](bool success) { first(success); second(success); };
+}
+
+WirelessRequestQueue::WirelessRequestQueue(WirelessManager* wireless_manager, std::size_t worker_count)
+	: m_wireless_manager(wireless_manager)
+{
+	assert(wireless_manager);
+	assert(worker_count > 0);
+
+	for (std::size_t i = 0; i < worker_count; i++)
+		m_workers.emplace_back(&WirelessRequestQueue::WorkerMain, this);
+}
+
+WirelessRequestQueue::~WirelessRequestQueue()
+{
+	{
+		std::lock_guard lock(m_mutex);
+		m_stop = true;
+	}
+	m_condition.notify_all();
+
+	for (std::thread& worker : m_workers)
+		worker.join();
+}
+
+void WirelessRequestQueue::Scan(Callback callback)
+{
+	Submit(WirelessRequestType::scan, m_wireless_manager->GetCurrentDevice().name, nullptr, nullptr, std::move(callback), true);
+}
+
+void WirelessRequestQueue::UpdateNetworks()
+{
+	Submit(WirelessRequestType::update_networks, m_wireless_manager->GetCurrentDevice().name, nullptr, nullptr, {}, true);
+}
+
+void WirelessRequestQueue::UpdateKnownNetworks(Callback callback)
+{
+	Submit(WirelessRequestType::update_known_networks, DeviceName(), nullptr, nullptr, std::move(callback), true);
+}
+
+void WirelessRequestQueue::Connect(const Network& network, const std::string& password, Callback callback)
+{
+	Submit(WirelessRequestType::connect, m_wireless_manager->GetCurrentDevice().name, &network, &password, std::move(callback), false);
+}
+
+void WirelessRequestQueue::Disconnect()
+{
+	Submit(WirelessRequestType::disconnect, m_wireless_manager->GetCurrentDevice().name, nullptr, nullptr, {}, false);
+}
+
+void WirelessRequestQueue::ForgetKnownNetwork(const Network& network, Callback callback)
+{
+	Submit(WirelessRequestType::forget_known_network, DeviceName(), &network, nullptr, std::move(callback), false);
+}
+
+void WirelessRequestQueue::ForgetKnownNetworks(const std::vector<Network>& networks, Callback callback)
+{
+	{
+		std::lock_guard lock(m_mutex);
+		SubmitLocked(WirelessRequestType::forget_known_networks, DeviceName(), nullptr, nullptr, std::move(callback), false);
+		m_requests.back().networks = networks;
+		m_forget_total += networks.size();
+	}
+	m_condition.notify_all();
+}
+
+void WirelessRequestQueue::Hold()
+{
+	std::lock_guard lock(m_mutex);
+	m_holds++;
+}
+
+void WirelessRequestQueue::Release()
+{
+	{
+		std::lock_guard lock(m_mutex);
+		m_holds--;
+	}
+	m_condition.notify_all();
+}
+
+WirelessRequestQueue::Progress WirelessRequestQueue::GetForgetProgress() const
+{
+	std::lock_guard lock(m_mutex);
+	return { m_forget_done, m_forget_total };
+}
+
+void WirelessRequestQueue::ActivateDevice(Callback callback)
+{
+	Submit(WirelessRequestType::activate_device, m_wireless_manager->GetCurrentDevice().name, nullptr, nullptr, std::move(callback), false);
+}
+
+void WirelessRequestQueue::SetCurrentDevice(const Device& device)
+{
+	Submit(WirelessRequestType::set_current_device, device.name, nullptr, nullptr, {}, false);
+}
+
+// Only reads, so it is not bound to the device and runs in a slot of its
+// own. It does not wait for a scan or connect on the device, nor for a
+// batch forget.
+void WirelessRequestQueue::GetNetworkDetails(const Network& network, std::shared_ptr<NetworkDetails> details, Callback callback)
+{
+	{
+		std::lock_guard lock(m_mutex);
+		SubmitLocked(WirelessRequestType::network_details, DeviceName(), &network, nullptr, std::move(callback), false);
+		m_requests.back().details = std::move(details);
+	}
+	m_condition.notify_all();
+}
+
+void WirelessRequestQueue::Submit(WirelessRequestType type, const DeviceName& device, const Network* network, const std::string* password, Callback callback, bool debounce)
+{
+	{
+		std::lock_guard lock(m_mutex);
+		SubmitLocked(type, device, network, password, std::move(callback), debounce);
+	}
+	m_condition.notify_all();
+}
+
+void WirelessRequestQueue::SubmitLocked(WirelessRequestType type, const DeviceName& device, const Network* network, const std::string* password, Callback callback, bool debounce)
+{
+	auto now = clock::now();
+
+	m_submitted++;
+
+	if (refreshes_networks(type))
+	{
+		auto it = std::remove_if(m_requests.begin(), m_requests.end(),
+			[&](const Request& r) { return !r.running && r.type == WirelessRequestType::update_networks && r.device == device; }
+		);
+		m_dropped_stale += std::distance(it, m_requests.end());
+		m_requests.erase(it, m_requests.end());
+	}
+
+	Network target {};
+	if (network)
+		target = *network;
+
+	for (Request& request : m_requests)
+	{
+		if (request.running || request.type != type || request.device != device)
+			continue;
+		if (!is_same_target(type, request.network, target))
+			continue;
+
+		if (password)
+			request.password = *password;
+		request.callback = chain_callbacks(std::move(request.callback), std::move(callback));
+		if (debounce)
+			request.ready_time = std::min(now + s_debounce, request.first_submit + s_max_debounce);
+
+		m_coalesced++;
+		BWM_TRACE_INSTANT("request coalesced", request_name(type));
+		return;
+	}
+
+	Request& request = m_requests.emplace_back();
+	request.id				= m_next_id++;
+	request.type			= type;
+	request.device			= device;
+	request.network			= target;
+	request.password		= password ? *password : std::string();
+	request.callback		= std::move(callback);
+	request.first_submit	= now;
+	request.ready_time		= debounce ? now + s_debounce : now;
+	request.running			= false;
+}
+
+bool WirelessRequestQueue::Execute(const Request& request)
+{
+	BWM_TRACE_SCOPE(request_name(request.type), request.network.ssid.c_str());
+
+	switch (request.type)
+	{
+		case WirelessRequestType::scan:
+			return m_wireless_manager->Scan();
+		case WirelessRequestType::update_networks:
+			return m_wireless_manager->UpdateNetworks();
+		case WirelessRequestType::update_known_networks:
+			return m_wireless_manager->UpdateKnownNetworks();
+		case WirelessRequestType::connect:
+			return m_wireless_manager->Connect(request.network, request.password);
+		case WirelessRequestType::disconnect:
+			return m_wireless_manager->Disconnect();
+		case WirelessRequestType::forget_known_network:
+			return m_wireless_manager->ForgetKnownNetwork(request.network);
+		case WirelessRequestType::forget_known_networks:
+		{
+			bool success = true;
+			for (const Network& network : request.networks)
+			{
+				success &= m_wireless_manager->ForgetKnownNetwork(network);
+
+				std::lock_guard lock(m_mutex);
+				m_forget_done++;
+			}
+
+			// Picks up whatever failed or changed meanwhile, once for the
+			// whole batch
+			return m_wireless_manager->UpdateKnownNetworks() && success;
+		}
+		case WirelessRequestType::activate_device:
+			return m_wireless_manager->ActivateDevice();
+		case WirelessRequestType::set_current_device:
+		{
+			Device device {};
+			device.name = request.device;
+			return m_wireless_manager->SetCurrentDevice(device);
+		}
+		case WirelessRequestType::network_details:
+			return m_wireless_manager->GetNetworkDetails(request.network, *request.details);
+	}
+	return false;
+}
+
+// Detail fetches have a slot of their own, next to the one of the device
+// or of the requests not bound to a device
+std::size_t WirelessRequestQueue::InFlight(const Request& request) const
+{
+	bool details = (request.type == WirelessRequestType::network_details);
+	return std::count_if(m_requests.begin(), m_requests.end(), [&](const Request& r) {
+		return r.running && r.device == request.device && (r.type == WirelessRequestType::network_details) == details;
+	});
+}
+
+void WirelessRequestQueue::WorkerMain()
+{
+	std::unique_lock lock(m_mutex);
+
+	while (!m_stop)
+	{
+		if (m_holds > 0)
+		{
+			m_condition.wait(lock);
+			continue;
+		}
+
+		auto now		= clock::now();
+		auto next_ready	= clock::time_point::max();
+
+		// Backend operations act on whatever device is current when they
+		// run. A device switch waits for the device operations queued before
+		// it, the ones queued after it wait for the switch.
+		bool device_busy	= std::any_of(m_requests.begin(), m_requests.end(), [](const Request& r) { return r.running && !r.device.empty(); });
+		bool switching		= false;
+
+		Request* selected = nullptr;
+		for (Request& request : m_requests)
+		{
+			bool device_bound	= !request.device.empty();
+			bool switch_device	= (request.type == WirelessRequestType::set_current_device);
+			if (device_bound && switching)
+				continue;
+			if (switch_device)
+				switching = true;
+
+			if (request.running)
+				continue;
+			if (InFlight(request) >= s_max_in_flight_per_device || (switch_device && device_busy))
+			{
+				device_busy |= device_bound;
+				continue;
+			}
+			if (request.ready_time > now)
+			{
+				next_ready = std::min(next_ready, request.ready_time);
+				device_busy |= device_bound;
+				continue;
+			}
+			selected = &request;
+			break;
+		}
+
+		if (selected == nullptr)
+		{
+			if (next_ready == clock::time_point::max())
+				m_condition.wait(lock);
+			else
+				m_condition.wait_until(lock, next_ready);
+			continue;
+		}
+
+		selected->running = true;
+
+		// Copy everything but the callback, the vector may be modified
+		// while the request executes
+		Request request;
+		request.id			= selected->id;
+		request.type		= selected->type;
+		request.device		= selected->device;
+		request.network		= selected->network;
+		request.networks	= std::move(selected->networks);
+		request.details		= selected->details;
+		request.password	= selected->password;
+
+		auto first_submit = selected->first_submit;
+
+		lock.unlock();
+
+		auto start = clock::now();
+		bool success = Execute(request);
+		auto end = clock::now();
+
+		MetricsOperation operation;
+		if (metrics_operation(request.type, operation))
+			MetricsRecordOperation(operation, end - start, success);
+		if (request.type == WirelessRequestType::connect)
+		{
+			MetricsRecordConnect(ConnectPhase::queued, request.network.security, start - first_submit, true);
+			MetricsRecordConnect(ConnectPhase::connect, request.network.security, end - start, success);
+		}
+
+		lock.lock();
+
+		auto it = std::find_if(m_requests.begin(), m_requests.end(), [&](const Request& r) { return r.id == request.id; });
+		assert(it != m_requests.end());
+		if (it->callback)
+			m_completions.push_back({ std::move(it->callback), success });
+		m_requests.erase(it);
+
+		if (request.type == WirelessRequestType::forget_known_networks)
+		{
+			bool batch_pending = std::any_of(m_requests.begin(), m_requests.end(), [](const Request& r) { return r.type == WirelessRequestType::forget_known_networks; });
+			if (!batch_pending)
+				m_forget_done = m_forget_total = 0;
+		}
+
+		if (success)
+		{
+			m_completed++;
+			if (refreshes_networks(request.type))
+				SubmitLocked(WirelessRequestType::update_networks, request.device, nullptr, nullptr, {}, false);
+		}
+		else
+		{
+			m_failed++;
+		}
+
+		m_condition.notify_all();
+	}
+}
+
+void WirelessRequestQueue::Poll()
+{
+	{
+		std::lock_guard lock(m_mutex);
+		if (m_completions.empty())
+			return;
+		std::swap(m_completions, m_poll_completions);
+	}
+
+	for (Completion& completion : m_poll_completions)
+		completion.callback(completion.success);
+	m_poll_completions.clear();
+}
+
+bool WirelessRequestQueue::IsPending(WirelessRequestType type) const
+{
+	std::lock_guard lock(m_mutex);
+	return std::any_of(m_requests.begin(), m_requests.end(), [&](const Request& r) { return r.type == type; });
+}
+
+WirelessRequestQueue::Stats WirelessRequestQueue::GetStats() const
+{
+	std::lock_guard lock(m_mutex);
+
+	Stats stats;
+	stats.in_flight		= std::count_if(m_requests.begin(), m_requests.end(), [](const Request& r) { return r.running; });
+	stats.queue_depth	= m_requests.size() - stats.in_flight;
+	stats.submitted		= m_submitted;
+	stats.coalesced		= m_coalesced;
+	stats.dropped_stale	= m_dropped_stale;
+	stats.completed		= m_completed;
+	stats.failed		= m_failed;
+	return stats;
+}
@@ -0,0 +1,161 @@
+#pragma once
+
+#include "wireless_manager.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum class WirelessRequestType
+{
+	scan,
+	update_networks,
+	update_known_networks,
+	connect,
+	disconnect,
+	forget_known_network,
+	forget_known_networks,
+	activate_device,
+	set_current_device,
+	network_details,
+};
+
+// Runs WirelessManager operations on worker threads.
+//
+// Requests are submitted from the UI thread and never block it:
+//  - a request identical to one still waiting in the queue is merged into it
+//  - refreshes are debounced so bursts of them run once
+//  - operations that are followed by a network refresh (scan, connect,
+//    activate, ...) drop the refreshes queued before them as stale
+//  - at most s_max_in_flight_per_device operations run per device, detail
+//    fetches have a slot of their own
+//
+// Completion callbacks are invoked from Poll() on the thread calling it.
+class WirelessRequestQueue
+{
+public:
+	using Callback = std::function<void(bool)>;
+
+	struct Stats
+	{
+		std::size_t		queue_depth;
+		std::size_t		in_flight;
+		std::uint64_t	submitted;
+		std::uint64_t	coalesced;
+		std::uint64_t	dropped_stale;
+		std::uint64_t	completed;
+		std::uint64_t	failed;
+	};
+
+	struct Progress
+	{
+		std::size_t		done;
+		std::size_t		total;
+	};
+
+public:
+	WirelessRequestQueue(WirelessManager* wireless_manager, std::size_t worker_count = 2);
+	~WirelessRequestQueue();
+
+	WirelessRequestQueue(const WirelessRequestQueue&) = delete;
+	WirelessRequestQueue& operator=(const WirelessRequestQueue&) = delete;
+
+	void Scan(Callback callback = {});
+	void UpdateNetworks();
+	void UpdateKnownNetworks(Callback callback = {});
+
+	void Connect(const Network& network, const std::string& password, Callback callback = {});
+	void Disconnect();
+	void ForgetKnownNetwork(const Network& network, Callback callback = {});
+
+	// Forgets all networks in one request, followed by a single refresh
+	// of the known networks. GetForgetProgress() counts the networks of
+	// all queued batches until the last one finishes.
+	void ForgetKnownNetworks(const std::vector<Network>& networks, Callback callback = {});
+	Progress GetForgetProgress() const;
+
+	void ActivateDevice(Callback callback = {});
+	void SetCurrentDevice(const Device& device);
+
+	// Fills details with what the backend reports about network. Never
+	// merged with other requests, NetworkDetailsCache deduplicates them.
+	void GetNetworkDetails(const Network& network, std::shared_ptr<NetworkDetails> details, Callback callback);
+
+	// While held no request starts, they are queued and merged as usual.
+	// Requests running already are not waited for. For code using the
+	// manager directly from another thread, see FastConnect. Holds nest.
+	void Hold();
+	void Release();
+
+	// Invokes callbacks of completed requests
+	void Poll();
+
+	bool IsPending(WirelessRequestType type) const;
+	Stats GetStats() const;
+
+private:
+	using clock = std::chrono::steady_clock;
+
+	struct Request
+	{
+		std::uint64_t					id;
+		WirelessRequestType				type;
+		DeviceName						device;
+		Network							network;
+		std::vector<Network>			networks;
+		std::shared_ptr<NetworkDetails>	details;
+		std::string						password;
+		Callback						callback;
+		clock::time_point				first_submit;
+		clock::time_point				ready_time;
+		bool							running;
+	};
+
+	struct Completion
+	{
+		Callback	callback;
+		bool		success;
+	};
+
+private:
+	void Submit(WirelessRequestType type, const DeviceName& device, const Network* network, const std::string* password, Callback callback, bool debounce);
+	void SubmitLocked(WirelessRequestType type, const DeviceName& device, const Network* network, const std::string* password, Callback callback, bool debounce);
+
+	bool Execute(const Request& request);
+	void WorkerMain();
+
+	std::size_t InFlight(const Request& request) const;
+
+private:
+	static constexpr auto			s_debounce					= std::chrono::milliseconds(100);
+	static constexpr auto			s_max_debounce				= std::chrono::milliseconds(500);
+	static constexpr std::size_t	s_max_in_flight_per_device	= 1;
+
+	WirelessManager*			m_wireless_manager;
+
+	mutable std::mutex			m_mutex;
+	std::condition_variable		m_condition;
+	bool						m_stop = false;
+	std::size_t					m_holds = 0;
+	std::uint64_t				m_next_id = 0;
+
+	std::vector<Request>		m_requests;
+	std::vector<Completion>		m_completions;
+	std::vector<Completion>		m_poll_completions;
+	std::vector<std::thread>	m_workers;
+
+	std::uint64_t				m_submitted		= 0;
+	std::uint64_t				m_coalesced		= 0;
+	std::uint64_t				m_dropped_stale	= 0;
+	std::uint64_t				m_completed		= 0;
+	std::uint64_t				m_failed		= 0;
+
+	std::size_t					m_forget_done	= 0;
+	std::size_t					m_forget_total	= 0;
+};
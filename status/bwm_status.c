@@ -0,0 +1,155 @@
+#define _GNU_SOURCE
+
+#include "bwm_status.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+int bwm_status_path(char* buffer, unsigned long size)
+{
+	const char* runtime_dir = getenv("XDG_RUNTIME_DIR");
+	int len;
+
+	if (runtime_dir && runtime_dir[0])
+		len = snprintf(buffer, size, "%s/bwm-status", runtime_dir);
+	else
+		len = snprintf(buffer, size, "/tmp/bwm-status-%d", (int)getuid());
+
+	return (len < 0 || (unsigned long)len >= size) ? -1 : 0;
+}
+
+const struct bwm_status_page* bwm_status_open(void)
+{
+	char path[256];
+	if (bwm_status_path(path, sizeof(path)) != 0)
+		return NULL;
+
+	/* Only a page written by bwm of the same user, a shorter file would
+	 * fault on access */
+	int fd = open(path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+	if (fd == -1)
+		return NULL;
+
+	struct stat st;
+	if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_uid != getuid() ||
+		(unsigned long)st.st_size < sizeof(struct bwm_status_page))
+	{
+		close(fd);
+		return NULL;
+	}
+
+	void* addr = mmap(NULL, sizeof(struct bwm_status_page), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (addr == MAP_FAILED)
+		return NULL;
+
+	const struct bwm_status_page* page = addr;
+	if (page->magic != BWM_STATUS_MAGIC || page->version != BWM_STATUS_VERSION)
+	{
+		munmap(addr, sizeof(struct bwm_status_page));
+		return NULL;
+	}
+
+	return page;
+}
+
+void bwm_status_close(const struct bwm_status_page* page)
+{
+	if (page)
+		munmap((void*)page, sizeof(struct bwm_status_page));
+}
+
+/* A writer that died mid-update leaves the sequence odd for good */
+static int writer_gone(const struct bwm_status_page* page)
+{
+	int32_t pid = __atomic_load_n(&page->status.pid, __ATOMIC_RELAXED);
+	return pid > 0 && kill(pid, 0) == -1 && errno == ESRCH;
+}
+
+/* Updates take microseconds, a writer that stays mid-update longer than
+ * this has stopped */
+#define BWM_STATUS_SPINS		1000
+#define BWM_STATUS_WAITS		10
+#define BWM_STATUS_WAIT_NS		10000000L
+
+int bwm_status_read(const struct bwm_status_page* page, struct bwm_status* out, uint32_t* sequence)
+{
+	int spins = 0;
+	int waits = 0;
+
+	for (;;)
+	{
+		uint32_t before = __atomic_load_n(&page->sequence, __ATOMIC_ACQUIRE);
+		if (before & 1)
+		{
+			if (++spins < BWM_STATUS_SPINS)
+				continue;
+			if (writer_gone(page))
+				return -EIO;
+			if (waits++ == BWM_STATUS_WAITS)
+				return -EAGAIN;
+
+			/* Woken by the writer's FUTEX_WAKE once it is done */
+			struct timespec timeout = { 0, BWM_STATUS_WAIT_NS };
+			syscall(SYS_futex, &page->sequence, FUTEX_WAIT, before, &timeout, NULL, 0);
+			continue;
+		}
+
+		memcpy(out, &page->status, sizeof(*out));
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		uint32_t after = __atomic_load_n(&page->sequence, __ATOMIC_RELAXED);
+		if (before == after)
+		{
+			out->device[sizeof(out->device) - 1]		= '\0';
+			out->ssid[sizeof(out->ssid) - 1]			= '\0';
+			out->security[sizeof(out->security) - 1]	= '\0';
+			if (sequence)
+				*sequence = after;
+			return 0;
+		}
+	}
+}
+
+int bwm_status_wait(const struct bwm_status_page* page, uint32_t sequence, int timeout_ms)
+{
+	struct timespec timeout;
+	struct timespec* ptimeout = NULL;
+	if (timeout_ms >= 0)
+	{
+		timeout.tv_sec	= timeout_ms / 1000;
+		timeout.tv_nsec	= (long)(timeout_ms % 1000) * 1000000;
+		ptimeout = &timeout;
+	}
+
+	/* Wait while nothing has changed or the writer is mid-update. EAGAIN
+	 * and EINTR are handled by rechecking the sequence. Mid-update waits
+	 * are short so a writer that died there is noticed. */
+	uint32_t current;
+	int update_waits = 0;
+	while ((current = __atomic_load_n(&page->sequence, __ATOMIC_ACQUIRE)) == sequence || (current & 1))
+	{
+		struct timespec update_timeout = { 0, BWM_STATUS_WAIT_NS };
+		int updating = current & 1;
+		if (updating && writer_gone(page))
+			return -EIO;
+		if (updating && update_waits++ == BWM_STATUS_WAITS)
+			return -EAGAIN;
+
+		if (syscall(SYS_futex, &page->sequence, FUTEX_WAIT, current, updating ? &update_timeout : ptimeout, NULL, 0) == -1 &&
+			errno == ETIMEDOUT && !updating)
+			return 0;
+	}
+
+	return 1;
+}
@@ -0,0 +1,83 @@
+#ifndef BWM_STATUS_H
+#define BWM_STATUS_H
+
+/*
+ * Connection state published by a running bwm instance.
+ *
+ * bwm keeps the page below in a file under $XDG_RUNTIME_DIR (see
+ * bwm_status_path()). Readers map it and read it with plain memory loads,
+ * no syscalls or process spawns are needed to poll it.
+ *
+ * The page is a seqlock: the writer makes `sequence` odd while updating
+ * and even again when done. A consistent read is one where `sequence` was
+ * the same even value before and after copying the fields, which is what
+ * bwm_status_read() does. After each update the writer calls FUTEX_WAKE
+ * on `sequence`, bwm_status_wait() sleeps until that happens. Only one bwm
+ * instance writes the page at a time, it holds an flock() on the file.
+ */
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BWM_STATUS_MAGIC	0x534d5742u	/* "BWMS" */
+#define BWM_STATUS_VERSION	1u
+
+enum bwm_connection_state
+{
+	BWM_STATE_NOT_RUNNING	= 0,
+	BWM_STATE_DEVICE_OFF	= 1,
+	BWM_STATE_DISCONNECTED	= 2,
+	BWM_STATE_CONNECTED		= 3,
+};
+
+struct bwm_status
+{
+	uint64_t	generation;
+	int32_t		pid;
+	int32_t		state;		/* enum bwm_connection_state */
+	int32_t		signal;		/* signal strength in percent, -1 if unknown */
+	char		device[16];
+	char		ssid[33];
+	char		security[8];
+};
+
+struct bwm_status_page
+{
+	uint32_t			magic;
+	uint32_t			version;
+	uint32_t			sequence;
+	uint32_t			reserved;
+	struct bwm_status	status;
+};
+
+/* Writes the path of the status file into buffer, returns 0 on success */
+int bwm_status_path(char* buffer, unsigned long size);
+
+/* Maps the status page read-only, returns NULL if bwm has not created it
+ * or the file is not a regular file owned by the user */
+const struct bwm_status_page* bwm_status_open(void);
+void bwm_status_close(const struct bwm_status_page* page);
+
+/*
+ * Copies a consistent snapshot of the status and stores its sequence number
+ * in `sequence` if not NULL. Returns 0 on success, -EIO if the writer died
+ * in the middle of an update and -EAGAIN if it has been updating for more
+ * than about 100 ms.
+ */
+int bwm_status_read(const struct bwm_status_page* page, struct bwm_status* out, uint32_t* sequence);
+
+/*
+ * Blocks until the sequence number differs from `sequence` or the timeout
+ * expires. timeout_ms < 0 waits forever. Returns 1 if the status changed,
+ * 0 on timeout and -EIO or -EAGAIN like bwm_status_read().
+ */
+int bwm_status_wait(const struct bwm_status_page* page, uint32_t sequence, int timeout_ms);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif